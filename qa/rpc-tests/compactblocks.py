@@ -0,0 +1,86 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018-2019 The fdreserve Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Benchmark block propagation with and without compact blocks:
+# four nodes in a line share a mempool, node 0 mines, and the
+# time until node 3 has the block is measured, first with blocks
+# relayed whole and then as compact blocks.
+#
+
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
+from util import *
+import random
+import time
+
+class CompactBlocksTest(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--blocks", dest="blocks", default=10, type="int",
+                          help="Blocks to time in each round (default: %default)")
+        parser.add_option("--txs", dest="txs", default=50, type="int",
+                          help="Transactions in each block (default: %default)")
+
+    def setup_network(self):
+        self.start_line(False)
+
+    def start_line(self, compact):
+        args = [ "-compactblocks=%d" % compact, "-debug=net" ]
+        self.nodes = start_nodes(4, self.options.tmpdir, [ args ] * 4)
+        for i in range(3):
+            connect_nodes_bi(self.nodes, i, i+1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def time_blocks(self):
+        addresses = [ node.getnewaddress() for node in self.nodes ]
+        # the first block takes every node out of initial block download
+        self.nodes[0].setgenerate(True, 1)
+        self.sync_all()
+
+        latencies = []
+        for n in range(self.options.blocks):
+            for i in range(self.options.txs):
+                sender = random.choice(self.nodes)
+                sender.sendtoaddress(random.choice(addresses), Decimal("0.1"))
+            sync_mempools(self.nodes)
+
+            blockhash = self.nodes[0].setgenerate(True, 1)[0]
+            start = time.time()
+            while self.nodes[3].getbestblockhash() != blockhash:
+                time.sleep(0.01)
+            latencies.append(time.time() - start)
+            self.sync_all()
+        return latencies
+
+    def run_test(self):
+        latencies_full = self.time_blocks()
+        info = self.nodes[3].getcompactblockinfo()
+        assert_equal(info["enabled"], False)
+        assert_equal(info["received"], 0)
+
+        stop_nodes(self.nodes)
+        wait_bitcoinds()
+        self.start_line(True)
+
+        latencies_compact = self.time_blocks()
+        for node in self.nodes[1:]:
+            info = node.getcompactblockinfo()
+            assert_equal(info["enabled"], True)
+            assert_greater_than(info["received"], self.options.blocks - 1)
+            assert_greater_than(info["reconstructed"] + info["roundtrips"], 0)
+
+        info = self.nodes[3].getcompactblockinfo()
+        print("Compact blocks: %d rebuilt from the mempool, %d after a round trip, %d fetched whole" %
+              (info["reconstructed"], info["roundtrips"], info["fallbacks"]))
+        print("Compact blocks: %d bytes received for %d bytes of blocks" %
+              (info["bytesreceived"], info["blockbytes"]))
+        for name, latencies in [ ("full", latencies_full), ("compact", latencies_compact) ]:
+            print("Propagation over 3 hops, %s blocks of %d transactions: mean %.3fs, max %.3fs" %
+                  (name, self.options.txs, sum(latencies) / len(latencies), max(latencies)))
+
+if __name__ == '__main__':
+    CompactBlocksTest().main()
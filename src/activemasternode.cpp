@@ -37,7 +37,7 @@ void CActiveMasternode::ManageStatus()
         CMasternode* pmn;
         pmn = mnodeman.Find(pubKeyMasternode);
         if (pmn != NULL) {
-            pmn->Check();
+            mnodeman.CheckMasternode(*pmn);
             if (pmn->IsEnabled() && pmn->protocolVersion >= ActiveProtocol())
                 EnableHotColdMasterNode(pmn->vin, pmn->addr);
         }
@@ -274,10 +274,14 @@ bool CActiveMasternode::Register(CTxIn vin, CService service, CKey keyCollateral
 
     CMasternode* pmn = mnodeman.Find(vin);
     if (!pmn) {
+        {
+            LOCK(cs_main);
+            collateralWatch.Watch(vin.prevout);
+        }
         CMasternode mn(mnb);
         mnodeman.Add(mn);
     } else {
-        pmn->UpdateFromNewBroadcast(mnb);
+        mnodeman.UpdateFromNewBroadcast(*pmn, mnb);
     }
 
     //send to all peers
@@ -0,0 +1,77 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "main.h"
+#include "random.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+namespace benchmark
+{
+BenchRunner::BenchmarkMap& BenchRunner::benchmarks()
+{
+    static BenchmarkMap benchmarks_map;
+    return benchmarks_map;
+}
+
+BenchRunner::BenchRunner(const std::string& name, BenchFunction func)
+{
+    benchmarks().insert(std::make_pair(name, func));
+}
+
+void BenchRunner::RunAll(const std::string& strFilter)
+{
+    std::cout << "#Benchmark, what, value" << std::endl;
+    for (const auto& bench : benchmarks()) {
+        if (bench.first.find(strFilter) != std::string::npos)
+            bench.second();
+    }
+}
+
+double Time(const BenchFunction& func, int nRuns)
+{
+    int64_t nBest = std::numeric_limits<int64_t>::max();
+    for (int i = 0; i < nRuns; i++) {
+        int64_t nStart = GetTimeMicros();
+        func();
+        nBest = std::min(nBest, GetTimeMicros() - nStart);
+    }
+    return 0.001 * nBest;
+}
+
+void Report(const std::string& strName, const std::string& strWhat, double dValue, const std::string& strUnit)
+{
+    std::cout << strprintf("%s, %s, %.3f %s", strName, strWhat, dValue, strUnit) << std::endl;
+}
+
+ChainSetup::ChainSetup(int nBlocks)
+{
+    CBlockIndex* pindexGenesis = chainActive.Tip();
+    vBlocks.push_back(pindexGenesis);
+    for (int i = 1; i <= nBlocks; i++) {
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->pprev = vBlocks.back();
+        pindex->nHeight = i;
+        pindex->nTime = pindexGenesis->nTime + i * 60;
+        pindex->phashBlock = &mapBlockIndex.insert(std::make_pair(GetRandHash(), pindex)).first->first;
+        vBlocks.push_back(pindex);
+    }
+    chainActive.SetTip(vBlocks.back());
+}
+
+ChainSetup::~ChainSetup()
+{
+    chainActive.SetTip(vBlocks[0]);
+    for (size_t i = 1; i < vBlocks.size(); i++) {
+        mapBlockIndex.erase(vBlocks[i]->GetBlockHash());
+        delete vBlocks[i];
+    }
+}
+}
@@ -0,0 +1,62 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_BENCH_H
+#define BITCOIN_BENCH_BENCH_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+class CBlockIndex;
+
+/**
+ * Benchmarks of the paths the unit tests only check for their outcome.
+ *
+ * A benchmark is a function registered under its name with BENCHMARK(name).
+ * It builds its own data, times the old and the new way of doing the same
+ * work with Time() and prints each figure with Report(). bench_fdreserve
+ * runs all of them, or those whose names contain its first argument.
+ */
+namespace benchmark
+{
+typedef boost::function<void()> BenchFunction;
+
+class BenchRunner
+{
+    typedef std::map<std::string, BenchFunction> BenchmarkMap;
+    static BenchmarkMap& benchmarks();
+
+public:
+    BenchRunner(const std::string& name, BenchFunction func);
+
+    static void RunAll(const std::string& strFilter);
+};
+
+/** The best of nRuns calls of func, in milliseconds */
+double Time(const BenchFunction& func, int nRuns = 5);
+
+/** Print one figure of a benchmark, as "name, what, value unit" */
+void Report(const std::string& strName, const std::string& strWhat, double dValue, const std::string& strUnit = "ms");
+
+/**
+ * A chain of nBlocks blocks a minute apart on top of the genesis block, made the
+ * active chain for as long as the object lives. vBlocks[0] is the genesis block.
+ * Requires cs_main.
+ */
+struct ChainSetup {
+    std::vector<CBlockIndex*> vBlocks;
+
+    ChainSetup(int nBlocks);
+    ~ChainSetup();
+};
+}
+
+#define BENCHMARK(n) static benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // BITCOIN_BENCH_BENCH_H
@@ -0,0 +1,68 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "chainparams.h"
+#include "main.h"
+#include "random.h"
+#include "txdb.h"
+#include "ui_interface.h"
+#include "util.h"
+#ifdef ENABLE_WALLET
+#include "db.h"
+#include "wallet.h"
+#endif
+
+#include <boost/filesystem.hpp>
+
+CClientUIInterface uiInterface;
+CWallet* pwalletMain;
+
+extern void noui_connect();
+
+// Same node state as the unit tests: unit test params, a fresh datadir and a chain of the genesis block
+int main(int argc, char** argv)
+{
+    SetupEnvironment();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+    SelectParams(CBaseChainParams::UNITTEST);
+    noui_connect();
+#ifdef ENABLE_WALLET
+    bitdb.MakeMock();
+#endif
+    boost::filesystem::path pathTemp = GetTempPath() / strprintf("bench_fdreserve_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    CCoinsViewDB* pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+    pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+    InitBlockIndex();
+
+    benchmark::BenchRunner::RunAll(argc > 1 ? argv[1] : "");
+
+    delete pcoinsTip;
+    delete pcoinsdbview;
+    delete pblocktree;
+#ifdef ENABLE_WALLET
+    bitdb.Flush(true);
+#endif
+    boost::filesystem::remove_all(pathTemp);
+    return 0;
+}
+
+void Shutdown(void* parg)
+{
+    exit(0);
+}
+
+void StartShutdown()
+{
+    exit(0);
+}
+
+bool ShutdownRequested()
+{
+    return false;
+}
@@ -0,0 +1,122 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "clientversion.h"
+#include "hash.h"
+#include "main.h"
+#include "masternode-payments.h"
+#include "masternode.h"
+#include "random.h"
+#include "streams.h"
+#include "utiltime.h"
+
+#include <boost/bind.hpp>
+
+// How GetLastPaid found the last payment before the last-paid index: a walk back from the tip
+static int64_t LegacyGetLastPaid(const CMasternode& mn, int nEnabledCount)
+{
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    CScript mnpayee = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << mn.vin;
+    ss << mn.sigTime;
+    int64_t nOffset = ss.GetHash().GetCompact(false) % 90;
+
+    LOCK(cs_mapMasternodeBlocks);
+    int nMnCount = int(nEnabledCount * 1.25);
+    int n = 0;
+    for (const CBlockIndex* BlockReading = pindexPrev; BlockReading && BlockReading->nHeight > 0; BlockReading = BlockReading->pprev) {
+        if (n++ >= nMnCount)
+            return 0;
+        const CMasternodeBlockPayees* block = masternodePayments.GetBlockPayees(BlockReading->nHeight);
+        if (block && block->HasPayeeWithVotes(mnpayee, MNPAYMENTS_LASTPAID_VOTES))
+            return BlockReading->nTime - nOffset;
+    }
+    return 0;
+}
+
+static void LegacyLastPaidAll(const std::vector<CMasternode>& vMasternodes, int nEnabledCount, int nStep)
+{
+    for (size_t i = 0; i < vMasternodes.size(); i += nStep)
+        LegacyGetLastPaid(vMasternodes[i], nEnabledCount);
+}
+
+static void LastPaidAll(std::vector<CMasternode>& vMasternodes, int nEnabledCount)
+{
+    for (CMasternode& mn : vMasternodes)
+        mn.GetLastPaid(nEnabledCount);
+}
+
+static void ReadPayments(const CDataStream& ssPayments)
+{
+    CDataStream ss(ssPayments);
+    CMasternodePayments paymentsRead;
+    ss >> paymentsRead;
+}
+
+// The last payments of 5,000 masternodes on each level, over 7,000 blocks with
+// one payee a level each, every fifth of them a vote short of counting as paid.
+static void MasternodeLastPaid()
+{
+    const int nPerLevel = 5000;
+    const int nBlocks = 7000;
+    // the chain walk is timed on every nSample-th masternode only
+    const int nSample = 10;
+    const CAmount vDeposits[] = {1000 * COIN, 10000 * COIN, 50000 * COIN};
+
+    LOCK(cs_main);
+    benchmark::ChainSetup chain(nBlocks);
+
+    std::vector<CMasternode> vMasternodes;
+    for (const CAmount nDeposit : vDeposits) {
+        for (int i = 0; i < nPerLevel; i++) {
+            CMasternode mn;
+            std::vector<unsigned char> vch(33);
+            vch[0] = 0x02;
+            uint256 hash = GetRandHash();
+            memcpy(&vch[1], hash.begin(), 32);
+            mn.pubKeyCollateralAddress = CPubKey(vch);
+            mn.vin = CTxIn(GetRandHash(), 0);
+            mn.sigTime = GetTime() - insecure_rand() % 100000;
+            mn.deposit = nDeposit;
+            vMasternodes.push_back(mn);
+        }
+    }
+
+    int64_t nStart = GetTimeMicros();
+    for (int h = 101; h <= nBlocks; h++) {
+        for (unsigned l = 0; l < 3; l++) {
+            const CMasternode& mn = vMasternodes[l * nPerLevel + insecure_rand() % nPerLevel];
+            int nVotes = h % 5 ? MNPAYMENTS_LASTPAID_VOTES : MNPAYMENTS_LASTPAID_VOTES - 1;
+            for (int v = 0; v < nVotes; v++) {
+                CMasternodePaymentWinner winner(CTxIn(GetRandHash(), 0));
+                winner.nBlockHeight = h;
+                winner.AddPayee(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()), l + 1);
+                masternodePayments.AddWinningMasternode(winner);
+            }
+        }
+    }
+    std::string strMasternodes = strprintf("%u masternodes", vMasternodes.size());
+    benchmark::Report("MasternodeLastPaid", strprintf("votes for %d blocks", nBlocks - 100), 0.001 * (GetTimeMicros() - nStart));
+
+    for (size_t i = 0; i < vMasternodes.size(); i += nSample)
+        assert(vMasternodes[i].GetLastPaid(nPerLevel) == LegacyGetLastPaid(vMasternodes[i], nPerLevel));
+    benchmark::Report("MasternodeLastPaid", strMasternodes + ", chain walk (extrapolated)",
+        nSample * benchmark::Time(boost::bind(&LegacyLastPaidAll, boost::cref(vMasternodes), nPerLevel, nSample), 1));
+    benchmark::Report("MasternodeLastPaid", strMasternodes + ", index",
+        benchmark::Time(boost::bind(&LastPaidAll, boost::ref(vMasternodes), nPerLevel)));
+
+    // the index is rebuilt by LoadBlocks as the payments are deserialized
+    CDataStream ssPayments(SER_DISK, CLIENT_VERSION);
+    ssPayments << masternodePayments;
+    benchmark::Report("MasternodeLastPaid", "read with index rebuild", benchmark::Time(boost::bind(&ReadPayments, boost::cref(ssPayments))));
+
+    masternodePayments.Clear();
+    blockHashCache.Clear();
+}
+
+BENCHMARK(MasternodeLastPaid);
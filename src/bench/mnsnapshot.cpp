@@ -0,0 +1,104 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "clientversion.h"
+#include "hash.h"
+#include "main.h"
+#include "masternodeman.h"
+#include "random.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "timedata.h"
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+
+static CPubKey RandomPubKey()
+{
+    std::vector<unsigned char> vch(33);
+    vch[0] = 0x02;
+    uint256 hash = GetRandHash();
+    memcpy(&vch[1], hash.begin(), 32);
+    return CPubKey(vch);
+}
+
+// mncache.dat as it is read at startup, into an empty manager
+static void ReadMasternodeCache()
+{
+    CMasternodeMan mnman;
+    CMasternodeDB mndb;
+    CMasternodeDB::ReadResult readResult = mndb.Read(mnman);
+    assert(readResult == CMasternodeDB::Ok);
+}
+
+static void WriteFile(const boost::filesystem::path& path, const CDataStream& ssData)
+{
+    CDataStream ssFile(ssData);
+    ssFile << Hash(ssFile.begin(), ssFile.end());
+    FILE* file = fopen(path.string().c_str(), "wb");
+    CAutoFile(file, SER_DISK, CLIENT_VERSION) << ssFile;
+}
+
+// The startup read of mncache.dat for 3,000 masternodes a running node has
+// seen the broadcasts and pings of: the whole serialized manager, as the file
+// held it before, against the snapshot. Both go through CMasternodeDB::Read,
+// with the collaterals in the chain state so its CheckAndRemove keeps them all.
+static void MasternodeSnapshotRead()
+{
+    const int nMasternodes = 3000;
+    const CAmount vDeposits[] = {1000 * COIN, 10000 * COIN, 50000 * COIN};
+
+    LOCK(cs_main);
+    CMasternodeMan mnman;
+    std::vector<uint256> vCollaterals;
+    for (int i = 0; i < nMasternodes; i++) {
+        CMutableTransaction txCollateral;
+        txCollateral.vin.push_back(CTxIn(GetRandHash(), 0));
+        txCollateral.vout.push_back(CTxOut(vDeposits[i % 3], GetScriptForDestination(RandomPubKey().GetID())));
+        CTransaction tx(txCollateral);
+        pcoinsTip->ModifyCoins(tx.GetHash())->FromTx(tx, 1);
+        vCollaterals.push_back(tx.GetHash());
+
+        CMasternode mn;
+        mn.vin = CTxIn(tx.GetHash(), 0);
+        mn.pubKeyMasternode = RandomPubKey();
+        mn.pubKeyCollateralAddress = RandomPubKey();
+        mn.addr = CService(strprintf("10.%d.%d.1", i / 256, i % 256), 9999);
+        mn.deposit = vDeposits[i % 3];
+        mn.sig = std::vector<unsigned char>(65, i % 251);
+        mn.sigTime = GetAdjustedTime() - 60 * 60 - i;
+        mn.lastPing.vin = mn.vin;
+        mn.lastPing.blockHash = GetRandHash();
+        mn.lastPing.sigTime = GetAdjustedTime() - i;
+        mn.lastPing.vchSig = std::vector<unsigned char>(65, i % 253);
+        collateralWatch.Watch(mn.vin.prevout);
+        assert(mnman.Add(mn));
+        CMasternodeBroadcast mnb(mn);
+        mnman.mapSeenMasternodeBroadcast.insert(std::make_pair(mnb.GetHash(), mnb));
+        mnman.mapSeenMasternodePing.insert(std::make_pair(mn.lastPing.GetHash(), mn.lastPing));
+    }
+
+    boost::filesystem::path pathMN = GetDataDir() / "mncache.dat";
+    std::string strMasternodes = strprintf("%d masternodes", nMasternodes);
+
+    CDataStream ssLegacy(SER_DISK, CLIENT_VERSION);
+    ssLegacy << std::string("MasternodeCache") << FLATDATA(Params().MessageStart()) << mnman;
+    WriteFile(pathMN, ssLegacy);
+    benchmark::Report("MasternodeSnapshotRead", strMasternodes + ", legacy file size", boost::filesystem::file_size(pathMN) / 1024.0, "KiB");
+    benchmark::Report("MasternodeSnapshotRead", strMasternodes + ", legacy read", benchmark::Time(&ReadMasternodeCache));
+
+    CMasternodeDB mndb;
+    assert(mndb.Write(mnman));
+    benchmark::Report("MasternodeSnapshotRead", strMasternodes + ", snapshot file size", boost::filesystem::file_size(pathMN) / 1024.0, "KiB");
+    benchmark::Report("MasternodeSnapshotRead", strMasternodes + ", snapshot read", benchmark::Time(&ReadMasternodeCache));
+
+    boost::filesystem::remove(pathMN);
+    collateralWatch.Clear();
+    for (const uint256& hash : vCollaterals)
+        pcoinsTip->ModifyCoins(hash)->Clear();
+}
+
+BENCHMARK(MasternodeSnapshotRead);
@@ -0,0 +1,91 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "main.h"
+#include "random.h"
+#include "timedata.h"
+#include "wallet.h"
+
+#include <boost/bind.hpp>
+
+typedef std::set<std::pair<const CWalletTx*, unsigned int> > CoinSet;
+
+// How SelectStakeCoins picked the stake set before the stake index: a full AvailableCoins pass
+static void LegacySelectStakeCoins(const CWallet& wallet, CoinSet& setCoins, CAmount nTargetAmount)
+{
+    setCoins.clear();
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins, true, NULL, false, STAKABLE_COINS);
+    CAmount nAmountSelected = 0;
+    for (const COutput& out : vCoins) {
+        if (nAmountSelected + out.tx->vout[out.i].nValue > nTargetAmount)
+            continue;
+        if (ActiveProtocol() >= CONSENSUS_FORK_PROTO && out.tx->vout[out.i].nValue < Params().StakeInputMin())
+            continue;
+        if (GetAdjustedTime() - out.tx->GetTxTime() - wallet.nHashDrift < nStakeMinAge)
+            continue;
+        if (out.nDepth < (out.tx->IsCoinStake() ? Params().COINBASE_MATURITY() : 10))
+            continue;
+        setCoins.insert(std::make_pair(out.tx, out.i));
+        nAmountSelected += out.tx->vout[out.i].nValue;
+    }
+}
+
+static void SelectStakeCoins(CWallet& wallet, CoinSet& setCoins, CAmount nTargetAmount)
+{
+    setCoins.clear();
+    wallet.SelectStakeCoins(setCoins, nTargetAmount);
+}
+
+// The stake set of a wallet of 100,000 transactions over 100 blocks, where every
+// 10th transaction is too young to stake and every 50th spends the one ten before it.
+static void StakeIndexSelect()
+{
+    const int nTransactions = 100000;
+    const int nBlocks = 100;
+    const CAmount nTarget = std::numeric_limits<CAmount>::max() / 2;
+
+    bool fFirstRun;
+    CWallet wallet("stakeindex_bench.dat");
+    wallet.LoadWallet(fFirstRun);
+    LOCK2(cs_main, wallet.cs_wallet);
+    benchmark::ChainSetup chain(nBlocks);
+
+    CKey key;
+    key.MakeNewKey(true);
+    wallet.AddKeyPubKey(key, key.GetPubKey());
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < nTransactions; i++) {
+        CMutableTransaction tx;
+        if (i % 50 == 49)
+            tx.vin.push_back(CTxIn(vHashes[i - 10], 0));
+        else
+            tx.vin.push_back(CTxIn(GetRandHash(), 0));
+        tx.vout.push_back(CTxOut(Params().StakeInputMin() + i, scriptPubKey));
+
+        CWalletTx wtx(&wallet, tx);
+        wtx.hashBlock = chain.vBlocks[1 + i % nBlocks]->GetBlockHash();
+        wtx.nIndex = 0;
+        wtx.fMerkleVerified = true;
+        wtx.nTimeReceived = GetAdjustedTime() - (i % 10 ? 2 * nStakeMinAge : 0);
+        wtx.nTimeSmart = wtx.nTimeReceived;
+        wallet.AddToWallet(wtx, true);
+        vHashes.push_back(wtx.GetHash());
+    }
+
+    CoinSet setLegacy, setIndexed;
+    std::string strWallet = strprintf("%d transactions", nTransactions);
+    benchmark::Report("StakeIndexSelect", strWallet + ", AvailableCoins", benchmark::Time(boost::bind(&LegacySelectStakeCoins, boost::cref(wallet), boost::ref(setLegacy), nTarget)));
+    benchmark::Report("StakeIndexSelect", strWallet + ", index build", benchmark::Time(boost::bind(&CWallet::BuildStakeIndex, &wallet), 1));
+    benchmark::Report("StakeIndexSelect", strWallet + ", indexed select", benchmark::Time(boost::bind(&SelectStakeCoins, boost::ref(wallet), boost::ref(setIndexed), nTarget)));
+    benchmark::Report("StakeIndexSelect", strWallet + ", MintableCoins", benchmark::Time(boost::bind(&CWallet::MintableCoins, &wallet)));
+    benchmark::Report("StakeIndexSelect", "stake set size", setIndexed.size(), "outputs");
+    assert(setIndexed == setLegacy);
+}
+
+BENCHMARK(StakeIndexSelect);
@@ -0,0 +1,92 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "base58.h"
+#include "coins.h"
+#include "main.h"
+#include "random.h"
+#include "script/standard.h"
+#include "spork.h"
+#include "txmempool.h"
+
+#include <boost/bind.hpp>
+
+static const int64_t FILTER_TIME = 1545731364;
+
+static CKeyID RandomKeyID()
+{
+    uint256 hash = GetRandHash();
+    return CKeyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20)));
+}
+
+// The lookup CheckTxFilter used before the filter was indexed: fetch each parent
+// through GetTransaction and compare its decoded addresses against mapFilterAddress.
+static bool LegacyCheckTxFilter(const CTransaction& tx, const int64_t nBlockTime)
+{
+    CTransaction prevoutTx;
+    uint256 prevoutHashBlock;
+    txnouttype txType;
+    std::vector<CTxDestination> vDest;
+    int nRequiredRet;
+    for (const CTxIn& txin : tx.vin) {
+        if (!GetTransaction(txin.prevout.hash, prevoutTx, prevoutHashBlock))
+            continue;
+        if (!ExtractDestinations(prevoutTx.vout[txin.prevout.n].scriptPubKey, txType, vDest, nRequiredRet))
+            continue;
+        for (const CTxDestination& txDest : vDest) {
+            auto it = mapFilterAddress.find(CBitcoinAddress(txDest));
+            if (it != mapFilterAddress.end() && (nBlockTime == 0 || nBlockTime > it->second))
+                return false;
+        }
+    }
+    return true;
+}
+
+// The tx filter check of a block spending 2,000 inputs, none of them filtered.
+// The legacy path is served from the mempool here, which is its best case: on a
+// live node every miss is a txindex read from disk.
+static void TxFilterInputs()
+{
+    const int nInputs = 2000;
+    LOCK(cs_main);
+    mapFilterAddress.clear();
+    mapFilterDestination.clear();
+    for (int i = 0; i < 10; i++)
+        AddTxFilterAddress(CBitcoinAddress(RandomKeyID()), FILTER_TIME);
+
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    std::vector<CTransaction> vParent;
+    CMutableTransaction tx;
+    for (int i = 0; i < nInputs; i++) {
+        CMutableTransaction parent;
+        parent.vin.resize(1);
+        parent.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        parent.vout.resize(1);
+        parent.vout[0].nValue = COIN;
+        parent.vout[0].scriptPubKey = GetScriptForDestination(RandomKeyID());
+        vParent.push_back(parent);
+        view.ModifyCoins(vParent.back().GetHash())->FromTx(vParent.back(), 1);
+        mempool.addUnchecked(vParent.back().GetHash(), CTxMemPoolEntry(vParent.back(), 0, 0, 0.0, 1));
+        tx.vin.push_back(CTxIn(COutPoint(vParent.back().GetHash(), 0)));
+    }
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+    tx.vout[0].scriptPubKey = GetScriptForDestination(RandomKeyID());
+    const CTransaction txSpend(tx);
+
+    assert(LegacyCheckTxFilter(txSpend, 0) && CheckTxFilter(txSpend, view, 0));
+    std::string strInputs = strprintf("%d inputs", nInputs);
+    benchmark::Report("TxFilterInputs", strInputs + ", GetTransaction", benchmark::Time(boost::bind(&LegacyCheckTxFilter, boost::cref(txSpend), 0)));
+    benchmark::Report("TxFilterInputs", strInputs + ", indexed", benchmark::Time(boost::bind(&CheckTxFilter, boost::cref(txSpend), boost::cref(view), 0)));
+
+    std::list<CTransaction> removed;
+    for (const CTransaction& parent : vParent)
+        mempool.remove(parent, removed, false);
+    InitTxFilter();
+}
+
+BENCHMARK(TxFilterInputs);
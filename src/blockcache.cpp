@@ -0,0 +1,87 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "main.h"
+
+CBlockCache blockCache;
+
+CBlockCache::CBlockCache(size_t nMaxBytesIn) : nBytes(0), nMaxBytes(nMaxBytesIn),
+                                               nHits(0), nMisses(0), nEvictions(0), nBytesFromCache(0), nBytesFromDisk(0)
+{
+}
+
+void CBlockCache::Trim()
+{
+    while (nBytes > nMaxBytes && !listBlocks.empty()) {
+        nBytes -= listBlocks.back().second->size();
+        mapBlocks.erase(listBlocks.back().first);
+        listBlocks.pop_back();
+        nEvictions++;
+    }
+}
+
+void CBlockCache::SetMaxBytes(size_t nMaxBytesIn)
+{
+    LOCK(cs);
+    nMaxBytes = nMaxBytesIn;
+    Trim();
+}
+
+CMessageDataRef CBlockCache::Get(const CBlockIndex* pindex)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    {
+        LOCK(cs);
+        auto it = mapBlocks.find(hash);
+        if (it != mapBlocks.end()) {
+            listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+            nHits++;
+            nBytesFromCache += it->second->second->size();
+            return it->second->second;
+        }
+    }
+
+    // Read without the lock, for the other peers' blocks to be served meanwhile
+    std::vector<char> vchBlock;
+    if (!ReadRawBlockFromDisk(vchBlock, pindex))
+        return CMessageDataRef();
+    // serialized the same on disk and on the wire
+    CMessageDataRef pdata = MakeMessageData("block", begin_ptr(vchBlock), end_ptr(vchBlock));
+
+    LOCK(cs);
+    nMisses++;
+    nBytesFromDisk += pdata->size();
+    // read by two threads at once, or too large to keep
+    if (mapBlocks.count(hash) || pdata->size() > nMaxBytes)
+        return pdata;
+
+    listBlocks.push_front(std::make_pair(hash, pdata));
+    mapBlocks[hash] = listBlocks.begin();
+    nBytes += pdata->size();
+    Trim();
+    return pdata;
+}
+
+void CBlockCache::Clear()
+{
+    LOCK(cs);
+    listBlocks.clear();
+    mapBlocks.clear();
+    nBytes = 0;
+}
+
+void CBlockCache::GetStats(CBlockCacheStats& stats) const
+{
+    LOCK(cs);
+    stats.nBlocks = mapBlocks.size();
+    stats.nBytes = nBytes;
+    stats.nMaxBytes = nMaxBytes;
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nEvictions = nEvictions;
+    stats.nBytesFromCache = nBytesFromCache;
+    stats.nBytesFromDisk = nBytesFromDisk;
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "net.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+class CBlockIndex;
+
+/** Default for -blockcache, megabytes of block messages kept to serve peers */
+static const int DEFAULT_BLOCK_CACHE = 32;
+
+struct CBlockCacheStats {
+    size_t nBlocks;
+    size_t nBytes;
+    size_t nMaxBytes;
+    //! blocks found in the cache, and read from disk
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEvictions;
+    uint64_t nBytesFromCache;
+    uint64_t nBytesFromDisk;
+};
+
+/**
+ * Block messages recently requested by peers, the least recently used
+ * dropped first once they take more than the size limit.
+ *
+ * A block missing from the cache is read from its block file as raw bytes,
+ * which are framed as a "block" message once and sent as they are: a new block
+ * requested by many peers at once, or the blocks a syncing peer asks for, are
+ * read and checksummed once and never deserialized.
+ * Blocks do not change once stored, so nothing needs to leave the cache but to
+ * make room.
+ */
+class CBlockCache
+{
+private:
+    struct BlockHasher {
+        size_t operator()(const uint256& hash) const { return hash.GetLow64(); }
+    };
+    typedef std::list<std::pair<uint256, CMessageDataRef> > BlockList;
+
+    mutable CCriticalSection cs;
+    //! most recently used first
+    BlockList listBlocks;
+    boost::unordered_map<uint256, BlockList::iterator, BlockHasher> mapBlocks;
+    size_t nBytes;
+    size_t nMaxBytes;
+
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEvictions;
+    uint64_t nBytesFromCache;
+    uint64_t nBytesFromDisk;
+
+    void Trim();
+
+public:
+    CBlockCache(size_t nMaxBytesIn = (size_t)DEFAULT_BLOCK_CACHE << 20);
+
+    void SetMaxBytes(size_t nMaxBytesIn);
+    /**
+     * The "block" message for the block pindex stands for, from the cache or
+     * else read from disk and kept. Returns an empty reference if the block
+     * could not be read. Does not need cs_main once the block has data.
+     */
+    CMessageDataRef Get(const CBlockIndex* pindex);
+    void Clear();
+    void GetStats(CBlockCacheStats& stats) const;
+};
+
+extern CBlockCache blockCache;
+
+#endif // BITCOIN_BLOCKCACHE_H
@@ -0,0 +1,176 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+
+#include <boost/unordered_map.hpp>
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block) : nNonce(GetRand(std::numeric_limits<uint64_t>::max())),
+                                                                           header(block), vchBlockSig(block.vchBlockSig)
+{
+    FillShortTxIDSelector();
+
+    // The coinbase, and the coinstake only its staker has seen before
+    size_t nPrefilled = block.IsProofOfStake() ? 2 : 1;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        if (i < nPrefilled) {
+            vPrefilledIndexes.push_back(i);
+            vPrefilledTx.push_back(block.vtx[i]);
+        } else {
+            vShortTxIds.push_back(GetShortID(block.vtx[i].GetHash()));
+        }
+    }
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header << nNonce;
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write((const unsigned char*)&ss[0], ss.size()).Finalize(hash);
+    nShortIdK0 = ReadLE64(hash);
+    nShortIdK1 = ReadLE64(hash + 8);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& hashTx) const
+{
+    return SipHashUint256(nShortIdK0, nShortIdK1, hashTx) & 0xffffffffffffULL;
+}
+
+ReadStatus CPartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool, const std::vector<CTransaction>& vExtraTxn)
+{
+    if (cmpctblock.header.IsNull() || cmpctblock.BlockTxCount() == 0 || cmpctblock.vPrefilledTx.size() != cmpctblock.vPrefilledIndexes.size())
+        return READ_STATUS_INVALID;
+
+    size_t nTx = cmpctblock.BlockTxCount();
+    vtxAvailable.assign(nTx, CTransaction());
+    vHaveTx.assign(nTx, false);
+    header = cmpctblock.header;
+    vchBlockSig = cmpctblock.vchBlockSig;
+
+    for (size_t i = 0; i < cmpctblock.vPrefilledTx.size(); i++) {
+        uint16_t nIndex = cmpctblock.vPrefilledIndexes[i];
+        if (nIndex >= nTx || vHaveTx[nIndex])
+            return READ_STATUS_INVALID;
+        vtxAvailable[nIndex] = cmpctblock.vPrefilledTx[i];
+        vHaveTx[nIndex] = true;
+    }
+    nPrefilled = cmpctblock.vPrefilledTx.size();
+
+    // Where in the block each short ID goes
+    boost::unordered_map<uint64_t, uint16_t> mapShortIds;
+    size_t nShortId = 0;
+    for (size_t i = 0; i < nTx; i++) {
+        if (vHaveTx[i])
+            continue;
+        // two transactions of the block that cannot be told apart
+        if (!mapShortIds.insert(std::make_pair(cmpctblock.vShortTxIds[nShortId++], i)).second)
+            return READ_STATUS_FAILED;
+    }
+
+    // A short ID two transactions we know match is asked for rather than guessed
+    std::vector<bool> vMatched(nTx, false);
+    std::vector<bool> vFromExtra(nTx, false);
+    {
+        LOCK(pool.cs);
+        for (const auto& entry : pool.mapTx) {
+            boost::unordered_map<uint64_t, uint16_t>::const_iterator it = mapShortIds.find(cmpctblock.GetShortID(entry.first));
+            if (it == mapShortIds.end())
+                continue;
+            if (!vMatched[it->second]) {
+                vMatched[it->second] = true;
+                vtxAvailable[it->second] = entry.second.GetTx();
+                vHaveTx[it->second] = true;
+                nFromMempool++;
+            } else if (vHaveTx[it->second]) {
+                vtxAvailable[it->second] = CTransaction();
+                vHaveTx[it->second] = false;
+                nFromMempool--;
+            }
+            if (nFromMempool == mapShortIds.size())
+                break;
+        }
+    }
+
+    for (const CTransaction& tx : vExtraTxn) {
+        if (nFromMempool + nFromExtra == mapShortIds.size())
+            break;
+        const uint256 hashTx = tx.GetHash();
+        boost::unordered_map<uint64_t, uint16_t>::const_iterator it = mapShortIds.find(cmpctblock.GetShortID(hashTx));
+        if (it == mapShortIds.end())
+            continue;
+        if (!vMatched[it->second]) {
+            vMatched[it->second] = true;
+            vFromExtra[it->second] = true;
+            vtxAvailable[it->second] = tx;
+            vHaveTx[it->second] = true;
+            nFromExtra++;
+        } else if (vHaveTx[it->second] && vtxAvailable[it->second].GetHash() != hashTx) {
+            vtxAvailable[it->second] = CTransaction();
+            vHaveTx[it->second] = false;
+            if (vFromExtra[it->second])
+                nFromExtra--;
+            else
+                nFromMempool--;
+        }
+    }
+
+    return READ_STATUS_OK;
+}
+
+bool CPartiallyDownloadedBlock::IsTxAvailable(size_t nIndex) const
+{
+    return nIndex < vHaveTx.size() && vHaveTx[nIndex];
+}
+
+std::vector<uint16_t> CPartiallyDownloadedBlock::GetMissing() const
+{
+    std::vector<uint16_t> vMissing;
+    for (size_t i = 0; i < vHaveTx.size(); i++) {
+        if (!vHaveTx[i])
+            vMissing.push_back(i);
+    }
+    return vMissing;
+}
+
+ReadStatus CPartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing)
+{
+    if (header.IsNull())
+        return READ_STATUS_INVALID;
+
+    block = CBlock(header);
+    block.vtx.resize(vtxAvailable.size());
+    size_t nMissing = 0;
+    for (size_t i = 0; i < vtxAvailable.size(); i++) {
+        if (vHaveTx[i]) {
+            block.vtx[i] = vtxAvailable[i];
+        } else {
+            if (nMissing >= vtxMissing.size())
+                return READ_STATUS_INVALID;
+            block.vtx[i] = vtxMissing[nMissing++];
+        }
+    }
+    block.vchBlockSig = vchBlockSig;
+
+    // Rebuilt once
+    header.SetNull();
+    vtxAvailable.clear();
+    vHaveTx.clear();
+
+    if (nMissing != vtxMissing.size())
+        return READ_STATUS_INVALID;
+
+    // A transaction matched by a colliding short ID makes another block
+    if (block.BuildMerkleTree() != block.hashMerkleRoot)
+        return READ_STATUS_FAILED;
+
+    return READ_STATUS_OK;
+}
@@ -0,0 +1,250 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKENCODINGS_H
+#define BITCOIN_BLOCKENCODINGS_H
+
+#include "primitives/block.h"
+
+#include <ios>
+#include <limits>
+#include <stdint.h>
+#include <vector>
+
+class CTxMemPool;
+
+/** Default for -compactblocks, whether new blocks are exchanged in compact form with peers that do too */
+static const bool DEFAULT_COMPACT_BLOCKS = true;
+/** Blocks deeper than this below the tip are sent whole, their transactions long gone from mempools */
+static const int MAX_COMPACT_BLOCK_DEPTH = 10;
+/** Bytes of a short transaction ID */
+static const int SHORTTXIDS_LENGTH = 6;
+
+/**
+ * Transaction positions in a block, ascending, each written as its distance from
+ * the one before it so that the usual runs of neighbours take a byte each.
+ */
+class CTxIndexesSerializer
+{
+private:
+    std::vector<uint16_t>& vIndexes;
+
+public:
+    CTxIndexesSerializer(std::vector<uint16_t>& vIndexesIn) : vIndexes(vIndexesIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        CSizeComputer s(nType, nVersion);
+        Serialize(s, nType, nVersion);
+        return s.size();
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, vIndexes.size());
+        for (size_t i = 0; i < vIndexes.size(); i++)
+            WriteCompactSize(s, i == 0 ? vIndexes[0] : vIndexes[i] - vIndexes[i - 1] - 1);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        uint64_t nIndexes = ReadCompactSize(s);
+        vIndexes.clear();
+        uint64_t nIndex = 0;
+        for (uint64_t i = 0; i < nIndexes; i++) {
+            nIndex += ReadCompactSize(s) + (i == 0 ? 0 : 1);
+            if (nIndex > std::numeric_limits<uint16_t>::max())
+                throw std::ios_base::failure("transaction index overflowed 16 bits");
+            vIndexes.push_back(nIndex);
+        }
+    }
+};
+
+/** Short transaction IDs, written in the 48 bits they are made of */
+class CShortTxIdsSerializer
+{
+private:
+    std::vector<uint64_t>& vShortTxIds;
+
+public:
+    CShortTxIdsSerializer(std::vector<uint64_t>& vShortTxIdsIn) : vShortTxIds(vShortTxIdsIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return GetSizeOfCompactSize(vShortTxIds.size()) + vShortTxIds.size() * SHORTTXIDS_LENGTH;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, vShortTxIds.size());
+        for (uint64_t nShortId : vShortTxIds)
+            s << (uint32_t)nShortId << (uint16_t)(nShortId >> 32);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        uint64_t nShortTxIds = ReadCompactSize(s);
+        vShortTxIds.clear();
+        for (uint64_t i = 0; i < nShortTxIds; i++) {
+            uint32_t nLow;
+            uint16_t nHigh;
+            s >> nLow >> nHigh;
+            vShortTxIds.push_back(((uint64_t)nHigh << 32) | nLow);
+        }
+    }
+};
+
+/** The transactions of a block a peer is missing, by their positions in it ("getblocktxn") */
+class CBlockTransactionsRequest
+{
+public:
+    uint256 hashBlock;
+    //! ascending
+    std::vector<uint16_t> vIndexes;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(hashBlock);
+        READWRITE(REF(CTxIndexesSerializer(vIndexes)));
+    }
+};
+
+/** The transactions a getblocktxn asked for, in the order asked ("blocktxn") */
+class CBlockTransactions
+{
+public:
+    uint256 hashBlock;
+    std::vector<CTransaction> vtx;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(hashBlock);
+        READWRITE(vtx);
+    }
+};
+
+/**
+ * A block as its header and a short ID of each transaction, which the receiver
+ * matches against the transactions it already has ("cmpctblock").
+ *
+ * Short IDs are the low 48 bits of SipHash-2-4 of the transaction hash, keyed
+ * by the SHA256 of the header and a nonce the sender picks, so that nobody can
+ * make two transactions collide for every block. The coinbase, and the
+ * coinstake of a proof-of-stake block with the stake reward and masternode
+ * payment nobody else has seen, are sent in full along with the block
+ * signature.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    mutable uint64_t nShortIdK0;
+    mutable uint64_t nShortIdK1;
+    uint64_t nNonce;
+
+    void FillShortTxIDSelector() const;
+
+public:
+    CBlockHeader header;
+    std::vector<uint64_t> vShortTxIds;
+    //! positions of the transactions sent in full, ascending, and the transactions
+    std::vector<uint16_t> vPrefilledIndexes;
+    std::vector<CTransaction> vPrefilledTx;
+    std::vector<unsigned char> vchBlockSig;
+
+    CBlockHeaderAndShortTxIDs() : nShortIdK0(0), nShortIdK1(0), nNonce(0) {}
+    CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    uint64_t GetShortID(const uint256& hashTx) const;
+    size_t BlockTxCount() const { return vShortTxIds.size() + vPrefilledTx.size(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(header);
+        READWRITE(nNonce);
+        READWRITE(REF(CShortTxIdsSerializer(vShortTxIds)));
+        READWRITE(REF(CTxIndexesSerializer(vPrefilledIndexes)));
+        READWRITE(vPrefilledTx);
+        READWRITE(vchBlockSig);
+
+        if (ser_action.ForRead()) {
+            if (vPrefilledTx.size() != vPrefilledIndexes.size())
+                throw std::ios_base::failure("prefilled transactions do not match their positions");
+            if (BlockTxCount() > std::numeric_limits<uint16_t>::max())
+                throw std::ios_base::failure("indexes overflowed 16 bits");
+            FillShortTxIDSelector();
+        }
+    }
+};
+
+enum ReadStatus {
+    READ_STATUS_OK,
+    //! the peer sent something no honest peer sends
+    READ_STATUS_INVALID,
+    //! the block could not be rebuilt from what it sent, most likely a short ID collision
+    READ_STATUS_FAILED,
+};
+
+/**
+ * A block rebuilt from a compact block: the transactions it sent in full, those
+ * matched in the mempool or among the other transactions known, and once asked
+ * for, the rest.
+ */
+class CPartiallyDownloadedBlock
+{
+private:
+    std::vector<CTransaction> vtxAvailable;
+    std::vector<bool> vHaveTx;
+    CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
+
+public:
+    size_t nPrefilled;
+    size_t nFromMempool;
+    size_t nFromExtra;
+
+    CPartiallyDownloadedBlock() : nPrefilled(0), nFromMempool(0), nFromExtra(0) {}
+
+    /** vExtraTxn are matched after the mempool, like the orphan transactions */
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool, const std::vector<CTransaction>& vExtraTxn);
+    bool IsTxAvailable(size_t nIndex) const;
+    std::vector<uint16_t> GetMissing() const;
+    /** Complete the block with the transactions GetMissing listed, in its order */
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing);
+    uint256 GetBlockHash() const { return header.GetHash(); }
+};
+
+struct CCompactBlockStats {
+    //! compact blocks received, and rebuilt without asking for anything
+    uint64_t nReceived;
+    uint64_t nReconstructed;
+    //! rebuilt after asking for the missing transactions
+    uint64_t nRoundTrips;
+    //! asked for in full when they could not be rebuilt
+    uint64_t nFallbacks;
+    uint64_t nTxPrefilled;
+    uint64_t nTxFromMempool;
+    uint64_t nTxFromExtra;
+    uint64_t nTxRequested;
+    //! size of the compact blocks received, and of the blocks rebuilt from them
+    uint64_t nBytesReceived;
+    uint64_t nBlockBytes;
+    //! compact blocks and missing transactions sent to peers
+    uint64_t nServed;
+    uint64_t nTxServed;
+};
+
+#endif // BITCOIN_BLOCKENCODINGS_H
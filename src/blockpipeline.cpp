@@ -0,0 +1,220 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockpipeline.h"
+
+#include "main.h"
+#include "net.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+CBlockPipeline blockPipeline;
+
+CBlockPipeline::CBlockPipeline() : nChecking(0), nBytes(0), fRunning(false), nCheckThreads(0),
+                                   nReceived(0), nChecked(0), nCheckFailed(0), nConnected(0), nSubmitWaitMicros(0)
+{
+}
+
+void CBlockPipeline::Start(boost::thread_group& threadGroup, int nThreads)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        assert(!fRunning);
+        fRunning = true;
+        nCheckThreads = nThreads;
+    }
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CBlockPipeline::ThreadCheck, this));
+    threadGroup.create_thread(boost::bind(&CBlockPipeline::ThreadConnect, this));
+}
+
+void CBlockPipeline::Stop()
+{
+    std::deque<EntryRef> queueDrop;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRunning = false;
+        queueDrop.swap(queueConnect);
+        queueCheck.clear();
+        setHashes.clear();
+        nBytes = 0;
+    }
+    condCheck.notify_all();
+    condConnect.notify_all();
+    condSpace.notify_all();
+
+    LOCK(cs_vNodes);
+    for (const EntryRef& entry : queueDrop)
+        entry->pfrom->Release();
+}
+
+bool CBlockPipeline::Submit(CNode* pfrom, CBlock& block, size_t nSize)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fRunning)
+            return false;
+    }
+    {
+        // keeps pfrom alive until its block is connected
+        LOCK(cs_vNodes);
+        pfrom->AddRef();
+    }
+
+    EntryRef entry = std::make_shared<CEntry>();
+    bool fQueued = false;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        int64_t nStart = GetTimeMicros();
+        while (fRunning && nBytes > 0 && nBytes + nSize > MAX_BLOCK_PIPELINE_BYTES)
+            condSpace.wait(lock);
+        int64_t nNow = GetTimeMicros();
+        nSubmitWaitMicros += nNow - nStart;
+
+        if (fRunning) {
+            entry->hash = block.GetHash();
+            entry->block = std::move(block);
+            entry->pfrom = pfrom;
+            entry->nSize = nSize;
+            entry->fChecked = false;
+            entry->fSignatureChecked = false;
+            entry->nTimeReceived = nNow;
+            entry->nTimeChecked = 0;
+            queueCheck.push_back(entry);
+            queueConnect.push_back(entry);
+            setHashes.insert(entry->hash);
+            nBytes += nSize;
+            nReceived++;
+            rateReceive.Add(nNow);
+            fQueued = true;
+        }
+    }
+    if (!fQueued) {
+        LOCK(cs_vNodes);
+        pfrom->Release();
+        return false;
+    }
+    condCheck.notify_one();
+    return true;
+}
+
+bool CBlockPipeline::Contains(const uint256& hash) const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return setHashes.count(hash) > 0;
+}
+
+void CBlockPipeline::ThreadCheck()
+{
+    RenameThread("fdreserve-blkcheck");
+    while (true) {
+        EntryRef entry;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (fRunning && queueCheck.empty())
+                condCheck.wait(lock);
+            if (!fRunning)
+                return;
+            entry = queueCheck.front();
+            queueCheck.pop_front();
+            nChecking++;
+        }
+
+        // A block failing here is checked again by ProcessNewBlock, which
+        // fills in the validation state the peer is answered with.
+        int64_t nStart = GetTimeMicros();
+        CValidationState state;
+        bool fValid = CheckBlockContextFree(entry->block, state) && entry->block.CheckBlockSignature();
+        int64_t nNow = GetTimeMicros();
+        histCheck.Add(nNow - nStart);
+        rateCheck.Add(nNow);
+        if (!fValid)
+            LogPrint("net", "%s : block %s failed its checks\n", __func__, entry->hash.ToString());
+
+        bool fOldest;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            entry->fChecked = true;
+            entry->fSignatureChecked = fValid;
+            entry->nTimeChecked = nNow;
+            nChecking--;
+            nChecked++;
+            if (!fValid)
+                nCheckFailed++;
+            fOldest = !queueConnect.empty() && queueConnect.front() == entry;
+        }
+        if (fOldest)
+            condConnect.notify_one();
+    }
+}
+
+void CBlockPipeline::ThreadConnect()
+{
+    RenameThread("fdreserve-blkconn");
+    while (true) {
+        EntryRef entry;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (fRunning && (queueConnect.empty() || !queueConnect.front()->fChecked))
+                condConnect.wait(lock);
+            if (!fRunning)
+                return;
+            // stays in the queue, and in Contains, until it is in mapBlockIndex
+            entry = queueConnect.front();
+        }
+
+        int64_t nStart = GetTimeMicros();
+        histConnectWait.Add(nStart - entry->nTimeChecked);
+        ProcessReceivedBlock(entry->pfrom, entry->block, entry->fSignatureChecked);
+        int64_t nNow = GetTimeMicros();
+        histConnect.Add(nNow - nStart);
+        rateConnect.Add(nNow);
+        LogPrint("bench", "%s : block %s received %.2fms ago, connected in %.2fms\n", __func__,
+            entry->hash.ToString(), 0.001 * (nNow - entry->nTimeReceived), 0.001 * (nNow - nStart));
+
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (!queueConnect.empty() && queueConnect.front() == entry) {
+                queueConnect.pop_front();
+                setHashes.erase(setHashes.find(entry->hash));
+                nBytes -= entry->nSize;
+            }
+            nConnected++;
+        }
+        condSpace.notify_all();
+
+        LOCK(cs_vNodes);
+        entry->pfrom->Release();
+    }
+}
+
+void CBlockPipeline::GetStats(CBlockPipelineStats& stats) const
+{
+    int64_t nNow = GetTimeMicros();
+    boost::unique_lock<boost::mutex> lock(cs);
+    stats.fRunning = fRunning;
+    stats.nCheckThreads = nCheckThreads;
+    stats.nQueuedCheck = queueCheck.size();
+    stats.nChecking = nChecking;
+    // the connect thread takes the oldest block as soon as it is checked
+    stats.nConnecting = !queueConnect.empty() && queueConnect.front()->fChecked ? 1 : 0;
+    stats.nQueuedConnect = 0;
+    for (const EntryRef& entry : queueConnect) {
+        if (entry->fChecked)
+            stats.nQueuedConnect++;
+    }
+    stats.nQueuedConnect -= stats.nConnecting;
+    stats.nBytes = nBytes;
+    stats.nReceived = nReceived;
+    stats.nChecked = nChecked;
+    stats.nCheckFailed = nCheckFailed;
+    stats.nConnected = nConnected;
+    stats.dReceiveRate = rateReceive.Get(nNow);
+    stats.dCheckRate = rateCheck.Get(nNow);
+    stats.dConnectRate = rateConnect.Get(nNow);
+    stats.nSubmitWaitMicros = nSubmitWaitMicros;
+}
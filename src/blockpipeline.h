@@ -0,0 +1,141 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKPIPELINE_H
+#define BITCOIN_BLOCKPIPELINE_H
+
+#include "primitives/block.h"
+#include "stats.h"
+#include "uint256.h"
+
+#include <deque>
+#include <memory>
+#include <set>
+#include <stdint.h>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CNode;
+
+namespace boost
+{
+class thread_group;
+} // namespace boost
+
+/** Default for -blockcheckthreads, threads running the context-free checks of received blocks */
+static const int DEFAULT_BLOCK_CHECK_THREADS = 2;
+/** Maximum number of block check threads */
+static const int MAX_BLOCK_CHECK_THREADS = 16;
+/** Serialized size of the blocks in the pipeline above which the message handler waits for room */
+static const size_t MAX_BLOCK_PIPELINE_BYTES = 32 * 1000 * 1000;
+
+struct CBlockPipelineStats {
+    bool fRunning;
+    int nCheckThreads;
+    //! received, waiting for a check thread
+    size_t nQueuedCheck;
+    //! being checked
+    size_t nChecking;
+    //! checked, waiting for the blocks received before them to be connected
+    size_t nQueuedConnect;
+    //! being connected
+    size_t nConnecting;
+    //! serialized size of all blocks in the pipeline
+    size_t nBytes;
+    uint64_t nReceived;
+    uint64_t nChecked;
+    uint64_t nCheckFailed;
+    uint64_t nConnected;
+    //! blocks per second through each stage, averaged over the last minute
+    double dReceiveRate;
+    double dCheckRate;
+    double dConnectRate;
+    //! time the message handler spent waiting for room in the pipeline
+    int64_t nSubmitWaitMicros;
+};
+
+/**
+ * Validation pipeline for blocks received from peers.
+ *
+ * The message handler hands each block to Submit and goes back to the network.
+ * A pool of check threads runs the checks that need no chain state
+ * (CheckBlockContextFree and the block signature), in whatever order blocks
+ * come up. A single connect thread then passes the blocks to
+ * ProcessReceivedBlock in the order they were received, so only that last
+ * stage runs under cs_main, and a block is connected only after the blocks
+ * received before it.
+ */
+class CBlockPipeline
+{
+private:
+    struct CEntry {
+        CBlock block;
+        uint256 hash;
+        CNode* pfrom;
+        size_t nSize;
+        bool fChecked;
+        bool fSignatureChecked;
+        int64_t nTimeReceived;
+        int64_t nTimeChecked;
+    };
+    typedef std::shared_ptr<CEntry> EntryRef;
+
+    mutable boost::mutex cs;
+    //! a block was queued for checking, or the pipeline is stopping
+    boost::condition_variable condCheck;
+    //! the oldest block finished its checks
+    boost::condition_variable condConnect;
+    //! blocks left the pipeline
+    boost::condition_variable condSpace;
+
+    std::deque<EntryRef> queueCheck;
+    //! every block in the pipeline, oldest first
+    std::deque<EntryRef> queueConnect;
+    std::multiset<uint256> setHashes;
+    size_t nChecking;
+    size_t nBytes;
+    bool fRunning;
+    int nCheckThreads;
+
+    uint64_t nReceived;
+    uint64_t nChecked;
+    uint64_t nCheckFailed;
+    uint64_t nConnected;
+    int64_t nSubmitWaitMicros;
+    CRateMeter rateReceive;
+    CRateMeter rateCheck;
+    CRateMeter rateConnect;
+
+    void ThreadCheck();
+    void ThreadConnect();
+
+public:
+    //! time spent in the checks of one block
+    CLatencyHistogram histCheck;
+    //! time from the end of its checks until a block's turn to be connected
+    CLatencyHistogram histConnectWait;
+    //! time spent connecting one block, ProcessNewBlock included
+    CLatencyHistogram histConnect;
+
+    CBlockPipeline();
+
+    void Start(boost::thread_group& threadGroup, int nThreads);
+    //! Drop the blocks left after the pipeline threads were stopped
+    void Stop();
+
+    /**
+     * Queue a block received from pfrom, waiting while the pipeline is full.
+     * Takes the contents of block. Returns false, leaving block alone, if the
+     * pipeline does not run.
+     */
+    bool Submit(CNode* pfrom, CBlock& block, size_t nSize);
+    //! Whether a block with this hash is in the pipeline
+    bool Contains(const uint256& hash) const;
+    void GetStats(CBlockPipelineStats& stats) const;
+};
+
+extern CBlockPipeline blockPipeline;
+
+#endif // BITCOIN_BLOCKPIPELINE_H
@@ -64,6 +64,7 @@ bool CCoinsView::HaveCoins(const uint256& txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(0); }
 bool CCoinsView::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return false; }
 bool CCoinsView::GetStats(CCoinsStats& stats) const { return false; }
+bool CCoinsView::Sync() { return true; }
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView* viewIn) : base(viewIn) {}
@@ -73,10 +74,152 @@ uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView& viewIn) { base = &viewIn; }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
 bool CCoinsViewBacked::GetStats(CCoinsStats& stats) const { return base->GetStats(stats); }
+bool CCoinsViewBacked::Sync() { return base->Sync(); }
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView* baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0) {}
+CCoinsMap::CCoinsMap() : nEntries(0), nFreeHead(NO_ENTRY), nSize(0) {}
+
+CCoinsMap::~CCoinsMap()
+{
+    clear();
+}
+
+size_t CCoinsMap::FindSlot(const uint256& key, uint32_t nHash) const
+{
+    size_t nMask = vSlot.size() - 1;
+    for (size_t nPos = nHash & nMask;; nPos = (nPos + 1) & nMask) {
+        const Slot& slot = vSlot[nPos];
+        if (slot.nEntry == 0)
+            return nPos;
+        if (slot.nHash == nHash && GetNode(slot.nEntry - 1).value()->first == key)
+            return nPos;
+    }
+}
+
+void CCoinsMap::Rehash(size_t nSlots)
+{
+    std::vector<Slot> vOld(nSlots);
+    vOld.swap(vSlot);
+    size_t nMask = nSlots - 1;
+    for (const Slot& slot : vOld) {
+        if (slot.nEntry == 0)
+            continue;
+        size_t nPos = slot.nHash & nMask;
+        while (vSlot[nPos].nEntry != 0)
+            nPos = (nPos + 1) & nMask;
+        vSlot[nPos] = slot;
+    }
+}
+
+uint32_t CCoinsMap::AllocateEntry()
+{
+    uint32_t nEntry = nFreeHead;
+    if (nEntry != NO_ENTRY) {
+        nFreeHead = GetNode(nEntry).nNextFree;
+        return nEntry;
+    }
+    nEntry = nEntries;
+    if ((nEntry >> CHUNK_BITS) == vChunk.size()) {
+        Node* chunk = static_cast<Node*>(::operator new(CHUNK_SIZE * sizeof(Node)));
+        for (uint32_t i = 0; i < CHUNK_SIZE; i++)
+            chunk[i].fUsed = false;
+        vChunk.push_back(chunk);
+    }
+    nEntries++;
+    return nEntry;
+}
+
+CCoinsMap::iterator CCoinsMap::find(const uint256& key)
+{
+    if (nSize == 0)
+        return end();
+    const Slot& slot = vSlot[FindSlot(key, Hash(key))];
+    return slot.nEntry ? iterator(this, slot.nEntry - 1) : end();
+}
+
+CCoinsMap::const_iterator CCoinsMap::find(const uint256& key) const
+{
+    if (nSize == 0)
+        return end();
+    const Slot& slot = vSlot[FindSlot(key, Hash(key))];
+    return slot.nEntry ? const_iterator(this, slot.nEntry - 1) : end();
+}
+
+std::pair<CCoinsMap::iterator, bool> CCoinsMap::insert(const value_type& value)
+{
+    // keep the table at most three quarters full
+    if (4 * (nSize + 1) > 3 * vSlot.size())
+        Rehash(vSlot.empty() ? 64 : 2 * vSlot.size());
+
+    uint32_t nHash = Hash(value.first);
+    Slot& slot = vSlot[FindSlot(value.first, nHash)];
+    if (slot.nEntry)
+        return std::make_pair(iterator(this, slot.nEntry - 1), false);
+
+    uint32_t nEntry = AllocateEntry();
+    Node& node = GetNode(nEntry);
+    new (node.value()) value_type(value);
+    node.fUsed = true;
+    node.nNextFree = NO_ENTRY;
+    slot.nHash = nHash;
+    slot.nEntry = nEntry + 1;
+    nSize++;
+    return std::make_pair(iterator(this, nEntry), true);
+}
+
+CCoinsCacheEntry& CCoinsMap::operator[](const uint256& key)
+{
+    return insert(std::make_pair(key, CCoinsCacheEntry())).first->second;
+}
+
+void CCoinsMap::erase(const_iterator it)
+{
+    Node& node = GetNode(it.nEntry);
+    size_t nMask = vSlot.size() - 1;
+    size_t nPos = FindSlot(node.value()->first, Hash(node.value()->first));
+    assert(vSlot[nPos].nEntry == it.nEntry + 1);
+
+    // shift the rest of the probe run back over the hole, so lookups need no tombstones
+    for (size_t nNext = (nPos + 1) & nMask; vSlot[nNext].nEntry != 0; nNext = (nNext + 1) & nMask) {
+        size_t nHome = vSlot[nNext].nHash & nMask;
+        if (((nNext - nHome) & nMask) >= ((nNext - nPos) & nMask)) {
+            vSlot[nPos] = vSlot[nNext];
+            nPos = nNext;
+        }
+    }
+    vSlot[nPos].nEntry = 0;
+
+    node.value()->~value_type();
+    node.fUsed = false;
+    node.nNextFree = nFreeHead;
+    nFreeHead = it.nEntry;
+    nSize--;
+}
+
+void CCoinsMap::clear()
+{
+    for (uint32_t nEntry = 0; nEntry < nEntries; nEntry++) {
+        Node& node = GetNode(nEntry);
+        if (node.fUsed)
+            node.value()->~value_type();
+    }
+    for (Node* chunk : vChunk)
+        ::operator delete(chunk);
+    std::vector<Node*>().swap(vChunk);
+    std::vector<Slot>().swap(vSlot);
+    nEntries = 0;
+    nFreeHead = NO_ENTRY;
+    nSize = 0;
+}
+
+size_t CCoinsMap::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vSlot) + memusage::DynamicUsage(vChunk) +
+           vChunk.size() * memusage::MallocUsage(CHUNK_SIZE * sizeof(Node));
+}
+
+CCoinsViewCache::CCoinsViewCache(CCoinsView* baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0), cachedCoinsUsage(0) {}
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -98,6 +241,7 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256& txid) const
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
+    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
     return ret;
 }
 
@@ -115,6 +259,7 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256& txid)
 {
     assert(!hasModifier);
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    size_t cachedCoinUsage = 0;
     if (ret.second) {
         if (!base->GetCoins(txid, ret.first->second.coins)) {
             // The parent view does not have this entry; mark it as fresh.
@@ -124,10 +269,12 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256& txid)
             // The parent view only has a pruned entry for this; mark it as fresh.
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
         }
+    } else {
+        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first);
+    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
 const CCoins* CCoinsViewCache::AccessCoins(const uint256& txid) const
@@ -177,6 +324,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
                     assert(it->second.flags & CCoinsCacheEntry::FRESH);
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
                     entry.coins.swap(it->second.coins);
+                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
                 }
             } else {
@@ -184,10 +332,13 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
+                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
+                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
+                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 }
             }
@@ -195,6 +346,8 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
         CCoinsMap::iterator itOld = it++;
         mapCoins.erase(itOld);
     }
+    // every entry has been moved up or dropped: release the child's chunks in one go
+    mapCoins.clear();
     hashBlock = hashBlockIn;
     return true;
 }
@@ -203,6 +356,7 @@ bool CCoinsViewCache::Flush()
 {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    cachedCoinsUsage = 0;
     return fOk;
 }
 
@@ -211,6 +365,11 @@ unsigned int CCoinsViewCache::GetCacheSize() const
     return cacheCoins.size();
 }
 
+size_t CCoinsViewCache::DynamicMemoryUsage() const
+{
+    return cacheCoins.DynamicMemoryUsage() + cachedCoinsUsage;
+}
+
 const CTxOut& CCoinsViewCache::GetOutputFor(const CTxIn& input) const
 {
     const CCoins* coins = AccessCoins(input.prevout.hash);
@@ -260,7 +419,7 @@ double CCoinsViewCache::GetPriority(const CTransaction& tx, int nHeight) const
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_) : cache(cache_), it(it_)
+CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage)
 {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
@@ -271,7 +430,11 @@ CCoinsModifier::~CCoinsModifier()
     assert(cache.hasModifier);
     cache.hasModifier = false;
     it->second.coins.Cleanup();
+    cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
+    } else {
+        // If the coin still exists after the modification, add the new usage
+        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
     }
 }
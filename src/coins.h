@@ -7,6 +7,7 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "memusage.h"
 #include "script/standard.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -15,8 +16,9 @@
 #include <assert.h>
 #include <stdint.h>
 
-
-#include <boost/unordered_map.hpp>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 /**
 
@@ -283,6 +285,15 @@ public:
                 return false;
         return true;
     }
+
+    //! heap memory held by the outputs and their scripts
+    size_t DynamicMemoryUsage() const
+    {
+        size_t ret = memusage::DynamicUsage(vout);
+        for (const CTxOut& out : vout)
+            ret += memusage::DynamicUsage(out.scriptPubKey);
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -316,7 +327,137 @@ struct CCoinsCacheEntry {
     CCoinsCacheEntry() : coins(), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+/**
+ * Open addressing hash map from txid to cache entry.
+ *
+ * The probe table holds 8 byte slots (32 bits of the key hash and an entry
+ * number), so a lookup walks a few adjacent slots before it touches an entry.
+ * Entries are allocated from chunks that never move: pointers and iterators
+ * to an entry stay valid until it is erased, as they did with the node based
+ * map this replaces. Erased entries go on a free list for the next insert and
+ * clear() hands every chunk back at once. Iteration runs over the chunks in
+ * allocation order.
+ */
+class CCoinsMap
+{
+public:
+    typedef uint256 key_type;
+    typedef CCoinsCacheEntry mapped_type;
+    typedef std::pair<const uint256, CCoinsCacheEntry> value_type;
+
+private:
+    static const unsigned int CHUNK_BITS = 8;
+    static const uint32_t CHUNK_SIZE = 1 << CHUNK_BITS;
+    static const uint32_t NO_ENTRY = 0xFFFFFFFF;
+
+    struct Node {
+        std::aligned_storage<sizeof(value_type), std::alignment_of<value_type>::value>::type data;
+        //! next entry on the free list, or NO_ENTRY while this one is in use
+        uint32_t nNextFree;
+        bool fUsed;
+
+        value_type* value() { return reinterpret_cast<value_type*>(&data); }
+    };
+
+    struct Slot {
+        uint32_t nHash;
+        //! entry number plus one, zero for an empty slot
+        uint32_t nEntry;
+    };
+
+    CCoinsKeyHasher hasher;
+    std::vector<Slot> vSlot;
+    std::vector<Node*> vChunk;
+    //! entries handed out so far, in use or on the free list
+    uint32_t nEntries;
+    uint32_t nFreeHead;
+    size_t nSize;
+
+    Node& GetNode(uint32_t nEntry) const { return vChunk[nEntry >> CHUNK_BITS][nEntry & (CHUNK_SIZE - 1)]; }
+    uint32_t Hash(const uint256& key) const
+    {
+        uint64_t nHash = hasher(key);
+        return (uint32_t)(nHash ^ (nHash >> 32));
+    }
+    //! table slot holding key, or the empty slot where it would go
+    size_t FindSlot(const uint256& key, uint32_t nHash) const;
+    uint32_t AllocateEntry();
+    void Rehash(size_t nSlots);
+
+    template <typename M, typename V>
+    class Iterator
+    {
+    private:
+        M* map;
+        uint32_t nEntry;
+
+        void Skip()
+        {
+            while (nEntry < map->nEntries && !map->GetNode(nEntry).fUsed)
+                nEntry++;
+        }
+
+    public:
+        Iterator() : map(NULL), nEntry(0) {}
+        Iterator(M* mapIn, uint32_t nEntryIn, bool fSkip = false) : map(mapIn), nEntry(nEntryIn)
+        {
+            if (fSkip)
+                Skip();
+        }
+        template <typename M2, typename V2>
+        Iterator(const Iterator<M2, V2>& it) : map(it.map), nEntry(it.nEntry) {}
+
+        V& operator*() const { return *map->GetNode(nEntry).value(); }
+        V* operator->() const { return map->GetNode(nEntry).value(); }
+        Iterator& operator++()
+        {
+            nEntry++;
+            Skip();
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            Iterator ret = *this;
+            ++*this;
+            return ret;
+        }
+        bool operator==(const Iterator& it) const { return nEntry == it.nEntry; }
+        bool operator!=(const Iterator& it) const { return nEntry != it.nEntry; }
+
+        template <typename M2, typename V2>
+        friend class Iterator;
+        friend class CCoinsMap;
+    };
+
+public:
+    typedef Iterator<CCoinsMap, value_type> iterator;
+    typedef Iterator<const CCoinsMap, const value_type> const_iterator;
+
+    CCoinsMap();
+    ~CCoinsMap();
+
+    iterator begin() { return iterator(this, 0, true); }
+    iterator end() { return iterator(this, nEntries); }
+    const_iterator begin() const { return const_iterator(this, 0, true); }
+    const_iterator end() const { return const_iterator(this, nEntries); }
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const uint256& key);
+    const_iterator find(const uint256& key) const;
+    std::pair<iterator, bool> insert(const value_type& value);
+    CCoinsCacheEntry& operator[](const uint256& key);
+    void erase(const_iterator it);
+    void clear();
+
+    //! heap memory held by the table and the entries, not by the coins in them
+    size_t DynamicMemoryUsage() const;
+
+private:
+    CCoinsMap(const CCoinsMap&);
+    CCoinsMap& operator=(const CCoinsMap&);
+};
 
 struct CCoinsStats {
     int nHeight;
@@ -352,6 +493,9 @@ public:
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats& stats) const;
 
+    //! Wait until everything passed to BatchWrite has reached durable storage
+    virtual bool Sync();
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 };
@@ -371,6 +515,7 @@ public:
     void SetBackend(CCoinsView& viewIn);
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+    bool Sync();
 };
 
 class CCoinsViewCache;
@@ -398,7 +543,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -421,6 +567,9 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
     ~CCoinsViewCache();
@@ -456,6 +605,9 @@ public:
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the memory used by the cache, in bytes
+    size_t DynamicMemoryUsage() const;
+
     /**
      * Amount of fdreserve coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
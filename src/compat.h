@@ -45,6 +45,12 @@
 #include <unistd.h>
 #endif
 
+// poll() has no FD_SETSIZE ceiling on the descriptors it waits for
+#if !defined(WIN32) && defined(HAVE_POLL_H)
+#define USE_POLL
+#include <poll.h>
+#endif
+
 #ifdef WIN32
 #define MSG_DONTWAIT 0
 #else
@@ -92,7 +98,7 @@ size_t strnlen_int(const char* start, size_t max_len);
 
 bool static inline IsSelectableSocket(SOCKET s)
 {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_POLL)
     return true;
 #else
     return (s < FD_SETSIZE);
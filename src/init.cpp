@@ -15,16 +15,22 @@
 #include "activemasternode.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockcache.h"
+#include "blockencodings.h"
+#include "blockpipeline.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
+#include "kernel.h"
 #include "key.h"
 #include "main.h"
 #include "masternode-payments.h"
+#include "masternode-verify.h"
 #include "masternodeconfig.h"
 #include "masternodeman.h"
 #include "miner.h"
 #include "net.h"
 #include "rpcserver.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "spork.h"
 #include "gm.h"
@@ -182,6 +188,8 @@ void PrepareShutdown()
         bitdb.Flush(false);
     GenerateBitcoins(false, NULL, 0);
 #endif
+    blockPipeline.Stop();
+    masternodeVerifyQueue.Stop();
     StopNode();
     DumpMasternodes();
     UnregisterNodeSignals(GetNodeSignals());
@@ -313,6 +321,8 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-daemon", _("Run in the background as a daemon and accept commands"));
 #endif
     }
+    strUsage += HelpMessageOpt("-blockcache=<n>", strprintf(_("Set the size in megabytes of the cache of blocks served to peers (0 to disable, default: %d)"), DEFAULT_BLOCK_CACHE));
+    strUsage += HelpMessageOpt("-blockcheckthreads=<n>", strprintf(_("Set the number of threads checking received blocks before they are connected (0 = check them on the message handler thread, max: %d, default: %d)"), MAX_BLOCK_CHECK_THREADS, DEFAULT_BLOCK_CHECK_THREADS));
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
@@ -333,6 +343,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-banscore=<n>", strprintf(_("Threshold for disconnecting misbehaving peers (default: %u)"), 100));
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), 86400));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
+    strUsage += HelpMessageOpt("-compactblocks", strprintf(_("Exchange new blocks with peers as their header and short transaction IDs (default: %u)"), DEFAULT_COMPACT_BLOCKS));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s)"));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP address (default: 1 when listening and no -externalip)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + _("(default: 1)"));
@@ -343,6 +354,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), 125));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
+    strUsage += HelpMessageOpt("-msghandthreads=<n>", strprintf(_("Set the number of threads processing the messages of peers, each peer's in the order received (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), 1));
@@ -412,7 +424,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf(_("Stop running after importing blocks from disk (default: %u)"), 0));
         strUsage += HelpMessageOpt("-sporkkey=<privkey>", _("Enable spork administration functionality with the appropriate private key."));
     }
-    string debugCategories = "addrman, alert, gm ,bench, coindb, db, lock, rand, rpc, selectcoins, mempool, net, proxy, fdreserve, (obfuscation, swiftx, masternode, mnpayments)"; // Don't translate these and qt below
+    string debugCategories = "addrman, alert, gm ,bench, coindb, db, lock, rand, rpc, selectcoins, mempool, net, proxy, staking, fdreserve, (obfuscation, swiftx, masternode, mnpayments)"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
@@ -429,7 +441,7 @@ std::string HelpMessage(HelpMessageMode mode)
     if (GetBoolArg("-help-debug", false)) {
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf(_("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default:%u)"), 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf(_("Require high priority for relaying free or low-fee transactions (default:%u)"), 1));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf(_("Limit size of signature cache to <n> entries (default: %u)"), 50000));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf(_("Limit size of signature cache to <n> bytes (default: %u)"), DEFAULT_MAX_SIG_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in fdreserve/Kb) smaller than this are considered zero fee for relaying (default: %s)"), FormatMoney(::minRelayTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-printtoconsole", strprintf(_("Send trace/debug info to console instead of debug.log file (default: %u)"), 0));
@@ -448,6 +460,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("Staking options:"));
     strUsage += HelpMessageOpt("-staking=<n>", strprintf(_("Enable staking functionality (0-1, default: %u)"), 1));
     strUsage += HelpMessageOpt("-reservebalance=<amt>", _("Keep the specified amount available for spending at all times (default: 0)"));
+    strUsage += HelpMessageOpt("-stakethreads=<n>", strprintf(_("Set the number of stake kernel search threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_STAKE_SEARCH_THREADS, DEFAULT_STAKE_SEARCH_THREADS));
     if (GetBoolArg("-help-debug", false)) {
         strUsage += HelpMessageOpt("-printstakemodifier", _("Display the stake modifier calculations in the debug.log file."));
         strUsage += HelpMessageOpt("-printcoinstake", _("Display verbose coin stake messages in the debug.log file."));
@@ -460,6 +473,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-mnconflock=<n>", strprintf(_("Lock masternodes from masternode configuration file (default: %u)"), 1));
     strUsage += HelpMessageOpt("-masternodeprivkey=<n>", _("Set the masternode private key"));
     strUsage += HelpMessageOpt("-masternodeaddr=<n>", strprintf(_("Set external address:port to get to this masternode (example: %s)"), "128.127.106.235:12474"));
+    strUsage += HelpMessageOpt("-mnverifythreads=<n>", strprintf(_("Set the number of threads verifying the signatures of received masternode broadcasts and pings (0 = verify them on the message handler thread, max: %d, default: %d)"), MAX_MASTERNODE_VERIFY_THREADS, DEFAULT_MASTERNODE_VERIFY_THREADS));
 
     strUsage += HelpMessageGroup(_("Obfuscation options:"));
     strUsage += HelpMessageOpt("-enableobfuscation=<n>", strprintf(_("Enable use of automated obfuscation for funds stored in this wallet (0-1, default: %u)"), 0));
@@ -768,9 +782,12 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
 
     // Make sure enough file descriptors are available
-    int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", 125);
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+#ifndef USE_POLL
+    int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
+    nMaxConnections = std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS));
+#endif
+    nMaxConnections = std::max(nMaxConnections, 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -812,6 +829,15 @@ bool AppInit2(boost::thread_group& threadGroup)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // -stakethreads works like -par, nStakeSearchThreads<=1 searches on the minter thread only
+    nStakeSearchThreads = GetArg("-stakethreads", DEFAULT_STAKE_SEARCH_THREADS);
+    if (nStakeSearchThreads <= 0)
+        nStakeSearchThreads += boost::thread::hardware_concurrency();
+    if (nStakeSearchThreads <= 1)
+        nStakeSearchThreads = 0;
+    else if (nStakeSearchThreads > MAX_STAKE_SEARCH_THREADS)
+        nStakeSearchThreads = MAX_STAKE_SEARCH_THREADS;
+
     fServer = GetBoolArg("-server", false);
     setvbuf(stdout, NULL, _IOLBF, 0); /// ***TODO*** do we still need this after -printtoconsole is gone?
 
@@ -892,6 +918,8 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     if (GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices |= NODE_BLOOM;
+    if (GetBoolArg("-compactblocks", DEFAULT_COMPACT_BLOCKS))
+        nLocalServices |= NODE_COMPACT_BLOCKS;
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
@@ -1246,7 +1274,10 @@ bool AppInit2(boost::thread_group& threadGroup)
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache; // the in-memory coins cache accounts its real usage in bytes
+
+    // serialized blocks kept to serve peers, on top of the database caches
+    blockCache.SetMaxBytes((size_t)std::max((int64_t)0, GetArg("-blockcache", DEFAULT_BLOCK_CACHE)) << 20);
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1266,6 +1297,7 @@ bool AppInit2(boost::thread_group& threadGroup)
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
+                pcoinsdbview->StartWriter();
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
@@ -1506,6 +1538,10 @@ bool AppInit2(boost::thread_group& threadGroup)
         else
             LogPrintf("file format is unknown or invalid, please fix it manually\n");
     }
+    {
+        LOCK(cs_main);
+        mnodeman.WatchCollaterals();
+    }
 
     fMasterNode = GetBoolArg("-masternode", false);
 
@@ -1633,6 +1669,20 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("mapAddressBook.size() = %u\n", pwalletMain ? pwalletMain->mapAddressBook.size() : 0);
 #endif
 
+    int nBlockCheckThreads = GetArg("-blockcheckthreads", DEFAULT_BLOCK_CHECK_THREADS);
+    if (nBlockCheckThreads > 0) {
+        nBlockCheckThreads = std::min(nBlockCheckThreads, MAX_BLOCK_CHECK_THREADS);
+        LogPrintf("Using %d threads to check received blocks\n", nBlockCheckThreads);
+        blockPipeline.Start(threadGroup, nBlockCheckThreads);
+    }
+
+    int nMasternodeVerifyThreads = GetArg("-mnverifythreads", DEFAULT_MASTERNODE_VERIFY_THREADS);
+    if (!fLiteMode && nMasternodeVerifyThreads > 0) {
+        nMasternodeVerifyThreads = std::min(nMasternodeVerifyThreads, MAX_MASTERNODE_VERIFY_THREADS);
+        LogPrintf("Using %d threads to verify masternode messages\n", nMasternodeVerifyThreads);
+        masternodeVerifyQueue.Start(threadGroup, nMasternodeVerifyThreads);
+    }
+
     StartNode(threadGroup);
 
 #ifdef ENABLE_WALLET
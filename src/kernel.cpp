@@ -8,12 +8,15 @@
 #include <boost/assign/list_of.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include "checkqueue.h"
+#include "crypto/common.h"
 #include "db.h"
 #include "kernel.h"
 #include "spork.h"
 #include "script/interpreter.h"
 #include "timedata.h"
 #include "util.h"
+#include "utiltime.h"
 
 using namespace std;
 
@@ -371,6 +374,203 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
     return fSuccess;
 }
 
+int nStakeSearchThreads = 0;
+
+//! number of inputs handed to a stake search worker at a time
+static const size_t STAKE_SEARCH_CHUNK = 16;
+
+bool GetStakeKernelInput(const uint256& hashBlockFrom, const COutPoint& prevout, int64_t nValueIn, CStakeKernelInput& input)
+{
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlockFrom);
+    if (mi == mapBlockIndex.end() || !mi->second)
+        return false;
+
+    uint64_t nStakeModifier = 0;
+    int nStakeModifierHeight = 0;
+    int64_t nStakeModifierTime = 0;
+    if (!GetKernelStakeModifier(hashBlockFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false, 0))
+        return false;
+
+    input.prevout = prevout;
+    input.nValueIn = nValueIn;
+    input.nTimeBlockFrom = mi->second->GetBlockTime();
+
+    // same layout as stakeHash(), with the timestamp left to be filled in
+    CDataStream ss(SER_GETHASH, 0);
+    ss << nStakeModifier << input.nTimeBlockFrom << prevout.n << prevout.hash << (unsigned int)0;
+    assert(ss.size() == sizeof(input.vchKernel));
+    memcpy(input.vchKernel, &ss[0], sizeof(input.vchKernel));
+    return true;
+}
+
+/** Shared state of a running stake kernel search */
+class CStakeKernelSearch
+{
+public:
+    CCriticalSection cs;
+    CStakeKernelResult result;
+    uint64_t nHashes;
+
+    CStakeKernelSearch() : nHashes(0) {}
+
+    //! whether a kernel at an index lower than nIndex has already been found
+    bool Found(int nIndex)
+    {
+        LOCK(cs);
+        return result.nIndex >= 0 && result.nIndex < nIndex;
+    }
+};
+
+/**
+ * A range of stake inputs to search, run on the stake search threads
+ * through a CCheckQueue. The queue result is unused: hits go to the shared
+ * CStakeKernelSearch, which keeps the one with the lowest input index.
+ */
+class CStakeKernelCheck
+{
+private:
+    const std::vector<CStakeKernelInput>* pvInputs;
+    int nBegin;
+    int nEnd;
+    uint256 bnTargetPerCoinDay;
+    unsigned int nTimeTx;
+    unsigned int nHashDrift;
+    unsigned int nTimeMin;
+    int nHeightStart;
+    CStakeKernelSearch* psearch;
+
+public:
+    CStakeKernelCheck() : pvInputs(NULL), nBegin(0), nEnd(0), nTimeTx(0), nHashDrift(0), nTimeMin(0), nHeightStart(0), psearch(NULL) {}
+    CStakeKernelCheck(const std::vector<CStakeKernelInput>& vInputsIn, int nBeginIn, int nEndIn, const uint256& bnTargetPerCoinDayIn, unsigned int nTimeTxIn, unsigned int nHashDriftIn, unsigned int nTimeMinIn, int nHeightStartIn, CStakeKernelSearch& search) : pvInputs(&vInputsIn), nBegin(nBeginIn), nEnd(nEndIn), bnTargetPerCoinDay(bnTargetPerCoinDayIn), nTimeTx(nTimeTxIn), nHashDrift(nHashDriftIn), nTimeMin(nTimeMinIn), nHeightStart(nHeightStartIn), psearch(&search) {}
+
+    bool operator()()
+    {
+        uint64_t nHashes = 0;
+        for (int i = nBegin; i < nEnd; i++) {
+            //new block came in or an earlier kernel was found, move on
+            if (chainActive.Height() != nHeightStart || psearch->Found(i))
+                break;
+
+            const CStakeKernelInput& input = (*pvInputs)[i];
+            if (nTimeTx < input.nTimeBlockFrom || input.nTimeBlockFrom + nStakeMinAge > nTimeTx)
+                continue;
+
+            uint256 bnTarget = uint256(input.nValueIn) / 100 * bnTargetPerCoinDay;
+            unsigned char vchKernel[sizeof(input.vchKernel)];
+            memcpy(vchKernel, input.vchKernel, sizeof(vchKernel));
+            for (unsigned int n = 0; n < nHashDrift; n++) {
+                unsigned int nTryTime = nTimeTx + nHashDrift - n;
+                if (nTryTime <= nTimeMin)
+                    break;
+                WriteLE32(vchKernel + sizeof(vchKernel) - 4, nTryTime);
+                uint256 hashProofOfStake = Hash(vchKernel, vchKernel + sizeof(vchKernel));
+                nHashes++;
+                if (hashProofOfStake < bnTarget) {
+                    LOCK(psearch->cs);
+                    psearch->nHashes += nHashes;
+                    if (psearch->result.nIndex < 0 || i < psearch->result.nIndex) {
+                        psearch->result.nIndex = i;
+                        psearch->result.nTime = nTryTime;
+                        psearch->result.hashProofOfStake = hashProofOfStake;
+                    }
+                    return true;
+                }
+            }
+        }
+        LOCK(psearch->cs);
+        psearch->nHashes += nHashes;
+        return true;
+    }
+
+    void swap(CStakeKernelCheck& check)
+    {
+        std::swap(pvInputs, check.pvInputs);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+        std::swap(bnTargetPerCoinDay, check.bnTargetPerCoinDay);
+        std::swap(nTimeTx, check.nTimeTx);
+        std::swap(nHashDrift, check.nHashDrift);
+        std::swap(nTimeMin, check.nTimeMin);
+        std::swap(nHeightStart, check.nHeightStart);
+        std::swap(psearch, check.psearch);
+    }
+};
+
+static CCheckQueue<CStakeKernelCheck> stakesearchqueue(4);
+static CCriticalSection cs_stakesearch;
+static CCriticalSection cs_stakesearchstats;
+static uint64_t nStakeSearchHashes = 0;
+static double dStakeSearchRate = 0;
+
+void ThreadStakeSearch()
+{
+    RenameThread("fdreserve-stakesearch");
+    stakesearchqueue.Thread();
+}
+
+bool SearchStakeKernel(const std::vector<CStakeKernelInput>& vInputs, unsigned int nBits, unsigned int nTimeTx, unsigned int nHashDrift, unsigned int nTimeMin, CStakeKernelResult& result)
+{
+    // the queue serves one search at a time
+    LOCK(cs_stakesearch);
+
+    int64_t nStart = GetTimeMicros();
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    CStakeKernelSearch search;
+
+    // the check queue is worked as a stack, so queue the lowest inputs last to search them first
+    std::vector<CStakeKernelCheck> vChecks;
+    for (int nEnd = vInputs.size(); nEnd > 0;) {
+        int nBegin = std::max(0, nEnd - (int)STAKE_SEARCH_CHUNK);
+        vChecks.push_back(CStakeKernelCheck(vInputs, nBegin, nEnd, bnTargetPerCoinDay, nTimeTx, nHashDrift, nTimeMin, chainActive.Height(), search));
+        nEnd = nBegin;
+    }
+
+    if (nStakeSearchThreads > 1) {
+        CCheckQueueControl<CStakeKernelCheck> control(&stakesearchqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (std::vector<CStakeKernelCheck>::reverse_iterator it = vChecks.rbegin(); it != vChecks.rend(); ++it)
+            (*it)();
+    }
+
+    int64_t nElapsed = GetTimeMicros() - nStart;
+    {
+        LOCK(cs_stakesearchstats);
+        nStakeSearchHashes += search.nHashes;
+        dStakeSearchRate = nElapsed > 0 ? 1000000.0 * search.nHashes / nElapsed : 0;
+    }
+    LogPrint("staking", "SearchStakeKernel() : %u inputs, %u hashes in %.2fms\n", vInputs.size(), search.nHashes, 0.001 * nElapsed);
+
+    if (!vInputs.empty()) {
+        mapHashedBlocks.clear();
+        mapHashedBlocks[chainActive.Tip()->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
+    }
+
+    result = search.result;
+    if (result.nIndex < 0)
+        return false;
+
+    if (fDebug || GetBoolArg("-printcoinstake", false))
+        LogPrintf("SearchStakeKernel() : pass nTimeBlockFrom=%u prevout=%s nTimeTx=%u hashProof=%s\n",
+            vInputs[result.nIndex].nTimeBlockFrom, vInputs[result.nIndex].prevout.ToString(), result.nTime,
+            result.hashProofOfStake.ToString());
+    return true;
+}
+
+double GetStakeSearchRate()
+{
+    LOCK(cs_stakesearchstats);
+    return dStakeSearchRate;
+}
+
+uint64_t GetStakeSearchHashes()
+{
+    LOCK(cs_stakesearchstats);
+    return nStakeSearchHashes;
+}
+
 // Check kernel hash target and coinstake signature
 bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
 {
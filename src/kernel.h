@@ -27,6 +27,45 @@ uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutInde
 bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
 bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
 
+// Stake kernel search
+static const int MAX_STAKE_SEARCH_THREADS = 16;
+static const int DEFAULT_STAKE_SEARCH_THREADS = 0;
+extern int nStakeSearchThreads;
+
+/** Per-coin constants of a stake kernel, resolved once per chain tip */
+struct CStakeKernelInput {
+    COutPoint prevout;
+    int64_t nValueIn;
+    unsigned int nTimeBlockFrom;
+    //! serialized kernel (modifier, block time, prevout), the trailing 4 bytes hold the tried timestamp
+    unsigned char vchKernel[52];
+};
+
+/** Outcome of a stake kernel search */
+struct CStakeKernelResult {
+    //! index of the kernel in the searched inputs, or -1 if none was found
+    int nIndex;
+    unsigned int nTime;
+    uint256 hashProofOfStake;
+
+    CStakeKernelResult() : nIndex(-1), nTime(0), hashProofOfStake(0) {}
+};
+
+// Resolve the per-coin kernel constants for an output of a transaction in block hashBlockFrom
+bool GetStakeKernelInput(const uint256& hashBlockFrom, const COutPoint& prevout, int64_t nValueIn, CStakeKernelInput& input);
+
+// Search the timestamp x coin grid of vInputs on the stake search threads.
+// Returns the kernel the sequential search would find first: the lowest input
+// index, at the latest timestamp in (nTimeMin, nTimeTx + nHashDrift].
+bool SearchStakeKernel(const std::vector<CStakeKernelInput>& vInputs, unsigned int nBits, unsigned int nTimeTx, unsigned int nHashDrift, unsigned int nTimeMin, CStakeKernelResult& result);
+
+// Run a stake kernel search worker
+void ThreadStakeSearch();
+
+// Kernel hashes per second over the last stake search
+double GetStakeSearchRate();
+uint64_t GetStakeSearchHashes();
+
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
 bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake);
@@ -10,6 +10,9 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blockcache.h"
+#include "blockencodings.h"
+#include "blockpipeline.h"
 #include "gm.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -30,6 +33,7 @@
 #include "util.h"
 #include "utilmoneystr.h"
 
+#include <algorithm>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -69,7 +73,7 @@ bool fReindex = false;
 bool fTxIndex = true;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 bool fGM = DEFAULT_GM;
 
@@ -189,6 +193,8 @@ set<int> setDirtyFileInfo;
 namespace
 {
 struct CMainSignals {
+    /** Notifies listeners of updated block chain tip */
+    boost::signals2::signal<void(const CBlockIndex*)> UpdatedBlockTip;
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void(const CTransaction&, const CBlock*)> SyncTransaction;
     /** Notifies listeners of an erased transaction (currently disabled, requires transaction replacement). */
@@ -209,6 +215,7 @@ struct CMainSignals {
 
 void RegisterValidationInterface(CValidationInterface* pwalletIn)
 {
+    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
     // XX42 g_signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
     g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
@@ -227,6 +234,7 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn)
     g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     // XX42    g_signals.EraseTransaction.disconnect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
     g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
+    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
 }
 
 void UnregisterAllValidationInterfaces()
@@ -238,6 +246,7 @@ void UnregisterAllValidationInterfaces()
     g_signals.UpdatedTransaction.disconnect_all_slots();
     // XX42    g_signals.EraseTransaction.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
+    g_signals.UpdatedBlockTip.disconnect_all_slots();
 }
 
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock)
@@ -363,6 +372,10 @@ struct CNodeState {
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Blocks asked for from this peer in compact form and not received yet
+    std::set<uint256> setCompactBlocksAsked;
+    //! A compact block from this peer waiting for the transactions asked for with getblocktxn
+    std::shared_ptr<CPartiallyDownloadedBlock> partialBlock;
 
     CNodeBlocks nodeBlocks;
 
@@ -384,6 +397,9 @@ struct CNodeState {
 /** Map maintaining per-node state. Requires cs_main. */
 map<NodeId, CNodeState> mapNodeState;
 
+CCriticalSection cs_compactBlockStats;
+CCompactBlockStats compactBlockStats;
+
 // Requires cs_main.
 CNodeState* State(NodeId pnode)
 {
@@ -630,6 +646,12 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats)
     return true;
 }
 
+void GetCompactBlockStats(CCompactBlockStats& stats)
+{
+    LOCK(cs_compactBlockStats);
+    stats = compactBlockStats;
+}
+
 void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.GetHeight.connect(&GetHeight);
@@ -1047,7 +1069,7 @@ bool MoneyRange(CAmount nValueOut)
     return nValueOut >= 0 && nValueOut <= Params().MaxMoneyOut();
 }
 
-bool CheckTransaction(const CTransaction& tx, CValidationState& state, const int64_t nBlockTime)
+bool CheckTransaction(const CTransaction& tx, CValidationState& state)
 {
     // Basic checks that don't depend on any context
     if (tx.vin.empty())
@@ -1101,44 +1123,25 @@ bool CheckTransaction(const CTransaction& tx, CValidationState& state, const int
                     REJECT_INVALID, "bad-txns-prevout-null");
     }
 
-    // Check tx filter
-    if (!IsInitialBlockDownload()) {
-         if (!CheckTxFilter(tx, nBlockTime)) {
-            return state.DoS(100, error("CheckTransaction() : filtered address detected"),
-                             REJECT_INVALID, "filtered-address");
-         }
-     }
-
     return true;
 }
 
-bool CheckTxFilter(const CTransaction& tx, const int64_t nBlockTime)
+bool CheckTxFilter(const CTransaction& tx, const CCoinsViewCache& view, const int64_t nBlockTime)
 {
     if (nBlockTime != 0 && nBlockTime < GetAdjustedTime() - 24 * 60 * 60)
         return true;
     // Check if they are filtered spender in the current tx
-    if (!mapFilterAddress.empty()) {
-        CTransaction prevoutTx;
-        uint256 prevoutHashBlock;
-        txnouttype txType;
-        vector<CTxDestination> vDest;
-        CBitcoinAddress Address;
-        int nRequiredRet;
+    if (!mapFilterDestination.empty() && !tx.IsCoinBase()) {
+        CTxDestination dest;
         for (const CTxIn& txin : tx.vin) {
-            if (!GetTransaction(txin.prevout.hash, prevoutTx, prevoutHashBlock))
-                continue;
-            if (!ExtractDestinations(prevoutTx.vout[txin.prevout.n].scriptPubKey, txType, vDest, nRequiredRet))
+            // inputs that are not in the view are not known yet, they get checked once connected
+            const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+            if (!coins || !coins->IsAvailable(txin.prevout.n))
                 continue;
-            for (const CTxDestination& txDest : vDest) {
-                Address.Set(txDest);
-                auto it = mapFilterAddress.find(Address);
-                if (it != mapFilterAddress.end()) {
-                    if (nBlockTime == 0 || nBlockTime > (*it).second) {
-                        LogPrintf("CheckTxFilter(): Tx %s contains the filtered "
-                                  "address %s\n", tx.GetHash().ToString(), Address.ToString());
-                        return false;
-                    }
-                }
+            if (IsTxFilterScript(coins->vout[txin.prevout.n].scriptPubKey, nBlockTime, dest)) {
+                LogPrintf("CheckTxFilter(): Tx %s contains the filtered "
+                          "address %s\n", tx.GetHash().ToString(), CBitcoinAddress(dest).ToString());
+                return false;
             }
         }
     }
@@ -1300,6 +1303,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
             view.SetBackend(dummy);
         }
 
+        // Check tx filter
+        if (!IsInitialBlockDownload() && !CheckTxFilter(tx, view, 0))
+            return state.DoS(100, error("AcceptToMemoryPool : filtered address detected"),
+                REJECT_INVALID, "filtered-address");
+
         // Check for non-standard pay-to-script-hash in inputs
         if (Params().RequireStandard() && !AreInputsStandard(tx, view))
             return error("AcceptToMemoryPool: : nonstandard transaction input");
@@ -1488,6 +1496,11 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
             view.SetBackend(dummy);
         }
 
+        // Check tx filter
+        if (!IsInitialBlockDownload() && !CheckTxFilter(tx, view, 0))
+            return state.DoS(100, error("AcceptableInputs : filtered address detected"),
+                REJECT_INVALID, "filtered-address");
+
         // Check for non-standard pay-to-script-hash in inputs
         // for any real tx this will be checked on AcceptToMemoryPool anyway
         //        if (Params().RequireStandard() && !AreInputsStandard(tx, view))
@@ -1716,6 +1729,44 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CBlockIndex* pindex)
+{
+    // The block follows the message start and its size, see WriteBlockToDisk
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s : bad position %u in file %d", __func__, pos.nPos, pos.nFile);
+    pos.nPos -= MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : OpenBlockFile failed", __func__);
+
+    try {
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        unsigned int nSize;
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0 || nSize > MAX_BLOCK_SIZE)
+            return error("%s : bad index header at %u in file %d", __func__, pos.nPos, pos.nFile);
+        vchBlock.resize(nSize);
+        filein.read(begin_ptr(vchBlock), nSize);
+    } catch (std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+
+    // The header is all it takes to tell the block apart
+    CBlockHeader header;
+    try {
+        CDataStream ss(begin_ptr(vchBlock), begin_ptr(vchBlock) + std::min(vchBlock.size(), (size_t)256), SER_DISK, CLIENT_VERSION);
+        ss >> header;
+    } catch (std::exception& e) {
+        return error("%s : Deserialize error - %s", __func__, e.what());
+    }
+    if (header.GetHash() != pindex->GetBlockHash())
+        return error("%s : GetHash() doesn't match index", __func__);
+
+    return true;
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -2294,6 +2345,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 return state.DoS(100, error("ConnectBlock() : inputs missing/spent"),
                     REJECT_INVALID, "bad-txns-inputs-missingorspent");
 
+            if (!IsInitialBlockDownload() && !CheckTxFilter(tx, view, block.GetBlockTime()))
+                return state.DoS(100, error("ConnectBlock() : filtered address detected"),
+                    REJECT_INVALID, "filtered-address");
+
             // BIP16
             // Add in sigops done by pay-to-script-hash inputs;
             // this is to prevent a "rogue miner" from creating
@@ -2329,9 +2384,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     pindex->nMoneySupply = nMoneySupplyPrev + nValueOut - nValueIn;
     pindex->nMint = pindex->nMoneySupply - nMoneySupplyPrev;
 
-    if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)))
-        return error("Connect() : WriteBlockIndex for pindex failed");
-
     int64_t nTime1 = GetTimeMicros();
     nTimeConnect += nTime1 - nTimeStart;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs - 1), nTimeConnect * 0.000001);
@@ -2357,6 +2409,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (fJustCheck)
         return true;
 
+    if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)))
+        return error("Connect() : WriteBlockIndex for pindex failed");
+
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
         if (pindex->GetUndoPos().IsNull()) {
@@ -2438,7 +2493,7 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
     static int64_t nLastWrite = 0;
     try {
         if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
             // Typical CCoins structures on disk are around 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
@@ -2469,6 +2524,7 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             }
             pblocktree->Sync();
             // Finally flush the chainstate (which may refer to block index entries).
+            // The coin database commits it in the background.
             if (!pcoinsTip->Flush())
                 return state.Abort("Failed to write to coin database");
             // Update best block in wallet (so we can detect restored wallets).
@@ -2486,7 +2542,12 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
 void FlushStateToDisk()
 {
     CValidationState state;
-    FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
+    if (FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        // callers (shutdown, gettxoutsetinfo) expect the chainstate to be on disk on return
+        LOCK(cs_main);
+        if (!pcoinsTip->Sync())
+            state.Abort("Failed to write to coin database");
+    }
 }
 
 /** Update chainActive and related internal data structures. */
@@ -2498,10 +2559,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-        Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+        Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2549,22 +2610,30 @@ bool static DisconnectTip(CValidationState& state)
     if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
         return false;
     // Resurrect mempool transactions from the disconnected block.
+    list<CTransaction> txConflicted;
     for (const CTransaction& tx : block.vtx) {
         // ignore validation errors in resurrected transactions
         list<CTransaction> removed;
         CValidationState stateDummy;
         if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
             mempool.remove(tx, removed, true);
+        txConflicted.splice(txConflicted.end(), removed);
     }
-    mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
+    mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight, txConflicted);
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
+    blockHashCache.BlockDisconnected(pindexDelete);
+    collateralWatch.BlockDisconnected(block);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     for (const CTransaction& tx : block.vtx) {
         SyncWithWallets(tx, NULL);
     }
+    // ... and about the spends of them that went from mempool to conflicted:
+    for (const CTransaction& tx : txConflicted) {
+        SyncWithWallets(tx, NULL);
+    }
     return true;
 }
 
@@ -2632,6 +2701,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    collateralWatch.BlockConnected(*pblock);
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     for (const CTransaction& tx : txConflicted) {
@@ -2922,6 +2992,7 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock)
                         pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
             }
             // Notify external listeners about the new tip.
+            g_signals.UpdatedBlockTip(pindexNewTip);
             uiInterface.NotifyBlockTip(hashNewTip);
         }
     } while (pindexMostWork != chainActive.Tip());
@@ -3208,10 +3279,13 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig)
+bool CheckBlockContextFree(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
 
+    if (block.fChecked)
+        return true;
+
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
     if (!CheckBlockHeader(block, state, fCheckPOW && block.IsProofOfWork()))
@@ -3273,6 +3347,31 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
             if (block.vtx[i].IsCoinStake())
                 return state.DoS(100, error("CheckBlock() : more than one coinstake"));
     }
+
+    // Check transactions
+    for (const CTransaction& tx : block.vtx)
+        if (!CheckTransaction(tx, state))
+            return error("CheckBlock() : CheckTransaction failed");
+
+    unsigned int nSigOps = 0;
+    for (const CTransaction& tx : block.vtx) {
+        nSigOps += GetLegacySigOpCount(tx);
+    }
+    if (nSigOps > MAX_BLOCK_SIGOPS)
+        return state.DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"),
+            REJECT_INVALID, "bad-blk-sigops", true);
+
+    if (fCheckPOW && fCheckMerkleRoot)
+        block.fChecked = true;
+
+    return true;
+}
+
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig)
+{
+    if (!CheckBlockContextFree(block, state, fCheckPOW, fCheckMerkleRoot))
+        return false;
+
     // ----------- swiftTX transaction scanning -----------
     if (IsSporkActive(SPORK_2_SWIFTTX_BLOCK_FILTERING)) {
         for (const CTransaction& tx : block.vtx) {
@@ -3322,19 +3421,6 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         }
     }
 
-    // Check transactions
-    for (const CTransaction& tx : block.vtx)
-        if (!CheckTransaction(tx, state, block.GetBlockTime()))
-            return error("CheckBlock() : CheckTransaction failed");
-
-    unsigned int nSigOps = 0;
-    for (const CTransaction& tx : block.vtx) {
-        nSigOps += GetLegacySigOpCount(tx);
-    }
-    if (nSigOps > MAX_BLOCK_SIGOPS)
-        return state.DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"),
-            REJECT_INVALID, "bad-blk-sigops", true);
-
     return true;
 }
 
@@ -3772,11 +3858,11 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
-bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp)
+bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp, bool fSignatureChecked)
 {
     // Preliminary checks
     int64_t nStartTime = GetTimeMillis();
-    bool checked = CheckBlock(*pblock, state);
+    bool checked = CheckBlockContextFree(*pblock, state);
 
     // ppcoin: check proof-of-stake
     // Limited duplicity on stake: prevents block flood attack
@@ -3785,7 +3871,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     //    return error("ProcessNewBlock() : duplicate proof-of-stake (%s, %d) for block %s", pblock->GetProofOfStake().first.ToString().c_str(), pblock->GetProofOfStake().second, pblock->GetHash().ToString().c_str());
 
     // NovaCoin: check proof-of-stake block signature
-    if (!pblock->CheckBlockSignature())
+    if (!fSignatureChecked && !pblock->CheckBlockSignature())
         return error("ProcessNewBlock() : bad proof-of-stake block signature");
 
     if (pblock->GetHash() != Params().HashGenesisBlock() && pfrom != NULL) {
@@ -3802,6 +3888,9 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
         LOCK(cs_main); // Replaces the former TRY_LOCK loop because busy waiting wastes too much resources
 
         MarkBlockAsReceived(pblock->GetHash());
+        // transaction locks and masternode payments
+        if (checked)
+            checked = CheckBlock(*pblock, state);
         if (!checked) {
             return error("%s : CheckBlock FAILED for block %s", __func__, pblock->GetHash().GetHex());
         }
@@ -3894,6 +3983,21 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     return true;
 }
 
+void ProcessReceivedBlock(CNode* pfrom, CBlock& block, bool fSignatureChecked)
+{
+    CValidationState state;
+    ProcessNewBlock(state, pfrom, &block, NULL, fSignatureChecked);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", std::string("block"), state.GetRejectCode(),
+            state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            TRY_LOCK(cs_main, lockMain);
+            if (lockMain) Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
 bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex* const pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     AssertLockHeld(cs_main);
@@ -3983,6 +4087,25 @@ boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos& pos, const char
     return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
 }
 
+//! Entries allocated in blocks by AllocateBlockIndexArena, with the number of entries in each
+static std::vector<std::pair<CBlockIndex*, size_t> > vBlockIndexArenas;
+
+CBlockIndex* AllocateBlockIndexArena(size_t nSize)
+{
+    CBlockIndex* pindexArena = new CBlockIndex[nSize];
+    vBlockIndexArenas.push_back(std::make_pair(pindexArena, nSize));
+    return pindexArena;
+}
+
+static bool IsInBlockIndexArena(const CBlockIndex* pindex)
+{
+    for (const PAIRTYPE(CBlockIndex*, size_t) & arena : vBlockIndexArenas) {
+        if (!std::less<const CBlockIndex*>()(pindex, arena.first) && std::less<const CBlockIndex*>()(pindex, arena.first + arena.second))
+            return true;
+    }
+    return false;
+}
+
 CBlockIndex* InsertBlockIndex(uint256 hash)
 {
     if (hash == 0)
@@ -4010,12 +4133,14 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
 
 bool static LoadBlockIndexDB()
 {
+    int64_t nStart = GetTimeMicros();
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
 
     boost::this_thread::interruption_point();
 
     // Calculate nChainWork
+    int64_t nTime1 = GetTimeMicros();
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     for (const PAIRTYPE(uint256, CBlockIndex*) & item : mapBlockIndex) {
@@ -4023,6 +4148,8 @@ bool static LoadBlockIndexDB()
         vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
     }
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    int64_t nTime2 = GetTimeMicros();
+    blockIndexLoadStats.nSortMicros = nTime2 - nTime1;
     for (const PAIRTYPE(int, CBlockIndex*) & item : vSortedByHeight) {
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
@@ -4047,6 +4174,8 @@ bool static LoadBlockIndexDB()
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    int64_t nTime3 = GetTimeMicros();
+    blockIndexLoadStats.nChainWorkMicros = nTime3 - nTime2;
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -4080,6 +4209,15 @@ bool static LoadBlockIndexDB()
             return false;
         }
     }
+    int64_t nTime4 = GetTimeMicros();
+    blockIndexLoadStats.nFileInfoMicros = nTime4 - nTime3;
+    blockIndexLoadStats.nTotalMicros = nTime4 - nStart;
+    LogPrintf("%s: loaded %u block index entries in %.2fms (read %.2fms, decode %.2fms on %d threads, insert %.2fms, link %.2fms, "
+              "sort %.2fms, chain work %.2fms, block files %.2fms)\n", __func__,
+        blockIndexLoadStats.nEntries, 0.001 * blockIndexLoadStats.nTotalMicros, 0.001 * blockIndexLoadStats.nReadMicros,
+        0.001 * blockIndexLoadStats.nDecodeMicros, blockIndexLoadStats.nThreads, 0.001 * blockIndexLoadStats.nInsertMicros,
+        0.001 * blockIndexLoadStats.nLinkMicros, 0.001 * blockIndexLoadStats.nSortMicros,
+        0.001 * blockIndexLoadStats.nChainWorkMicros, 0.001 * blockIndexLoadStats.nFileInfoMicros);
 
     //Check if the shutdown procedure was followed on last client exit
     bool fLastShutdownWasPrepared = true;
@@ -4243,7 +4381,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -4664,7 +4802,8 @@ bool static AlreadyHave(const CInv& inv)
         }
         return false;
     case MSG_MASTERNODE_ANNOUNCE:
-        if (mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
+        // a masternode listed from this broadcast needs nothing more, as after a restart with mncache.dat
+        if (mnodeman.mapSeenMasternodeBroadcast.count(inv.hash) || mnodeman.HaveBroadcast(inv.hash)) {
             masternodeSync.AddedMasternodeList(inv.hash);
             return true;
         }
@@ -4677,6 +4816,13 @@ bool static AlreadyHave(const CInv& inv)
 }
 
 
+// The block a "block" message from the block cache holds
+static void UnserializeBlockMessage(const CSerializeData& data, CBlock& block)
+{
+    CDataStream ssBlock(&data[CMessageHeader::HEADER_SIZE], &data[0] + data.size(), SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock >> block;
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -4693,13 +4839,17 @@ void static ProcessGetData(CNode* pfrom)
         boost::this_thread::interruption_point();
         it++;
 
-        if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+        if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
 
-            CBlock block;
             bool   send = false;
+            bool fCompact = false;
+            CBlockIndex* pindex = NULL;
+            uint256 hashTip;
 
             {
                 LOCK(cs_main);
+                // the tip moves as blocks connect, outside of the serialized messages
+                hashTip = chainActive.Tip()->GetBlockHash();
 
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
 
@@ -4720,23 +4870,35 @@ void static ProcessGetData(CNode* pfrom)
 
                     // Don't send not-validated blocks
                     send = send && (mi->second->nStatus & BLOCK_HAVE_DATA);
-
-                    if(send) {
-
-                        // Send block from disk
-                        if (!ReadBlockFromDisk(block, mi->second))
-                            assert(!"cannot load block from disk");
-                    }
+                    pindex = mi->second;
+                    // blocks deep below the tip are sent whole, the peer unlikely to have their transactions
+                    fCompact = inv.type == MSG_CMPCT_BLOCK && chainActive.Height() - pindex->nHeight <= MAX_COMPACT_BLOCK_DEPTH;
                 }
             }
 
+            // Send block from the cache or disk. Block files are never pruned, so
+            // the block stays where its index points once it has data, and the
+            // other peers need not wait for cs_main while it is read.
+            CMessageDataRef blockData;
+            if (send && !(blockData = blockCache.Get(pindex)))
+                assert(!"cannot load block from disk");
+
             if(send) {
-                if (inv.type == MSG_BLOCK)
-                    pfrom->PushMessage("block", block);
+                if (inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fCompact))
+                    pfrom->PushMessageData(blockData);
+                else if (inv.type == MSG_CMPCT_BLOCK) {
+                    CBlock block;
+                    UnserializeBlockMessage(*blockData, block);
+                    pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+                    LOCK(cs_compactBlockStats);
+                    compactBlockStats.nServed++;
+                }
                 else // MSG_FILTERED_BLOCK)
                 {
                     LOCK(pfrom->cs_filter);
                     if (pfrom->pfilter) {
+                        CBlock block;
+                        UnserializeBlockMessage(*blockData, block);
                         CMerkleBlock merkleBlock(block, *pfrom->pfilter);
                         pfrom->PushMessage("merkleblock", merkleBlock);
                         // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
@@ -4760,7 +4922,7 @@ void static ProcessGetData(CNode* pfrom)
                     // and we want it right after the last block so they don't
                     // wait for other stuff first.
                     vector<CInv> vInv;
-                    vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                    vInv.push_back(CInv(MSG_BLOCK, hashTip));
                     pfrom->PushMessage("inv", vInv);
                     pfrom->hashContinue = 0;
                 }
@@ -4770,9 +4932,9 @@ void static ProcessGetData(CNode* pfrom)
             bool pushed = false;
             {
                 LOCK(cs_mapRelay);
-                map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                map<CInv, CMessageDataRef>::iterator mi = mapRelay.find(inv);
                 if (mi != mapRelay.end()) {
-                    pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                    pfrom->PushMessageData((*mi).second);
                     pushed = true;
                 }
             }
@@ -4886,6 +5048,57 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+// Hand a block rebuilt from a compact block on like one received whole
+static void ProcessReconstructedBlock(CNode* pfrom, CBlock& block)
+{
+    const uint256 hashBlock = block.GetHash();
+    size_t nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    {
+        LOCK(cs_compactBlockStats);
+        compactBlockStats.nBlockBytes += nSize;
+    }
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hashBlock) || blockPipeline.Contains(hashBlock)) {
+            LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, hashBlock.GetHex());
+            return;
+        }
+    }
+    if (!blockPipeline.Submit(pfrom, block, nSize))
+        ProcessReceivedBlock(pfrom, block, false);
+}
+
+// Ask for a block whole once its compact form could not be used; requires cs_main
+static void RequestFullBlock(CNode* pfrom, const uint256& hashBlock)
+{
+    pfrom->PushMessage("getdata", std::vector<CInv>(1, CInv(MSG_BLOCK, hashBlock)));
+    LOCK(cs_compactBlockStats);
+    compactBlockStats.nFallbacks++;
+}
+
+// The checks of a compact block's header that need none of the transactions looked up for it:
+// the proof of work, or the signature by the key of the coinstake, which is always sent whole
+static bool CheckCompactBlockHeader(const CBlockHeaderAndShortTxIDs& cmpctblock, CValidationState& state)
+{
+    CBlock block(cmpctblock.header);
+    for (size_t i = 0; i < cmpctblock.vPrefilledTx.size() && i < 2 && cmpctblock.vPrefilledIndexes[i] == i; i++)
+        block.vtx.push_back(cmpctblock.vPrefilledTx[i]);
+    block.vchBlockSig = cmpctblock.vchBlockSig;
+
+    if (!CheckBlockHeader(block, state, block.IsProofOfWork()))
+        return false;
+
+    if (block.GetBlockTime() > GetAdjustedTime() + (block.IsProofOfStake() ? 180 : 7200))
+        return state.Invalid(error("%s : block timestamp too far in the future", __func__),
+            REJECT_INVALID, "time-too-new");
+
+    if (!block.CheckBlockSignature())
+        return state.DoS(100, error("%s : bad block signature", __func__),
+            REJECT_INVALID, "bad-signature");
+
+    return true;
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
@@ -5119,14 +5332,23 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             bool fAlreadyHave = AlreadyHave(inv);
             LogPrint("net", "got inv: %s  %s peer=%d\n", inv.ToString(), fAlreadyHave ? "have" : "new", pfrom->id);
 
-            if (!fAlreadyHave && !fImporting && !fReindex && inv.type != MSG_BLOCK)
+            if (!fAlreadyHave && !fImporting && !fReindex && inv.type != MSG_BLOCK) {
                 pfrom->AskFor(inv);
+                if (inv.type == MSG_MASTERNODE_ANNOUNCE)
+                    masternodeSync.AskedForMasternodeList(inv.hash);
+            }
 
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
                 if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
+                    // Add this to the list of blocks to request, a new block in compact
+                    // form from a peer that sends it so
+                    std::set<uint256>& setCompactBlocksAsked = State(pfrom->GetId())->setCompactBlocksAsked;
+                    bool fCompact = (nLocalServices & NODE_COMPACT_BLOCKS) && (pfrom->nServices & NODE_COMPACT_BLOCKS) && !IsInitialBlockDownload() &&
+                                    setCompactBlocksAsked.size() < MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+                    if (fCompact)
+                        setCompactBlocksAsked.insert(inv.hash);
+                    vToFetch.push_back(fCompact ? CInv(MSG_CMPCT_BLOCK, inv.hash) : inv);
                     LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
                 }
             }
@@ -5356,7 +5578,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             for (uint256 hash : vEraseQueue)
                 EraseOrphanTx(hash);
         } else if (fMissingInputs) {
-            if (CheckTxFilter(tx, 0)) {
+            if (CheckTxFilter(tx, *pcoinsTip, 0)) {
                 AddOrphanTx(tx, pfrom->GetId());
                 // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
                 unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
@@ -5450,38 +5672,44 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
+        size_t nSize = vRecv.size();
         CBlock block;
         vRecv >> block;
         uint256 hashBlock = block.GetHash();
         CInv inv(MSG_BLOCK, hashBlock);
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
-        //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
-        if (!mapBlockIndex.count(block.hashPrevBlock)) {
-            if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
-                //we already asked for this block, so lets work backwards and ask for the previous block
-                pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
-                pfrom->vBlockRequested.push_back(block.hashPrevBlock);
-            } else {
-                //ask to sync to this block
-                pfrom->PushMessage("getblocks", chainActive.GetLocator(), hashBlock);
-                pfrom->vBlockRequested.push_back(hashBlock);
+        // the connect thread adds to mapBlockIndex while we look
+        bool fHavePrev;
+        bool fHaveBlock;
+        {
+            LOCK(cs_main);
+            // a compact block asked for may come whole
+            State(pfrom->GetId())->setCompactBlocksAsked.erase(hashBlock);
+            fHavePrev = mapBlockIndex.count(block.hashPrevBlock) || blockPipeline.Contains(block.hashPrevBlock);
+            fHaveBlock = mapBlockIndex.count(hashBlock) || blockPipeline.Contains(hashBlock);
+
+            //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
+            if (!fHavePrev) {
+                if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
+                    //we already asked for this block, so lets work backwards and ask for the previous block
+                    pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
+                    pfrom->vBlockRequested.push_back(block.hashPrevBlock);
+                } else {
+                    //ask to sync to this block
+                    pfrom->PushMessage("getblocks", chainActive.GetLocator(), hashBlock);
+                    pfrom->vBlockRequested.push_back(hashBlock);
+                }
             }
-        } else {
+        }
+
+        if (fHavePrev) {
             pfrom->AddInventoryKnown(inv);
 
-            CValidationState state;
-            if (!mapBlockIndex.count(block.GetHash())) {
-                ProcessNewBlock(state, pfrom, &block);
-                int nDoS;
-                if (state.IsInvalid(nDoS)) {
-                    pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                        state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-                    if (nDoS > 0) {
-                        TRY_LOCK(cs_main, lockMain);
-                        if (lockMain) Misbehaving(pfrom->GetId(), nDoS);
-                    }
-                }
+            if (!fHaveBlock) {
+                // checked and connected by the block pipeline if it runs, here otherwise
+                if (!blockPipeline.Submit(pfrom, block, nSize))
+                    ProcessReceivedBlock(pfrom, block, false);
                 //disconnect this node if its old protocol version
                 pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
             } else {
@@ -5491,6 +5719,183 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        size_t nSize = vRecv.size();
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        const uint256 hashBlock = cmpctblock.header.GetHash();
+        LogPrint("net", "received compact block %s (%u txs, %u prefilled) peer=%d\n", hashBlock.ToString(), cmpctblock.BlockTxCount(), cmpctblock.vPrefilledTx.size(), pfrom->id);
+        pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hashBlock));
+        {
+            LOCK(cs_compactBlockStats);
+            compactBlockStats.nReceived++;
+            compactBlockStats.nBytesReceived += nSize;
+        }
+
+        CBlock block;
+        bool fReconstructed = false;
+        {
+            LOCK(cs_main);
+            // only a block asked for sets off a search of the mempool and the orphans
+            if (!State(pfrom->GetId())->setCompactBlocksAsked.erase(hashBlock)) {
+                LogPrint("net", "peer=%d sent compact block %s we did not ask for\n", pfrom->id, hashBlock.ToString());
+                return true;
+            }
+            if (mapBlockIndex.count(hashBlock) || blockPipeline.Contains(hashBlock))
+                return true;
+            if (!mapBlockIndex.count(cmpctblock.header.hashPrevBlock) && !blockPipeline.Contains(cmpctblock.header.hashPrevBlock)) {
+                // the block handler asks for the blocks before it
+                RequestFullBlock(pfrom, hashBlock);
+                return true;
+            }
+
+            CValidationState state;
+            if (!CheckCompactBlockHeader(cmpctblock, state)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS) && nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                return error("%s : invalid header of compact block %s from peer=%d", __func__, hashBlock.ToString(), pfrom->id);
+            }
+
+            // Transactions waiting for their inputs may be what a new block spends them with
+            std::vector<CTransaction> vExtraTxn;
+            vExtraTxn.reserve(mapOrphanTransactions.size());
+            for (const auto& item : mapOrphanTransactions)
+                vExtraTxn.push_back(item.second.tx);
+
+            std::shared_ptr<CPartiallyDownloadedBlock> partialBlock = std::make_shared<CPartiallyDownloadedBlock>();
+            ReadStatus status = partialBlock->InitData(cmpctblock, mempool, vExtraTxn);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("%s : invalid compact block %s from peer=%d", __func__, hashBlock.ToString(), pfrom->id);
+            }
+            if (status == READ_STATUS_FAILED) {
+                RequestFullBlock(pfrom, hashBlock);
+                return true;
+            }
+
+            std::vector<uint16_t> vMissing = partialBlock->GetMissing();
+            {
+                LOCK(cs_compactBlockStats);
+                compactBlockStats.nTxPrefilled += partialBlock->nPrefilled;
+                compactBlockStats.nTxFromMempool += partialBlock->nFromMempool;
+                compactBlockStats.nTxFromExtra += partialBlock->nFromExtra;
+                compactBlockStats.nTxRequested += vMissing.size();
+            }
+            LogPrint("net", "compact block %s: %u prefilled, %u from mempool, %u from orphans, %u missing peer=%d\n", hashBlock.ToString(),
+                partialBlock->nPrefilled, partialBlock->nFromMempool, partialBlock->nFromExtra, vMissing.size(), pfrom->id);
+
+            if (vMissing.empty()) {
+                if (partialBlock->FillBlock(block, std::vector<CTransaction>()) == READ_STATUS_OK) {
+                    fReconstructed = true;
+                    LOCK(cs_compactBlockStats);
+                    compactBlockStats.nReconstructed++;
+                } else {
+                    RequestFullBlock(pfrom, hashBlock);
+                }
+            } else {
+                CBlockTransactionsRequest req;
+                req.hashBlock = hashBlock;
+                req.vIndexes = vMissing;
+                State(pfrom->GetId())->partialBlock = partialBlock;
+                pfrom->PushMessage("getblocktxn", req);
+            }
+        }
+
+        if (fReconstructed)
+            ProcessReconstructedBlock(pfrom, block);
+    }
+
+
+    else if (strCommand == "getblocktxn") {
+        CBlockTransactionsRequest req;
+        vRecv >> req;
+
+        CBlockIndex* pindex = NULL;
+        bool fRecent = false;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(req.hashBlock);
+            if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrint("net", "peer=%d asked for transactions of block %s we do not have\n", pfrom->id, req.hashBlock.ToString());
+                return true;
+            }
+            pindex = mi->second;
+            fRecent = chainActive.Contains(pindex) && chainActive.Height() - pindex->nHeight <= MAX_COMPACT_BLOCK_DEPTH;
+        }
+
+        if (!fRecent) {
+            // Sent whole, with the checks of any other block asked for
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.hashBlock));
+            ProcessGetData(pfrom);
+            return true;
+        }
+
+        CMessageDataRef blockData = blockCache.Get(pindex);
+        if (!blockData)
+            return error("%s : cannot load block %s", __func__, req.hashBlock.ToString());
+        CBlock block;
+        UnserializeBlockMessage(*blockData, block);
+
+        CBlockTransactions resp;
+        resp.hashBlock = req.hashBlock;
+        for (uint16_t nIndex : req.vIndexes) {
+            if (nIndex >= block.vtx.size()) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("%s : peer=%d asked for transaction %u of block %s with %u", __func__, pfrom->id, nIndex, req.hashBlock.ToString(), block.vtx.size());
+            }
+            resp.vtx.push_back(block.vtx[nIndex]);
+        }
+        pfrom->PushMessage("blocktxn", resp);
+        LOCK(cs_compactBlockStats);
+        compactBlockStats.nTxServed += resp.vtx.size();
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        size_t nSize = vRecv.size();
+        CBlockTransactions resp;
+        vRecv >> resp;
+        {
+            LOCK(cs_compactBlockStats);
+            compactBlockStats.nBytesReceived += nSize;
+        }
+
+        CBlock block;
+        bool fReconstructed = false;
+        {
+            LOCK(cs_main);
+            CNodeState* state = State(pfrom->GetId());
+            std::shared_ptr<CPartiallyDownloadedBlock> partialBlock;
+            if (state->partialBlock && state->partialBlock->GetBlockHash() == resp.hashBlock)
+                partialBlock.swap(state->partialBlock);
+            if (!partialBlock) {
+                LogPrint("net", "peer=%d sent transactions of block %s we did not ask for\n", pfrom->id, resp.hashBlock.ToString());
+                return true;
+            }
+
+            ReadStatus status = partialBlock->FillBlock(block, resp.vtx);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("%s : peer=%d sent %u transactions of block %s, not those asked for", __func__, pfrom->id, resp.vtx.size(), resp.hashBlock.ToString());
+            }
+            if (status == READ_STATUS_FAILED) {
+                RequestFullBlock(pfrom, resp.hashBlock);
+            } else {
+                fReconstructed = true;
+                LOCK(cs_compactBlockStats);
+                compactBlockStats.nRoundTrips++;
+            }
+        }
+
+        if (fReconstructed)
+            ProcessReconstructedBlock(pfrom, block);
+    }
+
+
     // This asymmetric behavior for inbound and outbound connections was introduced
     // to prevent a fingerprinting attack: an attacker can send specific fake addresses
     // to users' AddrMan and later request them by sending getaddr messages.
@@ -5731,6 +6136,41 @@ int ActiveProtocol()
     return MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT;
 }
 
+static bool IsBlockInv(const CInv& inv)
+{
+    return inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK;
+}
+
+bool IsConcurrentMessage(const std::string& strCommand, const CDataStream& vRecv)
+{
+    // The peer's own ping state
+    if (strCommand == "ping" || strCommand == "pong")
+        return true;
+
+    // Transactions and blocks are looked up under cs_main, while the inventory of
+    // masternodes, sporks and the like is kept in maps the other handlers share.
+    // Blocks are answered from disk.
+    if (strCommand == "inv" || strCommand == "getdata") {
+        vector<CInv> vInv;
+        try {
+            CDataStream ss(vRecv);
+            ss >> vInv;
+        } catch (const std::ios_base::failure&) {
+            return false;
+        }
+        if (vInv.empty() || vInv.size() > MAX_INV_SZ)
+            return false;
+        for (const CInv& inv : vInv) {
+            bool fConcurrent = strCommand == "inv" ? (inv.type == MSG_TX || inv.type == MSG_BLOCK) : IsBlockInv(inv);
+            if (!fConcurrent)
+                return false;
+        }
+        return true;
+    }
+
+    return false;
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool ProcessMessages(CNode* pfrom)
 {
@@ -5747,8 +6187,14 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
-    if (!pfrom->vRecvGetData.empty())
-        ProcessGetData(pfrom);
+    if (!pfrom->vRecvGetData.empty()) {
+        if (std::all_of(pfrom->vRecvGetData.begin(), pfrom->vRecvGetData.end(), IsBlockInv)) {
+            ProcessGetData(pfrom);
+        } else {
+            LOCK(cs_serialMessages);
+            ProcessGetData(pfrom);
+        }
+    }
 
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
@@ -5806,7 +6252,13 @@ bool ProcessMessages(CNode* pfrom)
         // Process message
         bool fRet = false;
         try {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            // Before the version handshake every message is checked for being early
+            if (pfrom->nVersion != 0 && IsConcurrentMessage(strCommand, vRecv)) {
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            } else {
+                LOCK(cs_serialMessages);
+                fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            }
             boost::this_thread::interruption_point();
         } catch (std::ios_base::failure& e) {
             pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
@@ -6118,9 +6570,14 @@ public:
     {
         // block headers
         BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+        for (; it1 != mapBlockIndex.end(); it1++) {
+            if (!IsInBlockIndexArena((*it1).second))
+                delete (*it1).second;
+        }
         mapBlockIndex.clear();
+        for (const PAIRTYPE(CBlockIndex*, size_t) & arena : vBlockIndexArenas)
+            delete[] arena.first;
+        vBlockIndexArenas.clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
@@ -50,6 +50,7 @@ class CValidationInterface;
 class CValidationState;
 
 struct CBlockTemplate;
+struct CCompactBlockStats;
 struct CNodeStateStats;
 
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
@@ -142,7 +143,7 @@ extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern bool fGM;
@@ -158,6 +159,8 @@ extern int64_t nReserveBalance;
 extern std::map<uint256, int64_t> mapRejectedBlocks;
 extern std::map<unsigned int, unsigned int> mapHashedBlocks;
 extern std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
+/** Outputs spent by the last blocks of the active chain, by height, for the stake checks of forks */
+extern std::map<COutPoint, int> mapStakeSpent;
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex* pindexBestHeader;
@@ -188,9 +191,12 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
  * @param[in]   pfrom   The node which we are receiving the block from; it is added to mapBlockSource and may be penalised if the block is invalid.
  * @param[in]   pblock  The block we want to process.
  * @param[out]  dbp     If pblock is stored to disk (or already there), this will be set to its location.
+ * @param[in]   fSignatureChecked  The block signature was already verified, e.g. by the block pipeline.
  * @return True if state.IsValid()
  */
-bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp = NULL);
+bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp = NULL, bool fSignatureChecked = false);
+/** Process a block received in a "block" message from pfrom, and answer with a reject message if it is invalid */
+void ProcessReceivedBlock(CNode* pfrom, CBlock& block, bool fSignatureChecked);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
@@ -211,6 +217,11 @@ void UnloadBlockIndex();
 int ActiveProtocol();
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
+/**
+ * Whether a message can be processed without cs_serialMessages, alongside the
+ * messages of other peers: pings, and inventory of transactions and blocks.
+ */
+bool IsConcurrentMessage(const std::string& strCommand, const CDataStream& vRecv);
 /**
  * Send queued protocol messages to be sent to a give node.
  *
@@ -244,10 +255,14 @@ CAmount GetBlockValue(int nHeight);
 
 /** Create a new block index entry for a given block hash */
 CBlockIndex* InsertBlockIndex(uint256 hash);
+/** Allocate nSize block index entries in one block, freed with the rest of mapBlockIndex at shutdown */
+CBlockIndex* AllocateBlockIndexArena(size_t nSize);
 /** Abort with a message */
 bool AbortNode(const std::string& msg, const std::string& userMessage = "");
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
+/** Counters of the compact blocks received from and sent to peers */
+void GetCompactBlockStats(CCompactBlockStats& stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
@@ -350,8 +365,9 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
 
 /** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, CValidationState& state, const int64_t nBlockTime = 0);
-bool CheckTxFilter(const CTransaction& tx, const int64_t nBlockTime);
+bool CheckTransaction(const CTransaction& tx, CValidationState& state);
+/** Check that none of the inputs of tx spend a filtered address, resolving the spent outputs from view */
+bool CheckTxFilter(const CTransaction& tx, const CCoinsViewCache& view, const int64_t nBlockTime);
 /**
  * Check if transaction will be final in the next block to be created.
  *
@@ -426,6 +442,8 @@ public:
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read the block pindex stands for as it was serialized, checking only its header hash */
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CBlockIndex* pindex);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -444,6 +462,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
+/** The checks of CheckBlock that only look at the block itself; needs no locks and remembers a pass in block.fChecked */
+bool CheckBlockContextFree(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true);
 bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev);
 
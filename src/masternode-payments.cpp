@@ -353,12 +353,14 @@ bool CMasternodePaymentWinner::Sign(CKey& keyMasternode, CPubKey& pubKeyMasterno
 
 bool CMasternodePayments::GetBlockPayee(int nBlockHeight, unsigned mnlevel, CScript& payee)
 {
-    auto block = mapMasternodeBlocks.find(nBlockHeight);
+    LOCK(cs_mapMasternodeBlocks);
+
+    auto block = GetBlockPayees(nBlockHeight);
 
-    if(block == mapMasternodeBlocks.cend())
+    if(!block)
         return false;
 
-    return block->second.GetPayee(mnlevel, payee);
+    return block->GetPayee(mnlevel, payee);
 }
 
 // Is this masternode scheduled to get paid soon?
@@ -390,20 +392,198 @@ bool CMasternodePayments::IsScheduled(CMasternode& mn, int nSameLevelMNCount, in
         if(h == nNotBlockHeight)
             continue;
 
-        auto block_payees = mapMasternodeBlocks.find(h);
+        auto block_payees = GetBlockPayees(h);
+
+        if(block_payees && block_payees->IsLeader(mn.Level(), mnpayee))
+            return true;
+    }
+    return false;
+}
+
+int CMasternodePayments::GetLastPaidHeight(const CScript& payee, int nBlockHeight, int nDepth) const
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    auto paid = mapPayeePaidHeights.find(payee);
+
+    if(paid == mapPayeePaidHeights.cend())
+        return 0;
+
+    auto h = paid->second.upper_bound(nBlockHeight);
+
+    if(h == paid->second.cbegin())
+        return 0;
+
+    --h;
+
+    if(*h <= 0 || nBlockHeight - *h >= nDepth)
+        return 0;
+
+    return *h;
+}
+
+void CMasternodePayments::IndexPaidHeights(const CMasternodeBlockPayees& blockPayees)
+{
+    LOCK(cs_vecPayments);
+
+    for(const CMasternodePayee& payee : blockPayees.vecPayments) {
+        if(payee.nVotes >= MNPAYMENTS_LASTPAID_VOTES)
+            mapPayeePaidHeights[payee.scriptPubKey].insert(blockPayees.nBlockHeight);
+    }
+}
+
+void CMasternodePayments::UnindexPaidHeights(const CMasternodeBlockPayees& blockPayees)
+{
+    LOCK(cs_vecPayments);
 
-        if(block_payees == mapMasternodeBlocks.cend())
+    for(const CMasternodePayee& payee : blockPayees.vecPayments) {
+        auto paid = mapPayeePaidHeights.find(payee.scriptPubKey);
+
+        if(paid == mapPayeePaidHeights.end())
             continue;
 
-        CScript payee;
+        paid->second.erase(blockPayees.nBlockHeight);
+
+        if(paid->second.empty())
+            mapPayeePaidHeights.erase(paid);
+    }
+}
+
+const CMasternodeBlockPayees* CMasternodePayments::GetBlockPayees(int nBlockHeight) const
+{
+    if(vBlockWindow.empty() || nBlockHeight <= 0)
+        return nullptr;
+
+    const CMasternodeBlockPayees& block = vBlockWindow[nBlockHeight % vBlockWindow.size()];
+
+    return block.nBlockHeight == nBlockHeight ? &block : nullptr;
+}
+
+CMasternodeBlockPayees* CMasternodePayments::GetBlock(int nBlockHeight)
+{
+    return const_cast<CMasternodeBlockPayees*>(GetBlockPayees(nBlockHeight));
+}
+
+size_t CMasternodePayments::CountBlocks() const
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    return nBlocksHeld;
+}
+
+CMasternodeBlockPayees& CMasternodePayments::AddBlock(int nBlockHeight)
+{
+    assert(nBlockHeight > 0);
+
+    if(vBlockWindow.empty())
+        vBlockWindow.resize(MNPAYMENTS_WINDOW_MIN_BLOCKS);
+
+    // the blocks held span more heights than the window has slots until it is grown
+    while(true) {
+        CMasternodeBlockPayees& block = vBlockWindow[nBlockHeight % vBlockWindow.size()];
+
+        if(block.nBlockHeight == nBlockHeight)
+            return block;
 
-        if(!block_payees->second.GetPayee(mn.Level(), payee))
+        if(block.nBlockHeight == 0) {
+            block = CMasternodeBlockPayees(nBlockHeight);
+            if(!nBlocksHeld || nBlockHeight < nLowestHeight)
+                nLowestHeight = nBlockHeight;
+            ++nBlocksHeld;
+            return block;
+        }
+
+        GrowWindow();
+    }
+}
+
+void CMasternodePayments::GrowWindow()
+{
+    std::vector<CMasternodeBlockPayees> vOld;
+    vOld.swap(vBlockWindow);
+
+    size_t nSize = vOld.size() * 2;
+
+    while(true) {
+        vBlockWindow.assign(nSize, CMasternodeBlockPayees());
+
+        bool fFits = true;
+
+        for(const CMasternodeBlockPayees& block : vOld) {
+            if(block.nBlockHeight == 0)
+                continue;
+
+            CMasternodeBlockPayees& slot = vBlockWindow[block.nBlockHeight % nSize];
+
+            if(slot.nBlockHeight != 0) {
+                fFits = false;
+                break;
+            }
+
+            slot = block;
+        }
+
+        if(fFits)
+            break;
+
+        nSize *= 2;
+    }
+
+    LogPrint("mnpayments", "CMasternodePayments::GrowWindow - %u slots for %u blocks\n", nSize, nBlocksHeld);
+}
+
+void CMasternodePayments::RemoveBlock(CMasternodeBlockPayees& blockPayees)
+{
+    UnindexPaidHeights(blockPayees);
+
+    for(const uint256& hash : blockPayees.vecVoteHashes) {
+        masternodeSync.mapSeenSyncMNW.erase(hash);
+        mapMasternodePayeeVotes.erase(hash);
+    }
+
+    blockPayees = CMasternodeBlockPayees();
+    --nBlocksHeld;
+}
+
+std::map<int, CMasternodeBlockPayees> CMasternodePayments::GetBlocks() const
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::map<int, CMasternodeBlockPayees> mapBlocks;
+
+    for(const CMasternodeBlockPayees& block : vBlockWindow) {
+        if(block.nBlockHeight != 0)
+            mapBlocks.emplace(block.nBlockHeight, block);
+    }
+
+    return mapBlocks;
+}
+
+void CMasternodePayments::LoadBlocks(const std::map<int, CMasternodeBlockPayees>& mapBlocks)
+{
+    LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
+
+    vBlockWindow.clear();
+    nBlocksHeld = 0;
+    nLowestHeight = 0;
+    mapPayeePaidHeights.clear();
+
+    for(const auto& mnblock : mapBlocks) {
+        if(mnblock.first <= 0)
             continue;
 
-        if(mnpayee == payee)
-            return true;
+        CMasternodeBlockPayees& block = AddBlock(mnblock.first);
+        block = mnblock.second;
+        block.nBlockHeight = mnblock.first;
+        block.vecVoteHashes.clear();
+        IndexPaidHeights(block);
+    }
+
+    // every vote goes with the block it voted for, so it leaves with it
+    for(const auto& vote : mapMasternodePayeeVotes) {
+        if(vote.second.nBlockHeight > 0)
+            AddBlock(vote.second.nBlockHeight).vecVoteHashes.push_back(vote.first);
     }
-    return false;
 }
 
 bool CMasternodePayments::CanVote(const COutPoint& outMasternode, int nBlockHeight, unsigned mnlevel)
@@ -444,9 +624,11 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
         if(!vote_ins_res.second)
             return false;
 
-        auto mnblock = mapMasternodeBlocks.emplace(winnerIn.nBlockHeight, winnerIn.nBlockHeight).first;
+        CMasternodeBlockPayees& mnblock = AddBlock(winnerIn.nBlockHeight);
+        mnblock.vecVoteHashes.push_back(vote_ins_res.first->first);
 
-        mnblock->second.AddPayee(winnerIn.payeeLevel, winnerIn.payee, 1);
+        if (mnblock.AddPayee(winnerIn.payeeLevel, winnerIn.payee, 1) == MNPAYMENTS_LASTPAID_VOTES)
+            mapPayeePaidHeights[winnerIn.payee].insert(winnerIn.nBlockHeight);
     }
 
     return true;
@@ -458,15 +640,13 @@ bool CMasternodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
     std::map<unsigned, int> max_signatures;
     //require at least 6 signatures
     LogPrint("mnpayments", "-- Selecting signatures start --\n");
-    for(CMasternodePayee& payee : vecPayments) {
-        LogPrint("mnpayments", "-- payee: %s level %d votes %d\n", payee.scriptPubKey.ToString(), payee.mnlevel, payee.nVotes);
-        if(payee.nVotes < MNPAYMENTS_SIGNATURES_REQUIRED)
-            continue;
-        auto ins_res = max_signatures.emplace(payee.mnlevel, payee.nVotes);
-        if(ins_res.second)
+    for(unsigned mnlevel = CMasternode::LevelValue::UNSPECIFIED; mnlevel <= CMasternode::LevelValue::MAX; ++mnlevel) {
+        const CMasternodePayee* payee = GetLeader(mnlevel);
+        if(!payee)
             continue;
-        if(payee.nVotes >= ins_res.first->second)
-            ins_res.first->second = payee.nVotes;
+        LogPrint("mnpayments", "-- payee: %s level %d votes %d\n", payee->scriptPubKey.ToString(), payee->mnlevel, payee->nVotes);
+        if(payee->nVotes >= MNPAYMENTS_SIGNATURES_REQUIRED)
+            max_signatures.emplace(mnlevel, payee->nVotes);
     }
     LogPrint("mnpayments", "-- Selecting signatures end -- signatures size: %d\n", max_signatures.size());
 
@@ -560,22 +740,24 @@ std::string CMasternodePayments::GetRequiredPaymentsString(int nBlockHeight)
 {
     LOCK(cs_mapMasternodeBlocks);
 
-    auto mn_block = mapMasternodeBlocks.find(nBlockHeight);
+    auto mn_block = GetBlock(nBlockHeight);
 
-    if(mn_block == mapMasternodeBlocks.end())
+    if(!mn_block)
         return "Unknown";
 
-    return mn_block->second.GetRequiredPaymentsString();
+    return mn_block->GetRequiredPaymentsString();
 }
 
 bool CMasternodePayments::IsTransactionValid(const CTransaction& txNew, int nBlockHeight)
 {
     LOCK(cs_mapMasternodeBlocks);
 
-    if (mapMasternodeBlocks.count(nBlockHeight)) {
-        return mapMasternodeBlocks[nBlockHeight].IsTransactionValid(txNew);
+    auto mn_block = GetBlock(nBlockHeight);
+
+    if (mn_block) {
+        return mn_block->IsTransactionValid(txNew);
     }
-    LogPrintf("Blockheight: %i Is not found inside mapMasternodeBlocks\n", nBlockHeight);
+    LogPrintf("Blockheight: %i Is not found inside the masternode block window\n", nBlockHeight);
     return true;
 }
 
@@ -593,19 +775,30 @@ void CMasternodePayments::CleanPaymentList()
     //keep up to five cycles for historical sake
     int nLimit = std::max(int(mnodeman.size() * 1.25), 1000);  /*/ 100 * 125*/
 
-    std::map<uint256, CMasternodePaymentWinner>::iterator it = mapMasternodePayeeVotes.begin();
-    while (it != mapMasternodePayeeVotes.end()) {
-        CMasternodePaymentWinner winner = it->second;
+    // blocks below nCutoff go with their votes, from the lowest held one up
+    int nCutoff = nHeight - nLimit;
 
-        if (nHeight - winner.nBlockHeight > nLimit) {
-            LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", winner.nBlockHeight);
-            masternodeSync.mapSeenSyncMNW.erase(it->first);
-            mapMasternodeBlocks.erase(winner.nBlockHeight);
-            it = mapMasternodePayeeVotes.erase(it);
-        } else {
-            ++it;
+    if (!nBlocksHeld || nLowestHeight >= nCutoff)
+        return;
+
+    if (nCutoff - nLowestHeight > (int)vBlockWindow.size()) {
+        for (CMasternodeBlockPayees& block : vBlockWindow) {
+            if (block.nBlockHeight != 0 && block.nBlockHeight < nCutoff) {
+                LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", block.nBlockHeight);
+                RemoveBlock(block);
+            }
+        }
+    } else {
+        for (int h = nLowestHeight; h < nCutoff; ++h) {
+            CMasternodeBlockPayees* block = GetBlock(h);
+            if (block) {
+                LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", h);
+                RemoveBlock(*block);
+            }
         }
     }
+
+    nLowestHeight = nCutoff;
 }
 
 bool CMasternodePaymentWinner::IsValid(CNode* pnode, std::string& strError)
@@ -686,11 +879,13 @@ bool CMasternodePayments::ProcessBlock(int nBlockHeight)
 
     std::vector<CMasternodePaymentWinner> winners;
 
-    for(unsigned mnlevel = CMasternode::LevelValue::MIN; mnlevel <= CMasternode::LevelValue::MAX; ++mnlevel) {
+    // the winners of all levels from one pass over the masternode list
+    std::map<unsigned, unsigned> mapCount;
+    std::map<unsigned, CMasternode*> mapNext = mnodeman.GetNextMasternodesInQueueForPayment(nWinnerBlockHeight, mapCount);
 
-        unsigned nCount = 0;
+    for(unsigned mnlevel = CMasternode::LevelValue::MIN; mnlevel <= CMasternode::LevelValue::MAX; ++mnlevel) {
 
-        auto pmn = mnodeman.GetNextMasternodeInQueueForPayment(nWinnerBlockHeight, mnlevel, true, nCount);
+        auto pmn = mapNext[mnlevel];
 
         if(!pmn) {
             LogPrint("mnpayments", "CMasternodePayments::ProcessBlock() Failed to find masternode level %d to pay \n", mnlevel);
@@ -832,6 +1027,8 @@ void CMasternodePayments::Sync(CNode* node, int nCountNeeded)
         }
         //LogPrintf("=== total winners = %d\n", nInvCount);
         node->PushMessage("mnwp", ss);
+        // the pack holds every winner, tell the peer it is complete
+        node->PushMessage("ssc", MASTERNODE_SYNC_MNW, nInvCount);
     } else {
         for(const auto& vote : mapMasternodePayeeVotes) {
             const auto& winner = vote.second;
@@ -849,7 +1046,7 @@ std::string CMasternodePayments::ToString() const
 {
     std::ostringstream info;
 
-    info << "Votes: " << (int)mapMasternodePayeeVotes.size() << ", Blocks: " << (int)mapMasternodeBlocks.size();
+    info << "Votes: " << (int)mapMasternodePayeeVotes.size() << ", Blocks: " << (int)nBlocksHeld;
 
     return info.str();
 }
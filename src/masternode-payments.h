@@ -26,6 +26,10 @@ extern CMasternodePayments masternodePayments;
 
 #define MNPAYMENTS_SIGNATURES_REQUIRED 5
 #define MNPAYMENTS_SIGNATURES_TOTAL 10
+// votes a payee needs for a block to count as its last payment
+#define MNPAYMENTS_LASTPAID_VOTES 6
+// blocks the vote window holds at first, it doubles when two held heights meet in a slot
+#define MNPAYMENTS_WINDOW_MIN_BLOCKS 1024
 
 void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 bool IsBlockPayeeValid(const CBlock& block, int nBlockHeight);
@@ -66,17 +70,46 @@ public:
 // Keep track of votes for payees from masternodes
 class CMasternodeBlockPayees
 {
+private:
+    // index in vecPayments of the payee of each level with the most votes, the first one of them on a tie; -1 if none
+    int vLeader[CMasternode::LevelValue::MAX + 1];
+
+    void UpdateLeader(int nIndex)
+    {
+        const CMasternodePayee& payee = vecPayments[nIndex];
+
+        if(payee.mnlevel > CMasternode::LevelValue::MAX)
+            return;
+
+        int& nLeader = vLeader[payee.mnlevel];
+
+        if(nLeader < 0 || payee.nVotes > vecPayments[nLeader].nVotes || (payee.nVotes == vecPayments[nLeader].nVotes && nIndex < nLeader))
+            nLeader = nIndex;
+    }
+
+    void RebuildLeaders()
+    {
+        std::fill(std::begin(vLeader), std::end(vLeader), -1);
+
+        for(int i = 0; i < (int)vecPayments.size(); ++i)
+            UpdateLeader(i);
+    }
+
 public:
 
     int nBlockHeight;
     std::vector<CMasternodePayee> vecPayments;
+    // hashes of the votes counted here, not serialized
+    std::vector<uint256> vecVoteHashes;
 
     CMasternodeBlockPayees(int nBlockHeightIn = 0)
         : nBlockHeight{nBlockHeightIn}
     {
+        std::fill(std::begin(vLeader), std::end(vLeader), -1);
     }
 
-    void AddPayee(unsigned mnlevel, CScript payeeIn, int nIncrement)
+    // returns the votes the payee has now
+    int AddPayee(unsigned mnlevel, CScript payeeIn, int nIncrement)
     {
         LOCK(cs_vecPayments);
 
@@ -84,28 +117,33 @@ public:
             return p.scriptPubKey == payeeIn;
         });
 
-        if(payee == vecPayments.end())
+        if(payee == vecPayments.end()) {
             vecPayments.emplace_back(mnlevel, payeeIn, nIncrement);
-        else
-            payee->nVotes += nIncrement;
+            UpdateLeader(vecPayments.size() - 1);
+            return nIncrement;
+        }
+
+        payee->nVotes += nIncrement;
+        UpdateLeader(payee - vecPayments.begin());
+        return payee->nVotes;
     }
 
-    bool GetPayee(unsigned mnlevel, CScript& payee) const
+    // the payee of the level with the most votes, or null if the level has none
+    const CMasternodePayee* GetLeader(unsigned mnlevel) const
     {
-        LOCK(cs_vecPayments);
+        if(mnlevel > CMasternode::LevelValue::MAX || vLeader[mnlevel] < 0)
+            return nullptr;
 
-        auto payment = vecPayments.cend();
-
-        for(auto p = vecPayments.cbegin(), e = vecPayments.cend(); p != e; ++p) {
+        return &vecPayments[vLeader[mnlevel]];
+    }
 
-            if(p->mnlevel != mnlevel)
-                continue;
+    bool GetPayee(unsigned mnlevel, CScript& payee) const
+    {
+        LOCK(cs_vecPayments);
 
-            if(payment == vecPayments.cend() || p->nVotes > payment->nVotes)
-                payment = p;
-        };
+        const CMasternodePayee* payment = GetLeader(mnlevel);
 
-        if(payment == vecPayments.cend())
+        if(!payment)
             return false;
 
         payee = payment->scriptPubKey;
@@ -113,7 +151,16 @@ public:
         return true;
     }
 
-    bool HasPayeeWithVotes(CScript payee, int nVotesReq)
+    bool IsLeader(unsigned mnlevel, const CScript& payee) const
+    {
+        LOCK(cs_vecPayments);
+
+        const CMasternodePayee* payment = GetLeader(mnlevel);
+
+        return payment && payment->scriptPubKey == payee;
+    }
+
+    bool HasPayeeWithVotes(const CScript& payee, int nVotesReq) const
     {
         LOCK(cs_vecPayments);
 
@@ -134,6 +181,8 @@ public:
     {
         READWRITE(nBlockHeight);
         READWRITE(vecPayments);
+        if (ser_action.ForRead())
+            RebuildLeaders();
     }
 };
 
@@ -216,22 +265,47 @@ private:
 
     int nLastBlockHeight;
 
+    // the blocks with votes, each at the slot of its height modulo the size of the window;
+    // a slot of another height holds no block. Kept under cs_mapMasternodeBlocks
+    std::vector<CMasternodeBlockPayees> vBlockWindow;
+    size_t nBlocksHeld;
+    // no block is held below this height
+    int nLowestHeight;
+
+    // heights in the window at which each payee has MNPAYMENTS_LASTPAID_VOTES votes,
+    // kept in step with the window under cs_mapMasternodeBlocks
+    std::map<CScript, std::set<int> > mapPayeePaidHeights;
+
+    CMasternodeBlockPayees* GetBlock(int nBlockHeight);
+    CMasternodeBlockPayees& AddBlock(int nBlockHeight);
+    void GrowWindow();
+    void RemoveBlock(CMasternodeBlockPayees& blockPayees);
+    std::map<int, CMasternodeBlockPayees> GetBlocks() const;
+    void LoadBlocks(const std::map<int, CMasternodeBlockPayees>& mapBlocks);
+
+    void IndexPaidHeights(const CMasternodeBlockPayees& blockPayees);
+    void UnindexPaidHeights(const CMasternodeBlockPayees& blockPayees);
+
 public:
     std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
-    std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
     std::map<uint256, int> mapMasternodesLastVote;
 
     CMasternodePayments()
     {
         nLastBlockHeight = 0;
+        nBlocksHeld = 0;
+        nLowestHeight = 0;
     }
 
     void Clear()
     {
         LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
-        mapMasternodeBlocks.clear();
+        vBlockWindow.clear();
+        nBlocksHeld = 0;
+        nLowestHeight = 0;
         mapMasternodePayeeVotes.clear();
         mapMasternodesLastVote.clear();
+        mapPayeePaidHeights.clear();
     }
 
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
@@ -240,10 +314,15 @@ public:
     void Sync(CNode* node, int nCountNeeded);
     void CleanPaymentList();
 
+    // the votes for a block, or null if there are none; the caller holds cs_mapMasternodeBlocks
+    const CMasternodeBlockPayees* GetBlockPayees(int nBlockHeight) const;
+    size_t CountBlocks() const;
     bool GetBlockPayee(int nBlockHeight, unsigned mnlevel, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CMasternode& mn, int nSameLevelMNCount, int nNotBlockHeight) const;
     bool CanVote(const COutPoint& outMasternode, int nBlockHeight, unsigned mnlevel);
+    // last height at or below nBlockHeight, and above nBlockHeight - nDepth, at which payee was voted in; 0 if none
+    int GetLastPaidHeight(const CScript& payee, int nBlockHeight, int nDepth) const;
 
     int GetMinMasternodePaymentsProto();
     void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
@@ -256,8 +335,14 @@ public:
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
     {
+        // the blocks are kept as the map of heights they were held in before the window
+        std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
+        if (!ser_action.ForRead())
+            mapMasternodeBlocks = GetBlocks();
         READWRITE(mapMasternodePayeeVotes);
         READWRITE(mapMasternodeBlocks);
+        if (ser_action.ForRead())
+            LoadBlocks(mapMasternodeBlocks);
     }
 };
 
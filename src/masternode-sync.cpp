@@ -72,6 +72,10 @@ void CMasternodeSync::Reset()
     sumMasternodeWinner = 0;
     countMasternodeList = 0;
     countMasternodeWinner = 0;
+    {
+        LOCK(cs);
+        setAskedMasternodeList.clear();
+    }
     RequestedMasternodeAssets = MASTERNODE_SYNC_INITIAL;
     RequestedMasternodeAttempt = 0;
     nAssetSyncStarted = GetTime();
@@ -79,6 +83,8 @@ void CMasternodeSync::Reset()
 
 void CMasternodeSync::AddedMasternodeList(uint256 hash)
 {
+    ReceivedMasternodeList(hash);
+
     auto ins_res = mapSeenSyncMNB.emplace(hash, 1);
 
     if(!ins_res.second) {
@@ -106,6 +112,34 @@ void CMasternodeSync::AddedMasternodeList(uint256 hash)
 */
 }
 
+void CMasternodeSync::AskedForMasternodeList(const uint256& hash)
+{
+    if (RequestedMasternodeAssets != MASTERNODE_SYNC_LIST)
+        return;
+
+    LOCK(cs);
+    setAskedMasternodeList.insert(hash);
+}
+
+void CMasternodeSync::ReceivedMasternodeList(const uint256& hash)
+{
+    LOCK(cs);
+    setAskedMasternodeList.erase(hash);
+}
+
+bool CMasternodeSync::IsMasternodeListComplete() const
+{
+    if (RequestedMasternodeAssets != MASTERNODE_SYNC_LIST || RequestedMasternodeAttempt < MASTERNODE_SYNC_THRESHOLD)
+        return false;
+
+    // a peer sends its count after the announcements it lists, so the ones asked for are known by then
+    if (countMasternodeList < RequestedMasternodeAttempt)
+        return false;
+
+    LOCK(cs);
+    return setAskedMasternodeList.empty();
+}
+
 void CMasternodeSync::AddedMasternodeWinner(uint256 hash)
 {
 
@@ -149,6 +183,10 @@ void CMasternodeSync::GetNextAsset()
             break;
         case (MASTERNODE_SYNC_LIST):
             RequestedMasternodeAssets = MASTERNODE_SYNC_MNW;
+            {
+                LOCK(cs);
+                setAskedMasternodeList.clear();
+            }
             break;
         case (MASTERNODE_SYNC_MNW):
             RequestedMasternodeAssets = MASTERNODE_SYNC_GM;
@@ -314,6 +352,12 @@ void CMasternodeSync::Process()
 
         if (pnode->nVersion >= masternodePayments.GetMinMasternodePaymentsProto()) {
             if (RequestedMasternodeAssets == MASTERNODE_SYNC_LIST) {
+                if (IsMasternodeListComplete()) {
+                    LogPrint("masternode", "CMasternodeSync::Process() - list complete from %d peers, %d entries listed\n", countMasternodeList, sumMasternodeList);
+                    GetNextAsset();
+                    return;
+                }
+
                 LogPrint("masternode", "CMasternodeSync::Process() - lastMasternodeList %lld (GetTime() - MASTERNODE_SYNC_TIMEOUT) %lld\n", lastMasternodeList, GetTime() - MASTERNODE_SYNC_TIMEOUT);
                 if (lastMasternodeList > 0 && lastMasternodeList < GetTime() - MASTERNODE_SYNC_TIMEOUT && RequestedMasternodeAttempt >= MASTERNODE_SYNC_THRESHOLD) { //hasn't received a new item in the last five seconds, so we'll move to the
                     GetNextAsset();
@@ -17,6 +17,12 @@
 #define MASTERNODE_SYNC_TIMEOUT 5
 #define MASTERNODE_SYNC_THRESHOLD 2
 
+#include "sync.h"
+#include "uint256.h"
+
+#include <map>
+#include <set>
+
 class CMasternodeSync;
 extern CMasternodeSync masternodeSync;
 
@@ -26,6 +32,12 @@ extern CMasternodeSync masternodeSync;
 
 class CMasternodeSync
 {
+private:
+    // protects the announcements asked for, which the verify queue may receive meanwhile
+    mutable CCriticalSection cs;
+    // announcements the peers listed during the list sync that we did not have and asked for
+    std::set<uint256> setAskedMasternodeList;
+
 public:
     std::map<uint256, int> mapSeenSyncMNB;
     std::map<uint256, int> mapSeenSyncMNW;
@@ -52,6 +64,12 @@ public:
     CMasternodeSync();
 
     void AddedMasternodeList(uint256 hash);
+    /// An announcement listed by a peer during the list sync was asked for
+    void AskedForMasternodeList(const uint256& hash);
+    /// An announcement came in, whether or not it was accepted
+    void ReceivedMasternodeList(const uint256& hash);
+    /// Every peer asked for the list sent its count, and every announcement they listed that we lacked came in
+    bool IsMasternodeListComplete() const;
     void AddedMasternodeWinner(uint256 hash);
     void GetNextAsset();
     std::string GetSyncStatus();
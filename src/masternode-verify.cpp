@@ -0,0 +1,212 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternode-verify.h"
+
+#include "masternodeman.h"
+#include "net.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+CMasternodeVerifyQueue masternodeVerifyQueue;
+
+CMasternodeVerifyQueue::CMasternodeVerifyQueue() : fRunning(false), nVerifyThreads(0),
+                                                   nBroadcasts(0), nPings(0), nBadSignatures(0), nApplied(0)
+{
+}
+
+void CMasternodeVerifyQueue::Start(boost::thread_group& threadGroup, int nThreads)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        assert(!fRunning);
+        fRunning = true;
+        nVerifyThreads = nThreads;
+    }
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CMasternodeVerifyQueue::ThreadVerify, this));
+    threadGroup.create_thread(boost::bind(&CMasternodeVerifyQueue::ThreadApply, this));
+}
+
+void CMasternodeVerifyQueue::Stop()
+{
+    std::deque<EntryRef> queueDrop;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRunning = false;
+        queueDrop.swap(queueApply);
+        queueVerify.clear();
+    }
+    condVerify.notify_all();
+    condApply.notify_all();
+    condSpace.notify_all();
+
+    LOCK(cs_vNodes);
+    for (const EntryRef& entry : queueDrop)
+        entry->pfrom->Release();
+}
+
+bool CMasternodeVerifyQueue::Submit(CNode* pfrom, const CMasternodeBroadcast& mnb)
+{
+    EntryRef entry = std::make_shared<CEntry>();
+    entry->pfrom = pfrom;
+    entry->fPing = false;
+    entry->mnb = mnb;
+    return Submit(entry);
+}
+
+bool CMasternodeVerifyQueue::Submit(CNode* pfrom, const CMasternodePing& mnp, const CPubKey& pubKeyMasternode)
+{
+    EntryRef entry = std::make_shared<CEntry>();
+    entry->pfrom = pfrom;
+    entry->fPing = true;
+    entry->mnp = mnp;
+    entry->pubKeyMasternode = pubKeyMasternode;
+    return Submit(entry);
+}
+
+bool CMasternodeVerifyQueue::Submit(const EntryRef& entry)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fRunning)
+            return false;
+    }
+    {
+        // keeps pfrom alive until its message is applied
+        LOCK(cs_vNodes);
+        entry->pfrom->AddRef();
+    }
+
+    entry->fVerified = false;
+    entry->fSignatureValid = false;
+
+    bool fQueued = false;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (fRunning && queueApply.size() >= MAX_MASTERNODE_VERIFY_QUEUE)
+            condSpace.wait(lock);
+
+        if (fRunning) {
+            queueVerify.push_back(entry);
+            queueApply.push_back(entry);
+            if (entry->fPing)
+                nPings++;
+            else
+                nBroadcasts++;
+            fQueued = true;
+        }
+    }
+    if (!fQueued) {
+        LOCK(cs_vNodes);
+        entry->pfrom->Release();
+        return false;
+    }
+    condVerify.notify_one();
+    return true;
+}
+
+void CMasternodeVerifyQueue::ThreadVerify()
+{
+    RenameThread("fdreserve-mnverify");
+    std::vector<EntryRef> vBatch;
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (fRunning && queueVerify.empty())
+                condVerify.wait(lock);
+            if (!fRunning)
+                return;
+            while (!queueVerify.empty() && vBatch.size() < MASTERNODE_VERIFY_BATCH_SIZE) {
+                vBatch.push_back(queueVerify.front());
+                queueVerify.pop_front();
+            }
+        }
+
+        // A message failing here is verified again when it is applied, which
+        // answers the peer as before.
+        int nBad = 0;
+        for (const EntryRef& entry : vBatch) {
+            if (entry->fPing)
+                entry->fSignatureValid = entry->pubKeyMasternode.IsValid() && entry->mnp.VerifySignature(entry->pubKeyMasternode);
+            else
+                entry->fSignatureValid = entry->mnb.VerifySignature();
+            if (!entry->fSignatureValid && (!entry->fPing || entry->pubKeyMasternode.IsValid()))
+                nBad++;
+        }
+
+        bool fOldest = false;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            for (const EntryRef& entry : vBatch)
+                entry->fVerified = true;
+            nBadSignatures += nBad;
+            fOldest = !queueApply.empty() && queueApply.front()->fVerified;
+        }
+        if (fOldest)
+            condApply.notify_one();
+        vBatch.clear();
+    }
+}
+
+void CMasternodeVerifyQueue::ThreadApply()
+{
+    RenameThread("fdreserve-mnapply");
+    std::vector<EntryRef> vBatch;
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (fRunning && (queueApply.empty() || !queueApply.front()->fVerified))
+                condApply.wait(lock);
+            if (!fRunning)
+                return;
+            // all the verified messages up to the first one still being verified
+            while (!queueApply.empty() && queueApply.front()->fVerified) {
+                vBatch.push_back(queueApply.front());
+                queueApply.pop_front();
+            }
+        }
+        condSpace.notify_all();
+
+        int64_t nStart = GetTimeMicros();
+        for (const EntryRef& entry : vBatch) {
+            if (entry->fPing)
+                mnodeman.ProcessPing(entry->pfrom, entry->mnp, entry->fSignatureValid ? entry->pubKeyMasternode : CPubKey());
+            else
+                mnodeman.ProcessBroadcast(entry->pfrom, entry->mnb, entry->fSignatureValid);
+        }
+        LogPrint("bench", "%s : applied %u masternode messages in %.2fms\n", __func__, vBatch.size(), 0.001 * (GetTimeMicros() - nStart));
+
+        {
+            LOCK(cs_vNodes);
+            for (const EntryRef& entry : vBatch)
+                entry->pfrom->Release();
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            nApplied += vBatch.size();
+        }
+        vBatch.clear();
+    }
+}
+
+void CMasternodeVerifyQueue::GetStats(CMasternodeVerifyStats& stats) const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    stats.fRunning = fRunning;
+    stats.nVerifyThreads = nVerifyThreads;
+    stats.nQueuedVerify = queueVerify.size();
+    stats.nQueuedApply = 0;
+    for (const EntryRef& entry : queueApply) {
+        if (entry->fVerified)
+            stats.nQueuedApply++;
+    }
+    stats.nBroadcasts = nBroadcasts;
+    stats.nPings = nPings;
+    stats.nBadSignatures = nBadSignatures;
+    stats.nApplied = nApplied;
+}
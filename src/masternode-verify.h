@@ -0,0 +1,115 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef MASTERNODE_VERIFY_H
+#define MASTERNODE_VERIFY_H
+
+#include "masternode.h"
+#include "pubkey.h"
+
+#include <deque>
+#include <memory>
+#include <stdint.h>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CNode;
+
+namespace boost
+{
+class thread_group;
+} // namespace boost
+
+/** Default for -mnverifythreads, threads verifying the signatures of received masternode broadcasts and pings */
+static const int DEFAULT_MASTERNODE_VERIFY_THREADS = 2;
+/** Maximum number of masternode verify threads */
+static const int MAX_MASTERNODE_VERIFY_THREADS = 16;
+/** Number of messages a verify thread takes from the queue at a time */
+static const size_t MASTERNODE_VERIFY_BATCH_SIZE = 16;
+/** Number of messages in the queue above which the message handler waits for room */
+static const size_t MAX_MASTERNODE_VERIFY_QUEUE = 20000;
+
+struct CMasternodeVerifyStats {
+    bool fRunning;
+    int nVerifyThreads;
+    //! received, waiting for a verify thread
+    size_t nQueuedVerify;
+    //! verified, waiting for the messages received before them to be applied
+    size_t nQueuedApply;
+    uint64_t nBroadcasts;
+    uint64_t nPings;
+    uint64_t nBadSignatures;
+    uint64_t nApplied;
+};
+
+/**
+ * Signature verification of the masternode broadcasts and pings received from peers.
+ *
+ * The message handler drops the messages it has seen before and hands the
+ * others to Submit. A pool of verify threads takes them in batches and checks
+ * their signatures, which needs no masternode list: a broadcast is signed by
+ * the collateral key it carries, and a ping is checked against the key of its
+ * masternode as listed when the ping was received. A single apply thread then
+ * passes the messages to CMasternodeMan in the order they were received, which
+ * checks them against the list under its message lock and skips the
+ * signatures already found valid.
+ */
+class CMasternodeVerifyQueue
+{
+private:
+    struct CEntry {
+        CNode* pfrom;
+        bool fPing;
+        CMasternodeBroadcast mnb;
+        CMasternodePing mnp;
+        //! masternode key to check the ping against, invalid if the masternode was not listed
+        CPubKey pubKeyMasternode;
+        bool fVerified;
+        bool fSignatureValid;
+    };
+    typedef std::shared_ptr<CEntry> EntryRef;
+
+    mutable boost::mutex cs;
+    //! a message was queued for verifying, or the queue is stopping
+    boost::condition_variable condVerify;
+    //! the oldest message was verified
+    boost::condition_variable condApply;
+    //! messages left the queue
+    boost::condition_variable condSpace;
+
+    std::deque<EntryRef> queueVerify;
+    //! every message in the queue, oldest first
+    std::deque<EntryRef> queueApply;
+    bool fRunning;
+    int nVerifyThreads;
+
+    uint64_t nBroadcasts;
+    uint64_t nPings;
+    uint64_t nBadSignatures;
+    uint64_t nApplied;
+
+    bool Submit(const EntryRef& entry);
+    void ThreadVerify();
+    void ThreadApply();
+
+public:
+    CMasternodeVerifyQueue();
+
+    void Start(boost::thread_group& threadGroup, int nThreads);
+    //! Drop the messages left after the queue threads were stopped
+    void Stop();
+
+    /**
+     * Queue a broadcast or ping received from pfrom, waiting while the queue
+     * is full. Returns false if the queue does not run.
+     */
+    bool Submit(CNode* pfrom, const CMasternodeBroadcast& mnb);
+    bool Submit(CNode* pfrom, const CMasternodePing& mnp, const CPubKey& pubKeyMasternode);
+    void GetStats(CMasternodeVerifyStats& stats) const;
+};
+
+extern CMasternodeVerifyQueue masternodeVerifyQueue;
+
+#endif // MASTERNODE_VERIFY_H
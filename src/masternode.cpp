@@ -15,10 +15,14 @@
 #include <boost/lexical_cast.hpp>
 
 // cache block hashes as we calculate them
-std::map<int64_t, uint256> mapCacheBlockHashes;
+CBlockHashCache blockHashCache;
 
-//Get the last hash that matches the modulus given. Processed in reverse order
-bool GetBlockHash(uint256& hash, int nBlockHeight)
+CBlockHashCache::CBlockHashCache(size_t nSlots) : vSlots(std::max(nSlots, (size_t)1), std::make_pair(-1, uint256())),
+                                                  nGeneration(0), nLookups(0), nHits(0), nInvalidated(0)
+{
+}
+
+bool CBlockHashCache::Get(uint256& hash, int nBlockHeight)
 {
     auto active_tip = chainActive.Tip();
 
@@ -31,26 +35,69 @@ bool GetBlockHash(uint256& hash, int nBlockHeight)
     if(active_tip->nHeight < nBlockHeight)
         return false;
 
-    const auto& cached_hash = mapCacheBlockHashes.find(nBlockHeight);
+    uint64_t nGenerationRead;
+    {
+        LOCK(cs);
+        ++nLookups;
+
+        const auto& slot = vSlots[nBlockHeight % vSlots.size()];
 
-    if(cached_hash != mapCacheBlockHashes.cend()) {
-        hash = cached_hash->second;
-        return true;
+        if(slot.first == nBlockHeight) {
+            ++nHits;
+            hash = slot.second;
+            return true;
+        }
+
+        nGenerationRead = nGeneration;
     }
 
-    for(auto BlockReading = active_tip; BlockReading; BlockReading = BlockReading->pprev) {
+    const CBlockIndex* pindex = chainActive[nBlockHeight];
 
-        if(BlockReading->nHeight != nBlockHeight)
-            continue;
+    if(!pindex)
+        return false;
 
-        auto ins_res = mapCacheBlockHashes.emplace(nBlockHeight, BlockReading->GetBlockHash());
+    hash = pindex->GetBlockHash();
 
-        hash = ins_res.first->second;
+    LOCK(cs);
+    if(nGeneration == nGenerationRead)
+        vSlots[nBlockHeight % vSlots.size()] = std::make_pair(nBlockHeight, hash);
 
-        return true;
+    return true;
+}
+
+void CBlockHashCache::BlockDisconnected(const CBlockIndex* pindex)
+{
+    LOCK(cs);
+    ++nGeneration;
+
+    // heights above the tip are never looked up, so the disconnected one is the only one that can be held
+    auto& slot = vSlots[pindex->nHeight % vSlots.size()];
+
+    if(slot.first == pindex->nHeight) {
+        slot.first = -1;
+        ++nInvalidated;
     }
+}
 
-    return false;
+void CBlockHashCache::Clear()
+{
+    LOCK(cs);
+    ++nGeneration;
+    std::fill(vSlots.begin(), vSlots.end(), std::make_pair(-1, uint256()));
+}
+
+void CBlockHashCache::GetStats(CBlockHashCacheStats& stats) const
+{
+    LOCK(cs);
+    stats.nSlots = vSlots.size();
+    stats.nLookups = nLookups;
+    stats.nHits = nHits;
+    stats.nInvalidated = nInvalidated;
+}
+
+bool GetBlockHash(uint256& hash, int nBlockHeight)
+{
+    return blockHashCache.Get(hash, nBlockHeight);
 }
 
 CMasternode::CMasternode()
@@ -152,7 +199,7 @@ bool CMasternode::UpdateFromNewBroadcast(CMasternodeBroadcast& mnb)
 // the proof of work for that block. The further away they are the better, the furthest will win the election
 // and get paid this block
 //
-uint256 CMasternode::CalculateScore(int mod, int64_t nBlockHeight)
+uint256 CMasternode::CalculateScore(int mod, int64_t nBlockHeight) const
 {
     if (chainActive.Tip() == NULL) return 0;
 
@@ -203,43 +250,24 @@ void CMasternode::Check(bool forceCheck)
     }
 
     if (!unitTest) {
-
-/*
-        CMutableTransaction tx = CMutableTransaction();
-        CTxOut vout = CTxOut(9999.99 * COIN, obfuScationPool.collateralPubKey);
-        tx.vin.push_back(vin);
-        tx.vout.push_back(vout);
-*/
-        CMutableTransaction tx;
-
-        CValidationState state = CMasternodeMan::GetInputCheckingTx(vin, tx);
-
-        if(!state.IsValid()) {
+        // the collateral is watched from when the masternode is added
+        bool fWatched;
+        if (!collateralWatch.IsUnspent(vin.prevout, fWatched)) {
+            if (!fWatched)
+                LogPrint("masternode", "CMasternode::Check - collateral %s is not watched\n", vin.prevout.ToString());
             activeState = MASTERNODE_VIN_SPENT;
             return;
         }
-
-        {
-            TRY_LOCK(cs_main, lockMain);
-
-            if (!lockMain)
-                return;
-
-            if (!AcceptableInputs(mempool, state, CTransaction(tx), false, nullptr)) {
-                activeState = MASTERNODE_VIN_SPENT;
-                return;
-            }
-        }
     }
 
     activeState = MASTERNODE_ENABLED; // OK
 }
 
 //int64_t CMasternode::SecondsSincePayment(bool test)
-int64_t CMasternode::SecondsSincePayment()
+int64_t CMasternode::SecondsSincePayment(int nEnabledCount)
 {
 //    int64_t sec = (GetAdjustedTime() - GetLastPaid(test));
-    int64_t sec = (GetAdjustedTime() - GetLastPaid());
+    int64_t sec = (GetAdjustedTime() - GetLastPaid(nEnabledCount));
     int64_t month = 60 * 60 * 24 * 30;
 
     if (sec < month)
@@ -255,7 +283,7 @@ int64_t CMasternode::SecondsSincePayment()
 }
 
 //int64_t CMasternode::GetLastPaid(bool test)
-int64_t CMasternode::GetLastPaid()
+int64_t CMasternode::GetLastPaid(int nEnabledCount)
 {
     CBlockIndex* pindexPrev = chainActive.Tip();
 
@@ -273,31 +301,21 @@ int64_t CMasternode::GetLastPaid()
     // use a deterministic offset to break a tie -- 1.5 minutes
     int64_t nOffset = hash.GetCompact(false) % 90;
 
-    const CBlockIndex* BlockReading = pindexPrev;
+    if (nEnabledCount < 0)
+        nEnabledCount = mnodeman.CountEnabled(Level());
 
-    int nMnCount = 0;
-    nMnCount = int(mnodeman.CountEnabled(Level()) * 1.25); // new
+    int nMnCount = int(nEnabledCount * 1.25);
 
-    int n = 0;
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-        if (n >= nMnCount) {
-            return 0;
-        }
-        n++;
-
-        if (masternodePayments.mapMasternodeBlocks.count(BlockReading->nHeight)) {
-            /*
-                Search for this payee, with at least 6 votes.
-            */
-            if (masternodePayments.mapMasternodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(mnpayee, 6)) {
-                return BlockReading->nTime - nOffset;
-            }
-        }
+    /*
+        Last block within the last nMnCount blocks where this payee had at least 6 votes.
+        The index is keyed by height, so it follows the active chain as blocks are connected and disconnected.
+    */
+    int nPaidHeight = masternodePayments.GetLastPaidHeight(mnpayee, pindexPrev->nHeight, nMnCount);
 
-        BlockReading = BlockReading->pprev;
-    }
+    if (!nPaidHeight)
+        return 0;
 
-    return 0;
+    return chainActive[nPaidHeight]->nTime - nOffset;
 }
 
 bool CMasternode::IsValidNetAddr()
@@ -510,7 +528,7 @@ bool CMasternodeBroadcast::CheckDefaultPort(const CService& service, std::string
     return true;
 }
 
-bool CMasternodeBroadcast::CheckAndUpdate(int& nDos)
+bool CMasternodeBroadcast::CheckAndUpdate(int& nDos, bool fSignatureChecked)
 {
     // make sure signature isn't in the future (past is OK)
     if (sigTime > GetAdjustedTime() + 60 * 60) {
@@ -519,10 +537,6 @@ bool CMasternodeBroadcast::CheckAndUpdate(int& nDos)
         return false;
     }
 
-    std::string vchPubKey(pubKeyCollateralAddress.begin(), pubKeyCollateralAddress.end());
-    std::string vchPubKey2(pubKeyMasternode.begin(), pubKeyMasternode.end());
-    std::string strMessage = addr.ToString() + boost::lexical_cast<std::string>(sigTime) + vchPubKey + vchPubKey2 + boost::lexical_cast<std::string>(protocolVersion);
-
     if (protocolVersion < masternodePayments.GetMinMasternodePaymentsProto()) {
         LogPrintf("mnb - ignoring outdated Masternode %s protocol version %d\n", vin.prevout.hash.ToString(), protocolVersion);
         return false;
@@ -553,7 +567,7 @@ bool CMasternodeBroadcast::CheckAndUpdate(int& nDos)
 
     std::string errorMessage = "";
 
-    if (!obfuScationSigner.VerifyMessage(pubKeyCollateralAddress, sig, strMessage, errorMessage)) {
+    if (!fSignatureChecked && !VerifySignature()) {
         LogPrintf("mnb - Got bad Masternode address signature\n");
         nDos = 100;
         return false;
@@ -584,8 +598,8 @@ bool CMasternodeBroadcast::CheckAndUpdate(int& nDos)
     if (pmn->pubKeyCollateralAddress == pubKeyCollateralAddress && !pmn->IsBroadcastedWithin(MASTERNODE_MIN_MNB_SECONDS)) {
         //take the newest entry
         LogPrint("masternode","mnb - Got updated entry for %s\n", vin.prevout.hash.ToString());
-        if (pmn->UpdateFromNewBroadcast((*this))) {
-            pmn->Check();
+        if (mnodeman.UpdateFromNewBroadcast(*pmn, *this)) {
+            mnodeman.CheckMasternode(*pmn);
             if (pmn->IsEnabled()) Relay();
         }
         masternodeSync.AddedMasternodeList(GetHash());
@@ -641,6 +655,9 @@ bool CMasternodeBroadcast::CheckInputsAndAdd(int& nDoS)
             state.IsInvalid(nDoS);
             return false;
         }
+
+        // the blocks keep the collateral current from here on, for the checks of the masternode
+        collateralWatch.Watch(vin.prevout);
     }
 
     LogPrint("masternode", "mnb - Accepted Masternode entry\n");
@@ -691,6 +708,18 @@ bool CMasternodeBroadcast::CheckInputsAndAdd(int& nDoS)
     return true;
 }
 
+bool CMasternodeBroadcast::VerifySignature()
+{
+    std::string errorMessage;
+
+    std::string vchPubKey(pubKeyCollateralAddress.begin(), pubKeyCollateralAddress.end());
+    std::string vchPubKey2(pubKeyMasternode.begin(), pubKeyMasternode.end());
+
+    std::string strMessage = addr.ToString() + boost::lexical_cast<std::string>(sigTime) + vchPubKey + vchPubKey2 + boost::lexical_cast<std::string>(protocolVersion);
+
+    return obfuScationSigner.VerifyMessage(pubKeyCollateralAddress, sig, strMessage, errorMessage);
+}
+
 void CMasternodeBroadcast::Relay()
 {
     CInv inv(MSG_MASTERNODE_ANNOUNCE, GetHash());
@@ -759,7 +788,16 @@ bool CMasternodePing::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     return true;
 }
 
-bool CMasternodePing::CheckAndUpdate(int& nDos, bool fRequireEnabled)
+bool CMasternodePing::VerifySignature(const CPubKey& pubKeyMasternode)
+{
+    std::string errorMessage;
+
+    std::string strMessage = vin.ToString() + blockHash.ToString() + boost::lexical_cast<std::string>(sigTime);
+
+    return obfuScationSigner.VerifyMessage(pubKeyMasternode, vchSig, strMessage, errorMessage);
+}
+
+bool CMasternodePing::CheckAndUpdate(int& nDos, bool fRequireEnabled, const CPubKey& pubKeySigned)
 {
     if (sigTime > GetAdjustedTime() + 60 * 60) {
         LogPrintf("CMasternodePing::CheckAndUpdate - Signature rejected, too far into the future %s\n", vin.prevout.hash.ToString());
@@ -790,10 +828,9 @@ bool CMasternodePing::CheckAndUpdate(int& nDos, bool fRequireEnabled)
         // update only if there is no known ping for this masternode or
         // last ping was more then MASTERNODE_MIN_MNP_SECONDS-60 ago comparing to this one
         if (!pmn->IsPingedWithin((ActiveProtocol() >= CONSENSUS_FORK_PROTO) ? MASTERNODE_MIN_MNP_SECONDS2 - 60 : MASTERNODE_MIN_MNP_SECONDS - 60, sigTime)) {
-            std::string strMessage = vin.ToString() + blockHash.ToString() + boost::lexical_cast<std::string>(sigTime);
-
-            std::string errorMessage = "";
-            if (!obfuScationSigner.VerifyMessage(pmn->pubKeyMasternode, vchSig, strMessage, errorMessage)) {
+            // the verify queue checked the signature already if the masternode key is still the same
+            bool fSignatureChecked = pubKeySigned.IsValid() && pubKeySigned == pmn->pubKeyMasternode;
+            if (!fSignatureChecked && !VerifySignature(pmn->pubKeyMasternode)) {
                 LogPrintf("CMasternodePing::CheckAndUpdate - Got bad Masternode address signature %s\n", vin.prevout.hash.ToString());
                 nDos = 33;
                 return false;
@@ -827,12 +864,12 @@ bool CMasternodePing::CheckAndUpdate(int& nDos, bool fRequireEnabled)
 
             if (IsSporkActive(SPORK_7_MN_REBROADCAST_ENFORCEMENT)) {
             //dirty hack //
-            pmn->UpdateFromNewBroadcast(mnb);
+            mnodeman.UpdateFromNewBroadcast(*pmn, mnb);
             mnb.Relay();
             //////////////
             }
 
-            pmn->Check(true);
+            mnodeman.CheckMasternode(*pmn, true);
             if (!pmn->IsEnabled()) return false;
 
             LogPrint("masternode", "CMasternodePing::CheckAndUpdate - Masternode ping accepted, vin: %s\n", vin.prevout.hash.ToString());
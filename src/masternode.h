@@ -24,13 +24,54 @@
 #define MASTERNODE_EXPIRATION_SECONDS (120 * 60)
 #define MASTERNODE_REMOVAL_SECONDS (130 * 60)
 #define MASTERNODE_CHECK_SECONDS 5
+// heights the block hash cache holds
+#define MASTERNODE_BLOCK_HASH_CACHE_SIZE 4096
 
 using namespace std;
 
 class CMasternode;
 class CMasternodeBroadcast;
 class CMasternodePing;
-extern map<int64_t, uint256> mapCacheBlockHashes;
+
+struct CBlockHashCacheStats {
+    uint64_t nSlots;
+    uint64_t nLookups;
+    uint64_t nHits;
+    //! heights dropped because their block was disconnected
+    uint64_t nInvalidated;
+};
+
+/**
+ * Hashes of the active chain's blocks by height, as the masternode scores, payments
+ * and swifttx votes look them up. Each of a fixed number of slots holds the last
+ * height looked up that falls on it. A block that is disconnected leaves the cache,
+ * so a reorganization never leaves a stale hash behind; a miss is read from
+ * chainActive by height.
+ */
+class CBlockHashCache
+{
+private:
+    mutable CCriticalSection cs;
+    std::vector<std::pair<int, uint256> > vSlots;
+    //! bumped by every disconnected block, so that a miss read across one is not stored
+    uint64_t nGeneration;
+    uint64_t nLookups;
+    uint64_t nHits;
+    uint64_t nInvalidated;
+
+public:
+    CBlockHashCache(size_t nSlots = MASTERNODE_BLOCK_HASH_CACHE_SIZE);
+
+    /// Hash of the active chain's block at nBlockHeight, or at the tip if nBlockHeight <= 0
+    bool Get(uint256& hash, int nBlockHeight);
+    /// Drop the height of a block disconnected from the tip
+    void BlockDisconnected(const CBlockIndex* pindex);
+    /// Drop every height, after the active chain was replaced other than block by block
+    void Clear();
+    void GetStats(CBlockHashCacheStats& stats) const;
+};
+
+extern CBlockHashCache blockHashCache;
 
 bool GetBlockHash(uint256& hash, int nBlockHeight);
 
@@ -62,8 +103,10 @@ public:
         READWRITE(vchSig);
     }
 
-    bool CheckAndUpdate(int& nDos, bool fRequireEnabled = true);
+    /// pubKeySigned is a masternode key the signature was already found valid for
+    bool CheckAndUpdate(int& nDos, bool fRequireEnabled = true, const CPubKey& pubKeySigned = CPubKey());
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
+    bool VerifySignature(const CPubKey& pubKeyMasternode);
     void Relay();
 
     uint256 GetHash()
@@ -192,7 +235,7 @@ public:
         return !(a.vin == b.vin);
     }
 
-    uint256 CalculateScore(int mod = 1, int64_t nBlockHeight = 0);
+    uint256 CalculateScore(int mod = 1, int64_t nBlockHeight = 0) const;
 
     ADD_SERIALIZE_METHODS;
 
@@ -219,7 +262,8 @@ public:
     }
 
 //    int64_t SecondsSincePayment(bool test = false);
-    int64_t SecondsSincePayment();
+    // nEnabledCount: enabled masternodes of this level, counted here when -1
+    int64_t SecondsSincePayment(int nEnabledCount = -1);
 
     bool UpdateFromNewBroadcast(CMasternodeBroadcast& mnb);
 
@@ -230,6 +274,15 @@ public:
         return (GetAdjustedTime() - sigTime) < seconds;
     }
 
+    /// Hash of the broadcast the masternode was listed from, as CMasternodeBroadcast::GetHash
+    uint256 GetBroadcastHash() const
+    {
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << sigTime;
+        ss << pubKeyCollateralAddress;
+        return ss.GetHash();
+    }
+
     bool IsPingedWithin(int seconds, int64_t now = -1)
     {
         now == -1 ? now = GetAdjustedTime() : now;
@@ -263,7 +316,7 @@ public:
         return cacheInputAge + (chain_tip->nHeight - cacheInputAgeBlock);
     }
 
-    std::string Status()
+    std::string Status() const
     {
         std::string strStatus = "ACTIVE";
 
@@ -275,13 +328,13 @@ public:
         return strStatus;
     }
 
-    unsigned Level()
+    unsigned Level() const
     {
         return Level(deposit, chainActive.Height());
     }
 
 //    int64_t GetLastPaid(bool test = false);
-    int64_t GetLastPaid();
+    int64_t GetLastPaid(int nEnabledCount = -1);
     bool IsValidNetAddr();
 };
 
@@ -297,9 +350,11 @@ public:
     CMasternodeBroadcast(CService newAddr, CTxIn newVin, CPubKey newPubkey, CPubKey newPubkey2, int protocolVersionIn);
     CMasternodeBroadcast(const CMasternode& mn);
 
-    bool CheckAndUpdate(int& nDoS);
+    /// fSignatureChecked if the signature was already found valid
+    bool CheckAndUpdate(int& nDoS, bool fSignatureChecked = false);
     bool CheckInputsAndAdd(int& nDos);
     bool Sign(CKey& keyCollateralAddress);
+    bool VerifySignature();
     void Relay();
 
     ADD_SERIALIZE_METHODS;
@@ -8,6 +8,7 @@
 #include "activemasternode.h"
 #include "addrman.h"
 #include "masternode.h"
+#include "masternode-verify.h"
 #include "obfuscation.h"
 #include "spork.h"
 #include "util.h"
@@ -16,30 +17,145 @@
 
 /** Masternode manager */
 CMasternodeMan mnodeman;
+/** Masternode collaterals */
+CCollateralWatch collateralWatch;
 
 struct CompareLastPaid {
-    bool operator()(const pair<int64_t, CTxIn>& t1,
-        const pair<int64_t, CTxIn>& t2) const
+    bool operator()(const pair<int64_t, CMasternode*>& t1,
+        const pair<int64_t, CMasternode*>& t2) const
     {
         return t1.first < t2.first;
     }
 };
 
-struct CompareScoreTxIn {
-    bool operator()(const pair<int64_t, CTxIn>& t1,
-        const pair<int64_t, CTxIn>& t2) const
+// best score first, ties in list order
+struct CompareRankEntry {
+    bool operator()(const pair<int64_t, unsigned>& t1,
+        const pair<int64_t, unsigned>& t2) const
     {
-        return t1.first < t2.first;
+        return t1.first > t2.first || (t1.first == t2.first && t1.second < t2.second);
     }
 };
 
-struct CompareScoreMN {
-    bool operator()(const pair<int64_t, CMasternode>& t1,
-        const pair<int64_t, CMasternode>& t2) const
+// Entry nPos of the table in rank order, sorting only as far as needed to know it
+static const pair<int64_t, unsigned>& GetRanked(CMasternodeRankTable& table, size_t nPos)
+{
+    if (nPos >= table.nSorted) {
+        size_t nSort = std::min(std::max<size_t>(std::max<size_t>(2 * table.nSorted, 32), nPos + 1), table.vecScores.size());
+        partial_sort(table.vecScores.begin() + table.nSorted, table.vecScores.begin() + nSort, table.vecScores.end(), CompareRankEntry());
+        table.nSorted = nSort;
+    }
+    return table.vecScores[nPos];
+}
+
+//
+// CCollateralWatch
+//
+
+bool CCollateralWatch::IsUnspent(const COutPoint& outpoint, bool& fWatched) const
+{
     {
-        return t1.first < t2.first;
+        LOCK(cs);
+        auto it = mapWatched.find(outpoint);
+        fWatched = it != mapWatched.end();
+        if (!fWatched || it->second.fSpent || !it->second.fValid)
+            return false;
     }
-};
+    return !mempool.isSpent(outpoint);
+}
+
+// A deposit amount to no filtered address
+static bool IsValidCollateral(const CTxOut& out)
+{
+    CTxDestination dest;
+    return CMasternode::IsDepositCoins(out.nValue) &&
+           (IsInitialBlockDownload() || !IsTxFilterScript(out.scriptPubKey, 0, dest));
+}
+
+bool CCollateralWatch::Watch(const COutPoint& outpoint)
+{
+    AssertLockHeld(cs_main);
+
+    CEntry entry;
+    CCoins coins;
+    entry.fSpent = !pcoinsTip->GetCoins(outpoint.hash, coins) || !coins.IsAvailable(outpoint.n);
+    // an output not in the chain state holds nothing to check until a block brings it
+    entry.fValid = !entry.fSpent && IsValidCollateral(coins.vout[outpoint.n]);
+
+    {
+        LOCK(cs);
+        mapWatched[outpoint] = entry;
+    }
+    return entry.fValid && !entry.fSpent && !mempool.isSpent(outpoint);
+}
+
+void CCollateralWatch::Retain(const std::set<COutPoint>& setOutpoints)
+{
+    LOCK(cs);
+    auto it = mapWatched.begin();
+    while (it != mapWatched.end()) {
+        if (setOutpoints.count(it->first))
+            ++it;
+        else
+            mapWatched.erase(it++);
+    }
+}
+
+void CCollateralWatch::Clear()
+{
+    LOCK(cs);
+    mapWatched.clear();
+}
+
+size_t CCollateralWatch::size() const
+{
+    LOCK(cs);
+    return mapWatched.size();
+}
+
+void CCollateralWatch::BlockConnected(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs);
+    if (mapWatched.empty())
+        return;
+
+    for (const CTransaction& tx : block.vtx) {
+        // outputs the block brings back, after a reorganization
+        uint256 hash = tx.GetHash();
+        for (auto it = mapWatched.lower_bound(COutPoint(hash, 0)); it != mapWatched.end() && it->first.hash == hash; ++it) {
+            if (it->first.n < tx.vout.size()) {
+                it->second.fSpent = false;
+                it->second.fValid = IsValidCollateral(tx.vout[it->first.n]);
+            }
+        }
+        for (const CTxIn& txin : tx.vin) {
+            auto it = mapWatched.find(txin.prevout);
+            if (it != mapWatched.end())
+                it->second.fSpent = true;
+        }
+    }
+}
+
+void CCollateralWatch::BlockDisconnected(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs);
+    if (mapWatched.empty())
+        return;
+
+    for (auto tx = block.vtx.rbegin(); tx != block.vtx.rend(); ++tx) {
+        for (const CTxIn& txin : tx->vin) {
+            auto it = mapWatched.find(txin.prevout);
+            if (it != mapWatched.end())
+                it->second.fSpent = false;
+        }
+        // outputs of the block are gone with it
+        uint256 hash = tx->GetHash();
+        for (auto it = mapWatched.lower_bound(COutPoint(hash, 0)); it != mapWatched.end() && it->first.hash == hash; ++it)
+            it->second.fSpent = true;
+    }
+}
 
 //
 // CMasternodeDB
@@ -48,7 +164,8 @@ struct CompareScoreMN {
 CMasternodeDB::CMasternodeDB()
 {
     pathMN = GetDataDir() / "mncache.dat";
-    strMagicMessage = "MasternodeCache";
+    strMagicMessage = "MasternodeSnapshot";
+    strMagicMessageLegacy = "MasternodeCache";
 }
 
 bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
@@ -59,15 +176,18 @@ bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
     CDataStream ssMasternodes(SER_DISK, CLIENT_VERSION);
     ssMasternodes << strMagicMessage;                   // masternode cache file specific magic message
     ssMasternodes << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssMasternodes << mnodemanToSave;
+    ssMasternodes << MASTERNODES_SNAPSHOT_VERSION;
+    const_cast<CMasternodeMan&>(mnodemanToSave).WriteSnapshot(ssMasternodes);
     uint256 hash = Hash(ssMasternodes.begin(), ssMasternodes.end());
     ssMasternodes << hash;
 
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathMN.string().c_str(), "wb");
+    // write to a new file and move it over the old one, which stays whole if this fails
+    boost::filesystem::path pathTmp = pathMN;
+    pathTmp += ".new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
     CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathMN.string());
+        return error("%s : Failed to open file %s", __func__, pathTmp.string());
 
     // Write and commit header, data
     try {
@@ -75,10 +195,13 @@ bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
     } catch (std::exception& e) {
         return error("%s : Serialize or I/O error - %s", __func__, e.what());
     }
-    //    FileCommit(fileout);
+    FileCommit(fileout.Get());
     fileout.fclose();
 
-    LogPrintf("Written info to mncache.dat  %dms\n", GetTimeMillis() - nStart);
+    if (!RenameOver(pathTmp, pathMN))
+        return error("%s : Rename-into-place failed", __func__);
+
+    LogPrintf("Written info to mncache.dat  %dms, %u bytes\n", GetTimeMillis() - nStart, ssMasternodes.size());
     LogPrintf("  %s\n", mnodemanToSave.ToString());
 
     return true;
@@ -132,7 +255,8 @@ CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad, bo
         ssMasternodes >> strMagicMessageTmp;
 
         // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
+        bool fLegacy = strMagicMessageTmp == strMagicMessageLegacy;
+        if (strMagicMessage != strMagicMessageTmp && !fLegacy) {
             error("%s : Invalid masternode cache magic message", __func__);
             return IncorrectMagicMessage;
         }
@@ -145,8 +269,25 @@ CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad, bo
             error("%s : Invalid network magic number", __func__);
             return IncorrectMagicNumber;
         }
+
+        int nVersion = 0;
+        if (!fLegacy) {
+            ssMasternodes >> nVersion;
+            if (nVersion > MASTERNODES_SNAPSHOT_VERSION) {
+                error("%s : Unknown masternode snapshot version %d", __func__, nVersion);
+                return IncorrectFormat;
+            }
+        }
+
+        // the header is all a dry run needs to know the file may be replaced
+        if (fDryRun)
+            return Ok;
+
         // de-serialize data into CMasternodeMan object
-        ssMasternodes >> mnodemanToLoad;
+        if (fLegacy)
+            ssMasternodes >> mnodemanToLoad;
+        else
+            mnodemanToLoad.ReadSnapshot(ssMasternodes);
     } catch (std::exception& e) {
         mnodemanToLoad.Clear();
         error("%s : Deserialize or I/O error - %s", __func__, e.what());
@@ -195,6 +336,8 @@ void DumpMasternodes()
 CMasternodeMan::CMasternodeMan()
 {
     nDsqCount = 0;
+    nTimeChecked = 0;
+    nSnapshotTime = 0;
 }
 
 CValidationState CMasternodeMan::GetInputCheckingTx(const CTxIn& vin, CMutableTransaction& tx)
@@ -230,13 +373,76 @@ bool CMasternodeMan::Add(const CMasternode& mn)
 
     LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
     vMasternodes.push_back(mn);
+    IndexMasternode(vMasternodes.size() - 1);
+    mapRankTables.clear();
+    snapshot.reset();
     return true;
 }
 
-std::vector<CMasternode> CMasternodeMan::GetFullMasternodeMap()
+void CMasternodeMan::IndexMasternode(unsigned nPos)
+{
+    CMasternode& mn = vMasternodes[nPos];
+    mapIndexVin.emplace(mn.vin.prevout, nPos);
+    mapIndexPubKey.emplace(mn.pubKeyMasternode, nPos);
+    mapIndexAddr.emplace(mn.addr, nPos);
+    mapIndexPayee.emplace(mn.pubKeyCollateralAddress.GetID(), nPos);
+    mapIndexBroadcast.emplace(mn.GetBroadcastHash(), nPos);
+    ++mapLevelCount[mn.Level()];
+    CountEnabledMasternode(mn);
+}
+
+void CMasternodeMan::CountEnabledMasternode(const CMasternode& mn)
+{
+    // take the masternode out of the count it was last put in, which a check
+    // nested in a broadcast update may already have moved it from
+    auto counted = mapEnabledCounted.find(mn.vin.prevout);
+    if (counted != mapEnabledCounted.end()) {
+        auto count = mapEnabledCount.find(counted->second);
+        if (count != mapEnabledCount.end() && --count->second == 0)
+            mapEnabledCount.erase(count);
+        mapEnabledCounted.erase(counted);
+    }
+
+    if (!mn.IsEnabled())
+        return;
+
+    auto key = std::make_pair(mn.Level(), mn.protocolVersion);
+    ++mapEnabledCount[key];
+    mapEnabledCounted.emplace(mn.vin.prevout, key);
+}
+
+void CMasternodeMan::Reindex()
+{
+    mapIndexVin.clear();
+    mapIndexPubKey.clear();
+    mapIndexAddr.clear();
+    mapIndexPayee.clear();
+    mapIndexBroadcast.clear();
+    mapLevelCount.clear();
+    mapEnabledCount.clear();
+    mapEnabledCounted.clear();
+    mapRankTables.clear();
+    snapshot.reset();
+
+    mapIndexVin.reserve(vMasternodes.size());
+    mapIndexPubKey.reserve(vMasternodes.size());
+    mapIndexAddr.reserve(vMasternodes.size());
+    mapIndexPayee.reserve(vMasternodes.size());
+    mapIndexBroadcast.reserve(vMasternodes.size());
+    for (unsigned i = 0; i < vMasternodes.size(); ++i)
+        IndexMasternode(i);
+}
+
+std::shared_ptr<const std::vector<CMasternode> > CMasternodeMan::GetSnapshot()
 {
     LOCK(cs);
-    return vMasternodes;
+
+    if (!snapshot || GetTime() - nSnapshotTime >= MASTERNODE_CHECK_SECONDS) {
+        Check();
+        snapshot = std::make_shared<const std::vector<CMasternode> >(vMasternodes);
+        nSnapshotTime = GetTime();
+    }
+    return snapshot;
 }
 
 void CMasternodeMan::AskForMN(CNode* pnode, CTxIn& vin)
@@ -260,8 +466,24 @@ void CMasternodeMan::Check()
     LOCK(cs);
 
     for (CMasternode& mn : vMasternodes) {
-        mn.Check();
+        CheckMasternode(mn);
     }
+    nTimeChecked = GetTime();
+}
+
+void CMasternodeMan::CheckMasternode(CMasternode& mn, bool forceCheck)
+{
+    LOCK(cs);
+
+    mn.Check(forceCheck);
+    CountEnabledMasternode(mn);
+}
+
+void CMasternodeMan::CheckIfStale()
+{
+    // a masternode expires by the clock alone, so the counts are only as current as the last check
+    if (GetTime() - nTimeChecked >= MASTERNODE_CHECK_SECONDS)
+        Check();
 }
 
 void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
@@ -271,6 +493,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
     LOCK(cs);
 
     //remove inactive and outdated
+    bool fRemoved = false;
     vector<CMasternode>::iterator it = vMasternodes.begin();
     while (it != vMasternodes.end()) {
         if ((*it).activeState == CMasternode::MASTERNODE_REMOVE ||
@@ -303,11 +526,21 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             it = vMasternodes.erase(it);
+            fRemoved = true;
         } else {
             ++it;
         }
     }
 
+    if (fRemoved)
+        Reindex();
+
+    // stop watching the collaterals of removed masternodes
+    std::set<COutPoint> setCollaterals;
+    for (const CMasternode& mn : vMasternodes)
+        setCollaterals.insert(mn.vin.prevout);
+    collateralWatch.Retain(setCollaterals);
+
     // check who's asked for the Masternode list
     map<CNetAddr, int64_t>::iterator it1 = mAskedUsForMasternodeList.begin();
     while (it1 != mAskedUsForMasternodeList.end()) {
@@ -380,10 +613,65 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
     }
 }
 
+void CMasternodeMan::WriteSnapshot(CDataStream& ss)
+{
+    LOCK(cs);
+
+    unsigned nLive = std::count_if(vMasternodes.begin(), vMasternodes.end(), [](const CMasternode& mn) {
+        return mn.activeState != CMasternode::MASTERNODE_REMOVE && mn.activeState != CMasternode::MASTERNODE_VIN_SPENT;
+    });
+
+    WriteCompactSize(ss, nLive);
+    for (CMasternode& mn : vMasternodes) {
+        if (mn.activeState != CMasternode::MASTERNODE_REMOVE && mn.activeState != CMasternode::MASTERNODE_VIN_SPENT)
+            ss << CMasternodeSnapshotEntry(mn);
+    }
+
+    ss << mAskedUsForMasternodeList;
+    ss << mWeAskedForMasternodeList;
+    ss << mWeAskedForMasternodeListEntry;
+    ss << mAskedUsForWinnerMasternodeList;
+    ss << mWeAskedForWinnerMasternodeList;
+    ss << nDsqCount;
+}
+
+void CMasternodeMan::ReadSnapshot(CDataStream& ss)
+{
+    LOCK(cs);
+
+    Clear();
+
+    uint64_t nCount = ReadCompactSize(ss);
+    for (uint64_t i = 0; i < nCount; i++) {
+        CMasternode mn;
+        ss >> REF(CMasternodeSnapshotEntry(mn));
+        vMasternodes.push_back(mn);
+    }
+    Reindex();
+
+    ss >> mAskedUsForMasternodeList;
+    ss >> mWeAskedForMasternodeList;
+    ss >> mWeAskedForMasternodeListEntry;
+    ss >> mAskedUsForWinnerMasternodeList;
+    ss >> mWeAskedForWinnerMasternodeList;
+    ss >> nDsqCount;
+}
+
+void CMasternodeMan::WatchCollaterals()
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs);
+
+    for (const CMasternode& mn : vMasternodes)
+        collateralWatch.Watch(mn.vin.prevout);
+}
+
 void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    Reindex();
+    // the watched collaterals are the global list's, dropped by CheckAndRemove once it no longer holds them
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -396,19 +684,19 @@ void CMasternodeMan::Clear()
 
 int CMasternodeMan::size(unsigned mnlevel)
 {
-    auto check_level = mnlevel != CMasternode::LevelValue::UNSPECIFIED;
-
-    return std::count_if(vMasternodes.begin(), vMasternodes.end(), [=](CMasternode& mn){
+    LOCK(cs);
 
-        if(check_level && mnlevel != mn.Level())
-            return false;
+    if(mnlevel == CMasternode::LevelValue::UNSPECIFIED)
+        return vMasternodes.size();
 
-        return true;
-    });
+    auto it = mapLevelCount.find(mnlevel);
+    return it != mapLevelCount.end() ? it->second : 0;
 }
 
 int CMasternodeMan::stable_size(unsigned mnlevel)
 {
+    LOCK(cs);
+
     int nStable_size = 0;
     int nMinProtocol = ActiveProtocol();
     int64_t nMasternode_Min_Age = GetSporkValue(SPORK_6_MN_WINNER_MINIMUM_AGE);
@@ -432,7 +720,7 @@ int CMasternodeMan::stable_size(unsigned mnlevel)
                 continue; // Skip masternodes younger than (default) 8000 sec (MUST be > MASTERNODE_REMOVAL_SECONDS)
         }
 
-        mn.Check();
+        CheckMasternode(mn);
 
         if(!mn.IsEnabled())
             continue; // Skip not-enabled masternodes
@@ -450,15 +738,20 @@ unsigned CMasternodeMan::CountEnabled(unsigned mnlevel, int protocolVersion)
 
     auto check_level = mnlevel != CMasternode::LevelValue::UNSPECIFIED;
 
-    return std::count_if(vMasternodes.begin(), vMasternodes.end(), [=](CMasternode& mn){
+    LOCK(cs);
+    CheckIfStale();
 
-        mn.Check();
+    unsigned nCount = 0;
+    for(const auto& count : mapEnabledCount) {
 
-        if(check_level && mnlevel != mn.Level())
-            return false;
+        if(check_level && mnlevel != count.first.first)
+            continue;
 
-        return mn.protocolVersion >= protocolVersion && mn.IsEnabled();
-    });
+        if(count.first.second >= protocolVersion)
+            nCount += count.second;
+    }
+
+    return nCount;
 }
 
 std::map<unsigned, unsigned> CMasternodeMan::CountEnabledByLevels(int protocolVersion)
@@ -471,17 +764,14 @@ std::map<unsigned, unsigned> CMasternodeMan::CountEnabledByLevels(int protocolVe
     for(unsigned l = CMasternode::LevelValue::MIN; l <= CMasternode::LevelValue::MAX; ++l)
         result.emplace(l, 0u);
 
-    for(auto& mn : vMasternodes)
-    {
-        mn.Check();
-
-        bool enabled = mn.protocolVersion >= protocolVersion && mn.IsEnabled();
-
-        if(!enabled)
-            continue;
+    LOCK(cs);
+    CheckIfStale();
 
-        ++result[mn.Level()];
-    };
+    for(const auto& count : mapEnabledCount)
+    {
+        if(count.first.second >= protocolVersion)
+            result[count.first.first] += count.second;
+    }
 
     return result;
 }
@@ -490,8 +780,10 @@ void CMasternodeMan::CountNetworks(int protocolVersion, int& ipv4, int& ipv6, in
 {
     protocolVersion = protocolVersion == -1 ? masternodePayments.GetMinMasternodePaymentsProto() : protocolVersion;
 
+    LOCK(cs);
+
     for (CMasternode& mn : vMasternodes) {
-        mn.Check();
+        CheckMasternode(mn);
         std::string strHost;
         int port;
         SplitHostPort(mn.addr.ToString(), port, strHost);
@@ -564,28 +856,42 @@ bool CMasternodeMan::WinnersUpdate(CNode* node)
     return true;
 }
 
+bool CMasternodeMan::HaveBroadcast(const uint256& hash)
+{
+    LOCK(cs);
+
+    auto it = mapIndexBroadcast.find(hash);
+    if (it == mapIndexBroadcast.end())
+        return false;
+
+    // an older ping comes with the broadcast, which is worth fetching again
+    CMasternode& mn = vMasternodes[it->second];
+    return mn.IsEnabled() && mn.IsPingedWithin(MASTERNODE_PING_SECONDS2);
+}
+
 CMasternode* CMasternodeMan::Find(const CScript& payee)
 {
+    // only the pay-to-pubkey-hash script of a collateral address is a masternode payee
+    CTxDestination dest;
+    if (!ExtractDestination(payee, dest))
+        return nullptr;
+
+    const CKeyID* keyID = boost::get<CKeyID>(&dest);
+    if (!keyID || GetScriptForDestination(*keyID) != payee)
+        return nullptr;
+
     LOCK(cs);
-    CScript payee2;
 
-    for (CMasternode& mn : vMasternodes) {
-        payee2 = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
-        if (payee2 == payee)
-            return &mn;
-    }
-    return nullptr;
+    auto it = mapIndexPayee.find(*keyID);
+    return it != mapIndexPayee.end() ? &vMasternodes[it->second] : nullptr;
 }
 
 CMasternode* CMasternodeMan::Find(const CTxIn& vin)
 {
     LOCK(cs);
 
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return nullptr;
+    auto it = mapIndexVin.find(vin.prevout);
+    return it != mapIndexVin.end() ? &vMasternodes[it->second] : nullptr;
 }
 
 
@@ -593,57 +899,53 @@ CMasternode* CMasternodeMan::Find(const CPubKey& pubKeyMasternode)
 {
     LOCK(cs);
 
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.pubKeyMasternode == pubKeyMasternode)
-            return &mn;
-    }
-    return nullptr;
+    auto it = mapIndexPubKey.find(pubKeyMasternode);
+    return it != mapIndexPubKey.end() ? &vMasternodes[it->second] : nullptr;
 }
 
 CMasternode* CMasternodeMan::Find(const CService& service)
 {
     LOCK(cs);
 
-    for(auto& mn : vMasternodes) {
-        if (mn.addr == service)
-            return &mn;
-    }
-
-    return nullptr;
+    auto it = mapIndexAddr.find(service);
+    return it != mapIndexAddr.end() ? &vMasternodes[it->second] : nullptr;
 }
 
 //
 // Deterministically select the oldest/best masternode to pay on the network
 //
-CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight, unsigned mnlevel, bool fFilterSigTime, unsigned& nCount)
+std::map<unsigned, CMasternode*> CMasternodeMan::GetNextMasternodesInQueueForPayment(int nBlockHeight, std::map<unsigned, unsigned>& mapCount)
 {
     LOCK(cs);
 
+    int64_t nStart = GetTimeMicros();
+
+    std::map<unsigned, unsigned> mapEnabled = CountEnabledByLevels();
+    int nMinProtocol = masternodePayments.GetMinMasternodePaymentsProto();
+
     /*
-        Make a vector with all of the last paid times
+        Make vectors with all of the last paid times, of each level, in one pass over the list;
+        the masternodes that are too new are kept apart for a level that has too few others
     */
-    std::vector<std::pair<int64_t, CTxIn> > vecMasternodeLastPaid;
-//    std::vector<std::pair<int64_t, CTxIn> > vecMasternodeLastPaidTest;
-
-    int nMnCount = CountEnabled(mnlevel);
+    typedef std::vector<std::pair<int64_t, CMasternode*> > LastPaidVector;
+    std::map<unsigned, LastPaidVector> mapLastPaid, mapLastPaidNew;
 
     for(CMasternode& mn : vMasternodes) {
 
-        if(mn.Level() != mnlevel)
+        unsigned mnlevel = mn.Level();
+        if(mnlevel < CMasternode::LevelValue::MIN || mnlevel > CMasternode::LevelValue::MAX)
             continue;
 
         //check protocol version
-        if (mn.protocolVersion < masternodePayments.GetMinMasternodePaymentsProto())
+        if (mn.protocolVersion < nMinProtocol)
             continue;
 
-        mn.Check();
+        CheckMasternode(mn);
 
         if (!mn.IsEnabled())
             continue;
 
-        //it's too new, wait for a cycle
-        if (fFilterSigTime && mn.sigTime + (nMnCount * 2.6 * 60) > GetAdjustedTime())
-            continue;
+        int nMnCount = mapEnabled[mnlevel];
 
         //make sure it has as many confirmations as there are masternodes
         if (mn.GetMasternodeInputAge() < nMnCount)
@@ -653,48 +955,62 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
         if (masternodePayments.IsScheduled(mn, nMnCount, nBlockHeight))
             continue;
 
-        vecMasternodeLastPaid.emplace_back(mn.SecondsSincePayment(), mn.vin);
-//        vecMasternodeLastPaidTest.emplace_back(mn.SecondsSincePayment(true), mn.vin); // test
+        //it's too new, wait for a cycle
+        bool fTooNew = mn.sigTime + (nMnCount * 2.6 * 60) > GetAdjustedTime();
+
+        (fTooNew ? mapLastPaidNew : mapLastPaid)[mnlevel].emplace_back(mn.SecondsSincePayment(nMnCount), &mn);
     }
 
-    nCount = vecMasternodeLastPaid.size();
-    LogPrint("masternode", "CMasternodeMan::GetNextMasternodeInQueueForPayment - vecMasternodeLastPaid.size() = %d\n", nCount);
+    int64_t nScanned = GetTimeMicros();
+    LogPrint("masternode", "CMasternodeMan::GetNextMasternodesInQueueForPayment - %u masternodes scanned in %.2fms\n", vMasternodes.size(), 0.001 * (nScanned - nStart));
 
-    //when the network is in the process of upgrading, don't penalize nodes that recently restarted
-    if (fFilterSigTime && nCount < nMnCount / 3)
-        return GetNextMasternodeInQueueForPayment(nBlockHeight, mnlevel, false, nCount);
+    std::map<unsigned, CMasternode*> mapWinners;
 
-    // Sort them high to low
-    sort(vecMasternodeLastPaid.rbegin(), vecMasternodeLastPaid.rend(), CompareLastPaid());
-//    sort(vecMasternodeLastPaidTest.rbegin(), vecMasternodeLastPaidTest.rend(), CompareLastPaid());
+    for(unsigned mnlevel = CMasternode::LevelValue::MIN; mnlevel <= CMasternode::LevelValue::MAX; ++mnlevel) {
 
-/*
-    LogPrintf("GetNextMasternodeInQueueForPayment - Sorted last paid\n");
-    for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeLastPaid) {
-        LogPrintf("time = %d, vin = %s\n", s.first, s.second.ToString());
-    }
-*/
+        int64_t nLevelStart = GetTimeMicros();
+        int nMnCount = mapEnabled[mnlevel];
+        LastPaidVector& vecMasternodeLastPaid = mapLastPaid[mnlevel];
 
-    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
-    int nCountTenth = nMnCount / 10;
-    uint256 nHigh = 0;
-    CMasternode* pBestMasternode = nullptr;
+        //when the network is in the process of upgrading, don't penalize nodes that recently restarted
+        if (vecMasternodeLastPaid.size() < unsigned(nMnCount / 3)) {
+            // in list order, as a walk of the list without the filter would find them
+            LastPaidVector& vecNew = mapLastPaidNew[mnlevel];
+            LastPaidVector vecAll;
+            vecAll.reserve(vecMasternodeLastPaid.size() + vecNew.size());
+            std::merge(vecMasternodeLastPaid.begin(), vecMasternodeLastPaid.end(), vecNew.begin(), vecNew.end(), std::back_inserter(vecAll),
+                [](const std::pair<int64_t, CMasternode*>& t1, const std::pair<int64_t, CMasternode*>& t2) { return t1.second < t2.second; });
+            vecMasternodeLastPaid.swap(vecAll);
+        }
 
-    for(const auto& s : vecMasternodeLastPaid) {
-        CMasternode* pmn = Find(s.second);
-        if (!pmn)
-            continue;
-        uint256 n = pmn->CalculateScore(1, nBlockHeight - 100);
-        if (n > nHigh) {
-            nHigh = n;
-            pBestMasternode = pmn;
+        mapCount[mnlevel] = vecMasternodeLastPaid.size();
+
+        // Sort them high to low
+        sort(vecMasternodeLastPaid.rbegin(), vecMasternodeLastPaid.rend(), CompareLastPaid());
+
+        // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
+        int nCountTenth = nMnCount / 10;
+        uint256 nHigh = 0;
+        CMasternode* pBestMasternode = nullptr;
+
+        for(const auto& s : vecMasternodeLastPaid) {
+            CMasternode* pmn = s.second;
+            uint256 n = pmn->CalculateScore(1, nBlockHeight - 100);
+            if (n > nHigh) {
+                nHigh = n;
+                pBestMasternode = pmn;
+            }
+            if(--nCountTenth <= 0) break;
         }
-//          LogPrintf("New Level: %d, ID: %d, LastPay: %d, Address: %s, Score: %s\n", mnlevel, nCountTenth, s.first, CBitcoinAddress(pmn->pubKeyCollateralAddress.GetID()).ToString(), n.ToString());
-        if(--nCountTenth <= 0) break;
+
+        if (pBestMasternode)
+            mapWinners[mnlevel] = pBestMasternode;
+
+        LogPrint("masternode", "CMasternodeMan::GetNextMasternodesInQueueForPayment - level %u: %u in queue, picked in %.2fms\n",
+            mnlevel, vecMasternodeLastPaid.size(), 0.001 * (GetTimeMicros() - nLevelStart));
     }
-//    if (pBestMasternode)
-//      LogPrintf("Level: %d Winner: %s\n", mnlevel, CBitcoinAddress(pBestMasternode->pubKeyCollateralAddress.GetID()).ToString());
-    return pBestMasternode;
+
+    return mapWinners;
 }
 
 CMasternode* CMasternodeMan::FindRandomNotInVec(unsigned mnlevel, std::vector<CTxIn>& vecToExclude, int protocolVersion)
@@ -740,9 +1056,11 @@ CMasternode* CMasternodeMan::GetCurrentMasterNode(unsigned mnlevel, int mod, int
 
     auto check_mnlevel = mnlevel != CMasternode::LevelValue::UNSPECIFIED;
 
+    LOCK(cs);
+
     // scan for winner
     for(CMasternode& mn : vMasternodes) {
-        mn.Check();
+        CheckMasternode(mn);
 
         if(check_mnlevel && mn.Level() != mnlevel)
             continue;
@@ -764,21 +1082,56 @@ CMasternode* CMasternodeMan::GetCurrentMasterNode(unsigned mnlevel, int mod, int
     return winner;
 }
 
+CMasternodeRankTable* CMasternodeMan::GetRankTable(int64_t nBlockHeight)
+{
+    //make sure we know about this block
+    uint256 hash = 0;
+    if(!GetBlockHash(hash, nBlockHeight))
+        return nullptr;
+
+    auto it = mapRankTables.find(nBlockHeight);
+
+    if(it != mapRankTables.end() && it->second.hashBlock == hash)
+        return &it->second;
+
+    CMasternodeRankTable& table = mapRankTables[nBlockHeight];
+    table.hashBlock = hash;
+    table.vecScores.clear();
+    table.vecScores.reserve(vMasternodes.size());
+    table.nSorted = 0;
+
+    for(unsigned i = 0; i < vMasternodes.size(); ++i)
+        table.vecScores.emplace_back(vMasternodes[i].CalculateScore(1, nBlockHeight).GetCompact(false), i);
+
+    // keep the tables of the most recent blocks
+    while(mapRankTables.size() > MASTERNODES_RANK_TABLES && mapRankTables.begin()->first != nBlockHeight)
+        mapRankTables.erase(mapRankTables.begin());
+
+    return &table;
+}
+
 int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
+
     int64_t nMasternode_Min_Age = GetSporkValue(SPORK_6_MN_WINNER_MINIMUM_AGE);
     int64_t nMasternode_Age = 0;
 
-    //make sure we know about this block
-    uint256 hash = 0;
-    if(!GetBlockHash(hash, nBlockHeight))
+    CMasternodeRankTable* table = GetRankTable(nBlockHeight);
+    if(!table)
         return -1;
 
-    // scan for winner
-    for(CMasternode& mn : vMasternodes) {
+    int rank = 0;
+
+    // walk the masternodes best first, up to this one
+    for(size_t i = 0; i < table->vecScores.size(); ++i) {
+        CMasternode& mn = vMasternodes[GetRanked(*table, i).second];
+        bool fThis = mn.vin.prevout == vin.prevout;
+
         if(mn.protocolVersion < minProtocol) {
             LogPrintf("Skipping Masternode with obsolete version %d\n", mn.protocolVersion);
+            if(fThis)
+                return -1;
             continue;
         }
 
@@ -790,31 +1143,25 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
                 if(fDebug)
                     LogPrintf("Skipping just activated Masternode. Age: %ld\n", nMasternode_Age);
 
+                if(fThis)
+                    return -1;
                 continue;
             }
         }
 
         if(fOnlyActive) {
 
-            mn.Check();
-            if(!mn.IsEnabled())
+            CheckMasternode(mn);
+            if(!mn.IsEnabled()) {
+                if(fThis)
+                    return -1;
                 continue;
+            }
 
         }
 
-        uint256 n  = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
-
-    int rank = 0;
-
-    for(auto& s : vecMasternodeScores) {
         ++rank;
-        if(s.second.prevout == vin.prevout)
+        if(fThis)
             return rank;
     }
 
@@ -823,36 +1170,39 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
 
 std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
 {
-    std::vector<pair<int64_t, CMasternode> > vecMasternodeScores;
+    LOCK(cs);
+
+    std::vector<pair<int64_t, unsigned> > vecMasternodeScores;
     std::vector<pair<int, CMasternode> > vecMasternodeRanks;
 
-    //make sure we know about this block
-    uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return vecMasternodeRanks;
+    CMasternodeRankTable* table = GetRankTable(nBlockHeight);
+    if (!table) return vecMasternodeRanks;
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
-        mn.Check();
+    vecMasternodeScores.reserve(table->vecScores.size());
+
+    // every masternode is ranked, so take the scores as they are and sort once
+    for (const auto& s : table->vecScores) {
+        CMasternode& mn = vMasternodes[s.second];
+        CheckMasternode(mn);
 
         if (mn.protocolVersion < minProtocol) continue;
 
         if (!mn.IsEnabled()) {
-            vecMasternodeScores.push_back(make_pair(12474, mn));
+            vecMasternodeScores.emplace_back(12474, s.second);
             continue;
         }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn));
+        vecMasternodeScores.push_back(s);
     }
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+    sort(vecMasternodeScores.begin(), vecMasternodeScores.end(), CompareRankEntry());
+
+    vecMasternodeRanks.reserve(vecMasternodeScores.size());
 
     int rank = 0;
-    for (PAIRTYPE(int64_t, CMasternode) & s : vecMasternodeScores) {
+    for (const auto& s : vecMasternodeScores) {
         rank++;
-        vecMasternodeRanks.push_back(make_pair(rank, s.second));
+        vecMasternodeRanks.emplace_back(rank, vMasternodes[s.second]);
     }
 
     return vecMasternodeRanks;
@@ -860,29 +1210,25 @@ std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
+
+    CMasternodeRankTable* table = GetRankTable(nBlockHeight);
+    if (!table) return nullptr;
+
+    // only the first nRank eligible masternodes need to be put in order
+    int rank = 0;
+    for (size_t i = 0; i < table->vecScores.size(); ++i) {
+        CMasternode& mn = vMasternodes[GetRanked(*table, i).second];
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
         if (mn.protocolVersion < minProtocol) continue;
         if (fOnlyActive) {
-            mn.Check();
+            CheckMasternode(mn);
             if (!mn.IsEnabled()) continue;
         }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
-
-    int rank = 0;
-    for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeScores) {
         rank++;
         if (rank == nRank) {
-            return Find(s.second);
+            return &mn;
         }
     }
 
@@ -918,11 +1264,13 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         CMasternodeBroadcast mnb;
         vRecv >> mnb;
 
+        masternodeSync.ReceivedMasternodeList(mnb.GetHash());
+
         auto pmn = mnodeman.Find(mnb.addr);
 
         if(pmn && pmn->vin != mnb.vin)
         {
-            pmn->Check(true);
+            CheckMasternode(*pmn, true);
 
             if(pmn->IsEnabled())
             {
@@ -939,36 +1287,8 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
         mapSeenMasternodeBroadcast.insert(make_pair(mnb.GetHash(), mnb));
 
-        int nDoS = 0;
-        if (!mnb.CheckAndUpdate(nDoS)) {
-            if (nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
-
-            //failed
-            return;
-        }
-
-        // make sure the vout that was signed is related to the transaction that spawned the Masternode
-        //  - this is expensive, so it's only done once per Masternode
-        if (!obfuScationSigner.IsVinAssociatedWithPubkey(mnb.vin, mnb.pubKeyCollateralAddress)) {
-            LogPrintf("mnb - Got mismatched pubkey and vin\n");
-            Misbehaving(pfrom->GetId(), 33);
-            return;
-        }
-
-        // make sure it's still unspent
-        //  - this is checked later by .check() in many places and by ThreadCheckObfuScationPool()
-        if (mnb.CheckInputsAndAdd(nDoS)) {
-            // use this as a peer
-            addrman.Add(CAddress(mnb.addr), pfrom->addr, 2 * 60 * 60);
-            masternodeSync.AddedMasternodeList(mnb.GetHash());
-        } else {
-            LogPrintf("mnb - Rejected Masternode entry %s\n", mnb.vin.prevout.hash.ToString());
-            if (nDoS > 0) {
-                Misbehaving(pfrom->GetId(), nDoS);
-                return;
-            }
-        }
+        if (!masternodeVerifyQueue.Submit(pfrom, mnb))
+            ProcessBroadcast(pfrom, mnb);
     }
 
     else if (strCommand == "mnp") { //Masternode Ping
@@ -982,23 +1302,10 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
         mapSeenMasternodePing.insert(make_pair(mnp.GetHash(), mnp));
 
-        int nDoS = 0;
-        if (mnp.CheckAndUpdate(nDoS)) return;
-
-        if (nDoS > 0) {
-            // if anything significant failed, mark that node
-            Misbehaving(pfrom->GetId(), nDoS);
-        } else {
-            // if nothing significant failed, search existing Masternode list
-            CMasternode* pmn = Find(mnp.vin);
-            // if it's known, don't ask for the mnb, just return
-            if (pmn) return;
-        }
-
-        // something significant is broken or mn is unknown,
-        // we might have to ask for a masternode entry once
-        AskForMN(pfrom, mnp.vin);
-
+        // the ping is signed with the key of the listed masternode, if it is listed yet
+        CMasternode* pmn = Find(mnp.vin);
+        if (!masternodeVerifyQueue.Submit(pfrom, mnp, pmn ? pmn->pubKeyMasternode : CPubKey()))
+            ProcessPing(pfrom, mnp);
     }
 
     else if (strCommand == "dseg") { //Get Masternode list or specific entry
@@ -1023,8 +1330,18 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                 int64_t askAgain = GetTime() + MASTERNODES_DSEG_SECONDS;
                 mAskedUsForMasternodeList[pfrom->addr] = askAgain;
             }
-        } //else, asking for a specific node which is ok
+        } else { //asking for a specific node which is ok
+            CMasternode* pmn = Find(vin);
+            if (!pmn || pmn->addr.IsRFC1918() || !pmn->IsEnabled()) return;
 
+            CMasternodeBroadcast mnb = CMasternodeBroadcast(*pmn);
+            uint256 hash = mnb.GetHash();
+            pfrom->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
+            if (!mapSeenMasternodeBroadcast.count(hash)) mapSeenMasternodeBroadcast.insert(make_pair(hash, mnb));
+
+            LogPrint("masternode", "dseg - Sent 1 Masternode entry to peer %i\n", pfrom->GetId());
+            return;
+        }
 
         int nInvCount = 0;
 
@@ -1033,26 +1350,17 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
             if (mn.IsEnabled()) {
                 LogPrint("masternode", "dseg - Sending Masternode entry - %s \n", mn.vin.prevout.hash.ToString());
-                if (vin == CTxIn() || vin == mn.vin) {
-                    CMasternodeBroadcast mnb = CMasternodeBroadcast(mn);
-                    uint256 hash = mnb.GetHash();
-                    pfrom->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
-                    nInvCount++;
+                CMasternodeBroadcast mnb = CMasternodeBroadcast(mn);
+                uint256 hash = mnb.GetHash();
+                pfrom->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
+                nInvCount++;
 
-                    if (!mapSeenMasternodeBroadcast.count(hash)) mapSeenMasternodeBroadcast.insert(make_pair(hash, mnb));
-
-                    if (vin == mn.vin) {
-                        LogPrint("masternode", "dseg - Sent 1 Masternode entry to peer %i\n", pfrom->GetId());
-                        return;
-                    }
-                }
+                if (!mapSeenMasternodeBroadcast.count(hash)) mapSeenMasternodeBroadcast.insert(make_pair(hash, mnb));
             }
         }
 
-        if (vin == CTxIn()) {
-            pfrom->PushMessage("ssc", MASTERNODE_SYNC_LIST, nInvCount);
-            LogPrintf("dseg - Sent %d Masternode entries to %s\n", nInvCount, pfrom->addr.ToString());
-        }
+        pfrom->PushMessage("ssc", MASTERNODE_SYNC_LIST, nInvCount);
+        LogPrintf("dseg - Sent %d Masternode entries to %s\n", nInvCount, pfrom->addr.ToString());
     }
 
     else if (strCommand == "mnget") { //Get winnign Masternode list
@@ -1082,6 +1390,62 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
 }
 
+void CMasternodeMan::ProcessBroadcast(CNode* pfrom, CMasternodeBroadcast& mnb, bool fSignatureChecked)
+{
+    LOCK(cs_process_message);
+
+    int nDoS = 0;
+    if (!mnb.CheckAndUpdate(nDoS, fSignatureChecked)) {
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+
+        //failed
+        return;
+    }
+
+    // make sure the vout that was signed is related to the transaction that spawned the Masternode
+    //  - this is expensive, so it's only done once per Masternode
+    if (!obfuScationSigner.IsVinAssociatedWithPubkey(mnb.vin, mnb.pubKeyCollateralAddress)) {
+        LogPrintf("mnb - Got mismatched pubkey and vin\n");
+        Misbehaving(pfrom->GetId(), 33);
+        return;
+    }
+
+    // make sure it's still unspent
+    //  - this is checked later by .check() in many places and by ThreadCheckObfuScationPool()
+    if (mnb.CheckInputsAndAdd(nDoS)) {
+        // use this as a peer
+        addrman.Add(CAddress(mnb.addr), pfrom->addr, 2 * 60 * 60);
+        masternodeSync.AddedMasternodeList(mnb.GetHash());
+    } else {
+        LogPrintf("mnb - Rejected Masternode entry %s\n", mnb.vin.prevout.hash.ToString());
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+}
+
+void CMasternodeMan::ProcessPing(CNode* pfrom, CMasternodePing& mnp, const CPubKey& pubKeySigned)
+{
+    LOCK(cs_process_message);
+
+    int nDoS = 0;
+    if (mnp.CheckAndUpdate(nDoS, true, pubKeySigned)) return;
+
+    if (nDoS > 0) {
+        // if anything significant failed, mark that node
+        Misbehaving(pfrom->GetId(), nDoS);
+    } else {
+        // if nothing significant failed, search existing Masternode list
+        CMasternode* pmn = Find(mnp.vin);
+        // if it's known, don't ask for the mnb, just return
+        if (pmn) return;
+    }
+
+    // something significant is broken or mn is unknown,
+    // we might have to ask for a masternode entry once
+    AskForMN(pfrom, mnp.vin);
+}
+
 void CMasternodeMan::Remove(CTxIn vin)
 {
     LOCK(cs);
@@ -1091,6 +1455,7 @@ void CMasternodeMan::Remove(CTxIn vin)
         if ((*it).vin == vin) {
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
             vMasternodes.erase(it);
+            Reindex();
             break;
         }
         ++it;
@@ -1111,11 +1476,41 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
         if (Add(CMasternode{mnb}))
             masternodeSync.AddedMasternodeList(mnb.GetHash());
 
-    } else if (pmn->UpdateFromNewBroadcast(mnb)) {
+    } else if (UpdateFromNewBroadcast(*pmn, mnb)) {
         masternodeSync.AddedMasternodeList(mnb.GetHash());
     }
 }
 
+bool CMasternodeMan::UpdateFromNewBroadcast(CMasternode& mn, CMasternodeBroadcast& mnb)
+{
+    LOCK(cs);
+
+    CPubKey pubKeyMasternode = mn.pubKeyMasternode;
+    CPubKey pubKeyCollateralAddress = mn.pubKeyCollateralAddress;
+    CService addr = mn.addr;
+    uint256 hashBroadcast = mn.GetBroadcastHash();
+
+    // the protocol version may change, which moves the masternode to another count
+    bool fUpdated = mn.UpdateFromNewBroadcast(mnb);
+    CountEnabledMasternode(mn);
+
+    if (!fUpdated)
+        return false;
+
+    unsigned nPos = &mn - vMasternodes.data();
+    if (mn.pubKeyMasternode != pubKeyMasternode || mn.pubKeyCollateralAddress != pubKeyCollateralAddress || mn.addr != addr || nPos >= vMasternodes.size()) {
+        Reindex();
+    } else {
+        // a newer broadcast of the same keys only moves the masternode in the broadcast index
+        auto it = mapIndexBroadcast.find(hashBroadcast);
+        if (it != mapIndexBroadcast.end() && it->second == nPos)
+            mapIndexBroadcast.erase(it);
+        mapIndexBroadcast.emplace(mn.GetBroadcastHash(), nPos);
+    }
+    snapshot.reset();
+    return true;
+}
+
 std::string CMasternodeMan::ToString() const
 {
     std::ostringstream info;
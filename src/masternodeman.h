@@ -7,6 +7,7 @@
 #define MASTERNODEMAN_H
 
 #include "base58.h"
+#include "crypto/common.h"
 #include "key.h"
 #include "main.h"
 #include "masternode.h"
@@ -14,23 +15,73 @@
 #include "sync.h"
 #include "util.h"
 
+#include <memory>
+
+#include <boost/unordered_map.hpp>
+
 #define MASTERNODES_DSEG_SECONDS (1 * 60 * 60)
+// format of the masternode snapshot in mncache.dat
+#define MASTERNODES_SNAPSHOT_VERSION 1
 #define MASTERNODES_MNGET_SECONDS (1 * 1 * 60)
+// block heights whose masternode scores are kept
+#define MASTERNODES_RANK_TABLES 16
 
 using namespace std;
 
+class CCollateralWatch;
 class CMasternodeMan;
 
+extern CCollateralWatch collateralWatch;
 extern CMasternodeMan mnodeman;
 void DumpMasternodes();
 
+/** Masternode collaterals and whether they are still unspent
+ *
+ * A collateral is looked up in the chain state once, when its masternode is
+ * added, then kept current by the blocks connected and disconnected, so
+ * masternode checks need neither cs_main nor a validation of a spending
+ * transaction.
+ */
+class CCollateralWatch
+{
+private:
+    struct CEntry {
+        // spent in the active chain, or not in it at all
+        bool fSpent;
+        // holds a deposit amount and no filtered address, as last seen in the chain
+        bool fValid;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<COutPoint, CEntry> mapWatched;
+
+public:
+    /// Whether a watched collateral is unspent, in the chain and the mempool; fWatched is false when it is not watched
+    bool IsUnspent(const COutPoint& outpoint, bool& fWatched) const;
+    /// Look a collateral up in the chain state and watch it from now on (requires cs_main)
+    bool Watch(const COutPoint& outpoint);
+    /// Stop watching all collaterals but these
+    void Retain(const std::set<COutPoint>& setOutpoints);
+    void Clear();
+    size_t size() const;
+
+    /// Keep the watched collaterals current (require cs_main)
+    void BlockConnected(const CBlock& block);
+    void BlockDisconnected(const CBlock& block);
+};
+
 /** Access to the MN database (mncache.dat)
+ *
+ * The file holds a snapshot of the live masternodes (see CMasternodeMan::WriteSnapshot)
+ * behind a versioned header and a checksum. Files holding the whole serialized
+ * CMasternodeMan, as written before, are still read.
  */
 class CMasternodeDB
 {
 private:
     boost::filesystem::path pathMN;
     std::string strMagicMessage;
+    std::string strMagicMessageLegacy;
 
 public:
     enum ReadResult {
@@ -48,6 +99,67 @@ public:
     ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
 };
 
+/** A masternode as kept in the snapshot: what its broadcast and last ping carry,
+ *  without the state its checks work out again
+ */
+class CMasternodeSnapshotEntry
+{
+public:
+    CMasternode& mn;
+
+    explicit CMasternodeSnapshotEntry(CMasternode& mnIn) : mn(mnIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(mn.vin);
+        READWRITE(mn.addr);
+        READWRITE(mn.pubKeyCollateralAddress);
+        READWRITE(mn.pubKeyMasternode);
+        READWRITE(mn.sig);
+        READWRITE(mn.sigTime);
+        READWRITE(VARINT(mn.protocolVersion));
+        READWRITE(VARINT(mn.deposit));
+        READWRITE(VARINT(mn.nLastDsq));
+        // the ping is of this masternode's vin
+        READWRITE(mn.lastPing.blockHash);
+        READWRITE(mn.lastPing.sigTime);
+        READWRITE(mn.lastPing.vchSig);
+        if (ser_action.ForRead())
+            mn.lastPing.vin = mn.vin;
+    }
+};
+
+/** Scores of all masternodes for one block, best first as far as they have been sorted
+ */
+struct CMasternodeRankTable {
+    // block the scores were calculated for
+    uint256 hashBlock;
+    // score and index in vMasternodes of each masternode
+    std::vector<std::pair<int64_t, unsigned> > vecScores;
+    // vecScores[0, nSorted) is in rank order and ahead of all the rest
+    size_t nSorted;
+};
+
+struct MasternodeOutPointHasher {
+    size_t operator()(const COutPoint& outpoint) const { return outpoint.hash.GetLow64() ^ outpoint.n; }
+};
+
+struct MasternodePubKeyHasher {
+    // the bytes after the prefix are a curve coordinate, as good as random
+    size_t operator()(const CPubKey& pubkey) const { return pubkey.size() > 8 ? ReadLE64(pubkey.begin() + 1) : 0; }
+};
+
+struct MasternodeServiceHasher {
+    size_t operator()(const CService& addr) const { return addr.GetHash() ^ addr.GetPort(); }
+};
+
+struct MasternodeKeyIDHasher {
+    size_t operator()(const CKeyID& keyID) const { return keyID.GetLow64(); }
+};
+
 class CMasternodeMan
 {
 private:
@@ -69,6 +181,38 @@ private:
     std::map<CNetAddr, int64_t> mAskedUsForWinnerMasternodeList;
     // who we asked for the winning Masternode list and the last time
     std::map<CNetAddr, int64_t> mWeAskedForWinnerMasternodeList;
+    // masternode scores by block height, dropped whenever vMasternodes changes
+    std::map<int64_t, CMasternodeRankTable> mapRankTables;
+
+    // positions in vMasternodes by collateral, masternode key, address and collateral address;
+    // where masternodes share a key the first one listed is indexed, as a walk of the list would find it
+    boost::unordered_map<COutPoint, unsigned, MasternodeOutPointHasher> mapIndexVin;
+    boost::unordered_map<CPubKey, unsigned, MasternodePubKeyHasher> mapIndexPubKey;
+    boost::unordered_map<CService, unsigned, MasternodeServiceHasher> mapIndexAddr;
+    boost::unordered_map<CKeyID, unsigned, MasternodeKeyIDHasher> mapIndexPayee;
+    // positions in vMasternodes by the hash of the broadcast they were listed from
+    boost::unordered_map<uint256, unsigned, BlockHasher> mapIndexBroadcast;
+    // masternodes by level, and the enabled ones by level and protocol version, as of their last check
+    std::map<unsigned, unsigned> mapLevelCount;
+    std::map<std::pair<unsigned, int>, unsigned> mapEnabledCount;
+    // the level and protocol version each enabled masternode is counted under
+    boost::unordered_map<COutPoint, std::pair<unsigned, int>, MasternodeOutPointHasher> mapEnabledCounted;
+    // last time every masternode was checked
+    int64_t nTimeChecked;
+    // copy of vMasternodes handed out by GetSnapshot, dropped whenever vMasternodes changes
+    std::shared_ptr<const std::vector<CMasternode> > snapshot;
+    int64_t nSnapshotTime;
+
+    CMasternodeRankTable* GetRankTable(int64_t nBlockHeight);
+
+    /// Index the masternode at nPos and count it in
+    void IndexMasternode(unsigned nPos);
+    /// Move a masternode to the enabled count it belongs in now, or out of them
+    void CountEnabledMasternode(const CMasternode& mn);
+    /// Rebuild the indexes and counts after vMasternodes was rearranged
+    void Reindex();
+    /// Check all masternodes if that was last done more than MASTERNODE_CHECK_SECONDS ago
+    void CheckIfStale();
 
 public:
     // Keep track of all broadcasts I've seen
@@ -86,6 +230,8 @@ public:
     {
         LOCK(cs);
         READWRITE(vMasternodes);
+        if (ser_action.ForRead())
+            Reindex();
         READWRITE(mAskedUsForMasternodeList);
         READWRITE(mWeAskedForMasternodeList);
         READWRITE(mWeAskedForMasternodeListEntry);
@@ -105,8 +251,8 @@ public:
     /// Add an entry
     bool Add(const CMasternode& mn);
 
-    ///return all MN's
-    std::vector<CMasternode> GetFullMasternodeMap();
+    /// All masternodes as of at most MASTERNODE_CHECK_SECONDS ago, to be read without holding cs
+    std::shared_ptr<const std::vector<CMasternode> > GetSnapshot();
 
     /// Ask (source) node for mnb
     void AskForMN(CNode* pnode, CTxIn& vin);
@@ -114,12 +260,24 @@ public:
     /// Check all Masternodes
     void Check();
 
+    /// Check a listed masternode, keeping the enabled counts current
+    void CheckMasternode(CMasternode& mn, bool forceCheck = false);
+
     /// Check all Masternodes and remove inactive
     void CheckAndRemove(bool forceExpiredRemoval = false);
 
     /// Clear Masternode vector
     void Clear();
 
+    /// Look the collaterals of all masternodes up in the chain state again and watch them (requires cs_main)
+    void WatchCollaterals();
+
+    /// Write the masternodes that are not removed or spent and the list request times, leaving
+    /// out the broadcasts and pings seen, which the network sends again
+    void WriteSnapshot(CDataStream& ss);
+    /// Replace the list by a snapshot
+    void ReadSnapshot(CDataStream& ss);
+
     unsigned CountEnabled(unsigned mnlevel = CMasternode::LevelValue::UNSPECIFIED, int protocolVersion = -1);
     std::map<unsigned, unsigned> CountEnabledByLevels(int protocolVersion = -1);
 
@@ -128,14 +286,19 @@ public:
     bool DsegUpdate(CNode* pnode);
     bool WinnersUpdate(CNode* node);
 
+    /// Whether a listed masternode was announced with this broadcast and pinged recently,
+    /// so that the broadcast need not be fetched again
+    bool HaveBroadcast(const uint256& hash);
+
     /// Find an entry
     CMasternode* Find(const CScript& payee);
     CMasternode* Find(const CTxIn& vin);
     CMasternode* Find(const CPubKey& pubKeyMasternode);
     CMasternode* Find(const CService& service);
 
-    /// Find an entry in the masternode list that is next to be paid
-    CMasternode* GetNextMasternodeInQueueForPayment(int nBlockHeight, unsigned mnlevel, bool fFilterSigTime, unsigned& nCount);
+    /// Find the entries in the masternode list that are next to be paid, one of each level picked in one pass over
+    /// the list; a level with none to pay is left out. mapCount is set to the number of each level in the queue
+    std::map<unsigned, CMasternode*> GetNextMasternodesInQueueForPayment(int nBlockHeight, std::map<unsigned, unsigned>& mapCount);
 
     /// Find a random entry
     CMasternode* FindRandomNotInVec(unsigned mnlevel, std::vector<CTxIn>& vecToExclude, int protocolVersion = -1);
@@ -143,12 +306,6 @@ public:
     /// Get the current winner for this block
     CMasternode* GetCurrentMasterNode(unsigned mnlevel, int mod = 1, int64_t nBlockHeight = 0, int minProtocol = 0);
 
-    std::vector<CMasternode> GetFullMasternodeVector()
-    {
-        Check();
-        return vMasternodes;
-    }
-
     std::vector<pair<int, CMasternode> > GetMasternodeRanks(int64_t nBlockHeight, int minProtocol = 0);
     int GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
     CMasternode* GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
@@ -156,6 +313,9 @@ public:
     void ProcessMasternodeConnections();
 
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    /// Go on with a broadcast or ping received from pfrom once its signature was looked at by the verify queue
+    void ProcessBroadcast(CNode* pfrom, CMasternodeBroadcast& mnb, bool fSignatureChecked = false);
+    void ProcessPing(CNode* pfrom, CMasternodePing& mnp, const CPubKey& pubKeySigned = CPubKey());
 
     /// Return the number of (unique) Masternodes
     int size() { return vMasternodes.size(); }
@@ -170,6 +330,9 @@ public:
 
     /// Update masternode list and maps using provided CMasternodeBroadcast
     void UpdateMasternodeList(CMasternodeBroadcast mnb);
+
+    /// Update a listed masternode from a newer broadcast, keeping the indexes and counts current
+    bool UpdateFromNewBroadcast(CMasternode& mn, CMasternodeBroadcast& mnb);
 };
 
 #endif
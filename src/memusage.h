@@ -0,0 +1,38 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MEMUSAGE_H
+#define BITCOIN_MEMUSAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace memusage
+{
+/**
+ * Compute the total memory used by allocating alloc bytes, including the
+ * bookkeeping of the allocator. Assumes a glibc style malloc: 16 byte chunks
+ * with one word of overhead on 64 bit systems, 8 byte chunks on 32 bit ones.
+ */
+static inline size_t MallocUsage(size_t alloc)
+{
+    if (alloc == 0)
+        return 0;
+    if (sizeof(void*) == 8)
+        return ((alloc + 31) >> 4) << 4;
+    return ((alloc + 15) >> 3) << 3;
+}
+
+//! Heap memory held by a vector, not counting what its elements point to
+template <typename X>
+static inline size_t DynamicUsage(const std::vector<X>& v)
+{
+    return MallocUsage(v.capacity() * sizeof(X));
+}
+
+} // namespace memusage
+
+#endif // BITCOIN_MEMUSAGE_H
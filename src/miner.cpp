@@ -16,14 +16,17 @@
 #include "pow.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "stats.h"
 #include "timedata.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "validationinterface.h"
 #ifdef ENABLE_WALLET
 #include "wallet.h"
 #endif
 #include "masternode-payments.h"
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 
@@ -472,6 +475,127 @@ bool fGenerateBitcoins = false;
 static bool fMintableCoins = false;
 static int nMintableLastCheck = 0;
 
+CLatencyHistogram histTipToStakeSearch;
+CLatencyHistogram histTipToStakeBroadcast;
+
+/**
+ * Wakes the stake minter as soon as something it waits on may have changed:
+ * a new chain tip, a wallet unlock, or the earliest of its own timers.
+ */
+class CStakeScheduler : public CValidationInterface
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fWake;
+    uint256 hashTip;
+    int64_t nTipTime;   //! when hashTip was announced, in microseconds
+    bool fTipSearched; //! whether the first search on hashTip was already timed
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        hashTip = pindex->GetBlockHash();
+        nTipTime = GetTimeMicros();
+        fTipSearched = false;
+        fWake = true;
+        cond.notify_all();
+    }
+
+public:
+    CStakeScheduler() : fWake(false), hashTip(0), nTipTime(0), fTipSearched(false) {}
+
+    void WalletStatusChanged(CCryptoKeyStore* wallet)
+    {
+        if (!wallet->IsLocked()) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fWake = true;
+            cond.notify_all();
+        }
+    }
+
+    //! Sleep until woken or until nWakeTime (in milliseconds), whichever comes first
+    void WaitUntil(int64_t nWakeTime)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fWake) {
+            int64_t nNow = GetTimeMillis();
+            if (nNow >= nWakeTime)
+                break;
+            cond.timed_wait(lock, boost::posix_time::milliseconds(nWakeTime - nNow));
+        }
+        fWake = false;
+    }
+
+    //! Record the start of a kernel search on hashPrev, returns when hashPrev was announced or 0 if unknown
+    int64_t SearchStarted(const uint256& hashPrev)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (hashPrev != hashTip)
+            return 0;
+        if (!fTipSearched) {
+            fTipSearched = true;
+            histTipToStakeSearch.Add(GetTimeMicros() - nTipTime);
+        }
+        return nTipTime;
+    }
+};
+
+static CStakeScheduler stakeScheduler;
+
+/**
+ * Check whether the stake minter can search for a kernel right now. If not,
+ * nWakeTime is set to when (in milliseconds) the condition holding it back
+ * should be looked at again; new tips and wallet unlocks wake it earlier.
+ */
+static bool StakeMinterReady(CWallet* pwallet, int64_t& nWakeTime)
+{
+    int64_t nNow = GetTimeMillis();
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (pindexTip->nHeight < Params().LAST_POW_BLOCK()) {
+        nWakeTime = nNow + 60 * 1000;
+        return false;
+    }
+
+    // 5 minute check time, 2 minutes while we have nothing to stake
+    if (GetTime() - nMintableLastCheck > (fMintableCoins ? 5 * 60 : 2 * 60)) {
+        nMintableLastCheck = GetTime();
+        fMintableCoins = pwallet->MintableCoins();
+    }
+
+    bool fNetworkReady = Params().NetworkID() != CBaseChainParams::MAIN ||
+                         (pindexTip->nTime >= Params().GenesisBlock().nTime && !vNodes.empty() && masternodeSync.IsSynced());
+    bool fLocked = pwallet->IsLocked();
+    bool fReserved = !fLocked && fMintableCoins && nReserveBalance >= pwallet->GetBalance();
+    if (!fNetworkReady || fLocked || !fMintableCoins || fReserved) {
+        nLastCoinStakeSearchInterval = 0;
+        // unlocks and new tips wake us up, peers, sync state and balance have to be polled
+        nWakeTime = nNow + 60 * 1000;
+        if (!fNetworkReady || fReserved)
+            nWakeTime = nNow + 5000;
+        if (!fMintableCoins)
+            nWakeTime = std::min(nWakeTime, (int64_t)(nMintableLastCheck + 2 * 60) * 1000);
+        return false;
+    }
+
+    // search our map of hashed blocks, see if bestblock has been hashed yet
+    unsigned int nHashInterval = max(pwallet->nHashInterval, (unsigned int)1);
+    std::map<unsigned int, unsigned int>::const_iterator it = mapHashedBlocks.find(pindexTip->nHeight);
+    if (it != mapHashedBlocks.end() && GetTime() - it->second < nHashInterval) {
+        nWakeTime = (int64_t)(it->second + nHashInterval) * 1000;
+        return false;
+    }
+
+    // prevent staking a time that won't be accepted
+    if (GetAdjustedTime() <= pindexTip->nTime) {
+        nWakeTime = nNow + (pindexTip->nTime - GetAdjustedTime() + 1) * 1000;
+        return false;
+    }
+
+    return true;
+}
+
 // ***TODO*** that part changed in bitcoin, we are using a mix with old one here for now
 
 void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
@@ -484,46 +608,20 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
     CReserveKey reservekey(pwallet);
     unsigned int nExtraNonce = 0;
 
+    if (fProofOfStake) {
+        RegisterValidationInterface(&stakeScheduler);
+        pwallet->NotifyStatusChanged.connect(boost::bind(&CStakeScheduler::WalletStatusChanged, &stakeScheduler, _1));
+    }
+
     while (fGenerateBitcoins || fProofOfStake) {
+        int64_t nTipTime = 0;
         if (fProofOfStake) {
-            if (chainActive.Tip()->nHeight < Params().LAST_POW_BLOCK()) {
-                MilliSleep(5000);
+            int64_t nWakeTime;
+            if (!StakeMinterReady(pwallet, nWakeTime)) {
+                stakeScheduler.WaitUntil(nWakeTime);
                 continue;
             }
-            if ((GetTime() - nMintableLastCheck > 5 * 60)) { // 5 minute check time
-                nMintableLastCheck = GetTime();
-                fMintableCoins = pwallet->MintableCoins();
-            }
-            if (Params().NetworkID() == CBaseChainParams::MAIN)
-                while (chainActive.Tip()->nTime < Params().GenesisBlock().nTime || vNodes.empty() || !masternodeSync.IsSynced() || pwallet->IsLocked() || !fMintableCoins || nReserveBalance >= pwallet->GetBalance()) {
-                    nLastCoinStakeSearchInterval = 0;
-                    if (!fMintableCoins && (GetTime() - nMintableLastCheck > 2 * 60)) { // 2 minute check time
-                        nMintableLastCheck = GetTime();
-                        fMintableCoins = pwallet->MintableCoins();
-                    }
-                    MilliSleep(5000);
-                    if (!fGenerateBitcoins && !fProofOfStake)
-                        continue;
-                }
-            else
-                while (pwallet->IsLocked() || !fMintableCoins || nReserveBalance >= pwallet->GetBalance()) {
-                    nLastCoinStakeSearchInterval = 0;
-                    if (!fMintableCoins && (GetTime() - nMintableLastCheck > 2 * 60)) { // 2 minute check time
-                        nMintableLastCheck = GetTime();
-                        fMintableCoins = pwallet->MintableCoins();
-                    }
-                    MilliSleep(5000);
-                    if (!fGenerateBitcoins && !fProofOfStake)
-                        continue;
-                }
-            if (mapHashedBlocks.count(chainActive.Tip()->nHeight)) //search our map of hashed blocks, see if bestblock has been hashed yet
-            {
-                if (GetTime() - mapHashedBlocks[chainActive.Tip()->nHeight] < max(pwallet->nHashInterval, (unsigned int)1)) // wait half of the nHashDrift with max wait of 3 minutes
-                {
-                    MilliSleep(5000);
-                    continue;
-                }
-            }
+            nTipTime = stakeScheduler.SearchStarted(chainActive.Tip()->GetBlockHash());
         }
 
         //
@@ -535,8 +633,12 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
             continue;
 
         unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey, pwallet, fProofOfStake));
-        if (!pblocktemplate.get())
+        if (!pblocktemplate.get()) {
+            // no kernel on this tip, wait for the next one or the next hash interval
+            if (fProofOfStake)
+                stakeScheduler.WaitUntil(GetTimeMillis() + max(pwallet->nHashInterval, (unsigned int)1) * 1000);
             continue;
+        }
 
         CBlock* pblock = &pblocktemplate->block;
         IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
@@ -552,7 +654,8 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
 
             LogPrintf("CPUMiner : proof-of-stake block was signed %s \n", pblock->GetHash().ToString().c_str());
             SetThreadPriority(THREAD_PRIORITY_NORMAL);
-            ProcessBlockFound(pblock, *pwallet, reservekey);
+            if (ProcessBlockFound(pblock, *pwallet, reservekey) && nTipTime)
+                histTipToStakeBroadcast.Add(GetTimeMicros() - nTipTime);
             SetThreadPriority(THREAD_PRIORITY_LOWEST);
 
             continue;
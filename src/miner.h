@@ -11,6 +11,7 @@
 class CBlock;
 class CBlockHeader;
 class CBlockIndex;
+class CLatencyHistogram;
 class CReserveKey;
 class CScript;
 class CWallet;
@@ -31,5 +32,9 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake);
 
 extern double dHashesPerSec;
 extern int64_t nHPSTimerStart;
+/** Time from a new chain tip to the stake minter starting a kernel search on it */
+extern CLatencyHistogram histTipToStakeSearch;
+/** Time from a new chain tip to the stake minter broadcasting a block built on it */
+extern CLatencyHistogram histTipToStakeBroadcast;
 
 #endif // BITCOIN_MINER_H
@@ -15,9 +15,12 @@
 #include "addrman.h"
 #include "chainparams.h"
 #include "clientversion.h"
+#include "kernel.h"
 #include "miner.h"
 #include "obfuscation.h"
 #include "primitives/transaction.h"
+#include "socketevents.h"
+#include "stats.h"
 #include "ui_interface.h"
 #include "wallet.h"
 
@@ -25,6 +28,7 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_UPNP
@@ -40,6 +44,13 @@
 // Dump addresses to peers.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
 
+// Queued messages handed to the kernel by one send call, where it gathers them
+static const int MAX_SEND_BUFFERS = 64;
+
+// Milliseconds between the sweeps over all peers for disconnection and inactivity,
+// and the longest the network thread waits for socket events
+#define SOCKET_SWEEP_INTERVAL 50
+
 #if !defined(HAVE_MSG_NOSIGNAL) && !defined(MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -89,7 +100,7 @@ bool fAddressesInitialized = false;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CMessageDataRef> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -108,6 +119,18 @@ CCriticalSection cs_nLastNodeId;
 
 static CSemaphore* semOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
+static CMessageHandlerQueue messageHandlerQueue;
+CCriticalSection cs_serialMessages;
+
+static CSocketEvents socketEvents;
+// peers whose queued data a sending thread could not send at once
+static CCriticalSection cs_vNodesSendWake;
+static vector<CNode*> vNodesSendWake;
+
+static CCriticalSection cs_socketStats;
+static CSocketHandlerStats socketStats;
+static CRateMeter rateSocketWakeups;
+CLatencyHistogram histSocketLoop;
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -429,6 +452,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
         {
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
+            socketEvents.Add(pnode->hSocket, pnode);
         }
 
         pnode->nTimeConnected = GetTime();
@@ -449,13 +473,16 @@ void CNode::CloseSocketDisconnect()
     fDisconnect = true;
     if (hSocket != INVALID_SOCKET) {
         LogPrint("net", "disconnecting peer=%d\n", id);
+        socketEvents.Remove(hSocket);
         CloseSocket(hSocket);
     }
 
     // in case this fails, we'll empty the recv buffer when the CNode is deleted
     TRY_LOCK(cs_vRecvMsg, lockRecv);
-    if (lockRecv)
+    if (lockRecv) {
         vRecvMsg.clear();
+        nRecvMsgQueue = 0;
+    }
 }
 
 bool CNode::DisconnectOldProtocol(int nVersionRequired, string strLastCommand)
@@ -577,6 +604,9 @@ void CNode::copyStats(CNodeStats& stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    X(nRecvMsgQueue);
+    X(nRecvGetDataQueue);
 }
 #undef X
 
@@ -611,6 +641,7 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
+            nRecvMsgQueue++;
             messageHandlerCondition.notify_one();
         }
     }
@@ -668,23 +699,53 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode* pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CMessageDataRef>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData& data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        assert((*it)->size() > pnode->nSendOffset);
+#ifdef WIN32
+        const CSerializeData& data = **it;
+        size_t nWanted = data.size() - pnode->nSendOffset;
+        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], nWanted, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        // Gather the queued messages into one call, the first from where the last call stopped
+        struct iovec vBuffers[MAX_SEND_BUFFERS];
+        int nBuffers = 0;
+        size_t nWanted = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (std::deque<CMessageDataRef>::iterator itBuffer = it; itBuffer != pnode->vSendMsg.end() && nBuffers < MAX_SEND_BUFFERS; itBuffer++) {
+            const CSerializeData& data = **itBuffer;
+            vBuffers[nBuffers].iov_base = (void*)&data[nOffset];
+            vBuffers[nBuffers].iov_len = data.size() - nOffset;
+            nWanted += vBuffers[nBuffers].iov_len;
+            nOffset = 0;
+            nBuffers++;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vBuffers;
+        msg.msg_iovlen = nBuffers;
+        ssize_t nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            // Step over the messages sent in full
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRemaining = (*it)->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= (*it)->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nWanted) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -710,286 +771,338 @@ void SocketSendData(CNode* pnode)
 
 static list<CNode*> vNodesDisconnected;
 
-void ThreadSocketHandler()
+// Remove the peers to disconnect from vNodes, and delete those nobody uses any more
+static void DisconnectNodes(set<CNode*>& setNodesActive)
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true) {
-        //
-        // Disconnect nodes
-        //
-        {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
-
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
-
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+    {
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy) {
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
+
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
+
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
-        {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            for (CNode* pnode : vNodesDisconnectedCopy) {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend) {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv) {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        for (CNode* pnode : vNodesDisconnectedCopy) {
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend) {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv) {
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    setNodesActive.erase(pnode);
+                    delete pnode;
                 }
             }
         }
-        size_t vNodesSize;
-        {
-            LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
-        }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
-        }
+    }
+}
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+// requires LOCK(cs_vNodes)
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
         }
+    }
+}
+
+// Accept a connection waiting on hListenSocket. Returns false once none is left.
+static bool AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket == INVALID_SOCKET) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+        return nErr == WSAEINTR;
+    }
+
+    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+        LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (!IsSelectableSocket(hSocket)) {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (CNode::IsBanned(addr) && !whitelisted) {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
 
         {
             LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes) {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
+            vNodes.push_back(pnode);
+            socketEvents.Add(pnode->hSocket, pnode);
         }
+    }
+    return true;
+}
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-            &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
+/**
+ * Receive from and send to the socket of pnode as far as the socket and the
+ * receive flood limit allow. fKeep is set if the peer is left with data to
+ * serve, fAgain if some of it can be served right away.
+ */
+static void ServiceSocket(CNode* pnode, bool& fKeep, bool& fAgain)
+{
+    fKeep = false;
+    fAgain = false;
 
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
+    //
+    // Receive
+    //
+    if (pnode->hSocket == INVALID_SOCKET)
+        return;
+    bool fRecvWanted = true;
+    if (pnode->fRecvReady) {
+        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+        if (!lockRecv) {
+            fKeep = fAgain = true;
+        } else if (!pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+                   pnode->GetTotalRecvSize() > ReceiveFloodSize()) {
+            // The message handler has a complete message and more than enough
+            // queued: leave the data in the socket until it catches up, which
+            // makes the peer wait through TCP flow control.
+            fRecvWanted = false;
+            fKeep = true;
+        } else {
+            // typical socket buffer is 8K-64K
+            char pchBuf[0x10000];
+            int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+            if (nBytes > 0) {
+                if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+                    pnode->CloseSocketDisconnect();
+                pnode->nLastRecv = GetTime();
+                pnode->nRecvBytes += nBytes;
+                pnode->RecordBytesRecv(nBytes);
+                // A full buffer may have left more behind, which is read on the
+                // next loop so that one peer cannot hold the others up. Data
+                // arriving after a short read raises an event of its own.
+                if (nBytes == sizeof(pchBuf))
+                    fKeep = fAgain = true;
+                else
+                    pnode->fRecvReady = false;
+            } else if (nBytes == 0) {
+                // socket closed gracefully
+                if (!pnode->fDisconnect)
+                    LogPrint("net", "socket closed\n");
+                pnode->CloseSocketDisconnect();
+            } else if (nBytes < 0) {
+                // error
                 int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                if (nErr == WSAEINTR) {
+                    fKeep = fAgain = true;
+                } else if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINPROGRESS) {
+                    if (!pnode->fDisconnect)
+                        LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+                    pnode->CloseSocketDisconnect();
+                } else {
+                    pnode->fRecvReady = false;
+                }
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec / 1000);
         }
+    }
 
-        //
-        // Accept new connections
-        //
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
+    //
+    // Send
+    //
+    if (pnode->hSocket == INVALID_SOCKET) {
+        fKeep = fAgain = false;
+        return;
+    }
+    // data left behind by a send waits for the socket to become writable
+    bool fSendWanted = !pnode->fSendReady;
+    if (pnode->fSendReady) {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (!lockSend) {
+            fKeep = fAgain = true;
+        } else if (!pnode->vSendMsg.empty()) {
+            SocketSendData(pnode);
+            if (!pnode->vSendMsg.empty()) {
+                pnode->fSendReady = false;
+                fSendWanted = true;
+            }
+        }
+    }
 
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    for (CNode* pnode : vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
+    if (pnode->hSocket != INVALID_SOCKET)
+        socketEvents.SetInterest(pnode->hSocket, fRecvWanted, fSendWanted);
+}
 
-                if (hSocket == INVALID_SOCKET) {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (CNode::IsBanned(addr) && !whitelisted) {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
+void ThreadSocketHandler()
+{
+    unsigned int nPrevNodeCount = 0;
+    for (const ListenSocket& hListenSocket : vhListenSocket)
+        socketEvents.Add(hListenSocket.socket, NULL);
+
+    // peers the last loop left with data to receive or send
+    set<CNode*> setNodesActive;
+    vector<CSocketEvents::CEvent> vEvents;
+    int64_t nLastSweep = 0;
+    bool fBusy = false;
+    while (true) {
+        //
+        // Disconnect nodes, and those inactive for too long
+        //
+        if (GetTimeMillis() - nLastSweep >= SOCKET_SWEEP_INTERVAL) {
+            nLastSweep = GetTimeMillis();
+            DisconnectNodes(setNodesActive);
 
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
+            size_t vNodesSize;
+            {
+                LOCK(cs_vNodes);
+                vNodesSize = vNodes.size();
+                for (CNode* pnode : vNodes)
+                    InactivityCheck(pnode);
+            }
+            if (vNodesSize != nPrevNodeCount) {
+                nPrevNodeCount = vNodesSize;
+                uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
             }
         }
 
         //
-        // Service each socket
+        // Wait for sockets to become ready, or for data queued to send
         //
-        vector<CNode*> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy)
-                pnode->AddRef();
+        int64_t nTimeout = fBusy ? 0 : std::max(nLastSweep + SOCKET_SWEEP_INTERVAL - GetTimeMillis(), (int64_t)0);
+        bool fWoken = false;
+        if (!socketEvents.Wait(vEvents, fWoken, nTimeout)) {
+            LogPrintf("socket wait error %s\n", NetworkErrorString(WSAGetLastError()));
+            MilliSleep(SOCKET_SWEEP_INTERVAL);
         }
-        for (CNode* pnode : vNodesCopy) {
-            boost::this_thread::interruption_point();
-
-            //
-            // Receive
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        } else if (nBytes == 0) {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
+        boost::this_thread::interruption_point();
+        int64_t nStart = GetTimeMicros();
+
+        for (const CSocketEvents::CEvent& event : vEvents) {
+            if (!event.pdata) {
+                //
+                // Accept new connections
+                //
+                for (const ListenSocket& hListenSocket : vhListenSocket) {
+                    if (hListenSocket.socket == event.hSocket) {
+                        while (AcceptConnection(hListenSocket))
+                            boost::this_thread::interruption_point();
                     }
                 }
-            }
-
-            //
-            // Send
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    SocketSendData(pnode);
             }
+            CNode* pnode = (CNode*)event.pdata;
+            if (event.nEvents & (CSocketEvents::EVENT_RECV | CSocketEvents::EVENT_ERROR))
+                pnode->fRecvReady = true;
+            if (event.nEvents & CSocketEvents::EVENT_SEND)
+                pnode->fSendReady = true;
+            setNodesActive.insert(pnode);
+        }
+        {
+            // the wakeup does nothing on Windows, where these wait for the timeout
+            LOCK(cs_vNodesSendWake);
+            setNodesActive.insert(vNodesSendWake.begin(), vNodesSendWake.end());
+            vNodesSendWake.clear();
+        }
+        bool fWork = !setNodesActive.empty();
 
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+        //
+        // Service each socket
+        //
+        fBusy = false;
+        for (set<CNode*>::iterator it = setNodesActive.begin(); it != setNodesActive.end();) {
+            boost::this_thread::interruption_point();
+            bool fKeep, fAgain;
+            ServiceSocket(*it, fKeep, fAgain);
+            fBusy |= fAgain;
+            if (fKeep)
+                ++it;
+            else
+                setNodesActive.erase(it++);
         }
+
+        int64_t nNow = GetTimeMicros();
+        if (fWork)
+            histSocketLoop.Add(nNow - nStart);
+        if (fWoken || !vEvents.empty())
+            rateSocketWakeups.Add(nNow);
         {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodesCopy)
-                pnode->Release();
+            LOCK(cs_socketStats);
+            socketStats.nLoops++;
+            if (fWoken || !vEvents.empty())
+                socketStats.nWakeups++;
+            if (fWoken)
+                socketStats.nSignals++;
+            socketStats.nEvents += vEvents.size();
+            socketStats.nActive = setNodesActive.size();
         }
     }
 }
 
+void GetSocketHandlerStats(CSocketHandlerStats& stats)
+{
+    {
+        LOCK(cs_socketStats);
+        stats = socketStats;
+    }
+    stats.strBackend = CSocketEvents::GetBackend();
+    stats.nSockets = socketEvents.Count();
+    stats.dWakeupRate = rateSocketWakeups.Get(GetTimeMicros());
+}
+
 
 #ifdef USE_UPNP
 void ThreadMapPort()
@@ -1363,6 +1476,72 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant* grantOu
 }
 
 
+CMessageHandlerQueue::CMessageHandlerQueue() : nServing(0)
+{
+}
+
+void CMessageHandlerQueue::Push(CNode* pnode, int nFlags)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    pnode->nMessageFlags |= nFlags;
+    if (pnode->fMessageQueued)
+        return;
+    pnode->fMessageQueued = true;
+    // Done queues it again
+    if (pnode->fMessageServing)
+        return;
+    pnode->AddRef();
+    queue.push_back(pnode);
+    condQueue.notify_one();
+}
+
+CNode* CMessageHandlerQueue::Pop(int& nFlags)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (queue.empty())
+        condQueue.wait(lock);
+
+    CNode* pnode = queue.front();
+    queue.pop_front();
+    pnode->fMessageQueued = false;
+    pnode->fMessageServing = true;
+    nFlags = pnode->nMessageFlags;
+    pnode->nMessageFlags = 0;
+    nServing++;
+    return pnode;
+}
+
+void CMessageHandlerQueue::Done(CNode* pnode, bool fMore)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        pnode->fMessageServing = false;
+        nServing--;
+        if (fMore || pnode->fMessageQueued) {
+            // keeps the reference it was queued with
+            pnode->fMessageQueued = true;
+            queue.push_back(pnode);
+            condQueue.notify_one();
+            return;
+        }
+    }
+
+    LOCK(cs_vNodes);
+    pnode->Release();
+}
+
+size_t CMessageHandlerQueue::Size()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return queue.size();
+}
+
+size_t CMessageHandlerQueue::Serving()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return nServing;
+}
+
 void ThreadMessageHandler()
 {
     boost::mutex condition_mutex;
@@ -1372,40 +1551,63 @@ void ThreadMessageHandler()
 
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (true) {
-        vector<CNode*> vNodesCopy;
+        int nRebroadcast = 0;
+        if (!IsInitialBlockDownload() && (GetTime() - nLastRebroadcast > 24 * 60 * 60)) {
+            // Periodically clear setAddrKnown to allow refresh broadcasts
+            nRebroadcast = CMessageHandlerQueue::MESSAGES_ADVERTISE;
+            if (nLastRebroadcast)
+                nRebroadcast |= CMessageHandlerQueue::MESSAGES_FORGET_ADDR;
+        }
+
+        // Hand the connected nodes to the handler threads, for their messages
+        // received and those due to send
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
-                pnode->AddRef();
+            CNode* pnodeTrickle = nullptr;
+            if (!vNodes.empty())
+                pnodeTrickle = vNodes[GetRand(vNodes.size())];
+
+            for (CNode* pnode : vNodes) {
+                if (pnode->fDisconnect)
+                    continue;
+                int nFlags = nRebroadcast;
+                if (pnode == pnodeTrickle)
+                    nFlags |= CMessageHandlerQueue::MESSAGES_TRICKLE;
+                messageHandlerQueue.Push(pnode, nFlags);
             }
         }
+        if (nRebroadcast)
+            nLastRebroadcast = GetTime();
 
-        // Poll the connected nodes for messages
-        CNode* pnodeTrickle = nullptr;
-        if (!vNodesCopy.empty())
-            pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
-
-        bool fSleep = true;
-
-        bool performRebroadcast = !IsInitialBlockDownload() && (GetTime() - nLastRebroadcast > 24 * 60 * 60);
-
-        for (CNode* pnode : vNodesCopy) {
+        messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+    }
+}
 
-            if (pnode->fDisconnect)
-                continue;
+void static ThreadProcessMessages()
+{
+    SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
+    while (true) {
+        int nFlags;
+        CNode* pnode = messageHandlerQueue.Pop(nFlags);
+        bool fMore = false;
 
+        if (!pnode->fDisconnect) {
             // Receive messages
             {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    if (!g_signals.ProcessMessages(pnode))
-                        pnode->CloseSocketDisconnect();
-
-                    if (pnode->nSendSize < SendBufferSize()) {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete())) {
-                            fSleep = false;
-                        }
+                LOCK(pnode->cs_vRecvMsg);
+                if (!g_signals.ProcessMessages(pnode))
+                    pnode->CloseSocketDisconnect();
+
+                pnode->nRecvMsgQueue = 0;
+                for (const CNetMessage& msg : pnode->vRecvMsg) {
+                    if (msg.complete())
+                        pnode->nRecvMsgQueue++;
+                }
+                pnode->nRecvGetDataQueue = pnode->vRecvGetData.size();
+
+                if (pnode->nSendSize < SendBufferSize()) {
+                    if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete())) {
+                        fMore = true;
                     }
                 }
             }
@@ -1413,36 +1615,24 @@ void ThreadMessageHandler()
 
             // Send messages
             {
+                LOCK(cs_serialMessages);
                 TRY_LOCK(pnode->cs_vSend, lockSend);
 
-                if(lockSend) {
-
-                    g_signals.SendMessages(pnode, pnode == pnodeTrickle || pnode->fWhitelisted);
+                if (lockSend) {
+                    g_signals.SendMessages(pnode, (nFlags & CMessageHandlerQueue::MESSAGES_TRICKLE) || pnode->fWhitelisted);
 
-                    if(performRebroadcast) {
+                    if (nFlags & CMessageHandlerQueue::MESSAGES_FORGET_ADDR)
+                        pnode->setAddrKnown.clear();
 
-                        // Periodically clear setAddrKnown to allow refresh broadcasts
-                        if (nLastRebroadcast)
-                            pnode->setAddrKnown.clear();
-
-                        // Rebroadcast our address
+                    // Rebroadcast our address
+                    if (nFlags & CMessageHandlerQueue::MESSAGES_ADVERTISE)
                         AdvertiseLocal(pnode);
-
-                        nLastRebroadcast = GetTime();
-                    }
                 }
             }
             boost::this_thread::interruption_point();
         }
 
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodesCopy)
-                pnode->Release();
-        }
-
-        if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        messageHandlerQueue.Done(pnode, fMore);
     }
 }
 
@@ -1641,14 +1831,24 @@ void StartNode(boost::thread_group& threadGroup)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
+    int nMessageHandlerThreads = GetArg("-msghandthreads", DEFAULT_MESSAGE_HANDLER_THREADS);
+    nMessageHandlerThreads = std::max(1, std::min(nMessageHandlerThreads, MAX_MESSAGE_HANDLER_THREADS));
+    LogPrintf("Using %d threads to process peer messages\n", nMessageHandlerThreads);
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msgproc", &ThreadProcessMessages));
 
     // Dump network addresses
     threadGroup.create_thread(boost::bind(&LoopForever<void (*)()>, "dumpaddr", &DumpAddresses, DUMP_ADDRESSES_INTERVAL * 1000));
 
     // ppcoin:mint proof-of-stake blocks in the background
-    if (GetBoolArg("-staking", true))
+    if (GetBoolArg("-staking", true)) {
         threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "stakemint", &ThreadStakeMinter));
+
+        // the minter joins the search as the last worker
+        for (int i = 0; i < nStakeSearchThreads - 1; i++)
+            threadGroup.create_thread(&ThreadStakeSearch);
+    }
 }
 
 bool StopNode()
@@ -1730,8 +1930,9 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
             vRelayExpiration.pop_front();
         }
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        // Save original serialized message so newer versions are preserved, framed
+        // once for every peer that asks for it
+        mapRelay.insert(std::make_pair(inv, MakeMessageData(inv.GetCommand(), ss)));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
@@ -1750,6 +1951,7 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
 {
     CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
+    CMessageDataRef data = MakeMessageData("ix", tx);
 
     //broadcast the new lock
     LOCK(cs_vNodes);
@@ -1757,7 +1959,7 @@ void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
         if (!relayToAll && !pnode->fRelayTxes)
             continue;
 
-        pnode->PushMessage("ix", tx);
+        pnode->PushMessageData(data);
     }
 }
 
@@ -1935,6 +2137,8 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nLastRecv = 0;
     nSendBytes = 0;
     nRecvBytes = 0;
+    nRecvMsgQueue = 0;
+    nRecvGetDataQueue = 0;
     nTimeConnected = GetTime();
     addr = addrIn;
     addrName = addrNameIn == "" ? addr.ToStringIPPort() : addrNameIn;
@@ -1947,6 +2151,11 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fRecvReady = true;
+    fSendReady = true;
+    fMessageQueued = false;
+    fMessageServing = false;
+    nMessageFlags = 0;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -1981,8 +2190,15 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
 
 CNode::~CNode()
 {
+    if (hSocket != INVALID_SOCKET)
+        socketEvents.Remove(hSocket);
     CloseSocket(hSocket);
 
+    {
+        LOCK(cs_vNodesSendWake);
+        vNodesSendWake.erase(remove(vNodesSendWake.begin(), vNodesSendWake.end(), this), vNodesSendWake.end());
+    }
+
     if (pfilter)
         delete pfilter;
 
@@ -2019,6 +2235,33 @@ void CNode::AskFor(const CInv& inv)
     mapAskFor.insert(std::make_pair(nRequestTime, inv));
 }
 
+CMessageDataRef MakeMessageData(CDataStream& ss)
+{
+    // Set the size
+    assert(ss.size() >= CMessageHeader::HEADER_SIZE);
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    memcpy((char*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
+
+    // Set the checksum
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    std::shared_ptr<CSerializeData> pdata = std::make_shared<CSerializeData>();
+    ss.GetAndClear(*pdata);
+    return pdata;
+}
+
+CMessageDataRef MakeMessageData(const char* pszCommand, const char* pbegin, const char* pend)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(CMessageHeader::HEADER_SIZE + (pend - pbegin));
+    ss << CMessageHeader(pszCommand, 0);
+    ss.write(pbegin, pend - pbegin);
+    return MakeMessageData(ss);
+}
+
 void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSend)
 {
     ENTER_CRITICAL_SECTION(cs_vSend);
@@ -2052,26 +2295,43 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     if (ssSend.size() == 0)
         return;
 
-    // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    memcpy((char*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
+    LogPrint("net", "(%d bytes) peer=%d\n", ssSend.size() - CMessageHeader::HEADER_SIZE, id);
 
-    // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+    QueueSendData(MakeMessageData(ssSend));
 
-    LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
+    LEAVE_CRITICAL_SECTION(cs_vSend);
+}
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+void CNode::PushMessageData(const CMessageDataRef& data)
+{
+    LOCK(cs_vSend);
+    if (mapArgs.count("-dropmessagestest") && GetRand(GetArg("-dropmessagestest", 2)) == 0) {
+        LogPrint("net", "dropmessages DROPPING SEND MESSAGE\n");
+        return;
+    }
 
-    // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
-        SocketSendData(this);
+    const char* pszCommand = &(*data)[MESSAGE_START_SIZE];
+    LogPrint("net", "sending: %s (%d bytes) peer=%d\n", SanitizeString(std::string(pszCommand, strnlen(pszCommand, CMessageHeader::COMMAND_SIZE))),
+        data->size() - CMessageHeader::HEADER_SIZE, id);
 
-    LEAVE_CRITICAL_SECTION(cs_vSend);
+    QueueSendData(data);
+}
+
+void CNode::QueueSendData(const CMessageDataRef& data)
+{
+    vSendMsg.push_back(data);
+    nSendSize += data->size();
+
+    // If write queue empty, attempt "optimistic write", and have the network
+    // thread send what it leaves behind
+    if (vSendMsg.size() == 1) {
+        SocketSendData(this);
+        if (!vSendMsg.empty() && hSocket != INVALID_SOCKET) {
+            {
+                LOCK(cs_vNodesSendWake);
+                vNodesSendWake.push_back(this);
+            }
+            socketEvents.Wakeup();
+        }
+    }
 }
@@ -22,6 +22,7 @@
 #include "utilstrencodings.h"
 
 #include <deque>
+#include <memory>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -34,6 +35,7 @@
 
 class CAddrMan;
 class CBlockIndex;
+class CLatencyHistogram;
 class CNode;
 
 namespace boost
@@ -61,6 +63,10 @@ static const bool DEFAULT_UPNP = false;
 #endif
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+/** Default for -msghandthreads, threads processing the messages received from peers */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 4;
+/** Maximum number of message handler threads */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
@@ -80,6 +86,25 @@ void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode* pnode);
 
+/**
+ * A message framed for the wire, its header and checksum computed once. It does
+ * not change once made, so any number of peers can queue it and send it
+ * without a copy of their own.
+ */
+typedef std::shared_ptr<const CSerializeData> CMessageDataRef;
+
+/** Take the message ss holds, header first, filling in its payload size and checksum */
+CMessageDataRef MakeMessageData(CDataStream& ss);
+CMessageDataRef MakeMessageData(const char* pszCommand, const char* pbegin, const char* pend);
+/** Frame a payload serialized the same for every protocol version, like a transaction or a block */
+template <typename T>
+CMessageDataRef MakeMessageData(const char* pszCommand, const T& payload)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CMessageHeader(pszCommand, 0) << payload;
+    return MakeMessageData(ss);
+}
+
 typedef int NodeId;
 
 // Signals for message handling
@@ -131,10 +156,17 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CMessageDataRef> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
+/**
+ * Held by a message handler thread while it sends messages, or processes a
+ * message that may touch state the handlers of other peers share outside
+ * cs_main, taken before cs_vSend. Messages that only need cs_main and the
+ * peer's own state are processed without it, alongside those of other peers.
+ */
+extern CCriticalSection cs_serialMessages;
 
 extern std::vector<std::string> vAddedNodes;
 extern CCriticalSection cs_vAddedNodes;
@@ -150,6 +182,29 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+struct CSocketHandlerStats {
+    //! "epoll", "poll" or "select"
+    std::string strBackend;
+    //! sockets watched, the listening ones included
+    size_t nSockets;
+    //! peers the last loop left with data to receive or send
+    size_t nActive;
+    uint64_t nLoops;
+    //! loops woken by socket events or by data queued to send, rather than by the timeout
+    uint64_t nWakeups;
+    //! wakeups by a thread queuing data the optimistic send left behind
+    uint64_t nSignals;
+    uint64_t nEvents;
+    //! wakeups per second, averaged over the last minute
+    double dWakeupRate;
+
+    CSocketHandlerStats() : nSockets(0), nActive(0), nLoops(0), nWakeups(0), nSignals(0), nEvents(0), dWakeupRate(0) {}
+};
+
+void GetSocketHandlerStats(CSocketHandlerStats& stats);
+/** Time the network thread took to serve the sockets each time it had any to serve */
+extern CLatencyHistogram histSocketLoop;
+
 class CNodeStats
 {
 public:
@@ -169,6 +224,8 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    int nRecvMsgQueue;
+    int nRecvGetDataQueue;
 };
 
 
@@ -224,12 +281,16 @@ public:
     size_t nSendSize;   // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CMessageDataRef> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // Complete messages and requested inventory waiting to be processed, counted
+    // under cs_vRecvMsg whenever a message completes or a handler thread is done
+    int nRecvMsgQueue;
+    int nRecvGetDataQueue;
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -252,6 +313,15 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    // Readiness of hSocket as last seen by the network thread, which alone uses
+    // these: set by a socket event, cleared once recv or send would block.
+    bool fRecvReady;
+    bool fSendReady;
+    // State in the message handler queue, guarded by it: waiting to be served,
+    // being served, and the work wanted besides processing messages
+    bool fMessageQueued;
+    bool fMessageServing;
+    int nMessageFlags;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in their version message that we should not relay tx invs
@@ -285,6 +355,9 @@ protected:
     // Basic fuzz-testing
     void Fuzz(int nChance); // modifies ssSend
 
+    // Append a framed message to vSendMsg and start sending it; requires cs_vSend
+    void QueueSendData(const CMessageDataRef& data);
+
 public:
     uint256 hashContinue;
     int nStartingHeight;
@@ -417,6 +490,9 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    // Queue a message framed by MakeMessageData, shared with the other peers it is sent to
+    void PushMessageData(const CMessageDataRef& data);
+
     void PushVersion();
 
 
@@ -649,6 +725,51 @@ public:
     static uint64_t GetTotalBytesSent();
 };
 
+/**
+ * Peers waiting for a message handler thread.
+ *
+ * The message handler thread pushes every peer each time messages arrive, and
+ * at least every 100ms for the messages to send. A pool of handler threads
+ * pops them in turn, processes a message and sends what is due, and pushes the
+ * peer back to the end of the queue while it has more to process. A peer is
+ * queued at most once and is not popped while another thread serves it, so the
+ * messages of each peer are processed in the order they were received.
+ */
+class CMessageHandlerQueue
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable condQueue;
+    std::deque<CNode*> queue;
+    //! peers being served
+    size_t nServing;
+
+public:
+    enum {
+        //! send the inventory trickled to one random peer at a time
+        MESSAGES_TRICKLE = 1,
+        //! advertise our address again
+        MESSAGES_ADVERTISE = 2,
+        //! forget the addresses sent before, as they are advertised again
+        MESSAGES_FORGET_ADDR = 4,
+    };
+
+    CMessageHandlerQueue();
+
+    /**
+     * Queue pnode, holding a reference to it, unless it is queued already; a peer
+     * being served is queued again once it is done. Requires cs_vNodes.
+     */
+    void Push(CNode* pnode, int nFlags = 0);
+    /** Wait for a peer to serve, taking the flags it was pushed with */
+    CNode* Pop(int& nFlags);
+    /** Done serving pnode: queue it again if fMore or it was pushed meanwhile, else release it */
+    void Done(CNode* pnode, bool fMore);
+
+    size_t Size();
+    size_t Serving();
+};
+
 class CExplicitNetCleanup
 {
 public:
@@ -88,6 +88,8 @@ public:
     // memory only
     mutable CScript payee;
     mutable std::vector<uint256> vMerkleTree;
+    //! passed CheckBlockContextFree with proof of work and merkle root checks
+    mutable bool fChecked;
 
     CBlock()
     {
@@ -117,6 +119,7 @@ public:
         vMerkleTree.clear();
         payee = CScript();
         vchBlockSig.clear();
+        fChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
@@ -25,7 +25,8 @@ static const char* ppszTypeName[] =
         "mn winner",
         "mn announce",
         "mn ping",
-        "dstx"
+        "dstx",
+        "compact block"
 };
 
 CMessageHeader::CMessageHeader()
@@ -132,7 +133,7 @@ bool CInv::IsKnownType() const
 }
 
 bool CInv::IsMasterNodeType() const{
- 	return (type >= 6);
+ 	return (type >= MSG_SPORK && type <= MSG_DSTX);
 }
 
 const char* CInv::GetCommand() const
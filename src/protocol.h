@@ -77,6 +77,10 @@ enum {
 
 	 NODE_BLOOM_WITHOUT_MN = (1 << 4),
 
+    // NODE_COMPACT_BLOCKS means the node sends new blocks as their header and short
+    // transaction IDs when asked for MSG_CMPCT_BLOCK, and serves getblocktxn.
+    NODE_COMPACT_BLOCKS = (1 << 5),
+
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
     // bitcoin-development mailing list. Remember that service bits are just
@@ -164,7 +168,9 @@ enum {
     MSG_MASTERNODE_WINNER,
     MSG_MASTERNODE_ANNOUNCE,
     MSG_MASTERNODE_PING,
-    MSG_DSTX
+    MSG_DSTX,
+    // Like MSG_FILTERED_BLOCK, only asked for in a getdata to peers with NODE_COMPACT_BLOCKS
+    MSG_CMPCT_BLOCK
 };
 
 #endif // BITCOIN_PROTOCOL_H
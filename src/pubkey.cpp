@@ -6,26 +6,34 @@
 
 #include "eccryptoverify.h"
 
-#ifdef USE_SECP256K1
 #include <secp256k1.h>
-#else
-#include "ecwrapper.h"
-#endif
+
+//! anonymous namespace
+namespace
+{
+/** Build the verification tables (the precomputed multiples of G) once per process */
+class CSecp256k1VerifyInit
+{
+public:
+    CSecp256k1VerifyInit()
+    {
+        secp256k1_start(SECP256K1_START_VERIFY);
+    }
+    ~CSecp256k1VerifyInit()
+    {
+        secp256k1_stop();
+    }
+};
+static CSecp256k1VerifyInit instance_of_csecp256k1verify;
+
+} // anon namespace
 
 bool CPubKey::Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const
 {
-    if (!IsValid())
+    if (!IsValid() || vchSig.empty())
         return false;
-#ifdef USE_SECP256K1
     if (secp256k1_ecdsa_verify((const unsigned char*)&hash, 32, &vchSig[0], vchSig.size(), begin(), size()) != 1)
         return false;
-#else
-    CECKey key;
-    if (!key.SetPubKey(begin(), size()))
-        return false;
-    if (!key.Verify(hash, vchSig))
-        return false;
-#endif
     return true;
 }
 
@@ -35,19 +43,10 @@ bool CPubKey::RecoverCompact(const uint256& hash, const std::vector<unsigned cha
         return false;
     int recid = (vchSig[0] - 27) & 3;
     bool fComp = ((vchSig[0] - 27) & 4) != 0;
-#ifdef USE_SECP256K1
     int pubkeylen = 65;
     if (!secp256k1_ecdsa_recover_compact((const unsigned char*)&hash, 32, &vchSig[1], (unsigned char*)begin(), &pubkeylen, fComp, recid))
         return false;
     assert((int)size() == pubkeylen);
-#else
-    CECKey key;
-    if (!key.Recover(hash, &vchSig[1], recid))
-        return false;
-    std::vector<unsigned char> pubkey;
-    key.GetPubKey(pubkey, fComp);
-    Set(pubkey.begin(), pubkey.end());
-#endif
     return true;
 }
 
@@ -55,14 +54,8 @@ bool CPubKey::IsFullyValid() const
 {
     if (!IsValid())
         return false;
-#ifdef USE_SECP256K1
-    if (!secp256k1_ecdsa_pubkey_verify(begin(), size()))
-        return false;
-#else
-    CECKey key;
-    if (!key.SetPubKey(begin(), size()))
+    if (!secp256k1_ec_pubkey_verify(begin(), size()))
         return false;
-#endif
     return true;
 }
 
@@ -70,19 +63,10 @@ bool CPubKey::Decompress()
 {
     if (!IsValid())
         return false;
-#ifdef USE_SECP256K1
     int clen = size();
-    int ret = secp256k1_ecdsa_pubkey_decompress((unsigned char*)begin(), &clen);
-    assert(ret);
-    assert(clen == (int)size());
-#else
-    CECKey key;
-    if (!key.SetPubKey(begin(), size()))
+    if (!secp256k1_ec_pubkey_decompress((unsigned char*)begin(), &clen))
         return false;
-    std::vector<unsigned char> pubkey;
-    key.GetPubKey(pubkey, false);
-    Set(pubkey.begin(), pubkey.end());
-#endif
+    assert(clen == (int)size());
     return true;
 }
 
@@ -94,17 +78,8 @@ bool CPubKey::Derive(CPubKey& pubkeyChild, unsigned char ccChild[32], unsigned i
     unsigned char out[64];
     BIP32Hash(cc, nChild, *begin(), begin() + 1, out);
     memcpy(ccChild, out + 32, 32);
-#ifdef USE_SECP256K1
     pubkeyChild = *this;
-    bool ret = secp256k1_ecdsa_pubkey_tweak_add((unsigned char*)pubkeyChild.begin(), pubkeyChild.size(), out);
-#else
-    CECKey key;
-    bool ret = key.SetPubKey(begin(), size());
-    ret &= key.TweakPublic(out);
-    std::vector<unsigned char> pubkey;
-    key.GetPubKey(pubkey, true);
-    pubkeyChild.Set(pubkey.begin(), pubkey.end());
-#endif
+    bool ret = secp256k1_ec_pubkey_tweak_add((unsigned char*)pubkeyChild.begin(), pubkeyChild.size(), out);
     return ret;
 }
 
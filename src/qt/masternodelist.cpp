@@ -341,12 +341,12 @@ void MasternodeList::updateNodeList()
     ui->tableWidgetMasternodes->setSortingEnabled(false);
     ui->tableWidgetMasternodes->clearContents();
     ui->tableWidgetMasternodes->setRowCount(0);
-    std::vector<CMasternode> vMasternodes = mnodeman.GetFullMasternodeMap();
+    std::shared_ptr<const std::vector<CMasternode> > vMasternodes = mnodeman.GetSnapshot();
     int offsetFromUtc = GetOffsetFromUtc();
 
     std::string mnLevelText = "";
 
-    for(auto& mn : vMasternodes)
+    for(const auto& mn : *vMasternodes)
     {
         // populate list
         // Address, Protocol, Status, Active Seconds, Last Seen, Pub Key
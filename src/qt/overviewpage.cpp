@@ -357,8 +357,8 @@ void OverviewPage::updateMasternodeInfo()
    int mn2=0;
    int mn3=0;
    int totalmn=0;
-   std::vector<CMasternode> vMasternodes = mnodeman.GetFullMasternodeMap();
-    for(auto& mn : vMasternodes)
+   std::shared_ptr<const std::vector<CMasternode> > vMasternodes = mnodeman.GetSnapshot();
+    for(const auto& mn : *vMasternodes)
     {
        switch ( mn.Level())
        {
@@ -6,10 +6,15 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blockcache.h"
+#include "blockpipeline.h"
 #include "checkpoints.h"
 #include "main.h"
 #include "rpcserver.h"
+#include "script/sigcache.h"
+#include "spork.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <stdint.h>
@@ -499,7 +504,19 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"bestblockhash\": \"...\", (string) the hash of the currently best block\n"
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
-            "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"chainwork\": \"xxxx\",    (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"startup\": {              (json object) time spent loading the block index at startup\n"
+            "    \"entries\": xxxxxx,       (numeric) block index entries loaded\n"
+            "    \"threads\": n,            (numeric) threads decoding the entries\n"
+            "    \"totalms\": x.xxx,        (numeric) total time\n"
+            "    \"readms\": x.xxx,         (numeric) walking the block tree database\n"
+            "    \"decodems\": x.xxx,       (numeric) deserializing and hashing the entries\n"
+            "    \"insertms\": x.xxx,       (numeric) adding the entries to the block index\n"
+            "    \"linkms\": x.xxx,         (numeric) linking entries to blocks loaded later\n"
+            "    \"sortms\": x.xxx,         (numeric) ordering the entries by height\n"
+            "    \"chainworkms\": x.xxx,    (numeric) computing chain work and skip pointers\n"
+            "    \"blockfilesms\": x.xxx    (numeric) reading block file info and checking the block files\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getblockchaininfo", "") + HelpExampleRpc("getblockchaininfo", ""));
@@ -512,6 +529,19 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("difficulty", (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress", Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork", chainActive.Tip()->nChainWork.GetHex()));
+
+    UniValue startup(UniValue::VOBJ);
+    startup.push_back(Pair("entries", blockIndexLoadStats.nEntries));
+    startup.push_back(Pair("threads", blockIndexLoadStats.nThreads));
+    startup.push_back(Pair("totalms", 0.001 * blockIndexLoadStats.nTotalMicros));
+    startup.push_back(Pair("readms", 0.001 * blockIndexLoadStats.nReadMicros));
+    startup.push_back(Pair("decodems", 0.001 * blockIndexLoadStats.nDecodeMicros));
+    startup.push_back(Pair("insertms", 0.001 * blockIndexLoadStats.nInsertMicros));
+    startup.push_back(Pair("linkms", 0.001 * blockIndexLoadStats.nLinkMicros));
+    startup.push_back(Pair("sortms", 0.001 * blockIndexLoadStats.nSortMicros));
+    startup.push_back(Pair("chainworkms", 0.001 * blockIndexLoadStats.nChainWorkMicros));
+    startup.push_back(Pair("blockfilesms", 0.001 * blockIndexLoadStats.nFileInfoMicros));
+    obj.push_back(Pair("startup", startup));
     return obj;
 }
 
@@ -634,6 +664,190 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns size and usage counters of the signature cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"slots\": xxxxx               (numeric) Number of signatures the cache can hold\n"
+            "  \"bytes\": xxxxx               (numeric) Memory used by the cache\n"
+            "  \"lookups\": xxxxx             (numeric) Signature checks that consulted the cache\n"
+            "  \"hits\": xxxxx                (numeric) Lookups that found the signature\n"
+            "  \"hitrate\": x.xxx             (numeric) Hits per lookup\n"
+            "  \"inserts\": xxxxx             (numeric) Signatures added\n"
+            "  \"evictions\": xxxxx           (numeric) Signatures dropped to make room\n"
+            "  \"readretries\": xxxxx         (numeric) Lookups repeated because an insert ran at the same time\n"
+            "  \"writecontention\": xxxxx     (numeric) Inserts that waited for another insert\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getsigcacheinfo", "") + HelpExampleRpc("getsigcacheinfo", ""));
+
+    CSignatureCacheStats stats;
+    GetSignatureCacheStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("slots", stats.nSlots));
+    ret.push_back(Pair("bytes", stats.nBytes));
+    ret.push_back(Pair("lookups", stats.nLookups));
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("hitrate", stats.nLookups ? (double)stats.nHits / stats.nLookups : 0.0));
+    ret.push_back(Pair("inserts", stats.nInserts));
+    ret.push_back(Pair("evictions", stats.nEvictions));
+    ret.push_back(Pair("readretries", stats.nReadRetries));
+    ret.push_back(Pair("writecontention", stats.nWriteContention));
+
+    return ret;
+}
+
+UniValue getchainstateinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getchainstateinfo\n"
+            "\nReturns the state of the in-memory coins cache and of its writes to the coin database.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"cachebytes\": xxxxx           (numeric) Memory used by the coins cache\n"
+            "  \"cachelimit\": xxxxx           (numeric) Cache size that triggers a write (-dbcache)\n"
+            "  \"cachetransactions\": xxxxx    (numeric) Transactions held in the coins cache\n"
+            "  \"writes\": xxxxx               (numeric) Batches committed to the coin database\n"
+            "  \"writtentransactions\": xxxxx  (numeric) Changed transactions committed\n"
+            "  \"writtenbytes\": xxxxx         (numeric) Bytes of keys and values committed\n"
+            "  \"lastwritems\": x.xxx          (numeric) Duration of the last commit\n"
+            "  \"lastwritetransactions\": xxxxx (numeric) Changed transactions in the last commit\n"
+            "  \"lastwritebytes\": xxxxx       (numeric) Bytes in the last commit\n"
+            "  \"waitms\": x.xxx               (numeric) Time block connection waited for a previous commit to finish\n"
+            "  \"inprogress\": true|false      (boolean) If a commit is running in the background\n"
+            "  \"writetime\": {                (json object) Duration of commits\n"
+            "    \"count\": n,                 (numeric) number of samples\n"
+            "    \"avgms\": n.nnn,             (numeric) average duration in milliseconds\n"
+            "    \"maxms\": n.nnn,             (numeric) longest duration in milliseconds\n"
+            "    \"buckets\": {\"<1ms\": n, ...} (json object) number of samples per duration range\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getchainstateinfo", "") + HelpExampleRpc("getchainstateinfo", ""));
+
+    CCoinsWriteStats stats;
+    GetCoinsWriteStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        ret.push_back(Pair("cachebytes", (uint64_t)pcoinsTip->DynamicMemoryUsage()));
+        ret.push_back(Pair("cachelimit", (uint64_t)nCoinCacheUsage));
+        ret.push_back(Pair("cachetransactions", (uint64_t)pcoinsTip->GetCacheSize()));
+    }
+    ret.push_back(Pair("writes", stats.nWrites));
+    ret.push_back(Pair("writtentransactions", stats.nEntries));
+    ret.push_back(Pair("writtenbytes", stats.nBytes));
+    ret.push_back(Pair("lastwritems", 0.001 * stats.nLastMicros));
+    ret.push_back(Pair("lastwritetransactions", stats.nLastEntries));
+    ret.push_back(Pair("lastwritebytes", stats.nLastBytes));
+    ret.push_back(Pair("waitms", 0.001 * stats.nWaitMicros));
+    ret.push_back(Pair("inprogress", stats.fInProgress));
+    ret.push_back(Pair("writetime", LatencyHistogramToJSON(histCoinsWrite)));
+
+    return ret;
+}
+
+UniValue getblockpipelineinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockpipelineinfo\n"
+            "\nReturns the state of the pipeline checking and connecting blocks received from peers.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"running\": true|false        (boolean) If received blocks go through the pipeline (-blockcheckthreads)\n"
+            "  \"checkthreads\": n            (numeric) Threads checking blocks\n"
+            "  \"checkqueue\": n              (numeric) Blocks waiting for a check thread\n"
+            "  \"checking\": n                (numeric) Blocks being checked\n"
+            "  \"connectqueue\": n            (numeric) Checked blocks waiting for the blocks received before them\n"
+            "  \"connecting\": n              (numeric) Blocks being connected\n"
+            "  \"bytes\": n                   (numeric) Serialized size of the blocks in the pipeline\n"
+            "  \"received\": n                (numeric) Blocks handed to the pipeline\n"
+            "  \"checked\": n                 (numeric) Blocks checked\n"
+            "  \"checkfailed\": n             (numeric) Blocks that failed their checks\n"
+            "  \"connected\": n               (numeric) Blocks passed on to be connected\n"
+            "  \"receiverate\": x.xxx         (numeric) Blocks received per second, averaged over the last minute\n"
+            "  \"checkrate\": x.xxx           (numeric) Blocks checked per second\n"
+            "  \"connectrate\": x.xxx         (numeric) Blocks connected per second\n"
+            "  \"submitwaitms\": x.xxx        (numeric) Time the message handler waited for room in the pipeline\n"
+            "  \"checktime\": {...}           (json object) Duration of the checks of a block, see getchainstateinfo\n"
+            "  \"connectwait\": {...}         (json object) Time from the end of its checks until a block was connected\n"
+            "  \"connecttime\": {...}         (json object) Duration of connecting a block\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getblockpipelineinfo", "") + HelpExampleRpc("getblockpipelineinfo", ""));
+
+    CBlockPipelineStats stats;
+    blockPipeline.GetStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("running", stats.fRunning));
+    ret.push_back(Pair("checkthreads", stats.nCheckThreads));
+    ret.push_back(Pair("checkqueue", (uint64_t)stats.nQueuedCheck));
+    ret.push_back(Pair("checking", (uint64_t)stats.nChecking));
+    ret.push_back(Pair("connectqueue", (uint64_t)stats.nQueuedConnect));
+    ret.push_back(Pair("connecting", (uint64_t)stats.nConnecting));
+    ret.push_back(Pair("bytes", (uint64_t)stats.nBytes));
+    ret.push_back(Pair("received", stats.nReceived));
+    ret.push_back(Pair("checked", stats.nChecked));
+    ret.push_back(Pair("checkfailed", stats.nCheckFailed));
+    ret.push_back(Pair("connected", stats.nConnected));
+    ret.push_back(Pair("receiverate", stats.dReceiveRate));
+    ret.push_back(Pair("checkrate", stats.dCheckRate));
+    ret.push_back(Pair("connectrate", stats.dConnectRate));
+    ret.push_back(Pair("submitwaitms", 0.001 * stats.nSubmitWaitMicros));
+    ret.push_back(Pair("checktime", LatencyHistogramToJSON(blockPipeline.histCheck)));
+    ret.push_back(Pair("connectwait", LatencyHistogramToJSON(blockPipeline.histConnectWait)));
+    ret.push_back(Pair("connecttime", LatencyHistogramToJSON(blockPipeline.histConnect)));
+
+    return ret;
+}
+
+UniValue getblockcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockcacheinfo\n"
+            "\nReturns size and usage counters of the cache of block messages served to peers.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocks\": xxxxx              (numeric) Blocks held in the cache\n"
+            "  \"bytes\": xxxxx               (numeric) Size of the block messages held\n"
+            "  \"maxbytes\": xxxxx            (numeric) Size above which the least recently served blocks are dropped (-blockcache)\n"
+            "  \"hits\": xxxxx                (numeric) Blocks served from the cache\n"
+            "  \"misses\": xxxxx              (numeric) Blocks read from disk\n"
+            "  \"hitrate\": x.xxx             (numeric) Hits per block served\n"
+            "  \"evictions\": xxxxx           (numeric) Blocks dropped to make room\n"
+            "  \"bytesfromcache\": xxxxx      (numeric) Bytes of blocks served from the cache\n"
+            "  \"bytesfromdisk\": xxxxx       (numeric) Bytes of blocks read from disk\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getblockcacheinfo", "") + HelpExampleRpc("getblockcacheinfo", ""));
+
+    CBlockCacheStats stats;
+    blockCache.GetStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("blocks", (uint64_t)stats.nBlocks));
+    ret.push_back(Pair("bytes", (uint64_t)stats.nBytes));
+    ret.push_back(Pair("maxbytes", (uint64_t)stats.nMaxBytes));
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("misses", stats.nMisses));
+    ret.push_back(Pair("hitrate", stats.nHits + stats.nMisses ? (double)stats.nHits / (stats.nHits + stats.nMisses) : 0.0));
+    ret.push_back(Pair("evictions", stats.nEvictions));
+    ret.push_back(Pair("bytesfromcache", stats.nBytesFromCache));
+    ret.push_back(Pair("bytesfromdisk", stats.nBytesFromDisk));
+
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -706,3 +920,120 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
 
     return NullUniValue;
 }
+
+/**
+ * Besides the coins, DisconnectBlock and ConnectBlock update the stake spends of the
+ * active chain, the tx filter and the supply of each index they connect. A replay
+ * saves them first and puts them back when it ends, however it ends.
+ */
+class CReplayStateGuard
+{
+private:
+    std::map<COutPoint, int> mapStakeSpentSaved;
+    std::map<CBitcoinAddress, int64_t> mapFilterAddressSaved;
+    std::map<CTxDestination, int64_t> mapFilterDestinationSaved;
+    bool txFilterStateSaved;
+    int txFilterTargetSaved;
+    std::vector<std::pair<CBlockIndex*, std::pair<CAmount, CAmount> > > vSupplySaved;
+
+public:
+    CReplayStateGuard() : mapStakeSpentSaved(mapStakeSpent),
+                          mapFilterAddressSaved(mapFilterAddress),
+                          mapFilterDestinationSaved(mapFilterDestination),
+                          txFilterStateSaved(txFilterState),
+                          txFilterTargetSaved(txFilterTarget)
+    {
+        AssertLockHeld(cs_main);
+    }
+
+    void SaveSupply(CBlockIndex* pindex)
+    {
+        vSupplySaved.push_back(std::make_pair(pindex, std::make_pair(pindex->nMoneySupply, pindex->nMint)));
+    }
+
+    ~CReplayStateGuard()
+    {
+        mapStakeSpent.swap(mapStakeSpentSaved);
+        mapFilterAddress.swap(mapFilterAddressSaved);
+        mapFilterDestination.swap(mapFilterDestinationSaved);
+        txFilterState = txFilterStateSaved;
+        txFilterTarget = txFilterTargetSaved;
+        for (const auto& supply : vSupplySaved) {
+            supply.first->nMoneySupply = supply.second.first;
+            supply.first->nMint = supply.second.second;
+        }
+    }
+};
+
+UniValue replayblocks(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "replayblocks ( nblocks )\n"
+            "\nDisconnects the last blocks of the active chain in memory and connects them again, timing the second step.\n"
+            "Nothing is written to the coins or block index databases, and the chain state is left as it was.\n"
+            "Script checks are skipped below the last checkpoint, and signatures already in the signature cache\n"
+            "are not verified again: start with -maxsigcachesize=0 to time verification.\n"
+            "\nArguments:\n"
+            "1. nblocks   (numeric, optional, default=100) the number of blocks to replay\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocks\": xxxxx              (numeric) Blocks replayed\n"
+            "  \"transactions\": xxxxx        (numeric) Transactions connected\n"
+            "  \"inputs\": xxxxx              (numeric) Inputs connected\n"
+            "  \"scriptchecks\": true|false   (boolean) If the replayed blocks had their scripts checked\n"
+            "  \"ms\": x.xxx                  (numeric) Time spent connecting the blocks\n"
+            "  \"msperblock\": x.xxx          (numeric) Average time per block\n"
+            "  \"inputspersec\": xxxxx        (numeric) Inputs connected per second\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("replayblocks", "1000") + HelpExampleRpc("replayblocks", "1000"));
+
+    int nBlocks = 100;
+    if (params.size() > 0)
+        nBlocks = params[0].get_int();
+    if (nBlocks <= 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid number of blocks");
+
+    LOCK(cs_main);
+    if (nBlocks > chainActive.Height())
+        nBlocks = chainActive.Height();
+
+    CReplayStateGuard replayState;
+    CCoinsViewCache coins(pcoinsTip);
+    CValidationState state;
+    std::vector<CBlock> vBlocks(nBlocks);
+    CBlockIndex* pindex = chainActive.Tip();
+    for (int i = 0; i < nBlocks; i++, pindex = pindex->pprev) {
+        if (!ReadBlockFromDisk(vBlocks[i], pindex))
+            throw JSONRPCError(RPC_DATABASE_ERROR, strprintf("Can't read block %d from disk", pindex->nHeight));
+        if (!DisconnectBlock(vBlocks[i], state, pindex, coins))
+            throw JSONRPCError(RPC_DATABASE_ERROR, strprintf("Can't disconnect block %d", pindex->nHeight));
+    }
+
+    int64_t nTime = 0;
+    int nTransactions = 0;
+    int nInputs = 0;
+    for (int i = nBlocks - 1; i >= 0; i--) {
+        pindex = chainActive.Next(pindex);
+        replayState.SaveSupply(pindex);
+        int64_t nStart = GetTimeMicros();
+        if (!ConnectBlock(vBlocks[i], state, pindex, coins, true))
+            throw JSONRPCError(RPC_VERIFY_ERROR, strprintf("Can't connect block %d: %s", pindex->nHeight, state.GetRejectReason()));
+        nTime += GetTimeMicros() - nStart;
+        nTransactions += vBlocks[i].vtx.size();
+        for (const CTransaction& tx : vBlocks[i].vtx)
+            nInputs += tx.vin.size();
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("blocks", nBlocks));
+    ret.push_back(Pair("transactions", nTransactions));
+    ret.push_back(Pair("inputs", nInputs));
+    ret.push_back(Pair("scriptchecks", chainActive.Height() - nBlocks + 1 >= Checkpoints::GetTotalBlocksEstimate()));
+    ret.push_back(Pair("ms", 0.001 * nTime));
+    ret.push_back(Pair("msperblock", nBlocks ? 0.001 * nTime / nBlocks : 0.0));
+    ret.push_back(Pair("inputspersec", nTime ? (int64_t)(1000000.0 * nInputs / nTime) : 0));
+
+    return ret;
+}
@@ -329,7 +329,7 @@ UniValue listmasternodes(const UniValue& params, bool fHelp)
         std::string strTxHash = s.second.vin.prevout.hash.ToString();
         uint32_t oIdx = s.second.vin.prevout.n;
 
-        CMasternode* mn = mnodeman.Find(s.second.vin);
+        CMasternode* mn = &s.second;
 
         if (mn != NULL) {
             if (strFilter != "" && strTxHash.find(strFilter) == string::npos &&
@@ -445,6 +445,11 @@ UniValue getmasternodecount (const UniValue& params, bool fHelp)
 
     auto chain_tip = chainActive.Tip();
 
+    std::map<unsigned, unsigned> mapInQueue;
+
+    if(chain_tip)
+        mnodeman.GetNextMasternodesInQueueForPayment(chain_tip->nHeight, mapInQueue);
+
     for(unsigned l = CMasternode::LevelValue::MIN; l <= CMasternode::LevelValue::MAX; ++l) {
 
         UniValue total_item{UniValue::VOBJ};
@@ -470,13 +475,8 @@ UniValue getmasternodecount (const UniValue& params, bool fHelp)
 
         UniValue inqueue_item{UniValue::VOBJ};
 
-        unsigned inqueue_count = 0u;
-
-        if(chain_tip)
-            mnodeman.GetNextMasternodeInQueueForPayment(chain_tip->nHeight, l, true, inqueue_count);
-
         inqueue_item.push_back(Pair("level", l));
-        inqueue_item.push_back(Pair("count", inqueue_count));
+        inqueue_item.push_back(Pair("count", mapInQueue[l]));
 
         inqueue.push_back(inqueue_item);
 
@@ -1031,11 +1031,11 @@ UniValue getmasternodescores (const UniValue& params, bool fHelp)
     }
     UniValue obj(UniValue::VOBJ);
 
-    std::vector<CMasternode> vMasternodes = mnodeman.GetFullMasternodeVector();
+    std::shared_ptr<const std::vector<CMasternode> > vMasternodes = mnodeman.GetSnapshot();
     for (int nHeight = chainActive.Tip()->nHeight - nLast; nHeight < chainActive.Tip()->nHeight + 20; nHeight++) {
         uint256 nHigh = 0;
-        CMasternode* pBestMasternode = NULL;
-        for (CMasternode& mn : vMasternodes) {
+        const CMasternode* pBestMasternode = NULL;
+        for (const CMasternode& mn : *vMasternodes) {
             uint256 n = mn.CalculateScore(1, nHeight - 100);
             if (n > nHigh) {
                 nHigh = n;
@@ -1048,3 +1048,35 @@ UniValue getmasternodescores (const UniValue& params, bool fHelp)
 
     return obj;
 }
+
+UniValue getblockhashcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockhashcacheinfo\n"
+            "\nReturns size and usage counters of the cache of block hashes by height used by the masternode code.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"slots\": xxxxx               (numeric) Number of heights the cache can hold\n"
+            "  \"lookups\": xxxxx             (numeric) Block hashes looked up\n"
+            "  \"hits\": xxxxx                (numeric) Lookups answered from the cache\n"
+            "  \"misses\": xxxxx              (numeric) Lookups read from the active chain\n"
+            "  \"hitrate\": x.xxx             (numeric) Hits per lookup\n"
+            "  \"invalidated\": xxxxx         (numeric) Heights dropped because their block was disconnected\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getblockhashcacheinfo", "") + HelpExampleRpc("getblockhashcacheinfo", ""));
+
+    CBlockHashCacheStats stats;
+    blockHashCache.GetStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("slots", stats.nSlots));
+    ret.push_back(Pair("lookups", stats.nLookups));
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("misses", stats.nLookups - stats.nHits));
+    ret.push_back(Pair("hitrate", stats.nLookups ? (double)stats.nHits / stats.nLookups : 0.0));
+    ret.push_back(Pair("invalidated", stats.nInvalidated));
+
+    return ret;
+}
@@ -10,8 +10,10 @@
 #include "base58.h"
 #include "clientversion.h"
 #include "init.h"
+#include "kernel.h"
 #include "main.h"
 #include "masternode-sync.h"
+#include "miner.h"
 #include "net.h"
 #include "netbase.h"
 #include "rpcserver.h"
@@ -501,6 +503,16 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
             "  \"enoughcoins\": true|false,        (boolean) if available coins are greater than reserve balance\n"
             "  \"mnsync\": true|false,             (boolean) if masternode data is synced\n"
             "  \"staking status\": true|false,     (boolean) if the wallet is staking or not\n"
+            "  \"stakethreads\": n,                (numeric) the number of stake kernel search threads\n"
+            "  \"stakesearchrate\": n.nnn,         (numeric) kernel hashes per second over the last stake search\n"
+            "  \"stakesearchhashes\": n,           (numeric) total kernel hashes computed since startup\n"
+            "  \"tiptosearch\": {                  (json object) latency from a new chain tip to the start of a kernel search on it\n"
+            "    \"count\": n,                     (numeric) number of samples\n"
+            "    \"avgms\": n.nnn,                 (numeric) average latency in milliseconds\n"
+            "    \"maxms\": n.nnn,                 (numeric) highest latency in milliseconds\n"
+            "    \"buckets\": {\"<1ms\": n, ...}    (json object) number of samples per latency range\n"
+            "  },\n"
+            "  \"tiptobroadcast\": {...}           (json object) latency from a new chain tip to broadcasting a block staked on it, same fields\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getstakingstatus", "") + HelpExampleRpc("getstakingstatus", ""));
@@ -521,6 +533,11 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
     else if (mapHashedBlocks.count(chainActive.Tip()->nHeight - 1) && nLastCoinStakeSearchInterval)
         nStaking = true;
     obj.push_back(Pair("staking status", nStaking));
+    obj.push_back(Pair("stakethreads", std::max(nStakeSearchThreads, 1)));
+    obj.push_back(Pair("stakesearchrate", GetStakeSearchRate()));
+    obj.push_back(Pair("stakesearchhashes", GetStakeSearchHashes()));
+    obj.push_back(Pair("tiptosearch", LatencyHistogramToJSON(histTipToStakeSearch)));
+    obj.push_back(Pair("tiptobroadcast", LatencyHistogramToJSON(histTipToStakeBroadcast)));
 
     return obj;
 }
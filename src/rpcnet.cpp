@@ -7,6 +7,7 @@
 
 #include "rpcserver.h"
 
+#include "blockencodings.h"
 #include "clientversion.h"
 #include "main.h"
 #include "net.h"
@@ -88,6 +89,8 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"lastrecv\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last receive\n"
             "    \"bytessent\": n,            (numeric) The total bytes sent\n"
             "    \"bytesrecv\": n,            (numeric) The total bytes received\n"
+            "    \"msgqueue\": n,             (numeric) The messages received and waiting to be processed\n"
+            "    \"getdataqueue\": n,         (numeric) The inventory requested and waiting to be sent\n"
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
             "    \"pingtime\": n,             (numeric) ping time\n"
             "    \"pingwait\": n,             (numeric) ping wait\n"
@@ -126,6 +129,8 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         obj.push_back(Pair("lastrecv", stats.nLastRecv));
         obj.push_back(Pair("bytessent", stats.nSendBytes));
         obj.push_back(Pair("bytesrecv", stats.nRecvBytes));
+        obj.push_back(Pair("msgqueue", stats.nRecvMsgQueue));
+        obj.push_back(Pair("getdataqueue", stats.nRecvGetDataQueue));
         obj.push_back(Pair("conntime", stats.nTimeConnected));
         obj.push_back(Pair("pingtime", stats.dPingTime));
         if (stats.dPingWait > 0.0)
@@ -325,6 +330,90 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     return obj;
 }
 
+UniValue getsockethandlerinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsockethandlerinfo\n"
+            "\nReturns the state of the thread receiving from and sending to the sockets of the peers.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"backend\": \"xxxx\"           (string) How the thread waits for sockets: epoll, poll or select\n"
+            "  \"sockets\": n                (numeric) Sockets watched, the listening ones included\n"
+            "  \"activepeers\": n            (numeric) Peers the last loop left with data to receive or send\n"
+            "  \"loops\": n                  (numeric) Times the thread waited for sockets\n"
+            "  \"wakeups\": n                (numeric) Waits ended by socket events or by data queued to send\n"
+            "  \"signals\": n                (numeric) Waits ended by data queued to send\n"
+            "  \"events\": n                 (numeric) Socket events received\n"
+            "  \"wakeuprate\": x.xxx         (numeric) Wakeups per second, averaged over the last minute\n"
+            "  \"looptime\": {...}           (json object) Time taken to serve the sockets after a wakeup, see getchainstateinfo\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getsockethandlerinfo", "") + HelpExampleRpc("getsockethandlerinfo", ""));
+
+    CSocketHandlerStats stats;
+    GetSocketHandlerStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("backend", stats.strBackend));
+    ret.push_back(Pair("sockets", (uint64_t)stats.nSockets));
+    ret.push_back(Pair("activepeers", (uint64_t)stats.nActive));
+    ret.push_back(Pair("loops", stats.nLoops));
+    ret.push_back(Pair("wakeups", stats.nWakeups));
+    ret.push_back(Pair("signals", stats.nSignals));
+    ret.push_back(Pair("events", stats.nEvents));
+    ret.push_back(Pair("wakeuprate", stats.dWakeupRate));
+    ret.push_back(Pair("looptime", LatencyHistogramToJSON(histSocketLoop)));
+
+    return ret;
+}
+
+UniValue getcompactblockinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcompactblockinfo\n"
+            "\nReturns counters of the blocks exchanged with peers as their header and short transaction IDs.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false       (boolean) Whether compact blocks are asked for and served (-compactblocks)\n"
+            "  \"received\": n               (numeric) Compact blocks received\n"
+            "  \"reconstructed\": n          (numeric) Blocks rebuilt from the transactions already known\n"
+            "  \"roundtrips\": n             (numeric) Blocks rebuilt after asking for the missing transactions\n"
+            "  \"fallbacks\": n              (numeric) Blocks asked for whole when they could not be rebuilt\n"
+            "  \"txprefilled\": n            (numeric) Transactions sent in full within compact blocks\n"
+            "  \"txfrommempool\": n          (numeric) Transactions found in the mempool\n"
+            "  \"txfromorphans\": n          (numeric) Transactions found among the orphan transactions\n"
+            "  \"txrequested\": n            (numeric) Transactions asked for with getblocktxn\n"
+            "  \"bytesreceived\": n          (numeric) Size of the compact blocks and missing transactions received\n"
+            "  \"blockbytes\": n             (numeric) Size of the blocks rebuilt from them\n"
+            "  \"served\": n                 (numeric) Compact blocks sent to peers\n"
+            "  \"txserved\": n               (numeric) Missing transactions sent to peers\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getcompactblockinfo", "") + HelpExampleRpc("getcompactblockinfo", ""));
+
+    CCompactBlockStats stats;
+    GetCompactBlockStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("enabled", (nLocalServices & NODE_COMPACT_BLOCKS) != 0));
+    ret.push_back(Pair("received", stats.nReceived));
+    ret.push_back(Pair("reconstructed", stats.nReconstructed));
+    ret.push_back(Pair("roundtrips", stats.nRoundTrips));
+    ret.push_back(Pair("fallbacks", stats.nFallbacks));
+    ret.push_back(Pair("txprefilled", stats.nTxPrefilled));
+    ret.push_back(Pair("txfrommempool", stats.nTxFromMempool));
+    ret.push_back(Pair("txfromorphans", stats.nTxFromExtra));
+    ret.push_back(Pair("txrequested", stats.nTxRequested));
+    ret.push_back(Pair("bytesreceived", stats.nBytesReceived));
+    ret.push_back(Pair("blockbytes", stats.nBlockBytes));
+    ret.push_back(Pair("served", stats.nServed));
+    ret.push_back(Pair("txserved", stats.nTxServed));
+
+    return ret;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
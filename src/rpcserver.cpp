@@ -11,6 +11,7 @@
 #include "base58.h"
 #include "init.h"
 #include "main.h"
+#include "stats.h"
 #include "ui_interface.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
@@ -112,6 +113,30 @@ UniValue ValueFromAmount(const CAmount& amount)
             strprintf("%s%d.%08d", sign ? "-" : "", quotient, remainder));
 }
 
+UniValue LatencyHistogramToJSON(const CLatencyHistogram& histogram)
+{
+    std::vector<uint64_t> vBucket;
+    uint64_t nCount;
+    int64_t nSumMicros, nMaxMicros;
+    histogram.Get(vBucket, nCount, nSumMicros, nMaxMicros);
+
+    UniValue buckets(UniValue::VOBJ);
+    for (int n = 0; n < (int)vBucket.size(); n++) {
+        int64_t nLimit = CLatencyHistogram::BucketLimit(n);
+        if (nLimit)
+            buckets.push_back(Pair(strprintf("<%dms", nLimit), vBucket[n]));
+        else
+            buckets.push_back(Pair(strprintf(">=%dms", CLatencyHistogram::BucketLimit(n - 1)), vBucket[n]));
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("count", nCount));
+    ret.push_back(Pair("avgms", nCount ? 0.001 * nSumMicros / nCount : 0.0));
+    ret.push_back(Pair("maxms", 0.001 * nMaxMicros));
+    ret.push_back(Pair("buckets", buckets));
+    return ret;
+}
+
 uint256 ParseHashV(const UniValue& v, string strName)
 {
     string strHex;
@@ -268,6 +293,8 @@ static const CRPCCommand vRPCCommands[] =
         {"network", "getaddednodeinfo", &getaddednodeinfo, true, true, false},
         {"network", "getconnectioncount", &getconnectioncount, true, false, false},
         {"network", "getnettotals", &getnettotals, true, true, false},
+        {"network", "getsockethandlerinfo", &getsockethandlerinfo, true, true, false},
+        {"network", "getcompactblockinfo", &getcompactblockinfo, true, true, false},
         {"network", "getpeerinfo", &getpeerinfo, true, false, false},
         {"network", "ping", &ping, true, false, false},
 
@@ -282,6 +309,10 @@ static const CRPCCommand vRPCCommands[] =
         {"blockchain", "getdifficulty", &getdifficulty, true, false, false},
         {"blockchain", "getmempoolinfo", &getmempoolinfo, true, true, false},
         {"blockchain", "getrawmempool", &getrawmempool, true, false, false},
+        {"blockchain", "getsigcacheinfo", &getsigcacheinfo, true, true, false},
+        {"blockchain", "getchainstateinfo", &getchainstateinfo, true, true, false},
+        {"blockchain", "getblockpipelineinfo", &getblockpipelineinfo, true, true, false},
+        {"blockchain", "getblockcacheinfo", &getblockcacheinfo, true, true, false},
         {"blockchain", "gettxout", &gettxout, true, false, false},
         {"blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true, false, false},
         {"blockchain", "verifychain", &verifychain, true, false, false},
@@ -321,6 +352,7 @@ static const CRPCCommand vRPCCommands[] =
         /* Not shown in help */
         {"hidden", "invalidateblock", &invalidateblock, true, true, false},
         {"hidden", "reconsiderblock", &reconsiderblock, true, true, false},
+        {"hidden", "replayblocks", &replayblocks, true, true, false},
         {"hidden", "setmocktime", &setmocktime, true, false, false},
 
         /* fdr features */
@@ -337,6 +369,7 @@ static const CRPCCommand vRPCCommands[] =
         {"fdr", "getmasternodestatus", &getmasternodestatus, true, true, false},
         {"fdr", "getmasternodewinners", &getmasternodewinners, true, true, false},
         {"fdr", "getmasternodescores", &getmasternodescores, true, true, false},
+        {"fdr", "getblockhashcacheinfo", &getblockhashcacheinfo, true, true, false},
         {"fdr", "mnsync", &mnsync, true, true, false},
         {"fdr", "spork", &spork, true, true, false},
         {"fdr", "getpoolinfo", &getpoolinfo, true, true, false},
@@ -5,83 +5,220 @@
 
 #include "sigcache.h"
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
+#include <string.h>
 
-namespace {
+#include <boost/thread/tss.hpp>
 
-/**
- * Valid signature cache, to avoid doing expensive ECDSA signature checking
- * twice for every transaction (once when accepted into memory pool, and
- * again when accepted into the block chain)
- */
-class CSignatureCache
+#include <secp256k1.h>
+
+CSignatureCache::CSignatureCache(int64_t nMaxBytes)
 {
-private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    GetRandBytes(nonce, sizeof(nonce));
+    nShardSlots = 0;
+    if (nMaxBytes > 0 && nMaxBytes / (32 * SHARDS) >= PROBE)
+        nShardSlots = nMaxBytes / (32 * SHARDS);
+
+    for (Shard& shard : vShard) {
+        shard.nSequence = 0;
+        shard.nEvict = 0;
+        shard.nLookups = 0;
+        shard.nHits = 0;
+        shard.nInserts = 0;
+        shard.nEvictions = 0;
+        shard.nReadRetries = 0;
+        shard.nWriteContention = 0;
+        if (!nShardSlots)
+            continue;
+        shard.data.reset(new std::atomic<uint64_t>[4 * nShardSlots]);
+        for (size_t i = 0; i < 4 * nShardSlots; i++)
+            shard.data[i].store(0, std::memory_order_relaxed);
+    }
+}
 
-public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+CSignatureCache::Shard& CSignatureCache::Locate(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey, uint64_t* pEntry, size_t& nHome)
+{
+    // the public key encodes its own length, so it goes before the signature
+    unsigned char entry[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(nonce, sizeof(nonce)).Write(hash.begin(), 32).Write(pubKey.begin(), pubKey.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry);
+    memcpy(pEntry, entry, sizeof(entry));
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+    nHome = pEntry[0] % nShardSlots;
+    return vShard[pEntry[1] % SHARDS];
+}
+
+int CSignatureCache::Find(const Shard& shard, const uint64_t* pEntry, size_t nHome) const
+{
+    for (int n = 0; n < PROBE; n++) {
+        size_t nSlot = (nHome + n) % nShardSlots;
+        const std::atomic<uint64_t>* pSlot = &shard.data[4 * nSlot];
+        if (pSlot[0].load(std::memory_order_relaxed) == pEntry[0] &&
+            pSlot[1].load(std::memory_order_relaxed) == pEntry[1] &&
+            pSlot[2].load(std::memory_order_relaxed) == pEntry[2] &&
+            pSlot[3].load(std::memory_order_relaxed) == pEntry[3])
+            return nSlot;
     }
+    return -1;
+}
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+bool CSignatureCache::Get(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+{
+    if (!nShardSlots)
+        return false;
+
+    uint64_t entry[4];
+    size_t nHome;
+    Shard& shard = Locate(hash, vchSig, pubKey, entry, nHome);
+    shard.nLookups.fetch_add(1, std::memory_order_relaxed);
+
+    while (true) {
+        uint32_t nSequence = shard.nSequence.load(std::memory_order_acquire);
+        if (!(nSequence & 1)) {
+            bool fFound = Find(shard, entry, nHome) >= 0;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (shard.nSequence.load(std::memory_order_relaxed) == nSequence) {
+                if (fFound)
+                    shard.nHits.fetch_add(1, std::memory_order_relaxed);
+                return fFound;
+            }
         }
+        shard.nReadRetries.fetch_add(1, std::memory_order_relaxed);
+    }
+}
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+void CSignatureCache::Set(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+{
+    if (!nShardSlots)
+        return;
+
+    uint64_t entry[4];
+    size_t nHome;
+    Shard& shard = Locate(hash, vchSig, pubKey, entry, nHome);
+
+    boost::unique_lock<boost::mutex> lock(shard.mutex, boost::try_to_lock);
+    if (!lock.owns_lock()) {
+        shard.nWriteContention.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+    }
+
+    if (Find(shard, entry, nHome) >= 0)
+        return;
+
+    // take the first empty slot of the window, or evict the next one in turn
+    size_t nSlot = nShardSlots;
+    for (int n = 0; n < PROBE && nSlot == nShardSlots; n++) {
+        size_t nTry = (nHome + n) % nShardSlots;
+        const std::atomic<uint64_t>* pSlot = &shard.data[4 * nTry];
+        if (!(pSlot[0].load(std::memory_order_relaxed) | pSlot[1].load(std::memory_order_relaxed) |
+                pSlot[2].load(std::memory_order_relaxed) | pSlot[3].load(std::memory_order_relaxed)))
+            nSlot = nTry;
+    }
+    if (nSlot == nShardSlots) {
+        nSlot = (nHome + shard.nEvict++ % PROBE) % nShardSlots;
+        shard.nEvictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint32_t nSequence = shard.nSequence.load(std::memory_order_relaxed);
+    shard.nSequence.store(nSequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < 4; i++)
+        shard.data[4 * nSlot + i].store(entry[i], std::memory_order_relaxed);
+    shard.nSequence.store(nSequence + 2, std::memory_order_release);
+    shard.nInserts.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CSignatureCache::GetStats(CSignatureCacheStats& stats) const
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.nSlots = (uint64_t)nShardSlots * SHARDS;
+    stats.nBytes = stats.nSlots * 32;
+    for (const Shard& shard : vShard) {
+        stats.nLookups += shard.nLookups.load(std::memory_order_relaxed);
+        stats.nHits += shard.nHits.load(std::memory_order_relaxed);
+        stats.nInserts += shard.nInserts.load(std::memory_order_relaxed);
+        stats.nEvictions += shard.nEvictions.load(std::memory_order_relaxed);
+        stats.nReadRetries += shard.nReadRetries.load(std::memory_order_relaxed);
+        stats.nWriteContention += shard.nWriteContention.load(std::memory_order_relaxed);
+    }
+}
+
+static CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache(GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE));
+    return signatureCache;
+}
+
+void GetSignatureCacheStats(CSignatureCacheStats& stats)
+{
+    GetSignatureCache().GetStats(stats);
+}
+
+namespace
+{
+/**
+ * Per script check thread cache of decompressed public keys. secp256k1 has to
+ * recover y with a field square root for every compressed key it verifies
+ * against; block inputs keep spending to the same few keys, so each worker
+ * remembers the expanded form of the keys it has seen recently.
+ */
+class CPubKeyExpansionCache
+{
+private:
+    static const unsigned int SLOTS = 1024;
+
+    struct Entry {
+        CPubKey compressed;
+        CPubKey expanded;
+    };
+    Entry vEntry[SLOTS];
+
+public:
+    const CPubKey& Expand(const CPubKey& pubkey)
+    {
+        if (!pubkey.IsCompressed())
+            return pubkey;
+
+        // the x coordinate is uniformly distributed, so its low bytes index the table
+        unsigned int nSlot = ReadLE32(pubkey.begin() + 1) % SLOTS;
+        Entry& entry = vEntry[nSlot];
+        if (entry.compressed == pubkey)
+            return entry.expanded;
+
+        unsigned char vch[65];
+        int nLen = pubkey.size();
+        memcpy(vch, pubkey.begin(), nLen);
+        if (!secp256k1_ec_pubkey_decompress(vch, &nLen))
+            return pubkey;
+        entry.compressed = pubkey;
+        entry.expanded.Set(vch, vch + nLen);
+        return entry.expanded;
     }
 };
 
+static boost::thread_specific_ptr<CPubKeyExpansionCache> pubKeyExpansionCache;
+
+const CPubKey& ExpandPubKey(const CPubKey& pubkey)
+{
+    if (pubKeyExpansionCache.get() == NULL)
+        pubKeyExpansionCache.reset(new CPubKeyExpansionCache());
+    return pubKeyExpansionCache->Expand(pubkey);
 }
+} // anon namespace
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
 
     if (signatureCache.Get(sighash, vchSig, pubkey))
         return true;
 
-    if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
+    if (!TransactionSignatureChecker::VerifySignature(vchSig, ExpandPubKey(pubkey), sighash))
         return false;
 
     if (store)
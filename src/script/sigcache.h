@@ -8,10 +8,84 @@
 
 #include "script/interpreter.h"
 
+#include <atomic>
+#include <memory>
 #include <vector>
 
+#include <boost/thread/mutex.hpp>
+
+/** Default for -maxsigcachesize, in bytes */
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 10 * 1024 * 1024;
+
 class CPubKey;
 
+struct CSignatureCacheStats
+{
+    uint64_t nSlots;
+    uint64_t nBytes;
+    uint64_t nLookups;
+    uint64_t nHits;
+    uint64_t nInserts;
+    uint64_t nEvictions;
+    //! lookups repeated because an insert into the same shard overlapped them
+    uint64_t nReadRetries;
+    //! inserts that had to wait for another insert into the same shard
+    uint64_t nWriteContention;
+};
+
+/**
+ * Valid signature cache, to avoid doing expensive ECDSA signature checking
+ * twice for every transaction (once when accepted into memory pool, and
+ * again when accepted into the block chain)
+ *
+ * Entries are salted hashes of (signature hash, public key, signature), held
+ * in SHARDS open addressing tables of 32 byte slots. Lookups take no lock:
+ * each shard has a sequence number that is odd while an insert writes to it,
+ * and a lookup that overlapped an insert is repeated. Inserts into one shard
+ * are serialized by its mutex. An entry lives in one of the PROBE slots from
+ * its home slot on; when those are full they are evicted in turn. The salt
+ * keeps attackers from aiming entries at a particular slot.
+ */
+class CSignatureCache
+{
+public:
+    static const int SHARDS = 16;
+    static const int PROBE = 8;
+
+private:
+    struct Shard {
+        boost::mutex mutex;
+        std::atomic<uint32_t> nSequence;
+        //! four words per slot, all zero while the slot is empty
+        std::unique_ptr<std::atomic<uint64_t>[]> data;
+        unsigned int nEvict;
+        std::atomic<uint64_t> nLookups;
+        std::atomic<uint64_t> nHits;
+        std::atomic<uint64_t> nInserts;
+        std::atomic<uint64_t> nEvictions;
+        std::atomic<uint64_t> nReadRetries;
+        std::atomic<uint64_t> nWriteContention;
+    };
+
+    Shard vShard[SHARDS];
+    size_t nShardSlots;
+    unsigned char nonce[32];
+
+    Shard& Locate(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey, uint64_t* pEntry, size_t& nHome);
+    int Find(const Shard& shard, const uint64_t* pEntry, size_t nHome) const;
+
+public:
+    //! A cache of at most nMaxBytes, disabled if that is not enough for one full probe window per shard
+    explicit CSignatureCache(int64_t nMaxBytes);
+
+    bool Get(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey);
+    void Set(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey);
+    void GetStats(CSignatureCacheStats& stats) const;
+};
+
+/** Counters of the signature cache used by CachingTransactionSignatureChecker */
+void GetSignatureCacheStats(CSignatureCacheStats& stats);
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
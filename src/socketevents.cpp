@@ -0,0 +1,334 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/fdreserve-config.h"
+#endif
+
+#include "socketevents.h"
+
+#include "netbase.h"
+#include "util.h"
+#include "utiltime.h"
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(WIN32)
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
+// events taken from the kernel at a time
+static const int MAX_SOCKET_EVENTS = 256;
+
+#ifdef USE_EPOLL
+
+CSocketEvents::CSocketEvents() : nSockets(0)
+{
+    hEpoll = epoll_create1(EPOLL_CLOEXEC);
+    hWakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (hEpoll < 0 || hWakeup < 0)
+        return;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = hWakeup;
+    epoll_ctl(hEpoll, EPOLL_CTL_ADD, hWakeup, &event);
+}
+
+CSocketEvents::~CSocketEvents()
+{
+    if (hWakeup >= 0)
+        close(hWakeup);
+    if (hEpoll >= 0)
+        close(hEpoll);
+}
+
+const char* CSocketEvents::GetBackend()
+{
+    return "epoll";
+}
+
+bool CSocketEvents::Add(SOCKET hSocket, void* pdata)
+{
+    if (hEpoll < 0 || hSocket == INVALID_SOCKET)
+        return false;
+
+    LOCK(cs);
+    if (hSocket >= vEntries.size())
+        vEntries.resize(hSocket + 1, CEntry{false, NULL, true, true});
+    vEntries[hSocket].fWatched = true;
+    vEntries[hSocket].pdata = pdata;
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = hSocket;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hSocket, &event) != 0) {
+        LogPrintf("%s : epoll_ctl failed: %s\n", __func__, NetworkErrorString(WSAGetLastError()));
+        vEntries[hSocket].fWatched = false;
+        return false;
+    }
+    nSockets++;
+    return true;
+}
+
+void CSocketEvents::Remove(SOCKET hSocket)
+{
+    LOCK(cs);
+    if (hSocket >= vEntries.size() || !vEntries[hSocket].fWatched)
+        return;
+    vEntries[hSocket].fWatched = false;
+    nSockets--;
+
+    struct epoll_event event;
+    epoll_ctl(hEpoll, EPOLL_CTL_DEL, hSocket, &event);
+}
+
+void CSocketEvents::SetInterest(SOCKET hSocket, bool fRecv, bool fSend)
+{
+    // both directions stay watched: an edge is reported once, however long the caller ignores it
+}
+
+bool CSocketEvents::Wait(std::vector<CEvent>& vEvents, bool& fWoken, int nTimeoutMillis)
+{
+    vEvents.clear();
+    fWoken = false;
+    if (hEpoll < 0)
+        return false;
+
+    struct epoll_event vReady[MAX_SOCKET_EVENTS];
+    int nReady = epoll_wait(hEpoll, vReady, MAX_SOCKET_EVENTS, nTimeoutMillis);
+    if (nReady < 0)
+        return WSAGetLastError() == WSAEINTR;
+
+    LOCK(cs);
+    for (int i = 0; i < nReady; i++) {
+        SOCKET hSocket = vReady[i].data.u64;
+        if ((int)hSocket == hWakeup) {
+            uint64_t nCount;
+            if (read(hWakeup, &nCount, sizeof(nCount)) == sizeof(nCount))
+                fWoken = true;
+            continue;
+        }
+        // removed after the kernel reported it
+        if (hSocket >= vEntries.size() || !vEntries[hSocket].fWatched)
+            continue;
+
+        CEvent event;
+        event.hSocket = hSocket;
+        event.pdata = vEntries[hSocket].pdata;
+        event.nEvents = 0;
+        if (vReady[i].events & EPOLLIN)
+            event.nEvents |= EVENT_RECV;
+        if (vReady[i].events & EPOLLOUT)
+            event.nEvents |= EVENT_SEND;
+        if (vReady[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+            event.nEvents |= EVENT_ERROR;
+        vEvents.push_back(event);
+    }
+    return true;
+}
+
+void CSocketEvents::Wakeup()
+{
+    uint64_t nCount = 1;
+    if (write(hWakeup, &nCount, sizeof(nCount)) != sizeof(nCount)) {
+        // the counter is already set, the thread wakes anyway
+    }
+}
+
+#else // USE_EPOLL
+
+CSocketEvents::CSocketEvents() : nSockets(0)
+{
+#ifndef WIN32
+    if (pipe(vWakeupPipe) != 0) {
+        vWakeupPipe[0] = vWakeupPipe[1] = -1;
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(vWakeupPipe[i], F_SETFL, fcntl(vWakeupPipe[i], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(vWakeupPipe[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+}
+
+CSocketEvents::~CSocketEvents()
+{
+#ifndef WIN32
+    for (int i = 0; i < 2; i++) {
+        if (vWakeupPipe[i] >= 0)
+            close(vWakeupPipe[i]);
+    }
+#endif
+}
+
+const char* CSocketEvents::GetBackend()
+{
+#ifdef WIN32
+    return "select";
+#else
+    return "poll";
+#endif
+}
+
+bool CSocketEvents::Add(SOCKET hSocket, void* pdata)
+{
+    if (hSocket == INVALID_SOCKET || !IsSelectableSocket(hSocket))
+        return false;
+
+    LOCK(cs);
+    CEntry& entry = mapSockets[hSocket];
+    entry.fWatched = true;
+    entry.pdata = pdata;
+    entry.fRecv = true;
+    entry.fSend = true;
+    nSockets = mapSockets.size();
+    return true;
+}
+
+void CSocketEvents::Remove(SOCKET hSocket)
+{
+    LOCK(cs);
+    mapSockets.erase(hSocket);
+    nSockets = mapSockets.size();
+}
+
+void CSocketEvents::SetInterest(SOCKET hSocket, bool fRecv, bool fSend)
+{
+    LOCK(cs);
+    std::map<SOCKET, CEntry>::iterator it = mapSockets.find(hSocket);
+    if (it != mapSockets.end()) {
+        it->second.fRecv = fRecv;
+        it->second.fSend = fSend;
+    }
+}
+
+bool CSocketEvents::Wait(std::vector<CEvent>& vEvents, bool& fWoken, int nTimeoutMillis)
+{
+    vEvents.clear();
+    fWoken = false;
+
+#ifdef WIN32
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    bool fHaveSockets = false;
+    {
+        LOCK(cs);
+        for (const auto& item : mapSockets) {
+            if (!item.second.fRecv && !item.second.fSend)
+                continue;
+            if (item.second.fRecv)
+                FD_SET(item.first, &fdsetRecv);
+            if (item.second.fSend)
+                FD_SET(item.first, &fdsetSend);
+            FD_SET(item.first, &fdsetError);
+            fHaveSockets = true;
+        }
+    }
+    if (!fHaveSockets) {
+        // select() fails without a socket to wait for
+        MilliSleep(nTimeoutMillis);
+        return true;
+    }
+
+    struct timeval timeout = MillisToTimeval(nTimeoutMillis);
+    if (select(0, &fdsetRecv, &fdsetSend, &fdsetError, &timeout) == SOCKET_ERROR)
+        return false;
+
+    LOCK(cs);
+    for (const auto& item : mapSockets) {
+        CEvent event;
+        event.hSocket = item.first;
+        event.pdata = item.second.pdata;
+        event.nEvents = 0;
+        if (FD_ISSET(item.first, &fdsetRecv))
+            event.nEvents |= EVENT_RECV;
+        if (FD_ISSET(item.first, &fdsetSend))
+            event.nEvents |= EVENT_SEND;
+        if (FD_ISSET(item.first, &fdsetError))
+            event.nEvents |= EVENT_ERROR;
+        if (event.nEvents)
+            vEvents.push_back(event);
+    }
+#else
+    std::vector<struct pollfd> vPoll;
+    {
+        LOCK(cs);
+        vPoll.reserve(mapSockets.size() + 1);
+        struct pollfd wakeup;
+        wakeup.fd = vWakeupPipe[0];
+        wakeup.events = POLLIN;
+        wakeup.revents = 0;
+        vPoll.push_back(wakeup);
+        for (const auto& item : mapSockets) {
+            // a socket with no direction wanted would report its hangup on every call
+            if (!item.second.fRecv && !item.second.fSend)
+                continue;
+            struct pollfd entry;
+            entry.fd = item.first;
+            entry.events = (item.second.fRecv ? POLLIN : 0) | (item.second.fSend ? POLLOUT : 0);
+            entry.revents = 0;
+            vPoll.push_back(entry);
+        }
+    }
+
+    int nReady = poll(&vPoll[0], vPoll.size(), nTimeoutMillis);
+    if (nReady < 0)
+        return WSAGetLastError() == WSAEINTR;
+
+    if (vPoll[0].revents & POLLIN) {
+        char pchBuf[64];
+        while (read(vWakeupPipe[0], pchBuf, sizeof(pchBuf)) > 0) {
+        }
+        fWoken = true;
+    }
+
+    LOCK(cs);
+    for (size_t i = 1; i < vPoll.size(); i++) {
+        if (!vPoll[i].revents || (vPoll[i].revents & POLLNVAL))
+            continue;
+        // removed while polled
+        std::map<SOCKET, CEntry>::const_iterator it = mapSockets.find(vPoll[i].fd);
+        if (it == mapSockets.end())
+            continue;
+
+        CEvent event;
+        event.hSocket = vPoll[i].fd;
+        event.pdata = it->second.pdata;
+        event.nEvents = 0;
+        if (vPoll[i].revents & POLLIN)
+            event.nEvents |= EVENT_RECV;
+        if (vPoll[i].revents & POLLOUT)
+            event.nEvents |= EVENT_SEND;
+        if (vPoll[i].revents & (POLLERR | POLLHUP))
+            event.nEvents |= EVENT_ERROR;
+        vEvents.push_back(event);
+    }
+#endif
+    return true;
+}
+
+void CSocketEvents::Wakeup()
+{
+#ifndef WIN32
+    char ch = 0;
+    if (write(vWakeupPipe[1], &ch, 1) != 1) {
+        // the pipe is full, the thread wakes anyway
+    }
+#endif
+}
+
+#endif // USE_EPOLL
+
+size_t CSocketEvents::Count() const
+{
+    LOCK(cs);
+    return nSockets;
+}
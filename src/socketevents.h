@@ -0,0 +1,98 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SOCKETEVENTS_H
+#define BITCOIN_SOCKETEVENTS_H
+
+#include "compat.h"
+#include "sync.h"
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#define USE_EPOLL
+#endif
+
+/**
+ * Readiness of the sockets served by the network thread, and a way for the
+ * other threads to wake it.
+ *
+ * With epoll the sockets are watched edge-triggered in both directions: an
+ * event tells that a socket became readable or writable, and the caller keeps
+ * using it until recv or send would block. Elsewhere Wait polls the sockets for
+ * the directions last set by SetInterest, and the caller treats the events the
+ * same way. Wakeup makes the Wait in progress, or the next one, return at once;
+ * on Windows it does nothing and the caller relies on the Wait timeout.
+ */
+class CSocketEvents
+{
+public:
+    enum {
+        EVENT_RECV = 1,
+        EVENT_SEND = 2,
+        //! error or hangup, which the next recv reports
+        EVENT_ERROR = 4,
+    };
+
+    struct CEvent {
+        SOCKET hSocket;
+        //! as passed to Add
+        void* pdata;
+        int nEvents;
+    };
+
+private:
+    struct CEntry {
+        bool fWatched;
+        void* pdata;
+        //! directions wanted, see SetInterest
+        bool fRecv;
+        bool fSend;
+    };
+
+#ifdef USE_EPOLL
+    int hEpoll;
+    int hWakeup;
+    //! by file descriptor, which the kernel hands out lowest first
+    std::vector<CEntry> vEntries;
+#else
+    std::map<SOCKET, CEntry> mapSockets;
+#ifndef WIN32
+    int vWakeupPipe[2];
+#endif
+#endif
+    mutable CCriticalSection cs;
+    size_t nSockets;
+
+    CSocketEvents(const CSocketEvents&);
+    void operator=(const CSocketEvents&);
+
+public:
+    CSocketEvents();
+    ~CSocketEvents();
+
+    //! "epoll", "poll" or "select"
+    static const char* GetBackend();
+
+    /** Watch hSocket for both directions, reporting its events with pdata */
+    bool Add(SOCKET hSocket, void* pdata);
+    /** Stop watching hSocket, before it is closed */
+    void Remove(SOCKET hSocket);
+    /** Directions in which the events of hSocket are wanted, unless they are edge-triggered */
+    void SetInterest(SOCKET hSocket, bool fRecv, bool fSend);
+
+    /**
+     * Wait up to nTimeoutMillis for events, replacing vEvents with them; fWoken is
+     * set if Wakeup was called since the last Wait. Returns false on error.
+     */
+    bool Wait(std::vector<CEvent>& vEvents, bool& fWoken, int nTimeoutMillis);
+    /** Make Wait return, from any thread */
+    void Wakeup();
+
+    size_t Count() const;
+};
+
+#endif // BITCOIN_SOCKETEVENTS_H
@@ -8,6 +8,7 @@
 #include "base58.h"
 #include "key.h"
 #include "main.h"
+#include "masternodeman.h"
 #include "net.h"
 #include "protocol.h"
 #include "sync.h"
@@ -24,6 +25,7 @@ CSporkManager sporkManager;
 std::map<uint256, CSporkMessage> mapSporks;
 std::map<int, CSporkMessage> mapSporksActive;
 std::map<CBitcoinAddress, int64_t> mapFilterAddress; // address, timestamp lock from
+std::map<CTxDestination, int64_t> mapFilterDestination; // index of mapFilterAddress by destination
 bool txFilterState = false;
 int txFilterTarget = 0;
 
@@ -122,19 +124,69 @@ void ExecuteSpork(int nSporkID, int64_t nValue)
 }
 
 // TODO: create own class for the tx filter
+bool AddTxFilterAddress(const CBitcoinAddress& address, int64_t nTime)
+{
+    if (!mapFilterAddress.emplace(address, nTime).second)
+        return false;
+    if (address.IsValid())
+        mapFilterDestination.emplace(address.Get(), nTime);
+    return true;
+}
+
 void InitTxFilter()
 {
     mapFilterAddress.clear();
+    mapFilterDestination.clear();
 
     if (Params().NetworkID() == CBaseChainParams::MAIN) {
-        mapFilterAddress.emplace( CBitcoinAddress("e9S3j4pxUHZbKpQfBr5S9Th6W4j4E5kt8a"), 1545731364 );
-        mapFilterAddress.emplace( CBitcoinAddress("eLHLibXzYAiEt6deDncdftQtPZexvqGRRs"), 1545731364 );
-        mapFilterAddress.emplace( CBitcoinAddress("eLfE1zix91aELLEJPAXk3kTd92dpCQzd51"), 1545731364 );
-        mapFilterAddress.emplace( CBitcoinAddress("eD8T1WM1mu4F9ePG8ErEqmpvxFvvvwoz3K"), 1545731364 );
-        mapFilterAddress.emplace( CBitcoinAddress("e7qhxWqMRz3wNL1BdsoL4CD1xAKHkvuazf"), 1553500000 ); // lost user vallet, refunded by dev coins
+        AddTxFilterAddress(CBitcoinAddress("e9S3j4pxUHZbKpQfBr5S9Th6W4j4E5kt8a"), 1545731364);
+        AddTxFilterAddress(CBitcoinAddress("eLHLibXzYAiEt6deDncdftQtPZexvqGRRs"), 1545731364);
+        AddTxFilterAddress(CBitcoinAddress("eLfE1zix91aELLEJPAXk3kTd92dpCQzd51"), 1545731364);
+        AddTxFilterAddress(CBitcoinAddress("eD8T1WM1mu4F9ePG8ErEqmpvxFvvvwoz3K"), 1545731364);
+        AddTxFilterAddress(CBitcoinAddress("e7qhxWqMRz3wNL1BdsoL4CD1xAKHkvuazf"), 1553500000); // lost user vallet, refunded by dev coins
     } else if (Params().NetworkID() == CBaseChainParams::TESTNET) {
-        mapFilterAddress.emplace( CBitcoinAddress("xQpcdxugd9qdMGq93vvC5CpKF3pUo8bEg1"), 1552518900 ); // testing
+        AddTxFilterAddress(CBitcoinAddress("xQpcdxugd9qdMGq93vvC5CpKF3pUo8bEg1"), 1552518900); // testing
+    }
+}
+
+/**
+ * Resolve the destinations paid by a spent scriptPubKey. P2PKH and P2SH, which
+ * cover almost every output, are decoded straight from the script bytes; any
+ * other template goes through the generic solver.
+ */
+static bool GetFilterDestinations(const CScript& scriptPubKey, std::vector<CTxDestination>& vDest)
+{
+    vDest.clear();
+    if (scriptPubKey.IsPayToScriptHash()) {
+        vDest.push_back(CScriptID(uint160(std::vector<unsigned char>(scriptPubKey.begin() + 2, scriptPubKey.begin() + 22))));
+        return true;
+    }
+    if (scriptPubKey.size() == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 &&
+        scriptPubKey[2] == 20 && scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG) {
+        vDest.push_back(CKeyID(uint160(std::vector<unsigned char>(scriptPubKey.begin() + 3, scriptPubKey.begin() + 23))));
+        return true;
     }
+    txnouttype txType;
+    int nRequired;
+    return ExtractDestinations(scriptPubKey, txType, vDest, nRequired);
+}
+
+bool IsTxFilterScript(const CScript& scriptPubKey, const int64_t nBlockTime, CTxDestination& destRet)
+{
+    if (mapFilterDestination.empty())
+        return false;
+
+    std::vector<CTxDestination> vDest;
+    if (!GetFilterDestinations(scriptPubKey, vDest))
+        return false;
+    for (const CTxDestination& dest : vDest) {
+        auto it = mapFilterDestination.find(dest);
+        if (it != mapFilterDestination.end() && (nBlockTime == 0 || nBlockTime > it->second)) {
+            destRet = dest;
+            return true;
+        }
+    }
+    return false;
 }
 
 void BuildTxFilter()
@@ -152,6 +204,8 @@ void BuildTxFilter()
     if (txFilterTarget == 0) {
         // no target block, return
         txFilterState = true;
+        // collaterals are checked against the filter when they start being watched
+        mnodeman.WatchCollaterals();
         return;
     }
 
@@ -169,9 +223,7 @@ void BuildTxFilter()
                     if (referenceBlock.vtx[i].vout[j].nValue > 0) {
                         ExtractDestination(referenceBlock.vtx[i].vout[j].scriptPubKey, Dest);
                         Address.Set(Dest);
-                        auto it  = mapFilterAddress.emplace(Address, referenceBlock.GetBlockTime());
-
-                        if (/*fDebug &&*/ it.second)
+                        if (/*fDebug &&*/ AddTxFilterAddress(Address, referenceBlock.GetBlockTime()))
                             LogPrintf("BuildTxFilter(): Add Tx filter address %d in reference block %ld, %s\n",
                                           ++nAddressCount, sporkBlockValue, Address.ToString());
                     }
@@ -181,6 +233,7 @@ void BuildTxFilter()
         // filter initialization completed
         txFilterState = true;
     }
+    mnodeman.WatchCollaterals();
 }
 
 void ReprocessBlocks(int nBlocks)
@@ -65,6 +65,7 @@ extern std::map<uint256, CSporkMessage> mapSporks;
 extern std::map<int, CSporkMessage> mapSporksActive;
 //extern std::set<CBitcoinAddress> setFilterAddress;
 extern std::map<CBitcoinAddress, int64_t> mapFilterAddress;
+extern std::map<CTxDestination, int64_t> mapFilterDestination;
 extern bool txFilterState;
 extern int txFilterTarget;
 
@@ -73,8 +74,11 @@ int64_t GetSporkValue(int nSporkID);
 bool IsSporkActive(int nSporkID);
 void ExecuteSpork(int nSporkID, int64_t nValue);
 void ReprocessBlocks(int nBlocks);
+bool AddTxFilterAddress(const CBitcoinAddress& address, int64_t nTime);
 void InitTxFilter();
 void BuildTxFilter();
+/** Check a spent scriptPubKey against the filter index, without touching the disk */
+bool IsTxFilterScript(const CScript& scriptPubKey, const int64_t nBlockTime, CTxDestination& destRet);
 
 //
 // Spork Class
@@ -0,0 +1,70 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+CLatencyHistogram::CLatencyHistogram() : nCount(0), nSumMicros(0), nMaxMicros(0)
+{
+    std::fill(vBucket, vBucket + BUCKETS, 0);
+}
+
+void CLatencyHistogram::Add(int64_t nMicros)
+{
+    nMicros = std::max(nMicros, (int64_t)0);
+    int n = 0;
+    for (int64_t nMillis = nMicros / 1000; nMillis > 0 && n < BUCKETS - 1; nMillis >>= 1)
+        n++;
+
+    LOCK(cs);
+    vBucket[n]++;
+    nCount++;
+    nSumMicros += nMicros;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+}
+
+void CLatencyHistogram::Get(std::vector<uint64_t>& vBucketRet, uint64_t& nCountRet, int64_t& nSumMicrosRet, int64_t& nMaxMicrosRet) const
+{
+    LOCK(cs);
+    vBucketRet.assign(vBucket, vBucket + BUCKETS);
+    nCountRet = nCount;
+    nSumMicrosRet = nSumMicros;
+    nMaxMicrosRet = nMaxMicros;
+}
+
+int64_t CLatencyHistogram::BucketLimit(int n)
+{
+    if (n >= BUCKETS - 1)
+        return 0;
+    return (int64_t)1 << n;
+}
+
+CRateMeter::CRateMeter(int64_t nWindowSeconds) : nWindowMicros(nWindowSeconds * 1000000), dRate(0), nLastMicros(0)
+{
+}
+
+void CRateMeter::Decay(int64_t nNowMicros)
+{
+    if (nNowMicros > nLastMicros) {
+        dRate *= exp(-(double)(nNowMicros - nLastMicros) / nWindowMicros);
+        nLastMicros = nNowMicros;
+    }
+}
+
+void CRateMeter::Add(int64_t nNowMicros, uint64_t nEvents)
+{
+    LOCK(cs);
+    Decay(nNowMicros);
+    dRate += 1000000.0 * nEvents / nWindowMicros;
+}
+
+double CRateMeter::Get(int64_t nNowMicros) const
+{
+    LOCK(cs);
+    if (nNowMicros <= nLastMicros)
+        return dRate;
+    return dRate * exp(-(double)(nNowMicros - nLastMicros) / nWindowMicros);
+}
@@ -0,0 +1,62 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_STATS_H
+#define BITCOIN_STATS_H
+
+#include "sync.h"
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Latency histogram with power-of-two millisecond buckets.
+ * Bucket 0 counts samples below 1ms, bucket i samples in [2^(i-1), 2^i) ms,
+ * and the last bucket everything above.
+ */
+class CLatencyHistogram
+{
+public:
+    static const int BUCKETS = 18;
+
+private:
+    mutable CCriticalSection cs;
+    uint64_t vBucket[BUCKETS];
+    uint64_t nCount;
+    int64_t nSumMicros;
+    int64_t nMaxMicros;
+
+public:
+    CLatencyHistogram();
+
+    void Add(int64_t nMicros);
+    void Get(std::vector<uint64_t>& vBucketRet, uint64_t& nCountRet, int64_t& nSumMicrosRet, int64_t& nMaxMicrosRet) const;
+
+    //! Upper bound of bucket n in milliseconds, 0 for the open-ended last bucket
+    static int64_t BucketLimit(int n);
+};
+
+/**
+ * Rate of events per second, as an exponentially weighted moving average:
+ * an event counts for 1/nWindow at first and its weight decays by a factor e
+ * every nWindow, so a steady stream of r events per second reads as r.
+ */
+class CRateMeter
+{
+private:
+    mutable CCriticalSection cs;
+    const int64_t nWindowMicros;
+    double dRate;
+    int64_t nLastMicros;
+
+    void Decay(int64_t nNowMicros);
+
+public:
+    explicit CRateMeter(int64_t nWindowSeconds = 60);
+
+    void Add(int64_t nNowMicros, uint64_t nEvents = 1);
+    double Get(int64_t nNowMicros) const;
+};
+
+#endif // BITCOIN_STATS_H
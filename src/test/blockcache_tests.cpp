@@ -0,0 +1,128 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+#include "clientversion.h"
+#include "main.h"
+#include "random.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockcache_tests)
+
+// a block of its own, written to a block file no chain uses
+static CBlock MakeBlock()
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << insecure_rand() << OP_0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+
+    CBlock block;
+    block.nVersion = 1;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = insecure_rand();
+    block.vtx.push_back(CTransaction(tx));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+static void WriteBlocks(std::vector<CBlock>& vBlocks, std::vector<CBlockIndex>& vIndex, std::vector<uint256>& vHashes, int nBlocks)
+{
+    CDiskBlockPos pos(999, 0);
+    vBlocks.resize(nBlocks);
+    vIndex.resize(nBlocks);
+    vHashes.resize(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        vBlocks[i] = MakeBlock();
+        vHashes[i] = vBlocks[i].GetHash();
+        BOOST_REQUIRE(WriteBlockToDisk(vBlocks[i], pos));
+        vIndex[i].phashBlock = &vHashes[i];
+        vIndex[i].nFile = pos.nFile;
+        vIndex[i].nDataPos = pos.nPos;
+        vIndex[i].nStatus = BLOCK_HAVE_DATA;
+        pos.nPos += ::GetSerializeSize(vBlocks[i], SER_DISK, CLIENT_VERSION);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_raw_read)
+{
+    std::vector<CBlock> vBlocks;
+    std::vector<CBlockIndex> vIndex;
+    std::vector<uint256> vHashes;
+    WriteBlocks(vBlocks, vIndex, vHashes, 4);
+
+    CBlockCache cache;
+    for (int n = 0; n < 2; n++) {
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            // the bytes read are the block message as sent on the wire
+            CMessageDataRef blockData = cache.Get(&vIndex[i]);
+            BOOST_REQUIRE(blockData);
+            BOOST_CHECK(*MakeMessageData("block", vBlocks[i]) == *blockData);
+
+            CBlock block;
+            CDataStream ssBlock(&(*blockData)[CMessageHeader::HEADER_SIZE], &(*blockData)[0] + blockData->size(), SER_NETWORK, PROTOCOL_VERSION);
+            ssBlock >> block;
+            BOOST_CHECK(block.GetHash() == vHashes[i]);
+        }
+    }
+
+    CBlockCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nBlocks, vBlocks.size());
+    BOOST_CHECK_EQUAL(stats.nMisses, vBlocks.size());
+    BOOST_CHECK_EQUAL(stats.nHits, vBlocks.size());
+    BOOST_CHECK_EQUAL(stats.nBytesFromDisk, stats.nBytes);
+    BOOST_CHECK_EQUAL(stats.nBytesFromCache, stats.nBytes);
+
+    // an index pointing at another block, or past its start, is not trusted
+    CBlockIndex indexWrong = vIndex[1];
+    uint256 hashWrong = GetRandHash();
+    indexWrong.phashBlock = &hashWrong;
+    BOOST_CHECK(!cache.Get(&indexWrong));
+    indexWrong.nDataPos++;
+    BOOST_CHECK(!cache.Get(&indexWrong));
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_lru)
+{
+    std::vector<CBlock> vBlocks;
+    std::vector<CBlockIndex> vIndex;
+    std::vector<uint256> vHashes;
+    WriteBlocks(vBlocks, vIndex, vHashes, 3);
+    size_t nSize = CMessageHeader::HEADER_SIZE + ::GetSerializeSize(vBlocks[0], SER_NETWORK, PROTOCOL_VERSION);
+
+    // room for two blocks: the one served least recently makes room for the third
+    CBlockCache cache(2 * nSize + nSize / 2);
+    cache.Get(&vIndex[0]);
+    cache.Get(&vIndex[1]);
+    cache.Get(&vIndex[0]);
+    cache.Get(&vIndex[2]);
+
+    CBlockCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nBlocks, 2U);
+    BOOST_CHECK_EQUAL(stats.nEvictions, 1U);
+    BOOST_CHECK_EQUAL(stats.nHits, 1U);
+
+    cache.Get(&vIndex[0]);
+    cache.Get(&vIndex[2]);
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nHits, 3U);
+    cache.Get(&vIndex[1]);
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nMisses, 4U);
+
+    // a cache with no room still serves from disk
+    cache.SetMaxBytes(0);
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nBlocks, 0U);
+    BOOST_CHECK_EQUAL(stats.nBytes, 0U);
+    BOOST_CHECK(cache.Get(&vIndex[0]));
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nBlocks, 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
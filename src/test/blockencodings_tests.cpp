@@ -0,0 +1,185 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+static CTransaction MakeTransaction()
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = insecure_rand() + 1;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return CTransaction(tx);
+}
+
+// a proof-of-stake block: coinbase, coinstake and nTx spends
+static CBlock MakeBlock(int nTx)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << insecure_rand() << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].SetEmpty();
+
+    CMutableTransaction coinstake;
+    coinstake.vin.resize(1);
+    coinstake.vin[0].prevout = COutPoint(GetRandHash(), 1);
+    coinstake.vout.resize(3);
+    coinstake.vout[0].SetEmpty();
+    coinstake.vout[1].nValue = 100;
+    coinstake.vout[1].scriptPubKey = CScript() << OP_TRUE;
+    coinstake.vout[2].nValue = 10;
+    coinstake.vout[2].scriptPubKey = CScript() << OP_TRUE;
+
+    CBlock block;
+    block.nVersion = 1;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = insecure_rand();
+    block.nBits = 0x207fffff;
+    block.vtx.push_back(CTransaction(coinbase));
+    block.vtx.push_back(CTransaction(coinstake));
+    for (int i = 0; i < nTx; i++)
+        block.vtx.push_back(MakeTransaction());
+    block.vchBlockSig = std::vector<unsigned char>(72, 0x30);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+static void AddToMempool(CTxMemPool& pool, const CTransaction& tx)
+{
+    pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 0, 0, 0.0, 1));
+}
+
+BOOST_AUTO_TEST_CASE(blockencodings_serialize)
+{
+    CBlock block = MakeBlock(5);
+    BOOST_REQUIRE(block.IsProofOfStake());
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    BOOST_CHECK_EQUAL(cmpctblock.BlockTxCount(), block.vtx.size());
+    // the coinbase and the coinstake are sent whole
+    BOOST_REQUIRE_EQUAL(cmpctblock.vPrefilledTx.size(), 2U);
+    BOOST_CHECK(cmpctblock.vPrefilledTx[1].GetHash() == block.vtx[1].GetHash());
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << cmpctblock;
+    BOOST_CHECK_EQUAL(ss.size(), ::GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION));
+    CBlockHeaderAndShortTxIDs cmpctblock2;
+    ss >> cmpctblock2;
+
+    BOOST_CHECK(cmpctblock2.header.GetHash() == block.GetHash());
+    BOOST_CHECK(cmpctblock2.vShortTxIds == cmpctblock.vShortTxIds);
+    BOOST_CHECK(cmpctblock2.vPrefilledIndexes == cmpctblock.vPrefilledIndexes);
+    BOOST_CHECK(cmpctblock2.vchBlockSig == block.vchBlockSig);
+    // short IDs fit in their 48 bits, and the receiver computes the same ones
+    for (size_t i = 2; i < block.vtx.size(); i++) {
+        BOOST_CHECK_EQUAL(cmpctblock.vShortTxIds[i - 2] >> 48, 0U);
+        BOOST_CHECK_EQUAL(cmpctblock2.GetShortID(block.vtx[i].GetHash()), cmpctblock.vShortTxIds[i - 2]);
+    }
+
+    // the positions asked for, however far apart
+    CBlockTransactionsRequest req;
+    req.hashBlock = block.GetHash();
+    req.vIndexes.push_back(0);
+    req.vIndexes.push_back(1);
+    req.vIndexes.push_back(5);
+    req.vIndexes.push_back(65535);
+    CDataStream ssReq(SER_NETWORK, PROTOCOL_VERSION);
+    ssReq << req;
+    CBlockTransactionsRequest req2;
+    ssReq >> req2;
+    BOOST_CHECK(req2.hashBlock == req.hashBlock);
+    BOOST_CHECK(req2.vIndexes == req.vIndexes);
+
+    // a position past the last one a block can have
+    ssReq << req.hashBlock;
+    WriteCompactSize(ssReq, 2);
+    WriteCompactSize(ssReq, 65535);
+    WriteCompactSize(ssReq, 0);
+    BOOST_CHECK_THROW(ssReq >> req2, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(blockencodings_reconstruct)
+{
+    CBlock block = MakeBlock(6);
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+
+    // every transaction in the mempool, one of them only among the orphans
+    CTxMemPool pool(CFeeRate(0));
+    for (size_t i = 2; i < block.vtx.size() - 1; i++)
+        AddToMempool(pool, block.vtx[i]);
+    AddToMempool(pool, MakeTransaction());
+    std::vector<CTransaction> vExtraTxn(1, block.vtx.back());
+
+    CPartiallyDownloadedBlock partialBlock;
+    BOOST_CHECK_EQUAL(partialBlock.InitData(cmpctblock, pool, vExtraTxn), READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(partialBlock.nPrefilled, 2U);
+    BOOST_CHECK_EQUAL(partialBlock.nFromMempool, 5U);
+    BOOST_CHECK_EQUAL(partialBlock.nFromExtra, 1U);
+    BOOST_CHECK(partialBlock.GetMissing().empty());
+
+    CBlock block2;
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(block2, std::vector<CTransaction>()), READ_STATUS_OK);
+    BOOST_CHECK(block2.GetHash() == block.GetHash());
+    BOOST_CHECK(block2.hashMerkleRoot == block.hashMerkleRoot);
+    BOOST_CHECK(block2.vchBlockSig == block.vchBlockSig);
+    BOOST_CHECK(block2.IsProofOfStake());
+    // rebuilt once
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(block2, std::vector<CTransaction>()), READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(blockencodings_missing)
+{
+    CBlock block = MakeBlock(6);
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    CTxMemPool pool(CFeeRate(0));
+    AddToMempool(pool, block.vtx[3]);
+    AddToMempool(pool, block.vtx[6]);
+
+    CPartiallyDownloadedBlock partialBlock;
+    BOOST_REQUIRE_EQUAL(partialBlock.InitData(cmpctblock, pool, std::vector<CTransaction>()), READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+    BOOST_CHECK(partialBlock.IsTxAvailable(3));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(block.vtx.size()));
+    std::vector<uint16_t> vMissing = partialBlock.GetMissing();
+    BOOST_REQUIRE_EQUAL(vMissing.size(), 4U);
+    BOOST_CHECK_EQUAL(vMissing[0], 2);
+    BOOST_CHECK_EQUAL(vMissing[3], 7);
+
+    std::vector<CTransaction> vtxMissing;
+    for (uint16_t nIndex : vMissing)
+        vtxMissing.push_back(block.vtx[nIndex]);
+
+    // too few transactions is a peer misbehaving, the wrong ones a block to ask for whole
+    CPartiallyDownloadedBlock partialShort = partialBlock;
+    CBlock block2;
+    BOOST_CHECK_EQUAL(partialShort.FillBlock(block2, std::vector<CTransaction>(vtxMissing.begin(), vtxMissing.end() - 1)), READ_STATUS_INVALID);
+    CPartiallyDownloadedBlock partialWrong = partialBlock;
+    std::vector<CTransaction> vtxWrong = vtxMissing;
+    vtxWrong[1] = MakeTransaction();
+    BOOST_CHECK_EQUAL(partialWrong.FillBlock(block2, vtxWrong), READ_STATUS_FAILED);
+
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(block2, vtxMissing), READ_STATUS_OK);
+    BOOST_CHECK(block2.GetHash() == block.GetHash());
+    BOOST_CHECK(block2.BuildMerkleTree() == block.hashMerkleRoot);
+
+    // a prefilled transaction outside the block
+    CBlockHeaderAndShortTxIDs cmpctInvalid = cmpctblock;
+    cmpctInvalid.vPrefilledIndexes[1] = block.vtx.size();
+    CPartiallyDownloadedBlock partialInvalid;
+    BOOST_CHECK_EQUAL(partialInvalid.InitData(cmpctInvalid, pool, std::vector<CTransaction>()), READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,93 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "random.h"
+#include "txdb.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(blockindex_tests)
+
+// Write a chain long enough to be read in more than one batch, with a stake
+// every other block and a fork off a block that is not in the database, and
+// check that loading it links every entry the way the records say.
+BOOST_AUTO_TEST_CASE(blockindex_load)
+{
+    const int nBlocks = 70000;
+    const int nHeightStart = Params().LAST_POW_BLOCK() + 1;
+
+    CBlockTreeDB blocktree(1 << 20, true, true);
+    vector<CDiskBlockIndex> vDisk(nBlocks);
+    vector<uint256> vHashes(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        CDiskBlockIndex& diskindex = vDisk[i];
+        diskindex.nHeight = nHeightStart + i;
+        diskindex.nVersion = 1;
+        diskindex.nTime = i;
+        diskindex.nNonce = insecure_rand();
+        diskindex.nStatus = BLOCK_VALID_TREE;
+        if (i % 2) {
+            diskindex.SetProofOfStake();
+            diskindex.prevoutStake = COutPoint(GetRandHash(), i);
+            diskindex.nStakeTime = i;
+        }
+        diskindex.hashPrev = i ? vHashes[i - 1] : uint256(0);
+        vHashes[i] = diskindex.GetBlockHash();
+    }
+    for (int i = 0; i < nBlocks; i++) {
+        if (i + 1 < nBlocks)
+            vDisk[i].hashNext = vHashes[i + 1];
+        BOOST_CHECK(blocktree.WriteBlockIndex(vDisk[i]));
+    }
+
+    CDiskBlockIndex diskFork;
+    diskFork.nHeight = nHeightStart + 10;
+    diskFork.hashPrev = GetRandHash();
+    uint256 hashFork = diskFork.GetBlockHash();
+    BOOST_CHECK(blocktree.WriteBlockIndex(diskFork));
+
+    LOCK(cs_main);
+    size_t nSizeBefore = mapBlockIndex.size();
+    uint64_t nEntriesBefore = blockIndexLoadStats.nEntries;
+    BOOST_CHECK(blocktree.LoadBlockIndexGuts());
+    BOOST_CHECK_EQUAL(blockIndexLoadStats.nEntries - nEntriesBefore, (uint64_t)nBlocks + 1);
+    // the missing parent of the fork gets an empty entry
+    BOOST_CHECK_EQUAL(mapBlockIndex.size() - nSizeBefore, (size_t)nBlocks + 2);
+
+    for (int i = 0; i < nBlocks; i++) {
+        BlockMap::iterator mi = mapBlockIndex.find(vHashes[i]);
+        BOOST_REQUIRE(mi != mapBlockIndex.end());
+        const CBlockIndex* pindex = mi->second;
+        BOOST_CHECK(pindex->GetBlockHash() == vHashes[i]);
+        BOOST_CHECK_EQUAL(pindex->nHeight, nHeightStart + i);
+        BOOST_CHECK_EQUAL(pindex->nNonce, vDisk[i].nNonce);
+        BOOST_CHECK(i ? pindex->pprev && pindex->pprev->GetBlockHash() == vHashes[i - 1] : !pindex->pprev);
+        BOOST_CHECK(i + 1 < nBlocks ? pindex->pnext && pindex->pnext->GetBlockHash() == vHashes[i + 1] : !pindex->pnext);
+        BOOST_CHECK_EQUAL(pindex->IsProofOfStake(), i % 2 == 1);
+        if (pindex->IsProofOfStake())
+            BOOST_CHECK(setStakeSeen.count(make_pair(vDisk[i].prevoutStake, vDisk[i].nStakeTime)));
+    }
+
+    CBlockIndex* pindexFork = mapBlockIndex[hashFork];
+    BOOST_REQUIRE(pindexFork->pprev);
+    BOOST_CHECK(pindexFork->pprev->GetBlockHash() == diskFork.hashPrev);
+    BOOST_CHECK_EQUAL(pindexFork->pprev->nHeight, 0);
+
+    // entries loaded from the database stay owned by their arena
+    for (int i = 0; i < nBlocks; i++) {
+        if (vDisk[i].IsProofOfStake())
+            setStakeSeen.erase(make_pair(vDisk[i].prevoutStake, vDisk[i].nStakeTime));
+        mapBlockIndex.erase(vHashes[i]);
+    }
+    delete pindexFork->pprev;
+    mapBlockIndex.erase(diskFork.hashPrev);
+    mapBlockIndex.erase(hashFork);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,81 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockpipeline.h"
+#include "main.h"
+#include "net.h"
+#include "random.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockpipeline_tests)
+
+static bool WaitForDrain(const CBlockPipeline& pipeline, uint64_t nBlocks, CBlockPipelineStats& stats)
+{
+    for (int i = 0; i < 1000; i++) {
+        pipeline.GetStats(stats);
+        if (stats.nConnected == nBlocks && stats.nBytes == 0)
+            return true;
+        MilliSleep(10);
+    }
+    return false;
+}
+
+// Blocks on unknown parents fail their checks and are turned down by
+// ProcessNewBlock; every one of them must still make it through both stages,
+// and the pipeline must give the peer back once it is empty.
+BOOST_AUTO_TEST_CASE(blockpipeline_drain)
+{
+    CBlockPipeline pipeline;
+    CAddress addr(CService("250.1.2.3", Params().GetDefaultPort()));
+    CNode dummyNode(INVALID_SOCKET, addr, "", true);
+    dummyNode.nVersion = 1;
+
+    CBlock block;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = GetTime();
+    BOOST_CHECK(!pipeline.Submit(&dummyNode, block, 80));
+    BOOST_CHECK(!block.hashPrevBlock.IsNull());
+
+    boost::thread_group threadGroup;
+    pipeline.Start(threadGroup, 3);
+    int nRefCount = dummyNode.GetRefCount();
+
+    const int nBlocks = 50;
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < nBlocks; i++) {
+        CBlock blockNew;
+        blockNew.nVersion = 1;
+        blockNew.hashPrevBlock = GetRandHash();
+        blockNew.nTime = GetTime();
+        vHashes.push_back(blockNew.GetHash());
+        BOOST_CHECK(pipeline.Submit(&dummyNode, blockNew, 80));
+    }
+
+    CBlockPipelineStats stats;
+    BOOST_CHECK(WaitForDrain(pipeline, nBlocks, stats));
+    BOOST_CHECK(stats.fRunning);
+    BOOST_CHECK_EQUAL(stats.nReceived, (uint64_t)nBlocks);
+    BOOST_CHECK_EQUAL(stats.nChecked, (uint64_t)nBlocks);
+    BOOST_CHECK_EQUAL(stats.nCheckFailed, (uint64_t)nBlocks);
+    BOOST_CHECK_EQUAL(stats.nQueuedCheck + stats.nChecking + stats.nQueuedConnect + stats.nConnecting, 0U);
+    BOOST_CHECK(stats.dConnectRate > 0);
+    for (const uint256& hash : vHashes)
+        BOOST_CHECK(!pipeline.Contains(hash));
+    BOOST_CHECK_EQUAL(dummyNode.GetRefCount(), nRefCount);
+
+    uint64_t nCount;
+    int64_t nSumMicros, nMaxMicros;
+    std::vector<uint64_t> vBucket;
+    pipeline.histConnect.Get(vBucket, nCount, nSumMicros, nMaxMicros);
+    BOOST_CHECK_EQUAL(nCount, (uint64_t)nBlocks);
+
+    pipeline.Stop();
+    threadGroup.join_all();
+    BOOST_CHECK(!pipeline.Submit(&dummyNode, block, 80));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -58,12 +58,80 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = cacheCoins.DynamicMemoryUsage();
+        for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coins.DynamicMemoryUsage();
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
 
 static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 
+// Random inserts and erases on a CCoinsMap, checked against a std::map holding
+// the same keys. Entries must not move while other keys come and go.
+BOOST_AUTO_TEST_CASE(coins_map_test)
+{
+    CCoinsMap mapCoins;
+    std::map<uint256, std::pair<int, const CCoinsCacheEntry*> > mapExpected;
+    std::vector<uint256> txids(2000);
+    for (unsigned int i = 0; i < txids.size(); i++)
+        txids[i] = GetRandHash();
+
+    for (int i = 0; i < 100000; i++) {
+        const uint256& txid = txids[insecure_rand() % txids.size()];
+        if (insecure_rand() % 3) {
+            CCoinsCacheEntry entry;
+            entry.coins.nHeight = i;
+            std::pair<CCoinsMap::iterator, bool> ret = mapCoins.insert(std::make_pair(txid, entry));
+            BOOST_CHECK_EQUAL(ret.second, !mapExpected.count(txid));
+            if (ret.second)
+                mapExpected[txid] = std::make_pair(i, &ret.first->second);
+        } else {
+            CCoinsMap::iterator it = mapCoins.find(txid);
+            BOOST_CHECK_EQUAL(it != mapCoins.end(), mapExpected.count(txid) == 1);
+            if (it != mapCoins.end()) {
+                mapCoins.erase(it);
+                mapExpected.erase(txid);
+            }
+        }
+        BOOST_CHECK_EQUAL(mapCoins.size(), mapExpected.size());
+
+        if (insecure_rand() % 5000 == 0) {
+            size_t nSeen = 0;
+            for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+                std::map<uint256, std::pair<int, const CCoinsCacheEntry*> >::const_iterator itExpected = mapExpected.find(it->first);
+                BOOST_CHECK(itExpected != mapExpected.end());
+                BOOST_CHECK_EQUAL(it->second.coins.nHeight, itExpected->second.first);
+                BOOST_CHECK(&it->second == itExpected->second.second);
+                nSeen++;
+            }
+            BOOST_CHECK_EQUAL(nSeen, mapExpected.size());
+        }
+    }
+
+    size_t nUsage = mapCoins.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage >= mapCoins.size() * sizeof(CCoinsMap::value_type));
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();)
+        mapCoins.erase(it++);
+    BOOST_CHECK(mapCoins.empty());
+    BOOST_CHECK(mapCoins.find(txids[0]) == mapCoins.end());
+    mapCoins.clear();
+    BOOST_CHECK_EQUAL(mapCoins.DynamicMemoryUsage(), 0U);
+}
+
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
@@ -89,8 +157,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -135,6 +203,9 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            for (const CCoinsViewCacheTest* test : stack) {
+                test->SelfTest();
+            }
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -151,7 +222,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -0,0 +1,87 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "random.h"
+#include "txdb.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(coinsdb_tests)
+
+// Feed the same batches to a coin database written in the background and to
+// one written in place. Reads through the background one must see each batch
+// as soon as BatchWrite returns, and both must end up with the same contents.
+BOOST_AUTO_TEST_CASE(coinsdb_background_writer)
+{
+    CCoinsViewDB dbAsync(1 << 20, true, true);
+    CCoinsViewDB dbSync(1 << 20, true, true);
+    dbAsync.StartWriter();
+
+    CCoinsWriteStats statsBefore;
+    GetCoinsWriteStats(statsBefore);
+
+    std::map<uint256, CCoins> mapExpected;
+    std::vector<uint256> txids(500);
+    for (unsigned int i = 0; i < txids.size(); i++)
+        txids[i] = GetRandHash();
+
+    for (int nRound = 0; nRound < 20; nRound++) {
+        CCoinsViewCache cacheAsync(&dbAsync);
+        CCoinsViewCache cacheSync(&dbSync);
+        for (int n = 0; n < 200; n++) {
+            const uint256& txid = txids[insecure_rand() % txids.size()];
+            CCoins& coins = mapExpected[txid];
+            if (coins.IsPruned() || insecure_rand() % 2) {
+                coins.nVersion = 1;
+                coins.nHeight = nRound;
+                coins.vout.resize(1 + insecure_rand() % 3);
+                for (CTxOut& out : coins.vout) {
+                    out.nValue = insecure_rand();
+                    out.scriptPubKey = CScript() << OP_TRUE;
+                }
+            } else {
+                coins.Clear();
+            }
+            *cacheAsync.ModifyCoins(txid) = coins;
+            *cacheSync.ModifyCoins(txid) = coins;
+        }
+        uint256 hashBlock = GetRandHash();
+        cacheAsync.SetBestBlock(hashBlock);
+        cacheSync.SetBestBlock(hashBlock);
+        BOOST_CHECK(cacheAsync.Flush());
+        BOOST_CHECK(cacheSync.Flush());
+
+        // whether or not the writer got to it yet, the batch is visible
+        BOOST_CHECK(dbAsync.GetBestBlock() == hashBlock);
+        for (std::map<uint256, CCoins>::const_iterator it = mapExpected.begin(); it != mapExpected.end(); it++) {
+            CCoins coins;
+            bool fFound = dbAsync.GetCoins(it->first, coins);
+            BOOST_CHECK_EQUAL(fFound, !it->second.IsPruned());
+            BOOST_CHECK_EQUAL(dbAsync.HaveCoins(it->first), !it->second.IsPruned());
+            if (fFound)
+                BOOST_CHECK(coins == it->second);
+        }
+    }
+
+    // once synced, reads are served by the database itself
+    BOOST_CHECK(dbAsync.Sync());
+    BOOST_CHECK(dbAsync.GetBestBlock() == dbSync.GetBestBlock());
+    for (const uint256& txid : txids) {
+        CCoins coinsAsync, coinsSync;
+        BOOST_CHECK_EQUAL(dbAsync.GetCoins(txid, coinsAsync), dbSync.GetCoins(txid, coinsSync));
+        BOOST_CHECK(coinsAsync == coinsSync);
+    }
+
+    CCoinsWriteStats statsAfter;
+    GetCoinsWriteStats(statsAfter);
+    BOOST_CHECK_EQUAL(statsAfter.nWrites - statsBefore.nWrites, 40U);
+    BOOST_CHECK(statsAfter.nBytes > statsBefore.nBytes);
+    BOOST_CHECK(!statsAfter.fInProgress);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,86 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "kernel.h"
+#include "random.h"
+#include "streams.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(kernel_tests)
+
+static const unsigned int nTimeTx = 1550000000;
+static const unsigned int nHashDrift = 45;
+
+// The per-coin search CheckStakeKernelHash does, run over the inputs one at a time
+static int SerialSearch(const std::vector<CStakeKernelInput>& vInputs, const std::vector<uint64_t>& vModifiers, unsigned int nBits, unsigned int nTimeMin, unsigned int& nTimeRet)
+{
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    for (unsigned int i = 0; i < vInputs.size(); i++) {
+        CDataStream ss(SER_GETHASH, 0);
+        ss << vModifiers[i];
+        for (unsigned int n = 0; n < nHashDrift; n++) {
+            unsigned int nTryTime = nTimeTx + nHashDrift - n;
+            uint256 hashProofOfStake = stakeHash(nTryTime, ss, vInputs[i].prevout.n, vInputs[i].prevout.hash, vInputs[i].nTimeBlockFrom);
+            if (stakeTargetHit(hashProofOfStake, vInputs[i].nValueIn, bnTargetPerCoinDay)) {
+                if (nTryTime <= nTimeMin)
+                    break;
+                nTimeRet = nTryTime;
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+BOOST_AUTO_TEST_CASE(stake_search_matches_serial)
+{
+    std::vector<CStakeKernelInput> vInputs;
+    std::vector<uint64_t> vModifiers;
+    for (int i = 0; i < 500; i++) {
+        CStakeKernelInput input;
+        input.prevout = COutPoint(GetRandHash(), insecure_rand() % 4);
+        input.nValueIn = 100 * COIN;
+        input.nTimeBlockFrom = nTimeTx - nStakeMinAge - insecure_rand() % 100000;
+        uint64_t nStakeModifier = GetRand(std::numeric_limits<uint64_t>::max());
+        CDataStream ss(SER_GETHASH, 0);
+        ss << nStakeModifier << input.nTimeBlockFrom << input.prevout.n << input.prevout.hash << (unsigned int)0;
+        memcpy(input.vchKernel, &ss[0], sizeof(input.vchKernel));
+        vInputs.push_back(input);
+        vModifiers.push_back(nStakeModifier);
+    }
+    // about one hit per 4096 hashes
+    unsigned int nBits = uint256(~uint256(0) >> 39).GetCompact();
+
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(&ThreadStakeSearch);
+
+    for (int nRound = 0; nRound < 20; nRound++) {
+        unsigned int nTimeMin = nTimeTx + insecure_rand() % nHashDrift;
+        std::vector<CStakeKernelInput> vRound(vInputs.begin() + nRound * 20, vInputs.end());
+        std::vector<uint64_t> vRoundModifiers(vModifiers.begin() + nRound * 20, vModifiers.end());
+
+        unsigned int nTimeExpected = 0;
+        int nExpected = SerialSearch(vRound, vRoundModifiers, nBits, nTimeMin, nTimeExpected);
+
+        for (int nThreads = 0; nThreads <= 4; nThreads += 4) {
+            nStakeSearchThreads = nThreads;
+            CStakeKernelResult result;
+            BOOST_CHECK_EQUAL(SearchStakeKernel(vRound, nBits, nTimeTx, nHashDrift, nTimeMin, result), nExpected >= 0);
+            BOOST_CHECK_EQUAL(result.nIndex, nExpected);
+            if (nExpected >= 0)
+                BOOST_CHECK_EQUAL(result.nTime, nTimeExpected);
+        }
+    }
+    nStakeSearchThreads = 0;
+    BOOST_CHECK(GetStakeSearchHashes() > 0);
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -57,6 +57,40 @@ void dumpKeyInfo(uint256 privkey)
 }
 #endif
 
+// Replace S of a DER signature by n - S, the other signature valid for the same key and message
+static vector<unsigned char> NegateS(const vector<unsigned char>& vchSig)
+{
+    static const unsigned char order[32] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE,
+        0xBA, 0xAE, 0xDC, 0xE6, 0xAF, 0x48, 0xA0, 0x3B, 0xBF, 0xD2, 0x5E, 0x8C, 0xD0, 0x36, 0x41, 0x41};
+    unsigned int nLenR = vchSig[3];
+    unsigned int nLenS = vchSig[5 + nLenR];
+    unsigned char s[32] = {};
+    memcpy(s + 32 - std::min(nLenS, 32U), &vchSig[6 + nLenR] + nLenS - std::min(nLenS, 32U), std::min(nLenS, 32U));
+
+    unsigned char negated[32];
+    int nBorrow = 0;
+    for (int i = 31; i >= 0; i--) {
+        int nDiff = order[i] - s[i] - nBorrow;
+        nBorrow = nDiff < 0;
+        negated[i] = nDiff + (nBorrow << 8);
+    }
+    int nSkip = 0;
+    while (nSkip < 31 && negated[nSkip] == 0 && !(negated[nSkip + 1] & 0x80))
+        nSkip++;
+
+    vector<unsigned char> vchS;
+    if (negated[nSkip] & 0x80)
+        vchS.push_back(0);
+    vchS.insert(vchS.end(), negated + nSkip, negated + 32);
+
+    vector<unsigned char> vchRet(vchSig.begin(), vchSig.begin() + 4 + nLenR);
+    vchRet.push_back(0x02);
+    vchRet.push_back(vchS.size());
+    vchRet.insert(vchRet.end(), vchS.begin(), vchS.end());
+    vchRet[1] = vchRet.size() - 2;
+    return vchRet;
+}
 
 BOOST_AUTO_TEST_SUITE(key_tests)
 
@@ -187,4 +221,42 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("1f4f304f1b05599f88bc517819f6d43c69503baea5f253c55ea2d791394f7ce0de4f23c0d4c1f4d7a89bf130fed755201d22581911a8a44cf594014794231d325a"));
 }
 
+BOOST_AUTO_TEST_CASE(key_verify_forms)
+{
+    // Verification must accept exactly what the OpenSSL based check accepted: both
+    // encodings of a key, and both S values of a signature (low S is policy, not consensus).
+    const string vstrSecret[] = {strSecret1, strSecret2, strSecret1C, strSecret2C};
+    for (const string& strSecret : vstrSecret) {
+        CBitcoinSecret bsecret;
+        BOOST_CHECK(bsecret.SetString(strSecret));
+        CKey key = bsecret.GetKey();
+        CPubKey pubkey = key.GetPubKey();
+        BOOST_CHECK(pubkey.IsFullyValid());
+        CPubKey pubkeyFull = pubkey;
+        BOOST_CHECK(pubkeyFull.Decompress());
+        BOOST_CHECK(!pubkeyFull.IsCompressed());
+
+        for (int n = 0; n < 16; n++) {
+            string strMsg = strprintf("Verify forms %d", n);
+            uint256 hashMsg = Hash(strMsg.begin(), strMsg.end());
+            vector<unsigned char> vchSig;
+            BOOST_CHECK(key.Sign(hashMsg, vchSig));
+
+            BOOST_CHECK(pubkey.Verify(hashMsg, vchSig));
+            BOOST_CHECK(pubkeyFull.Verify(hashMsg, vchSig));
+            vector<unsigned char> vchHighS = NegateS(vchSig);
+            BOOST_CHECK(vchHighS != vchSig);
+            BOOST_CHECK(pubkey.Verify(hashMsg, vchHighS));
+            BOOST_CHECK(pubkeyFull.Verify(hashMsg, vchHighS));
+            BOOST_CHECK(NegateS(vchHighS) == vchSig);
+
+            vector<unsigned char> vchBad = vchSig;
+            vchBad[vchBad.size() - 1] ^= 1;
+            BOOST_CHECK(!pubkey.Verify(hashMsg, vchBad));
+            BOOST_CHECK(!pubkey.Verify(hashMsg, vector<unsigned char>()));
+            BOOST_CHECK(!pubkey.Verify(Hash(vchSig.begin(), vchSig.end()), vchSig));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
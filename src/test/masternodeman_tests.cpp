@@ -0,0 +1,652 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test/test_fdreserve.h"
+
+#include "clientversion.h"
+#include "main.h"
+#include "masternode-payments.h"
+#include "masternode-sync.h"
+#include "masternodeman.h"
+#include "script/standard.h"
+#include "random.h"
+#include "txmempool.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(masternodeman_tests)
+
+// The masternodes ranked at a height, each checked to score no higher than the one before
+static vector<CTxIn> GetRanked(CMasternodeMan& mnman, int64_t nBlockHeight, int minProtocol)
+{
+    vector<CTxIn> vRanked;
+    for (int n = 1; CMasternode* pmn = mnman.GetMasternodeByRank(n, nBlockHeight, minProtocol); n++) {
+        BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(pmn->vin, nBlockHeight, minProtocol), n);
+        if (!vRanked.empty())
+            BOOST_CHECK(pmn->CalculateScore(1, nBlockHeight).GetCompact(false) <=
+                        mnman.Find(vRanked.back())->CalculateScore(1, nBlockHeight).GetCompact(false));
+        vRanked.push_back(pmn->vin);
+    }
+    return vRanked;
+}
+
+// The ranks come from tables of scores kept per block, in the order of the
+// scores and without the masternodes filtered out.
+BOOST_AUTO_TEST_CASE(masternodeman_rank_tables)
+{
+    const int nMasternodes = 20;
+    const int nMinProtocol = PROTOCOL_VERSION;
+
+    LOCK(cs_main);
+    TestChainSetup chain(200);
+    blockHashCache.Clear();
+
+    // every seventh masternode runs an old protocol and every eleventh has not pinged for too long
+    CMasternodeMan mnman;
+    vector<CMasternode> vMasternodes;
+    for (int i = 0; i < nMasternodes; i++) {
+        CMasternode mn;
+        mn.vin = CTxIn(GetRandHash(), 0);
+        mn.unitTest = true;
+        mn.sigTime = GetAdjustedTime() - 30 * 24 * 60 * 60;
+        mn.lastPing.vin = mn.vin;
+        mn.lastPing.sigTime = GetAdjustedTime() - (i % 11 ? 0 : MASTERNODE_EXPIRATION_SECONDS + 60);
+        if (i % 7 == 0)
+            mn.protocolVersion = nMinProtocol - 1;
+        BOOST_CHECK(mnman.Add(mn));
+        vMasternodes.push_back(mn);
+    }
+
+    // the 16 enabled ones of the protocol, each once
+    const int64_t nHeight = 190;
+    vector<CTxIn> vRanked = GetRanked(mnman, nHeight, nMinProtocol);
+    BOOST_REQUIRE_EQUAL(vRanked.size(), 16U);
+    set<COutPoint> setRanked;
+    for (const CTxIn& vin : vRanked)
+        setRanked.insert(vin.prevout);
+    BOOST_CHECK_EQUAL(setRanked.size(), 16U);
+
+    // masternodes filtered out have no rank
+    BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(vMasternodes[0].vin, nHeight, nMinProtocol), -1);
+    BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(vMasternodes[7].vin, nHeight, nMinProtocol), -1);
+    BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(vMasternodes[11].vin, nHeight, nMinProtocol), -1);
+    BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(vMasternodes[1].vin, 201, 0), -1);
+
+    // the full list puts the disabled one of the protocol in last with a fixed score
+    vector<pair<int, CMasternode> > vRanks = mnman.GetMasternodeRanks(nHeight, nMinProtocol);
+    BOOST_REQUIRE_EQUAL(vRanks.size(), 17U);
+    for (size_t i = 0; i < vRanks.size(); i++)
+        BOOST_CHECK_EQUAL(vRanks[i].first, (int)i + 1);
+    for (size_t i = 0; i < vRanked.size(); i++)
+        BOOST_CHECK(vRanks[i].second.vin == vRanked[i]);
+    BOOST_CHECK(vRanks.back().second.vin == vMasternodes[11].vin);
+    BOOST_CHECK(!vRanks.back().second.IsEnabled());
+
+    // removing a masternode moves the ones behind it up
+    mnman.Remove(vRanked[3]);
+    BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(vRanked[3], nHeight, nMinProtocol), -1);
+    vRanked.erase(vRanked.begin() + 3);
+    BOOST_CHECK(GetRanked(mnman, nHeight, nMinProtocol) == vRanked);
+
+    // and another block has a table of its own
+    BOOST_CHECK_EQUAL(GetRanked(mnman, nHeight + 1, nMinProtocol).size(), 15U);
+
+    blockHashCache.Clear();
+}
+
+// A watched collateral follows the blocks connected and disconnected and the
+// mempool, without another look at the chain state.
+BOOST_AUTO_TEST_CASE(masternodeman_collateral_watch)
+{
+    LOCK(cs_main);
+    CCollateralWatch watch;
+
+    // two collaterals and an output of no deposit amount
+    CMutableTransaction txFund;
+    txFund.vin.push_back(CTxIn(GetRandHash(), 0));
+    txFund.vout.push_back(CTxOut(1000 * COIN, CScript() << OP_TRUE));
+    txFund.vout.push_back(CTxOut(10000 * COIN, CScript() << OP_TRUE));
+    txFund.vout.push_back(CTxOut(5 * COIN, CScript() << OP_TRUE));
+    uint256 hashFund = txFund.GetHash();
+    *pcoinsTip->ModifyCoins(hashFund) = CCoins(txFund, 1);
+    const COutPoint collateral(hashFund, 0), collateral2(hashFund, 1);
+
+    bool fWatched;
+    BOOST_CHECK(!watch.IsUnspent(collateral, fWatched));
+    BOOST_CHECK(!fWatched);
+    BOOST_CHECK(watch.Watch(collateral));
+    BOOST_CHECK(watch.Watch(collateral2));
+    BOOST_CHECK(!watch.Watch(COutPoint(hashFund, 2)));
+    BOOST_CHECK(!watch.Watch(COutPoint(GetRandHash(), 0)));
+    BOOST_CHECK(watch.IsUnspent(collateral, fWatched));
+    BOOST_CHECK(fWatched);
+    BOOST_CHECK_EQUAL(watch.size(), 4U);
+
+    CMutableTransaction txSpend;
+    txSpend.vin.push_back(CTxIn(collateral));
+    txSpend.vout.push_back(CTxOut(999 * COIN, CScript() << OP_TRUE));
+    CBlock blockSpend;
+    blockSpend.vtx.push_back(txSpend);
+
+    watch.BlockConnected(blockSpend);
+    BOOST_CHECK(!watch.IsUnspent(collateral, fWatched));
+    BOOST_CHECK(watch.IsUnspent(collateral2, fWatched));
+    watch.BlockDisconnected(blockSpend);
+    BOOST_CHECK(watch.IsUnspent(collateral, fWatched));
+
+    // a spend waiting in the mempool counts for as long as it is there
+    BOOST_CHECK(mempool.addUnchecked(txSpend.GetHash(), CTxMemPoolEntry(txSpend, 0, GetTime(), 0.0, 1)));
+    BOOST_CHECK(!watch.IsUnspent(collateral, fWatched));
+    std::list<CTransaction> removed;
+    mempool.remove(txSpend, removed);
+    BOOST_CHECK(watch.IsUnspent(collateral, fWatched));
+
+    // a collateral whose block is disconnected is gone until the block comes back
+    CBlock blockFund;
+    blockFund.vtx.push_back(txFund);
+    watch.BlockDisconnected(blockFund);
+    BOOST_CHECK(!watch.IsUnspent(collateral2, fWatched));
+    watch.BlockConnected(blockFund);
+    BOOST_CHECK(watch.IsUnspent(collateral2, fWatched));
+    BOOST_CHECK(!watch.IsUnspent(COutPoint(hashFund, 2), fWatched));
+
+    // a collateral not in the chain yet is checked once its block comes in
+    CMutableTransaction txLater;
+    txLater.vin.push_back(CTxIn(GetRandHash(), 0));
+    txLater.vout.push_back(CTxOut(1000 * COIN, CScript() << OP_TRUE));
+    txLater.vout.push_back(CTxOut(5 * COIN, CScript() << OP_TRUE));
+    const COutPoint collateralLater(txLater.GetHash(), 0), outputLater(txLater.GetHash(), 1);
+    BOOST_CHECK(!watch.Watch(collateralLater));
+    BOOST_CHECK(!watch.Watch(outputLater));
+    CBlock blockLater;
+    blockLater.vtx.push_back(txLater);
+    watch.BlockConnected(blockLater);
+    BOOST_CHECK(watch.IsUnspent(collateralLater, fWatched));
+    BOOST_CHECK(!watch.IsUnspent(outputLater, fWatched));
+    BOOST_CHECK(fWatched);
+
+    std::set<COutPoint> setRetain;
+    setRetain.insert(collateral2);
+    watch.Retain(setRetain);
+    BOOST_CHECK_EQUAL(watch.size(), 1U);
+    BOOST_CHECK(!watch.IsUnspent(collateral, fWatched));
+    BOOST_CHECK(!fWatched);
+
+    pcoinsTip->ModifyCoins(hashFund)->Clear();
+}
+
+static CPubKey RandomPubKey()
+{
+    vector<unsigned char> vch(33);
+    vch[0] = 0x02;
+    uint256 hash = GetRandHash();
+    memcpy(&vch[1], hash.begin(), 32);
+    return CPubKey(vch);
+}
+
+// The enabled counts of each level, of any protocol and of the current one
+static void CheckCounts(CMasternodeMan& mnman, const vector<unsigned>& vAny, const vector<unsigned>& vCurrent)
+{
+    std::map<unsigned, unsigned> mapAny = mnman.CountEnabledByLevels(0);
+    std::map<unsigned, unsigned> mapCurrent = mnman.CountEnabledByLevels(PROTOCOL_VERSION);
+    unsigned nAny = 0, nCurrent = 0;
+    for (unsigned l = CMasternode::LevelValue::MIN; l <= CMasternode::LevelValue::MAX; l++) {
+        BOOST_CHECK_EQUAL(mnman.CountEnabled(l, 0), vAny[l - 1]);
+        BOOST_CHECK_EQUAL(mnman.CountEnabled(l, PROTOCOL_VERSION), vCurrent[l - 1]);
+        BOOST_CHECK_EQUAL(mapAny[l], vAny[l - 1]);
+        BOOST_CHECK_EQUAL(mapCurrent[l], vCurrent[l - 1]);
+        nAny += vAny[l - 1];
+        nCurrent += vCurrent[l - 1];
+    }
+    BOOST_CHECK_EQUAL(mnman.CountEnabled(CMasternode::LevelValue::UNSPECIFIED, 0), nAny);
+    BOOST_CHECK_EQUAL(mnman.CountEnabled(CMasternode::LevelValue::UNSPECIFIED, PROTOCOL_VERSION), nCurrent);
+}
+
+// Every lookup goes through an index kept in step with the list, and the
+// enabled counts follow the checks without another walk of the list.
+BOOST_AUTO_TEST_CASE(masternodeman_registry_index)
+{
+    const int nMasternodes = 105;
+    const CAmount vDeposits[] = {1000 * COIN, 10000 * COIN, 50000 * COIN};
+
+    // every fifth masternode has not pinged for too long and every seventh runs an old protocol
+    CMasternodeMan mnman;
+    vector<CMasternode> vMasternodes;
+    for (int i = 0; i < nMasternodes; i++) {
+        CMasternode mn;
+        mn.vin = CTxIn(GetRandHash(), i % 3);
+        mn.unitTest = true;
+        mn.pubKeyMasternode = RandomPubKey();
+        mn.pubKeyCollateralAddress = RandomPubKey();
+        mn.addr = CService(strprintf("10.0.%d.1", i), 9999);
+        mn.deposit = vDeposits[i % 3];
+        mn.sigTime = GetAdjustedTime() - 60 * 60;
+        mn.lastPing.vin = mn.vin;
+        mn.lastPing.sigTime = GetAdjustedTime() - (i % 5 ? 0 : MASTERNODE_EXPIRATION_SECONDS + 60);
+        if (i % 7 == 0)
+            mn.protocolVersion = PROTOCOL_VERSION - 1;
+        BOOST_CHECK(mnman.Add(mn));
+        vMasternodes.push_back(mn);
+    }
+    BOOST_CHECK(!mnman.Add(vMasternodes[0]));
+    BOOST_CHECK_EQUAL(mnman.size(), nMasternodes);
+    for (unsigned l = CMasternode::LevelValue::MIN; l <= CMasternode::LevelValue::MAX; l++)
+        BOOST_CHECK_EQUAL(mnman.size(l), nMasternodes / 3);
+
+    for (const CMasternode& mn : vMasternodes) {
+        BOOST_CHECK(mnman.Find(mn.vin)->vin == mn.vin);
+        BOOST_CHECK(mnman.Find(mn.pubKeyMasternode)->vin == mn.vin);
+        BOOST_CHECK(mnman.Find(mn.addr)->vin == mn.vin);
+        BOOST_CHECK(mnman.Find(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()))->vin == mn.vin);
+    }
+
+    BOOST_CHECK(!mnman.Find(CTxIn(GetRandHash(), 0)));
+    BOOST_CHECK(!mnman.Find(RandomPubKey()));
+    BOOST_CHECK(!mnman.Find(CService("10.255.255.1", 9999)));
+    // a pay-to-pubkey script of a collateral address is no payee
+    BOOST_CHECK(!mnman.Find(CScript() << ToByteVector(vMasternodes[1].pubKeyCollateralAddress) << OP_CHECKSIG));
+
+    // 35 of each level, 7 of them expired, 5 of an old protocol and one both
+    CheckCounts(mnman, {28, 28, 28}, {24, 24, 24});
+
+    // a newer broadcast moves the masternode to its new keys, address and protocol count
+    CMasternodeBroadcast mnb(vMasternodes[1]);
+    mnb.sigTime += 60;
+    mnb.pubKeyMasternode = RandomPubKey();
+    mnb.addr = CService("10.255.255.1", 9999);
+    mnb.protocolVersion = PROTOCOL_VERSION - 1;
+    mnb.lastPing = CMasternodePing();
+    CMasternode* pmn = mnman.Find(vMasternodes[1].vin);
+    BOOST_CHECK(mnman.UpdateFromNewBroadcast(*pmn, mnb));
+    BOOST_CHECK(!mnman.UpdateFromNewBroadcast(*pmn, mnb));
+    pmn->lastPing = vMasternodes[1].lastPing;
+    BOOST_CHECK(!mnman.Find(vMasternodes[1].pubKeyMasternode));
+    BOOST_CHECK(!mnman.Find(vMasternodes[1].addr));
+    BOOST_CHECK(mnman.Find(mnb.pubKeyMasternode) == pmn);
+    BOOST_CHECK(mnman.Find(mnb.addr) == pmn);
+    CheckCounts(mnman, {28, 28, 28}, {24, 23, 24});
+
+    // where two masternodes share an address the one listed first is found, until it is removed
+    CMasternode mnSameAddr(vMasternodes[3]);
+    mnSameAddr.vin = CTxIn(GetRandHash(), 0);
+    mnSameAddr.pubKeyMasternode = RandomPubKey();
+    BOOST_CHECK(mnman.Add(mnSameAddr));
+    BOOST_CHECK(mnman.Find(vMasternodes[3].addr)->vin == vMasternodes[3].vin);
+    CheckCounts(mnman, {29, 28, 28}, {25, 23, 24});
+
+    // a snapshot handed out is not touched by later changes to the list
+    std::shared_ptr<const vector<CMasternode> > snapshot = mnman.GetSnapshot();
+    BOOST_CHECK(mnman.GetSnapshot() == snapshot);
+    mnman.Remove(vMasternodes[3].vin);
+    BOOST_CHECK_EQUAL(snapshot->size(), (size_t)nMasternodes + 1);
+    BOOST_CHECK_EQUAL(mnman.GetSnapshot()->size(), (size_t)nMasternodes);
+    BOOST_CHECK(!mnman.Find(vMasternodes[3].vin));
+    BOOST_CHECK(mnman.Find(vMasternodes[3].addr)->vin == mnSameAddr.vin);
+    BOOST_CHECK(mnman.Find(vMasternodes.back().vin)->vin == vMasternodes.back().vin);
+    BOOST_CHECK(mnman.Find(vMasternodes.back().pubKeyMasternode)->vin == vMasternodes.back().vin);
+    BOOST_CHECK_EQUAL(mnman.size(vMasternodes[3].Level()), nMasternodes / 3);
+    CheckCounts(mnman, {28, 28, 28}, {24, 23, 24});
+
+    mnman.Clear();
+    BOOST_CHECK(!mnman.Find(vMasternodes.back().vin));
+    BOOST_CHECK_EQUAL(mnman.CountEnabled(CMasternode::LevelValue::UNSPECIFIED, 0), 0U);
+    BOOST_CHECK_EQUAL(mnman.size(1), 0);
+}
+
+// A broadcast whose ping brings an expired masternode back counts it as
+// enabled once, although the ping checks the masternode within the update.
+BOOST_AUTO_TEST_CASE(masternodeman_broadcast_enables)
+{
+    LOCK(cs_main);
+    TestChainSetup chain(30);
+
+    CMasternode mn;
+    mn.vin = CTxIn(GetRandHash(), 0);
+    mn.unitTest = true;
+    mn.pubKeyMasternode = RandomPubKey();
+    mn.pubKeyCollateralAddress = RandomPubKey();
+    mn.addr = CService("10.1.0.1", 9999);
+    mn.deposit = 1000 * COIN;
+    mn.sigTime = GetAdjustedTime() - 2 * 60 * 60;
+    mn.lastPing.vin = mn.vin;
+    mn.lastPing.sigTime = GetAdjustedTime();
+    // the global list, where the ping looks its masternode up
+    BOOST_CHECK(mnodeman.Add(mn));
+    BOOST_CHECK_EQUAL(mnodeman.CountEnabled(CMasternode::LevelValue::UNSPECIFIED, 0), 1U);
+
+    CMasternode* pmn = mnodeman.Find(mn.vin);
+    pmn->lastPing.sigTime = GetAdjustedTime() - MASTERNODE_EXPIRATION_SECONDS - 60;
+    mnodeman.CheckMasternode(*pmn, true);
+    BOOST_REQUIRE(pmn->activeState == CMasternode::MASTERNODE_EXPIRED);
+    BOOST_CHECK_EQUAL(mnodeman.CountEnabled(CMasternode::LevelValue::UNSPECIFIED, 0), 0U);
+
+    // a newer broadcast under a new masternode key, with a ping signed by it
+    CKey keyMasternode;
+    keyMasternode.MakeNewKey(true);
+    CPubKey pubKeyMasternode = keyMasternode.GetPubKey();
+    CMasternodeBroadcast mnb(*pmn);
+    mnb.sigTime += 60;
+    mnb.pubKeyMasternode = pubKeyMasternode;
+    mnb.lastPing = CMasternodePing(mnb.vin);
+    BOOST_REQUIRE(mnb.lastPing.Sign(keyMasternode, pubKeyMasternode));
+
+    BOOST_CHECK(mnodeman.UpdateFromNewBroadcast(*pmn, mnb));
+    BOOST_CHECK(pmn->lastPing == mnb.lastPing);
+    BOOST_CHECK(pmn->IsEnabled());
+    BOOST_CHECK_EQUAL(mnodeman.CountEnabled(CMasternode::LevelValue::UNSPECIFIED, 0), 1U);
+    BOOST_CHECK_EQUAL(mnodeman.CountEnabled(CMasternode::LevelValue::MIN, PROTOCOL_VERSION), 1U);
+    mnodeman.CheckMasternode(*pmn, true);
+    BOOST_CHECK_EQUAL(mnodeman.CountEnabled(CMasternode::LevelValue::UNSPECIFIED, 0), 1U);
+
+    // expiring again takes it out of the counts altogether
+    pmn->lastPing.sigTime = GetAdjustedTime() - MASTERNODE_EXPIRATION_SECONDS - 60;
+    mnodeman.CheckMasternode(*pmn, true);
+    BOOST_CHECK_EQUAL(mnodeman.CountEnabled(CMasternode::LevelValue::UNSPECIFIED, 0), 0U);
+
+    mnodeman.Clear();
+}
+
+// The snapshot keeps what the broadcasts and last pings of the live masternodes
+// carry, and is what mncache.dat holds in place of the whole manager.
+BOOST_AUTO_TEST_CASE(masternodeman_snapshot)
+{
+    const int nMasternodes = 300;
+    const CAmount vDeposits[] = {1000 * COIN, 10000 * COIN, 50000 * COIN};
+
+    CMasternodeMan mnman;
+    for (int i = 0; i < nMasternodes; i++) {
+        CMasternode mn;
+        mn.vin = CTxIn(GetRandHash(), i % 3);
+        mn.pubKeyMasternode = RandomPubKey();
+        mn.pubKeyCollateralAddress = RandomPubKey();
+        mn.addr = CService(strprintf("10.%d.%d.1", i / 256, i % 256), 9999);
+        mn.deposit = vDeposits[i % 3];
+        mn.sig = vector<unsigned char>(65, i % 251);
+        mn.sigTime = GetAdjustedTime() - 60 * 60 - i;
+        mn.nLastDsq = i;
+        mn.lastPing.vin = mn.vin;
+        mn.lastPing.blockHash = GetRandHash();
+        mn.lastPing.sigTime = GetAdjustedTime() - i;
+        mn.lastPing.vchSig = vector<unsigned char>(65, i % 253);
+        BOOST_CHECK(mnman.Add(mn));
+        // every tenth one has its collateral spent since it was added
+        if (i % 10 == 0)
+            mnman.Find(mn.vin)->activeState = CMasternode::MASTERNODE_VIN_SPENT;
+        // as a running node has seen them
+        CMasternodeBroadcast mnb(mn);
+        mnman.mapSeenMasternodeBroadcast.insert(make_pair(mnb.GetHash(), mnb));
+        mnman.mapSeenMasternodePing.insert(make_pair(mn.lastPing.GetHash(), mn.lastPing));
+    }
+
+    // the whole manager, as mncache.dat held it before
+    CDataStream ssLegacy(SER_DISK, CLIENT_VERSION);
+    ssLegacy << mnman;
+    CDataStream ssSnapshot(SER_DISK, CLIENT_VERSION);
+    mnman.WriteSnapshot(ssSnapshot);
+    // without the maps of what was seen, the snapshot is under half the size
+    BOOST_CHECK(ssSnapshot.size() < ssLegacy.size() / 2);
+
+    CMasternodeMan mnmanLegacy;
+    ssLegacy >> mnmanLegacy;
+    BOOST_CHECK_EQUAL(mnmanLegacy.size(), nMasternodes);
+    BOOST_CHECK_EQUAL(mnmanLegacy.mapSeenMasternodeBroadcast.size(), (size_t)nMasternodes);
+
+    CMasternodeMan mnmanRead;
+    mnmanRead.ReadSnapshot(ssSnapshot);
+    BOOST_CHECK(ssSnapshot.empty());
+
+    BOOST_CHECK_EQUAL(mnmanRead.size(), nMasternodes - nMasternodes / 10);
+    BOOST_CHECK(mnmanRead.mapSeenMasternodeBroadcast.empty());
+    BOOST_CHECK(mnmanRead.mapSeenMasternodePing.empty());
+    for (CMasternode mn : *mnman.GetSnapshot()) {
+        CMasternode* pmn = mnmanRead.Find(mn.vin);
+        if (mn.activeState == CMasternode::MASTERNODE_VIN_SPENT) {
+            BOOST_CHECK(!pmn);
+            continue;
+        }
+        BOOST_REQUIRE(pmn);
+        BOOST_CHECK(mnmanRead.Find(mn.pubKeyMasternode) == pmn);
+        BOOST_CHECK(pmn->addr == mn.addr);
+        BOOST_CHECK(pmn->pubKeyCollateralAddress == mn.pubKeyCollateralAddress);
+        BOOST_CHECK(pmn->sig == mn.sig);
+        BOOST_CHECK_EQUAL(pmn->sigTime, mn.sigTime);
+        BOOST_CHECK_EQUAL(pmn->protocolVersion, mn.protocolVersion);
+        BOOST_CHECK_EQUAL(pmn->deposit, mn.deposit);
+        BOOST_CHECK_EQUAL(pmn->nLastDsq, mn.nLastDsq);
+        // the ping still hashes and verifies as the one received
+        BOOST_CHECK(pmn->lastPing.GetHash() == mn.lastPing.GetHash());
+        BOOST_CHECK(pmn->lastPing.vchSig == mn.lastPing.vchSig);
+        BOOST_CHECK(CMasternodeBroadcast(*pmn).GetHash() == CMasternodeBroadcast(mn).GetHash());
+    }
+
+    // mncache.dat holds the snapshot and still takes the legacy format
+    CMasternodeDB mndb;
+    boost::filesystem::path pathMN = GetDataDir() / "mncache.dat";
+    BOOST_CHECK(mndb.Write(mnman));
+    BOOST_CHECK(mndb.Read(mnmanLegacy, true) == CMasternodeDB::Ok);
+    BOOST_CHECK(!boost::filesystem::exists(GetDataDir() / "mncache.dat.new"));
+
+    CDataStream ssFile(SER_DISK, CLIENT_VERSION);
+    ssFile << string("MasternodeCache") << FLATDATA(Params().MessageStart()) << mnman;
+    ssFile << Hash(ssFile.begin(), ssFile.end());
+    FILE* file = fopen(pathMN.string().c_str(), "wb");
+    CAutoFile(file, SER_DISK, CLIENT_VERSION) << ssFile;
+    BOOST_CHECK(mndb.Read(mnmanLegacy, true) == CMasternodeDB::Ok);
+
+    // a snapshot of a later version is turned down
+    ssFile.clear();
+    ssFile << string("MasternodeSnapshot") << FLATDATA(Params().MessageStart()) << MASTERNODES_SNAPSHOT_VERSION + 1;
+    ssFile << Hash(ssFile.begin(), ssFile.end());
+    file = fopen(pathMN.string().c_str(), "wb");
+    CAutoFile(file, SER_DISK, CLIENT_VERSION) << ssFile;
+    BOOST_CHECK(mndb.Read(mnmanLegacy, true) == CMasternodeDB::IncorrectFormat);
+
+    boost::filesystem::remove(pathMN);
+}
+
+// A node that restarts with its list asks a peer's listing only for the
+// broadcasts it does not hold, and knows the list sync is done once every
+// peer asked sent its count and those broadcasts came in.
+BOOST_AUTO_TEST_CASE(masternodeman_list_delta)
+{
+    CMasternodeMan mnman;
+    vector<CMasternode> vMasternodes;
+    for (int i = 0; i < 10; i++) {
+        CMasternode mn;
+        mn.vin = CTxIn(GetRandHash(), 0);
+        mn.unitTest = true;
+        mn.pubKeyMasternode = RandomPubKey();
+        mn.pubKeyCollateralAddress = RandomPubKey();
+        mn.addr = CService(strprintf("10.1.%d.1", i), 9999);
+        mn.deposit = 1000 * COIN;
+        mn.sigTime = GetAdjustedTime() - 60 * 60;
+        mn.lastPing.vin = mn.vin;
+        // the last one has not pinged for a while
+        mn.lastPing.sigTime = GetAdjustedTime() - (i < 9 ? 0 : MASTERNODE_PING_SECONDS2 + 60);
+        BOOST_CHECK(mnman.Add(mn));
+        vMasternodes.push_back(mn);
+    }
+
+    for (int i = 0; i < 9; i++)
+        BOOST_CHECK(mnman.HaveBroadcast(CMasternodeBroadcast(vMasternodes[i]).GetHash()));
+    BOOST_CHECK(!mnman.HaveBroadcast(CMasternodeBroadcast(vMasternodes[9]).GetHash()));
+    BOOST_CHECK(!mnman.HaveBroadcast(GetRandHash()));
+
+    // a newer broadcast replaces the old one in the index
+    CMasternodeBroadcast mnb(vMasternodes[1]);
+    mnb.sigTime += 60;
+    mnb.lastPing = CMasternodePing();
+    BOOST_CHECK(mnman.UpdateFromNewBroadcast(*mnman.Find(mnb.vin), mnb));
+    mnman.Find(mnb.vin)->lastPing = vMasternodes[1].lastPing;
+    BOOST_CHECK(!mnman.HaveBroadcast(CMasternodeBroadcast(vMasternodes[1]).GetHash()));
+    BOOST_CHECK(mnman.HaveBroadcast(mnb.GetHash()));
+    BOOST_CHECK(mnman.HaveBroadcast(CMasternodeBroadcast(vMasternodes[2]).GetHash()));
+
+    // two peers asked, one broadcast fetched
+    masternodeSync.Reset();
+    masternodeSync.RequestedMasternodeAssets = MASTERNODE_SYNC_LIST;
+    masternodeSync.RequestedMasternodeAttempt = 2;
+    uint256 hashFetched = CMasternodeBroadcast(vMasternodes[9]).GetHash();
+    masternodeSync.AskedForMasternodeList(hashFetched);
+    masternodeSync.countMasternodeList = 1;
+    BOOST_CHECK(!masternodeSync.IsMasternodeListComplete());
+    masternodeSync.countMasternodeList = 2;
+    BOOST_CHECK(!masternodeSync.IsMasternodeListComplete());
+    masternodeSync.ReceivedMasternodeList(hashFetched);
+    BOOST_CHECK(masternodeSync.IsMasternodeListComplete());
+    masternodeSync.Reset();
+    BOOST_CHECK(!masternodeSync.IsMasternodeListComplete());
+}
+
+// The masternodes to pay of all levels come from one pass over the list,
+// and a level left too few older masternodes falls back to its new ones.
+BOOST_AUTO_TEST_CASE(masternodeman_payment_queue)
+{
+    const int nBlocks = 200;
+    const int nHeight = nBlocks - 5;
+    const CAmount vDeposits[] = {1000 * COIN, 10000 * COIN, 50000 * COIN};
+
+    LOCK(cs_main);
+    TestChainSetup chain(nBlocks);
+    blockHashCache.Clear();
+
+    enum { ELIGIBLE, NEW, YOUNG_INPUT, SCHEDULED, EXPIRED, OLD_PROTOCOL };
+    // of each level: the first one can be paid, the second level has no older one left to pay,
+    // and the third has two to pick from
+    const vector<vector<int> > vLevels = {
+        {ELIGIBLE, YOUNG_INPUT, SCHEDULED, EXPIRED, OLD_PROTOCOL},
+        {NEW, SCHEDULED, YOUNG_INPUT},
+        {ELIGIBLE, ELIGIBLE, NEW}};
+
+    CMasternodeMan mnman;
+    vector<vector<CTxIn> > vVins(3);
+    for (int l = 0; l < 3; l++) {
+        for (int nKind : vLevels[l]) {
+            CMasternode mn;
+            mn.vin = CTxIn(GetRandHash(), 0);
+            mn.unitTest = true;
+            mn.pubKeyCollateralAddress = RandomPubKey();
+            mn.deposit = vDeposits[l];
+            mn.sigTime = GetAdjustedTime() - (nKind == NEW || nKind == YOUNG_INPUT ? 60 : 30 * 24 * 60 * 60);
+            mn.lastPing.vin = mn.vin;
+            mn.lastPing.sigTime = GetAdjustedTime() - (nKind == EXPIRED ? MASTERNODE_EXPIRATION_SECONDS + 60 : 0);
+            mn.cacheInputAge = nKind == YOUNG_INPUT ? 1 : 10000;
+            mn.cacheInputAgeBlock = nBlocks;
+            if (nKind == OLD_PROTOCOL)
+                mn.protocolVersion = masternodePayments.GetMinMasternodePaymentsProto() - 1;
+            if (nKind == SCHEDULED) {
+                // voted the payee of one of the next blocks
+                CMasternodePaymentWinner winner(CTxIn(GetRandHash(), 0));
+                winner.nBlockHeight = nBlocks + 9;
+                winner.AddPayee(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()), l + 1);
+                BOOST_CHECK(masternodePayments.AddWinningMasternode(winner));
+            }
+            BOOST_CHECK(mnman.Add(mn));
+            vVins[l].push_back(mn.vin);
+        }
+    }
+
+    map<unsigned, unsigned> mapCount;
+    map<unsigned, CMasternode*> mapNext = mnman.GetNextMasternodesInQueueForPayment(nHeight, mapCount);
+    BOOST_CHECK_EQUAL(mapCount[CMasternode::LevelValue::MIN], 1U);
+    BOOST_CHECK_EQUAL(mapCount[CMasternode::LevelValue::MIN + 1], 1U);
+    BOOST_CHECK_EQUAL(mapCount[CMasternode::LevelValue::MAX], 2U);
+    BOOST_REQUIRE_EQUAL(mapNext.size(), 3U);
+    BOOST_CHECK(mapNext[CMasternode::LevelValue::MIN]->vin == vVins[0][0]);
+    BOOST_CHECK(mapNext[CMasternode::LevelValue::MIN + 1]->vin == vVins[1][0]);
+    BOOST_CHECK(mapNext[CMasternode::LevelValue::MAX]->vin == vVins[2][0] || mapNext[CMasternode::LevelValue::MAX]->vin == vVins[2][1]);
+    for (const auto& next : mapNext)
+        BOOST_CHECK_EQUAL(next.second->Level(), next.first);
+
+    // the one to pay of the first level, once scheduled, leaves it none
+    CMasternodePaymentWinner winner(CTxIn(GetRandHash(), 0));
+    winner.nBlockHeight = nBlocks + 8;
+    winner.AddPayee(GetScriptForDestination(mapNext[CMasternode::LevelValue::MIN]->pubKeyCollateralAddress.GetID()), CMasternode::LevelValue::MIN);
+    BOOST_CHECK(masternodePayments.AddWinningMasternode(winner));
+    mapCount.clear();
+    mapNext = mnman.GetNextMasternodesInQueueForPayment(nHeight, mapCount);
+    BOOST_CHECK_EQUAL(mapCount[CMasternode::LevelValue::MIN], 0U);
+    BOOST_CHECK(!mapNext.count(CMasternode::LevelValue::MIN));
+
+    masternodePayments.Clear();
+    blockHashCache.Clear();
+}
+
+// A block hash looked up by height after a reorganization is the one of the
+// block now at that height, never the one it replaced.
+BOOST_AUTO_TEST_CASE(masternodeman_block_hash_cache)
+{
+    const int nBlocks = 300;
+
+    LOCK(cs_main);
+    TestChainSetup chain(nBlocks);
+    const vector<CBlockIndex*>& vBlocks = chain.vBlocks;
+
+    // fewer slots than heights, so heights falling on the same slot push each other out
+    CBlockHashCache cache(64);
+    uint256 hash;
+    for (int n = 0; n < 2; n++) {
+        for (int h = nBlocks - 100; h <= nBlocks; h++) {
+            BOOST_REQUIRE(cache.Get(hash, h));
+            BOOST_CHECK(hash == vBlocks[h]->GetBlockHash());
+        }
+    }
+    BOOST_CHECK(cache.Get(hash, 0));
+    BOOST_CHECK(hash == vBlocks[nBlocks]->GetBlockHash());
+    BOOST_CHECK(!cache.Get(hash, nBlocks + 1));
+
+    CBlockHashCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nSlots, 64U);
+    BOOST_CHECK_EQUAL(stats.nLookups, 2U * 101U + 1U);
+    BOOST_CHECK(stats.nHits > 0 && stats.nHits < stats.nLookups);
+
+    // the last heights held come from the cache
+    uint64_t nHits = stats.nHits;
+    for (int h = nBlocks - 20; h <= nBlocks; h++)
+        BOOST_CHECK(cache.Get(hash, h) && hash == vBlocks[h]->GetBlockHash());
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nHits, nHits + 21U);
+
+    // disconnect the top ten blocks and connect others in their place
+    const int nReorg = 10;
+    for (int h = nBlocks; h > nBlocks - nReorg; h--) {
+        chainActive.SetTip(vBlocks[h - 1]);
+        cache.BlockDisconnected(vBlocks[h]);
+    }
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nInvalidated, (uint64_t)nReorg);
+    BOOST_CHECK(!cache.Get(hash, nBlocks));
+
+    vector<CBlockIndex*> vFork;
+    for (int h = nBlocks - nReorg + 1; h <= nBlocks; h++) {
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->pprev = vFork.empty() ? vBlocks[h - 1] : vFork.back();
+        pindex->nHeight = h;
+        pindex->phashBlock = &mapBlockIndex.insert(make_pair(GetRandHash(), pindex)).first->first;
+        vFork.push_back(pindex);
+    }
+    chainActive.SetTip(vFork.back());
+    for (int h = nBlocks - nReorg + 1; h <= nBlocks; h++) {
+        BOOST_REQUIRE(cache.Get(hash, h));
+        BOOST_CHECK(hash == vFork[h - (nBlocks - nReorg + 1)]->GetBlockHash());
+    }
+    BOOST_CHECK(cache.Get(hash, nBlocks - nReorg) && hash == vBlocks[nBlocks - nReorg]->GetBlockHash());
+
+    chainActive.SetTip(vBlocks[0]);
+    for (CBlockIndex* pindex : vFork) {
+        mapBlockIndex.erase(pindex->GetBlockHash());
+        delete pindex;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,175 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test/test_fdreserve.h"
+
+#include "clientversion.h"
+#include "main.h"
+#include "masternode-payments.h"
+#include "random.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(mnpayments_tests)
+
+static void Vote(int nBlockHeight, const CScript& payee, unsigned mnlevel, int nVotes)
+{
+    for (int v = 0; v < nVotes; v++) {
+        CMasternodePaymentWinner winner(CTxIn(GetRandHash(), 0));
+        winner.nBlockHeight = nBlockHeight;
+        winner.AddPayee(payee, mnlevel);
+        BOOST_CHECK(masternodePayments.AddWinningMasternode(winner));
+    }
+}
+
+static CScript RandomPayee()
+{
+    CKeyID keyID;
+    GetRandBytes(keyID.begin(), keyID.size());
+    return GetScriptForDestination(keyID);
+}
+
+// GetLastPaid is the block time of the last paid height, less an offset of under 90 seconds
+static bool IsPaidAt(CMasternode& mn, int nEnabledCount, const CBlockIndex* pindex)
+{
+    int64_t nLastPaid = mn.GetLastPaid(nEnabledCount);
+    return nLastPaid > pindex->nTime - 90 && nLastPaid <= pindex->nTime;
+}
+
+BOOST_AUTO_TEST_CASE(mnpayments_lastpaid)
+{
+    const int nBlocks = 1300;
+
+    LOCK(cs_main);
+    TestChainSetup chain(nBlocks);
+
+    vector<CMasternode> vMasternodes(3);
+    vector<CScript> vPayees;
+    for (CMasternode& mn : vMasternodes) {
+        vector<unsigned char> vch(33);
+        vch[0] = 0x02;
+        uint256 hash = GetRandHash();
+        memcpy(&vch[1], hash.begin(), 32);
+        mn.pubKeyCollateralAddress = CPubKey(vch);
+        mn.vin = CTxIn(GetRandHash(), 0);
+        vPayees.push_back(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()));
+    }
+
+    // a block counts as paid from MNPAYMENTS_LASTPAID_VOTES votes on
+    Vote(100, vPayees[0], CMasternode::LevelValue::MIN, MNPAYMENTS_LASTPAID_VOTES);
+    Vote(1200, vPayees[0], CMasternode::LevelValue::MIN, MNPAYMENTS_LASTPAID_VOTES);
+    Vote(1250, vPayees[0], CMasternode::LevelValue::MIN, MNPAYMENTS_LASTPAID_VOTES - 1);
+    Vote(1280, vPayees[1], CMasternode::LevelValue::MIN, MNPAYMENTS_LASTPAID_VOTES);
+    Vote(1290, vPayees[2], CMasternode::LevelValue::MIN, MNPAYMENTS_LASTPAID_VOTES - 1);
+
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(vPayees[0], nBlocks, nBlocks), 1200);
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(vPayees[1], nBlocks, nBlocks), 1280);
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(vPayees[2], nBlocks, nBlocks), 0);
+
+    // only the last nDepth blocks are looked at
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(vPayees[0], nBlocks, 100), 0);
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(vPayees[0], nBlocks, 101), 1200);
+    BOOST_CHECK_EQUAL(vMasternodes[0].GetLastPaid(80), 0);
+    BOOST_CHECK(IsPaidAt(vMasternodes[0], 200, chain.vBlocks[1200]));
+    BOOST_CHECK(IsPaidAt(vMasternodes[1], 200, chain.vBlocks[1280]));
+    BOOST_CHECK_EQUAL(vMasternodes[2].GetLastPaid(200), 0);
+
+    // the index is rebuilt when the payments are read back
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << masternodePayments;
+    CMasternodePayments paymentsRead;
+    ss >> paymentsRead;
+    BOOST_CHECK_EQUAL(paymentsRead.GetLastPaidHeight(vPayees[0], nBlocks, nBlocks), 1200);
+    BOOST_CHECK_EQUAL(paymentsRead.GetLastPaidHeight(vPayees[1], nBlocks, nBlocks), 1280);
+    BOOST_CHECK_EQUAL(paymentsRead.GetLastPaidHeight(vPayees[2], nBlocks, nBlocks), 0);
+
+    // disconnecting blocks moves the last payment back with the tip
+    chainActive.SetTip(chain.vBlocks[1150]);
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(vPayees[0], 1150, nBlocks), 100);
+    BOOST_CHECK(IsPaidAt(vMasternodes[0], 1000, chain.vBlocks[100]));
+    BOOST_CHECK_EQUAL(vMasternodes[1].GetLastPaid(1000), 0);
+
+    // cleaned up blocks leave the index with them
+    chainActive.SetTip(chain.vBlocks[nBlocks]);
+    masternodePayments.CleanPaymentList();
+    BOOST_CHECK(!masternodePayments.GetBlockPayees(100));
+    BOOST_CHECK(masternodePayments.GetBlockPayees(1200));
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(vPayees[0], 1150, nBlocks), 0);
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(vPayees[0], nBlocks, nBlocks), 1200);
+
+    masternodePayments.Clear();
+    blockHashCache.Clear();
+}
+
+// The votes are held in a window of slots by height, which grows to take
+// every block voted for until CleanPaymentList drops the old ones.
+BOOST_AUTO_TEST_CASE(mnpayments_block_window)
+{
+    const int nBlocks = 1300;
+    const unsigned nLevelMin = CMasternode::LevelValue::MIN;
+    const unsigned nLevelMax = CMasternode::LevelValue::MAX;
+
+    LOCK(cs_main);
+    TestChainSetup chain(nBlocks);
+
+    vector<CScript> vPayees;
+    for (int i = 0; i < 4; i++)
+        vPayees.push_back(RandomPayee());
+
+    // votes in no order of height, the window growing both ways
+    Vote(1210, vPayees[0], nLevelMin, 2);
+    Vote(1210, vPayees[1], nLevelMin, 3);
+    Vote(1210, vPayees[2], nLevelMin + 1, 2);
+    Vote(1210, vPayees[3], nLevelMin + 1, 2);
+    Vote(150, vPayees[0], nLevelMin, 1);
+    Vote(1320, vPayees[1], nLevelMax, 4);
+    Vote(700, vPayees[2], nLevelMin, 2);
+    Vote(700, vPayees[0], nLevelMin, 2);
+    Vote(150, vPayees[3], nLevelMin, 1);
+    BOOST_CHECK_EQUAL(masternodePayments.CountBlocks(), 4U);
+
+    // the payee of a level with the most votes, the first voted for on a tie
+    CScript payee;
+    BOOST_CHECK(masternodePayments.GetBlockPayee(1210, nLevelMin, payee) && payee == vPayees[1]);
+    BOOST_CHECK(masternodePayments.GetBlockPayee(1210, nLevelMin + 1, payee) && payee == vPayees[2]);
+    BOOST_CHECK(!masternodePayments.GetBlockPayee(1210, nLevelMax, payee));
+    BOOST_CHECK(masternodePayments.GetBlockPayee(700, nLevelMin, payee) && payee == vPayees[2]);
+    BOOST_CHECK(masternodePayments.GetBlockPayee(150, nLevelMin, payee) && payee == vPayees[0]);
+    BOOST_CHECK(masternodePayments.GetBlockPayee(1320, nLevelMax, payee) && payee == vPayees[1]);
+    BOOST_CHECK(!masternodePayments.GetBlockPayee(151, nLevelMin, payee));
+    BOOST_CHECK(!masternodePayments.GetBlockPayee(1319, nLevelMax, payee));
+
+    // one more vote breaks the tie
+    Vote(1210, vPayees[3], nLevelMin + 1, 1);
+    BOOST_CHECK(masternodePayments.GetBlockPayee(1210, nLevelMin + 1, payee) && payee == vPayees[3]);
+
+    // the window is written as the map of blocks it replaced
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << masternodePayments;
+    CMasternodePayments paymentsRead;
+    ss >> paymentsRead;
+    BOOST_CHECK_EQUAL(paymentsRead.CountBlocks(), 4U);
+    BOOST_CHECK(paymentsRead.GetBlockPayee(1210, nLevelMin + 1, payee) && payee == vPayees[3]);
+    BOOST_CHECK(paymentsRead.GetBlockPayee(700, nLevelMin, payee) && payee == vPayees[2]);
+    BOOST_CHECK(paymentsRead.GetBlockPayee(1320, nLevelMax, payee) && payee == vPayees[1]);
+
+    // blocks more than 1000 below the tip leave with their votes, the newer ones stay as they were
+    masternodePayments.CleanPaymentList();
+    for (const auto& vote : masternodePayments.mapMasternodePayeeVotes)
+        BOOST_CHECK(vote.second.nBlockHeight >= nBlocks - 1000);
+    BOOST_CHECK_EQUAL(masternodePayments.mapMasternodePayeeVotes.size(), 18U);
+    BOOST_CHECK_EQUAL(masternodePayments.CountBlocks(), 3U);
+    BOOST_CHECK(!masternodePayments.GetBlockPayees(150));
+    BOOST_CHECK(masternodePayments.GetBlockPayee(700, nLevelMin, payee) && payee == vPayees[2]);
+    BOOST_CHECK(masternodePayments.GetBlockPayee(1210, nLevelMin, payee) && payee == vPayees[1]);
+
+    masternodePayments.Clear();
+    blockHashCache.Clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,107 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternode-verify.h"
+#include "masternodeman.h"
+#include "net.h"
+#include "random.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(mnverify_tests)
+
+static bool WaitForDrain(const CMasternodeVerifyQueue& queue, uint64_t nMessages, CMasternodeVerifyStats& stats)
+{
+    for (int i = 0; i < 1000; i++) {
+        queue.GetStats(stats);
+        if (stats.nApplied == nMessages)
+            return true;
+        MilliSleep(10);
+    }
+    return false;
+}
+
+static CKey NewKey()
+{
+    CKey key;
+    key.MakeNewKey(true);
+    return key;
+}
+
+// Broadcasts and pings of masternodes nobody knows are turned down once
+// applied; every one of them must still make it through, with the bad
+// signatures found by the verify threads, and the peer must be given back.
+BOOST_AUTO_TEST_CASE(mnverify_drain)
+{
+    CMasternodeVerifyQueue queue;
+    CAddress addr(CService("250.1.2.3", Params().GetDefaultPort()));
+    CNode dummyNode(INVALID_SOCKET, addr, "", true);
+    dummyNode.nVersion = 1;
+
+    CKey keyCollateral = NewKey(), keyMasternode = NewKey();
+    CService service("250.1.2.4", Params().GetDefaultPort());
+
+    std::vector<CMasternodeBroadcast> vBroadcasts;
+    for (int i = 0; i < 50; i++) {
+        CMasternodeBroadcast mnb(service, CTxIn(GetRandHash(), 0), keyCollateral.GetPubKey(), keyMasternode.GetPubKey(), PROTOCOL_VERSION);
+        BOOST_REQUIRE(mnb.Sign(keyCollateral));
+        // every fifth one is tampered with
+        if (i % 5 == 0)
+            mnb.sig[10] ^= 1;
+        vBroadcasts.push_back(mnb);
+    }
+
+    // a tampered broadcast is turned down unless its signature was found valid before
+    int nDoS = 0;
+    BOOST_CHECK(!vBroadcasts[0].CheckAndUpdate(nDoS));
+    BOOST_CHECK_EQUAL(nDoS, 100);
+    nDoS = 0;
+    BOOST_CHECK(vBroadcasts[0].CheckAndUpdate(nDoS, true));
+    BOOST_CHECK(vBroadcasts[1].CheckAndUpdate(nDoS));
+
+    // pings checked against their own key, another key, and no key for an unlisted masternode
+    std::vector<CMasternodePing> vPings;
+    std::vector<CPubKey> vPingKeys;
+    CPubKey pubKeyMasternode = keyMasternode.GetPubKey();
+    for (int i = 0; i < 30; i++) {
+        CMasternodePing mnp;
+        mnp.vin = CTxIn(GetRandHash(), 0);
+        mnp.blockHash = GetRandHash();
+        BOOST_REQUIRE(mnp.Sign(keyMasternode, pubKeyMasternode));
+        vPings.push_back(mnp);
+        vPingKeys.push_back(i % 6 == 1 ? NewKey().GetPubKey() : i % 6 == 2 ? CPubKey() : pubKeyMasternode);
+    }
+    BOOST_CHECK(vPings[0].VerifySignature(pubKeyMasternode));
+    BOOST_CHECK(!vPings[1].VerifySignature(vPingKeys[1]));
+
+    BOOST_CHECK(!queue.Submit(&dummyNode, vBroadcasts[0]));
+
+    boost::thread_group threadGroup;
+    queue.Start(threadGroup, 3);
+    int nRefCount = dummyNode.GetRefCount();
+
+    for (size_t i = 0; i < vBroadcasts.size() || i < vPings.size(); i++) {
+        if (i < vBroadcasts.size())
+            BOOST_CHECK(queue.Submit(&dummyNode, vBroadcasts[i]));
+        if (i < vPings.size())
+            BOOST_CHECK(queue.Submit(&dummyNode, vPings[i], vPingKeys[i]));
+    }
+
+    CMasternodeVerifyStats stats;
+    BOOST_CHECK(WaitForDrain(queue, vBroadcasts.size() + vPings.size(), stats));
+    BOOST_CHECK(stats.fRunning);
+    BOOST_CHECK_EQUAL(stats.nBroadcasts, (uint64_t)vBroadcasts.size());
+    BOOST_CHECK_EQUAL(stats.nPings, (uint64_t)vPings.size());
+    BOOST_CHECK_EQUAL(stats.nBadSignatures, 10U + 5U);
+    BOOST_CHECK_EQUAL(stats.nQueuedVerify + stats.nQueuedApply, 0U);
+    BOOST_CHECK_EQUAL(dummyNode.GetRefCount(), nRefCount);
+
+    queue.Stop();
+    threadGroup.join_all();
+    BOOST_CHECK(!queue.Submit(&dummyNode, vPings[0], pubKeyMasternode));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
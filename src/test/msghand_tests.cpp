@@ -0,0 +1,174 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "net.h"
+#include "random.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(msghand_tests)
+
+static CDataStream InvMessage(const std::vector<CInv>& vInv)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vInv;
+    return ss;
+}
+
+BOOST_AUTO_TEST_CASE(msghand_concurrent_messages)
+{
+    CDataStream ssEmpty(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(IsConcurrentMessage("ping", ssEmpty));
+    BOOST_CHECK(IsConcurrentMessage("pong", ssEmpty));
+    BOOST_CHECK(!IsConcurrentMessage("version", ssEmpty));
+    BOOST_CHECK(!IsConcurrentMessage("addr", ssEmpty));
+    BOOST_CHECK(!IsConcurrentMessage("getaddr", ssEmpty));
+    BOOST_CHECK(!IsConcurrentMessage("mnb", ssEmpty));
+    BOOST_CHECK(!IsConcurrentMessage("block", ssEmpty));
+
+    std::vector<CInv> vInv;
+    vInv.push_back(CInv(MSG_TX, GetRandHash()));
+    vInv.push_back(CInv(MSG_BLOCK, GetRandHash()));
+    BOOST_CHECK(IsConcurrentMessage("inv", InvMessage(vInv)));
+    // only blocks are served from disk
+    BOOST_CHECK(!IsConcurrentMessage("getdata", InvMessage(vInv)));
+
+    vInv[0] = CInv(MSG_FILTERED_BLOCK, GetRandHash());
+    BOOST_CHECK(IsConcurrentMessage("getdata", InvMessage(vInv)));
+
+    // the inventory kept by the masternode and spork handlers
+    vInv.push_back(CInv(MSG_MASTERNODE_ANNOUNCE, GetRandHash()));
+    BOOST_CHECK(!IsConcurrentMessage("inv", InvMessage(vInv)));
+    BOOST_CHECK(!IsConcurrentMessage("getdata", InvMessage(vInv)));
+
+    // left to the serialized handler to turn down, and the stream to read again
+    CDataStream ssShort = InvMessage(std::vector<CInv>(1, CInv(MSG_TX, GetRandHash())));
+    ssShort.resize(ssShort.size() - 1);
+    size_t nSize = ssShort.size();
+    BOOST_CHECK(!IsConcurrentMessage("inv", ssShort));
+    BOOST_CHECK_EQUAL(ssShort.size(), nSize);
+    BOOST_CHECK(!IsConcurrentMessage("inv", InvMessage(std::vector<CInv>())));
+}
+
+BOOST_AUTO_TEST_CASE(msghand_queue_push)
+{
+    CMessageHandlerQueue queue;
+    CAddress addr(CService("250.1.2.3", Params().GetDefaultPort()));
+    CNode dummyNode(INVALID_SOCKET, addr, "", true);
+
+    // queued once, with the flags of every push
+    {
+        LOCK(cs_vNodes);
+        queue.Push(&dummyNode, CMessageHandlerQueue::MESSAGES_TRICKLE);
+        queue.Push(&dummyNode, CMessageHandlerQueue::MESSAGES_ADVERTISE);
+    }
+    BOOST_CHECK_EQUAL(queue.Size(), 1U);
+    BOOST_CHECK_EQUAL(dummyNode.GetRefCount(), 1);
+
+    int nFlags;
+    BOOST_CHECK(queue.Pop(nFlags) == &dummyNode);
+    BOOST_CHECK_EQUAL(nFlags, CMessageHandlerQueue::MESSAGES_TRICKLE | CMessageHandlerQueue::MESSAGES_ADVERTISE);
+    BOOST_CHECK_EQUAL(queue.Serving(), 1U);
+
+    // pushed while served, it waits for the thread serving it
+    {
+        LOCK(cs_vNodes);
+        queue.Push(&dummyNode, CMessageHandlerQueue::MESSAGES_TRICKLE);
+    }
+    BOOST_CHECK_EQUAL(queue.Size(), 0U);
+    queue.Done(&dummyNode, false);
+    BOOST_CHECK_EQUAL(queue.Size(), 1U);
+    BOOST_CHECK_EQUAL(queue.Serving(), 0U);
+
+    BOOST_CHECK(queue.Pop(nFlags) == &dummyNode);
+    BOOST_CHECK_EQUAL(nFlags, CMessageHandlerQueue::MESSAGES_TRICKLE);
+    queue.Done(&dummyNode, true);
+    BOOST_CHECK(queue.Pop(nFlags) == &dummyNode);
+    BOOST_CHECK_EQUAL(nFlags, 0);
+    queue.Done(&dummyNode, false);
+
+    BOOST_CHECK_EQUAL(queue.Size(), 0U);
+    BOOST_CHECK_EQUAL(dummyNode.GetRefCount(), 0);
+}
+
+struct CPeerWork {
+    CNode* pnode;
+    int nLeft;
+    bool fServing;
+    bool fOverlap;
+};
+
+static void ServePeers(CMessageHandlerQueue& queue, std::map<CNode*, CPeerWork>& mapWork, boost::mutex& csWork)
+{
+    try {
+        while (true) {
+            int nFlags;
+            CNode* pnode = queue.Pop(nFlags);
+            {
+                boost::unique_lock<boost::mutex> lock(csWork);
+                CPeerWork& work = mapWork[pnode];
+                work.fOverlap |= work.fServing;
+                work.fServing = true;
+            }
+            MilliSleep(insecure_rand() % 2);
+            bool fMore;
+            {
+                boost::unique_lock<boost::mutex> lock(csWork);
+                CPeerWork& work = mapWork[pnode];
+                work.fServing = false;
+                fMore = --work.nLeft > 0;
+            }
+            queue.Done(pnode, fMore);
+        }
+    } catch (const boost::thread_interrupted&) {
+    }
+}
+
+// Handler threads serving peers pushed over and over never serve a peer on two
+// threads at once, and give each back once it has no more to process.
+BOOST_AUTO_TEST_CASE(msghand_queue_threads)
+{
+    const int nPeers = 16;
+    const int nMessages = 50;
+
+    CMessageHandlerQueue queue;
+    std::vector<CNode*> vPeers;
+    std::map<CNode*, CPeerWork> mapWork;
+    boost::mutex csWork;
+    for (int i = 0; i < nPeers; i++) {
+        CAddress addr(CService(CNetAddr(strprintf("250.1.2.%d", i + 1)), Params().GetDefaultPort()));
+        CNode* pnode = new CNode(INVALID_SOCKET, addr, "", true);
+        vPeers.push_back(pnode);
+        mapWork[pnode] = CPeerWork{pnode, nMessages, false, false};
+    }
+
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 4; i++)
+        threadGroup.create_thread(boost::bind(&ServePeers, boost::ref(queue), boost::ref(mapWork), boost::ref(csWork)));
+
+    for (int n = 0; n < 200; n++) {
+        {
+            LOCK(cs_vNodes);
+            for (CNode* pnode : vPeers)
+                queue.Push(pnode);
+        }
+        MilliSleep(1);
+    }
+    for (int i = 0; i < 2000 && (queue.Size() || queue.Serving()); i++)
+        MilliSleep(5);
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+
+    BOOST_CHECK_EQUAL(queue.Size(), 0U);
+    for (CNode* pnode : vPeers) {
+        BOOST_CHECK(!mapWork[pnode].fOverlap);
+        BOOST_CHECK_EQUAL(pnode->GetRefCount(), 0);
+        delete pnode;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
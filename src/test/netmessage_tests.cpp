@@ -0,0 +1,120 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "net.h"
+#include "netbase.h"
+#include "primitives/transaction.h"
+#include "random.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(netmessage_tests)
+
+static CTransaction MakeTransaction()
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << insecure_rand() << OP_0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = insecure_rand();
+    return CTransaction(tx);
+}
+
+BOOST_AUTO_TEST_CASE(netmessage_framing)
+{
+    CTransaction tx = MakeTransaction();
+    CMessageDataRef data = MakeMessageData("tx", tx);
+    BOOST_REQUIRE_EQUAL(data->size(), CMessageHeader::HEADER_SIZE + ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+
+    CMessageHeader hdr;
+    CDataStream ssHeader(&(*data)[0], &(*data)[0] + CMessageHeader::HEADER_SIZE, SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader >> hdr;
+    BOOST_CHECK(hdr.IsValid());
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), "tx");
+    BOOST_CHECK_EQUAL(hdr.nMessageSize, data->size() - CMessageHeader::HEADER_SIZE);
+    uint256 hash = Hash(data->begin() + CMessageHeader::HEADER_SIZE, data->end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    BOOST_CHECK_EQUAL(hdr.nChecksum, nChecksum);
+
+    // the same bytes as a message built for one peer, and the same buffer for every peer
+    CAddress addr(CService("250.1.2.3", Params().GetDefaultPort()));
+    CNode dummyNode(INVALID_SOCKET, addr, "", true);
+    CNode dummyNode2(INVALID_SOCKET, addr, "", true);
+    dummyNode.PushMessage("tx", tx);
+    dummyNode.PushMessageData(data);
+    dummyNode2.PushMessageData(data);
+    BOOST_REQUIRE_EQUAL(dummyNode.vSendMsg.size(), 2U);
+    BOOST_CHECK(*dummyNode.vSendMsg[0] == *data);
+    BOOST_CHECK(dummyNode.vSendMsg[1] == data);
+    BOOST_CHECK(dummyNode2.vSendMsg[0] == data);
+    BOOST_CHECK_EQUAL(dummyNode.nSendSize, 2 * data->size());
+
+    // framing raw bytes
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    BOOST_CHECK(*MakeMessageData("tx", &ss[0], &ss[0] + ss.size()) == *data);
+    BOOST_CHECK(*MakeMessageData("tx", ss) == *data);
+}
+
+#ifndef WIN32
+
+// Messages queued faster than the socket takes them arrive whole and in order,
+// however many each send call gathers and wherever it stops.
+BOOST_AUTO_TEST_CASE(netmessage_send_gather)
+{
+    int vSockets[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, vSockets) == 0);
+    SOCKET hSocketSend = vSockets[0];
+    SOCKET hSocketRecv = vSockets[1];
+    BOOST_REQUIRE(SetSocketNonBlocking(hSocketSend, true));
+    BOOST_REQUIRE(SetSocketNonBlocking(hSocketRecv, true));
+    int nBufferSize = 4096;
+    setsockopt(hSocketSend, SOL_SOCKET, SO_SNDBUF, &nBufferSize, sizeof(nBufferSize));
+
+    CAddress addr(CService("250.1.2.3", Params().GetDefaultPort()));
+    CNode* pnode = new CNode(hSocketSend, addr, "", true);
+
+    std::vector<char> vExpected;
+    std::vector<char> vPayload;
+    CMessageDataRef dataShared = MakeMessageData("ping", (uint64_t)insecure_rand());
+    for (int i = 0; i < 300; i++) {
+        CMessageDataRef data = dataShared;
+        if (i % 3) {
+            vPayload.resize(insecure_rand() % 3000);
+            for (char& ch : vPayload)
+                ch = insecure_rand();
+            data = MakeMessageData("test", begin_ptr(vPayload), end_ptr(vPayload));
+        }
+        pnode->PushMessageData(data);
+        vExpected.insert(vExpected.end(), data->begin(), data->end());
+    }
+
+    std::vector<char> vReceived;
+    char pchBuf[8192];
+    for (int n = 0; n < 100000 && vReceived.size() < vExpected.size(); n++) {
+        ssize_t nBytes = recv(hSocketRecv, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+        if (nBytes > 0)
+            vReceived.insert(vReceived.end(), pchBuf, pchBuf + nBytes);
+        LOCK(pnode->cs_vSend);
+        SocketSendData(pnode);
+    }
+
+    BOOST_CHECK(vReceived == vExpected);
+    {
+        LOCK(pnode->cs_vSend);
+        BOOST_CHECK(pnode->vSendMsg.empty());
+        BOOST_CHECK_EQUAL(pnode->nSendSize, 0U);
+        BOOST_CHECK_EQUAL(pnode->nSendOffset, 0U);
+        BOOST_CHECK_EQUAL(pnode->nSendBytes, vExpected.size());
+    }
+    BOOST_CHECK(!pnode->fDisconnect);
+    delete pnode;
+    CloseSocket(hSocketRecv);
+}
+
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,96 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "checkpoints.h"
+#include "main.h"
+#include "miner.h"
+#include "rpcserver.h"
+#include "spork.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+using namespace std;
+
+extern UniValue CallRPC(string args);
+
+BOOST_AUTO_TEST_SUITE(replayblocks_tests)
+
+// Mine a block paying OP_TRUE on top of the tip, with vtx after its coinbase
+static CBlock MineBlock(const vector<CMutableTransaction>& vtx)
+{
+    CBlockTemplate* pblocktemplate = CreateNewBlock(CScript() << OP_TRUE, NULL, false);
+    BOOST_REQUIRE(pblocktemplate);
+    CBlock block = pblocktemplate->block;
+    delete pblocktemplate;
+
+    for (const CMutableTransaction& tx : vtx)
+        block.vtx.push_back(CTransaction(tx));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlock(state, NULL, &block));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    return block;
+}
+
+// A replay disconnects and connects blocks of the active chain; the outputs they
+// spend must still be found by the stake check of a fork block restaking one.
+BOOST_AUTO_TEST_CASE(replayblocks_keeps_chain_state)
+{
+    LOCK(cs_main);
+    Checkpoints::fEnabled = false;
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    BOOST_REQUIRE_EQUAL(chainActive.Height(), 0);
+
+    CBlock blockFirst = MineBlock(vector<CMutableTransaction>());
+    while (chainActive.Height() < Params().COINBASE_MATURITY())
+        MineBlock(vector<CMutableTransaction>());
+
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(blockFirst.vtx[0].GetHash(), 0));
+    tx.vout.push_back(CTxOut(blockFirst.vtx[0].vout[0].nValue, CScript() << OP_TRUE));
+    MineBlock(vector<CMutableTransaction>(1, tx));
+    const int nSpendHeight = chainActive.Height();
+    MineBlock(vector<CMutableTransaction>());
+    MineBlock(vector<CMutableTransaction>());
+
+    const COutPoint prevout = tx.vin[0].prevout;
+    BOOST_CHECK(!pcoinsTip->HaveInputs(CTransaction(tx)));
+    BOOST_REQUIRE(mapStakeSpent.count(prevout));
+    BOOST_CHECK_EQUAL(mapStakeSpent[prevout], nSpendHeight);
+
+    map<COutPoint, int> mapStakeSpentBefore(mapStakeSpent);
+    map<CTxDestination, int64_t> mapFilterDestinationBefore(mapFilterDestination);
+    bool txFilterStateBefore = txFilterState;
+    CBlockIndex* pindexSpend = chainActive[nSpendHeight];
+    CAmount nMoneySupplySpend = pindexSpend->nMoneySupply;
+    CAmount nMintSpend = pindexSpend->nMint;
+
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("replayblocks 4"));
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "blocks").get_int(), 4);
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "transactions").get_int(), 5);
+
+    // the stake check of a fork block restaking the replayed input still finds its spend
+    BOOST_CHECK(mapStakeSpent == mapStakeSpentBefore);
+    BOOST_CHECK(mapStakeSpent.find(prevout) != mapStakeSpent.end());
+    BOOST_CHECK(mapFilterDestination == mapFilterDestinationBefore);
+    BOOST_CHECK_EQUAL(txFilterState, txFilterStateBefore);
+    BOOST_CHECK_EQUAL(pindexSpend->nMoneySupply, nMoneySupplySpend);
+    BOOST_CHECK_EQUAL(pindexSpend->nMint, nMintSpend);
+
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, chainActive[1]));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+    BOOST_CHECK(!mapStakeSpent.count(prevout));
+    mempool.clear();
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    Checkpoints::fEnabled = true;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
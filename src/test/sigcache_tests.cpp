@@ -0,0 +1,120 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "random.h"
+#include "script/sigcache.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+static std::vector<unsigned char> RandomSig(int n)
+{
+    std::vector<unsigned char> vchSig(72);
+    GetRandBytes(&vchSig[0], vchSig.size());
+    vchSig[0] = n & 0xff;
+    return vchSig;
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_insert_lookup)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+
+    CSignatureCache cache(1 << 20);
+    std::vector<uint256> vHash;
+    std::vector<std::vector<unsigned char> > vSig;
+    for (int i = 0; i < 1000; i++) {
+        vHash.push_back(GetRandHash());
+        vSig.push_back(RandomSig(i));
+        BOOST_CHECK(!cache.Get(vHash[i], vSig[i], pubkey));
+        cache.Set(vHash[i], vSig[i], pubkey);
+    }
+    for (int i = 0; i < 1000; i++) {
+        BOOST_CHECK(cache.Get(vHash[i], vSig[i], pubkey));
+        // any change to one of the three parts misses
+        BOOST_CHECK(!cache.Get(vHash[(i + 1) % 1000], vSig[i], pubkey));
+        BOOST_CHECK(!cache.Get(vHash[i], vSig[(i + 1) % 1000], pubkey));
+    }
+
+    CSignatureCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nSlots, (uint64_t)(1 << 20) / 32);
+    BOOST_CHECK_EQUAL(stats.nInserts, 1000U);
+    BOOST_CHECK_EQUAL(stats.nHits, 1000U);
+    BOOST_CHECK_EQUAL(stats.nLookups, 4000U);
+
+    // too small for a probe window per shard: disabled
+    CSignatureCache disabled(32 * CSignatureCache::SHARDS * CSignatureCache::PROBE - 1);
+    disabled.Set(vHash[0], vSig[0], pubkey);
+    BOOST_CHECK(!disabled.Get(vHash[0], vSig[0], pubkey));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_eviction)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+
+    // the smallest cache: every shard is a single probe window
+    const int nSlots = CSignatureCache::SHARDS * CSignatureCache::PROBE;
+    CSignatureCache cache(32 * nSlots);
+    std::vector<uint256> vHash;
+    std::vector<unsigned char> vchSig = RandomSig(0);
+    for (int i = 0; i < 10 * nSlots; i++) {
+        vHash.push_back(GetRandHash());
+        cache.Set(vHash[i], vchSig, pubkey);
+    }
+    int nFound = 0;
+    for (int i = 0; i < 10 * nSlots; i++)
+        nFound += cache.Get(vHash[i], vchSig, pubkey);
+    BOOST_CHECK(nFound <= nSlots);
+    BOOST_CHECK(nFound > 0);
+
+    CSignatureCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nInserts, (uint64_t)10 * nSlots);
+    BOOST_CHECK(stats.nEvictions >= (uint64_t)9 * nSlots);
+}
+
+static void LookupThread(CSignatureCache* cache, const std::vector<uint256>* vHash, const std::vector<unsigned char>* vchSig, const CPubKey* pubkey, int* nMissing)
+{
+    for (int nRound = 0; nRound < 20; nRound++)
+        for (unsigned int i = 0; i < vHash->size(); i++)
+            if (!cache->Get((*vHash)[i], *vchSig, *pubkey))
+                (*nMissing)++;
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_concurrent)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    std::vector<unsigned char> vchSig = RandomSig(0);
+
+    // entries inserted before the readers start are never lost while other
+    // inserts run, the cache is large enough for everything
+    CSignatureCache cache(32 << 20);
+    std::vector<uint256> vHash;
+    for (int i = 0; i < 1000; i++) {
+        vHash.push_back(GetRandHash());
+        cache.Set(vHash[i], vchSig, pubkey);
+    }
+
+    int vMissing[4] = {0, 0, 0, 0};
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 4; i++)
+        threadGroup.create_thread(boost::bind(&LookupThread, &cache, &vHash, &vchSig, &pubkey, &vMissing[i]));
+    for (int i = 0; i < 20000; i++)
+        cache.Set(GetRandHash(), vchSig, pubkey);
+    threadGroup.join_all();
+
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK_EQUAL(vMissing[i], 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,151 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netbase.h"
+#include "socketevents.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/resource.h>
+#endif
+
+BOOST_AUTO_TEST_SUITE(socketevents_tests)
+
+#ifndef WIN32
+
+static bool MakeSocketPair(SOCKET& hSocketA, SOCKET& hSocketB)
+{
+    int vSockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, vSockets) != 0)
+        return false;
+    hSocketA = vSockets[0];
+    hSocketB = vSockets[1];
+    return SetSocketNonBlocking(hSocketA, true) && SetSocketNonBlocking(hSocketB, true);
+}
+
+static const CSocketEvents::CEvent* FindEvent(const std::vector<CSocketEvents::CEvent>& vEvents, SOCKET hSocket)
+{
+    for (const CSocketEvents::CEvent& event : vEvents) {
+        if (event.hSocket == hSocket)
+            return &event;
+    }
+    return NULL;
+}
+
+static bool HasEvent(const std::vector<CSocketEvents::CEvent>& vEvents, SOCKET hSocket, int nEvents)
+{
+    const CSocketEvents::CEvent* pevent = FindEvent(vEvents, hSocket);
+    return pevent && (pevent->nEvents & nEvents);
+}
+
+static void Drain(SOCKET hSocket)
+{
+    char pchBuf[256];
+    while (recv(hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT) > 0) {
+    }
+}
+
+// Every backend reports a socket becoming readable once, as long as the caller
+// reads until it would block. Edge-triggered backends also report a socket
+// becoming writable again after its peer read, which the caller ignores.
+BOOST_AUTO_TEST_CASE(socketevents_ready)
+{
+    CSocketEvents events;
+    SOCKET hSocketA, hSocketB;
+    BOOST_REQUIRE(MakeSocketPair(hSocketA, hSocketB));
+    int nDataA = 1, nDataB = 2;
+    BOOST_REQUIRE(events.Add(hSocketA, &nDataA));
+    BOOST_REQUIRE(events.Add(hSocketB, &nDataB));
+    BOOST_CHECK_EQUAL(events.Count(), 2U);
+
+    // both start out writable
+    std::vector<CSocketEvents::CEvent> vEvents;
+    bool fWoken;
+    BOOST_REQUIRE(events.Wait(vEvents, fWoken, 1000));
+    BOOST_CHECK(!fWoken);
+    const CSocketEvents::CEvent* pevent = FindEvent(vEvents, hSocketB);
+    BOOST_REQUIRE(pevent);
+    BOOST_CHECK(pevent->pdata == &nDataB);
+    BOOST_CHECK(pevent->nEvents & CSocketEvents::EVENT_SEND);
+    events.SetInterest(hSocketA, true, false);
+    events.SetInterest(hSocketB, true, false);
+
+    // data sent on one end makes the other readable, once
+    BOOST_REQUIRE_EQUAL(send(hSocketA, "ping", 4, MSG_NOSIGNAL), 4);
+    BOOST_REQUIRE(events.Wait(vEvents, fWoken, 1000));
+    BOOST_CHECK(HasEvent(vEvents, hSocketB, CSocketEvents::EVENT_RECV));
+    BOOST_CHECK(!HasEvent(vEvents, hSocketA, CSocketEvents::EVENT_RECV));
+    Drain(hSocketB);
+    BOOST_REQUIRE(events.Wait(vEvents, fWoken, 0));
+    BOOST_CHECK(!HasEvent(vEvents, hSocketA, CSocketEvents::EVENT_RECV));
+    BOOST_CHECK(!HasEvent(vEvents, hSocketB, CSocketEvents::EVENT_RECV));
+
+    // another thread ends the wait
+    int64_t nStart = GetTimeMillis();
+    boost::thread threadWakeup([&events]() {
+        MilliSleep(50);
+        events.Wakeup();
+    });
+    BOOST_REQUIRE(events.Wait(vEvents, fWoken, 10000));
+    threadWakeup.join();
+    BOOST_CHECK(fWoken);
+    BOOST_CHECK(GetTimeMillis() - nStart < 5000);
+    BOOST_REQUIRE(events.Wait(vEvents, fWoken, 0));
+    BOOST_CHECK(!fWoken);
+
+    // a closed peer reads as an event to receive
+    events.Remove(hSocketA);
+    CloseSocket(hSocketA);
+    BOOST_CHECK_EQUAL(events.Count(), 1U);
+    BOOST_REQUIRE(events.Wait(vEvents, fWoken, 1000));
+    BOOST_CHECK(HasEvent(vEvents, hSocketB, CSocketEvents::EVENT_RECV | CSocketEvents::EVENT_ERROR));
+
+    // and a removed socket is not reported at all
+    events.Remove(hSocketB);
+    BOOST_REQUIRE(events.Wait(vEvents, fWoken, 0));
+    BOOST_CHECK(vEvents.empty());
+    CloseSocket(hSocketB);
+    BOOST_CHECK_EQUAL(events.Count(), 0U);
+}
+
+// Sockets numbered past FD_SETSIZE are served like any other where select() is not used
+BOOST_AUTO_TEST_CASE(socketevents_fd_setsize)
+{
+#ifdef USE_POLL
+    struct rlimit limitFD;
+    if (getrlimit(RLIMIT_NOFILE, &limitFD) != 0 || limitFD.rlim_cur < FD_SETSIZE + 16) {
+        BOOST_TEST_MESSAGE("descriptor limit too low to test past FD_SETSIZE");
+        return;
+    }
+
+    SOCKET hSocketA, hSocketB;
+    BOOST_REQUIRE(MakeSocketPair(hSocketA, hSocketB));
+    SOCKET hSocketHigh = fcntl(hSocketB, F_DUPFD, FD_SETSIZE + 8);
+    BOOST_REQUIRE(hSocketHigh != INVALID_SOCKET && hSocketHigh >= FD_SETSIZE);
+    CloseSocket(hSocketB);
+    BOOST_CHECK(IsSelectableSocket(hSocketHigh));
+
+    CSocketEvents events;
+    BOOST_REQUIRE(events.Add(hSocketHigh, NULL));
+    events.SetInterest(hSocketHigh, true, false);
+    BOOST_REQUIRE_EQUAL(send(hSocketA, "ping", 4, MSG_NOSIGNAL), 4);
+
+    std::vector<CSocketEvents::CEvent> vEvents;
+    bool fWoken;
+    BOOST_REQUIRE(events.Wait(vEvents, fWoken, 1000));
+    BOOST_CHECK(HasEvent(vEvents, hSocketHigh, CSocketEvents::EVENT_RECV));
+
+    events.Remove(hSocketHigh);
+    CloseSocket(hSocketHigh);
+    CloseSocket(hSocketA);
+#endif
+}
+
+#endif // WIN32
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,144 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test/test_fdreserve.h"
+
+#include "main.h"
+#include "random.h"
+#include "timedata.h"
+#include "txmempool.h"
+#include "wallet.h"
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+typedef set<pair<const CWalletTx*, unsigned int> > CoinSet;
+
+BOOST_AUTO_TEST_SUITE(stakeindex_tests)
+
+static const int nTransactions = 1000;
+static const int nBlocks = 100;
+
+// Transaction i is in block 1 + i % nBlocks, every 10th one is too young to stake
+// and every 50th spends the one ten before it.
+static bool IsSpender(int i)
+{
+    return i % 50 == 49;
+}
+
+// The outputs of vHashes the wallet can stake with the tip at nHeight
+static CoinSet ExpectedStakeSet(CWallet& wallet, const vector<uint256>& vHashes, int nHeight)
+{
+    CoinSet setCoins;
+    for (int i = 0; i < nTransactions; i++) {
+        bool fSpent = i + 10 < nTransactions && IsSpender(i + 10) && 1 + (i + 10) % nBlocks <= nHeight;
+        if (i % 10 == 0 || fSpent || 1 + i % nBlocks > nHeight - 9)
+            continue;
+        setCoins.insert(make_pair(&wallet.mapWallet[vHashes[i]], 0U));
+    }
+    return setCoins;
+}
+
+static CoinSet SelectStakeCoins(CWallet& wallet)
+{
+    CoinSet setCoins;
+    BOOST_CHECK(wallet.SelectStakeCoins(setCoins, numeric_limits<CAmount>::max() / 2));
+    return setCoins;
+}
+
+static CWalletTx MakeSpend(CWallet& wallet, const uint256& hash, const CScript& scriptPubKey)
+{
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(hash, 0));
+    tx.vout.push_back(CTxOut(wallet.mapWallet[hash].vout[0].nValue, scriptPubKey));
+    return CWalletTx(&wallet, tx);
+}
+
+BOOST_AUTO_TEST_CASE(stakeindex_select)
+{
+    bool fFirstRun;
+    CWallet wallet("stakeindex_test.dat");
+    wallet.LoadWallet(fFirstRun);
+    LOCK2(cs_main, wallet.cs_wallet);
+    TestChainSetup chain(nBlocks);
+
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    vector<uint256> vHashes;
+    for (int i = 0; i < nTransactions; i++) {
+        CMutableTransaction tx;
+        if (IsSpender(i))
+            tx.vin.push_back(CTxIn(vHashes[i - 10], 0));
+        else
+            tx.vin.push_back(CTxIn(GetRandHash(), 0));
+        tx.vout.push_back(CTxOut(Params().StakeInputMin() + i, scriptPubKey));
+
+        CWalletTx wtx(&wallet, tx);
+        wtx.hashBlock = chain.vBlocks[1 + i % nBlocks]->GetBlockHash();
+        wtx.nIndex = 0;
+        wtx.fMerkleVerified = true;
+        wtx.nTimeReceived = GetAdjustedTime() - (i % 10 ? 2 * nStakeMinAge : 0);
+        wtx.nTimeSmart = wtx.nTimeReceived;
+        wallet.AddToWallet(wtx, true);
+        vHashes.push_back(wtx.GetHash());
+    }
+
+    wallet.BuildStakeIndex();
+    CoinSet setCoins = SelectStakeCoins(wallet);
+    BOOST_CHECK_EQUAL(setCoins.size(), 790U);
+    BOOST_CHECK(setCoins == ExpectedStakeSet(wallet, vHashes, nBlocks));
+    BOOST_CHECK(wallet.MintableCoins());
+
+    // spending a candidate in a block takes it out of the index
+    const CWalletTx* pcoin = &wallet.mapWallet[vHashes[1]];
+    BOOST_REQUIRE(setCoins.count(make_pair(pcoin, 0U)));
+    unsigned int nVersion = wallet.nStakeIndexVersion;
+    CWalletTx wtxSpend = MakeSpend(wallet, vHashes[1], scriptPubKey);
+    wtxSpend.hashBlock = chain.vBlocks[nBlocks]->GetBlockHash();
+    wtxSpend.nIndex = 0;
+    wtxSpend.fMerkleVerified = true;
+    BOOST_CHECK(wallet.AddToWallet(wtxSpend));
+    BOOST_CHECK(wallet.nStakeIndexVersion != nVersion);
+    setCoins = SelectStakeCoins(wallet);
+    BOOST_CHECK_EQUAL(setCoins.size(), 789U);
+    BOOST_CHECK(!setCoins.count(make_pair(pcoin, 0U)));
+
+    // disconnecting blocks takes their outputs out again, as SyncTransaction runs for each of
+    // their transactions, and gives back what their spends held
+    chainActive.SetTip(chain.vBlocks[nBlocks - 20]);
+    for (int i = 0; i < nTransactions; i++) {
+        if (1 + i % nBlocks > nBlocks - 20)
+            wallet.SyncTransaction(wallet.mapWallet[vHashes[i]], NULL);
+    }
+    wallet.SyncTransaction(wtxSpend, NULL);
+    setCoins = SelectStakeCoins(wallet);
+    BOOST_CHECK_EQUAL(setCoins.size(), 620U);
+    BOOST_CHECK(setCoins == ExpectedStakeSet(wallet, vHashes, nBlocks - 20));
+
+    // a spend waiting in the mempool holds the output until it is conflicted out of it
+    CWalletTx wtxPending = MakeSpend(wallet, vHashes[2], scriptPubKey);
+    BOOST_CHECK(mempool.addUnchecked(wtxPending.GetHash(), CTxMemPoolEntry(wtxPending, 0, GetTime(), 0.0, 1)));
+    wallet.SyncTransaction(wtxPending, NULL);
+    setCoins = SelectStakeCoins(wallet);
+    BOOST_CHECK(!setCoins.count(make_pair(&wallet.mapWallet[vHashes[2]], 0U)));
+    list<CTransaction> removed;
+    mempool.remove(wtxPending, removed);
+    wallet.SyncTransaction(wtxPending, NULL);
+    BOOST_CHECK(SelectStakeCoins(wallet) == ExpectedStakeSet(wallet, vHashes, nBlocks - 20));
+
+    // and a spend erased from the wallet gives it back as well
+    CWalletTx wtxErased = MakeSpend(wallet, vHashes[3], scriptPubKey);
+    BOOST_CHECK(mempool.addUnchecked(wtxErased.GetHash(), CTxMemPoolEntry(wtxErased, 0, GetTime(), 0.0, 1)));
+    wallet.SyncTransaction(wtxErased, NULL);
+    BOOST_CHECK(!SelectStakeCoins(wallet).count(make_pair(&wallet.mapWallet[vHashes[3]], 0U)));
+    wallet.EraseFromWallet(wtxErased.GetHash());
+    BOOST_CHECK(SelectStakeCoins(wallet) == ExpectedStakeSet(wallet, vHashes, nBlocks - 20));
+    mempool.remove(wtxErased, removed);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,66 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stats.h"
+
+#include <cmath>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(stats_tests)
+
+BOOST_AUTO_TEST_CASE(latency_histogram)
+{
+    CLatencyHistogram histogram;
+    histogram.Add(-5);            // clamped to 0
+    histogram.Add(999);           // <1ms
+    histogram.Add(1000);          // [1,2)ms
+    histogram.Add(3999);          // [2,4)ms
+    histogram.Add(4000);          // [4,8)ms
+    histogram.Add(3600 * 1000000LL); // open-ended last bucket
+
+    std::vector<uint64_t> vBucket;
+    uint64_t nCount;
+    int64_t nSumMicros, nMaxMicros;
+    histogram.Get(vBucket, nCount, nSumMicros, nMaxMicros);
+
+    BOOST_CHECK_EQUAL(vBucket.size(), (unsigned int)CLatencyHistogram::BUCKETS);
+    BOOST_CHECK_EQUAL(vBucket[0], 2U);
+    BOOST_CHECK_EQUAL(vBucket[1], 1U);
+    BOOST_CHECK_EQUAL(vBucket[2], 1U);
+    BOOST_CHECK_EQUAL(vBucket[3], 1U);
+    BOOST_CHECK_EQUAL(vBucket[CLatencyHistogram::BUCKETS - 1], 1U);
+    BOOST_CHECK_EQUAL(nCount, 6U);
+    BOOST_CHECK_EQUAL(nSumMicros, 999 + 1000 + 3999 + 4000 + 3600 * 1000000LL);
+    BOOST_CHECK_EQUAL(nMaxMicros, 3600 * 1000000LL);
+
+    BOOST_CHECK_EQUAL(CLatencyHistogram::BucketLimit(0), 1);
+    BOOST_CHECK_EQUAL(CLatencyHistogram::BucketLimit(3), 8);
+    BOOST_CHECK_EQUAL(CLatencyHistogram::BucketLimit(CLatencyHistogram::BUCKETS - 1), 0);
+}
+
+BOOST_AUTO_TEST_CASE(rate_meter)
+{
+    CRateMeter meter(10);
+    int64_t nNow = 1000 * 1000000LL;
+    BOOST_CHECK_EQUAL(meter.Get(nNow), 0);
+
+    // a steady 5 events per second settles at 5
+    for (int i = 0; i < 500; i++) {
+        nNow += 200000;
+        meter.Add(nNow);
+    }
+    BOOST_CHECK(meter.Get(nNow) > 4.9 && meter.Get(nNow) < 5.1);
+
+    // and decays by a factor e per window once the events stop
+    double dRate = meter.Get(nNow);
+    BOOST_CHECK_CLOSE(meter.Get(nNow + 10 * 1000000LL), dRate / exp(1.0), 0.01);
+    BOOST_CHECK(meter.Get(nNow + 600 * 1000000LL) < 0.001);
+
+    // reading does not move the meter, and samples from the past do not decay it
+    meter.Add(nNow - 1000000, 10);
+    BOOST_CHECK_CLOSE(meter.Get(nNow), dRate + 1, 0.01);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,8 @@
 
 #define BOOST_TEST_MODULE fdreserve Test Suite
 
+#include "test/test_fdreserve.h"
+
 #include "main.h"
 #include "random.h"
 #include "txdb.h"
@@ -77,6 +79,30 @@ struct TestingSetup {
 
 BOOST_GLOBAL_FIXTURE(TestingSetup);
 
+TestChainSetup::TestChainSetup(int nBlocks)
+{
+    CBlockIndex* pindexGenesis = chainActive.Tip();
+    vBlocks.push_back(pindexGenesis);
+    for (int i = 1; i <= nBlocks; i++) {
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->pprev = vBlocks.back();
+        pindex->nHeight = i;
+        pindex->nTime = pindexGenesis->nTime + i * 60;
+        pindex->phashBlock = &mapBlockIndex.insert(std::make_pair(GetRandHash(), pindex)).first->first;
+        vBlocks.push_back(pindex);
+    }
+    chainActive.SetTip(vBlocks.back());
+}
+
+TestChainSetup::~TestChainSetup()
+{
+    chainActive.SetTip(vBlocks[0]);
+    for (size_t i = 1; i < vBlocks.size(); i++) {
+        mapBlockIndex.erase(vBlocks[i]->GetBlockHash());
+        delete vBlocks[i];
+    }
+}
+
 void Shutdown(void* parg)
 {
   exit(0);
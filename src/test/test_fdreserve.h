@@ -0,0 +1,24 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TEST_TEST_FDRESERVE_H
+#define BITCOIN_TEST_TEST_FDRESERVE_H
+
+#include <vector>
+
+class CBlockIndex;
+
+/**
+ * A chain of nBlocks blocks a minute apart on top of the genesis block, made the
+ * active chain for as long as the object lives. vBlocks[0] is the genesis block.
+ * Requires cs_main.
+ */
+struct TestChainSetup {
+    std::vector<CBlockIndex*> vBlocks;
+
+    TestChainSetup(int nBlocks);
+    ~TestChainSetup();
+};
+
+#endif // BITCOIN_TEST_TEST_FDRESERVE_H
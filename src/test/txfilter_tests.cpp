@@ -0,0 +1,132 @@
+// Copyright (c) 2018-2019 The fdreserve Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "base58.h"
+#include "coins.h"
+#include "key.h"
+#include "main.h"
+#include "random.h"
+#include "script/standard.h"
+#include "spork.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(txfilter_tests)
+
+static const int64_t FILTER_TIME = 1545731364;
+
+static CKeyID RandomKeyID()
+{
+    uint256 hash = GetRandHash();
+    return CKeyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20)));
+}
+
+// Spend every output of vParent in a single transaction
+static CMutableTransaction SpendAll(const std::vector<CTransaction>& vParent)
+{
+    CMutableTransaction tx;
+    for (const CTransaction& parent : vParent)
+        for (unsigned int n = 0; n < parent.vout.size(); n++)
+            tx.vin.push_back(CTxIn(COutPoint(parent.GetHash(), n)));
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+    tx.vout[0].scriptPubKey = GetScriptForDestination(RandomKeyID());
+    return tx;
+}
+
+static CTransaction MakeParent(const CScript& scriptPubKey)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = COIN;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(txfilter_match)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CScript redeem = GetScriptForDestination(RandomKeyID());
+
+    mapFilterAddress.clear();
+    mapFilterDestination.clear();
+    BOOST_CHECK(AddTxFilterAddress(CBitcoinAddress(pubkey.GetID()), FILTER_TIME));
+    BOOST_CHECK(AddTxFilterAddress(CBitcoinAddress(CScriptID(redeem)), FILTER_TIME));
+    BOOST_CHECK(!AddTxFilterAddress(CBitcoinAddress(pubkey.GetID()), FILTER_TIME));
+
+    std::vector<CScript> vFiltered;
+    vFiltered.push_back(GetScriptForDestination(pubkey.GetID()));
+    vFiltered.push_back(GetScriptForDestination(CScriptID(redeem)));
+    vFiltered.push_back(CScript() << ToByteVector(pubkey) << OP_CHECKSIG);
+    vFiltered.push_back(GetScriptForMultisig(1, std::vector<CPubKey>(1, pubkey)));
+
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    for (const CScript& script : vFiltered) {
+        CTransaction parent = MakeParent(script);
+        view.ModifyCoins(parent.GetHash())->FromTx(parent, 1);
+        CTransaction tx = SpendAll(std::vector<CTransaction>(1, parent));
+
+        BOOST_CHECK(!CheckTxFilter(tx, view, 0));
+        BOOST_CHECK(!CheckTxFilter(tx, view, GetAdjustedTime()));
+        // blocks older than one day and spends from before the lock time are not filtered
+        BOOST_CHECK(CheckTxFilter(tx, view, GetAdjustedTime() - 2 * 24 * 60 * 60));
+        CTxDestination dest;
+        BOOST_CHECK(!IsTxFilterScript(script, FILTER_TIME, dest));
+        BOOST_CHECK(IsTxFilterScript(script, FILTER_TIME + 1, dest));
+    }
+
+    // unfiltered and unknown inputs pass
+    CTransaction parent = MakeParent(GetScriptForDestination(RandomKeyID()));
+    view.ModifyCoins(parent.GetHash())->FromTx(parent, 1);
+    std::vector<CTransaction> vParent(1, parent);
+    vParent.push_back(MakeParent(vFiltered[0]));
+    BOOST_CHECK(CheckTxFilter(SpendAll(vParent), view, 0));
+
+    InitTxFilter();
+}
+
+// A transaction of many inputs is filtered on any one of them, each looked up
+// in the coins view it is checked against and nowhere else.
+BOOST_AUTO_TEST_CASE(txfilter_inputs)
+{
+    const int nInputs = 200;
+    CKeyID keyFiltered = RandomKeyID();
+    mapFilterAddress.clear();
+    mapFilterDestination.clear();
+    BOOST_CHECK(AddTxFilterAddress(CBitcoinAddress(keyFiltered), FILTER_TIME));
+
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    std::vector<CTransaction> vParent;
+    for (int i = 0; i < nInputs; i++) {
+        CTransaction parent = MakeParent(GetScriptForDestination(RandomKeyID()));
+        view.ModifyCoins(parent.GetHash())->FromTx(parent, 1);
+        vParent.push_back(parent);
+    }
+    CTransaction tx = SpendAll(vParent);
+    BOOST_CHECK_EQUAL(tx.vin.size(), (unsigned int)nInputs);
+    BOOST_CHECK(CheckTxFilter(tx, view, 0));
+
+    // the filtered input last
+    CTransaction parentFiltered = MakeParent(GetScriptForDestination(keyFiltered));
+    vParent.push_back(parentFiltered);
+    BOOST_CHECK(CheckTxFilter(SpendAll(vParent), view, 0));
+    view.ModifyCoins(parentFiltered.GetHash())->FromTx(parentFiltered, 1);
+    BOOST_CHECK(!CheckTxFilter(SpendAll(vParent), view, 0));
+
+    // and first
+    std::reverse(vParent.begin(), vParent.end());
+    BOOST_CHECK(!CheckTxFilter(SpendAll(vParent), view, 0));
+
+    InitTxFilter();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -13,10 +13,23 @@
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 
+CLatencyHistogram histCoinsWrite;
+CBlockIndexLoadStats blockIndexLoadStats;
+
+static CCriticalSection cs_coinsWriteStats;
+static CCoinsWriteStats coinsWriteStats;
+
+void GetCoinsWriteStats(CCoinsWriteStats& stats)
+{
+    LOCK(cs_coinsWriteStats);
+    stats = coinsWriteStats;
+}
+
 void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
 {
     if (coins.IsPruned())
@@ -30,47 +43,195 @@ void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe),
+                                                                             fPending(false), fWriteFailed(false), fStopWriter(false)
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csWrite);
+        fStopWriter = true;
+    }
+    condWrite.notify_all();
+    if (threadWriter.joinable())
+        threadWriter.join();
+}
+
+void CCoinsViewDB::StartWriter()
+{
+    assert(!threadWriter.joinable());
+    threadWriter = boost::thread(boost::bind(&CCoinsViewDB::ThreadWriter, this));
+}
+
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
+    {
+        boost::unique_lock<boost::mutex> lock(csWrite);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(txid);
+            if (it != mapPending.end()) {
+                // pruned entries are about to be erased from the database
+                if (it->second.coins.IsPruned())
+                    return false;
+                coins = it->second.coins;
+                return true;
+            }
+        }
+    }
     return db.Read(make_pair('c', txid), coins);
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256& txid) const
 {
+    {
+        boost::unique_lock<boost::mutex> lock(csWrite);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(txid);
+            if (it != mapPending.end())
+                return !it->second.coins.IsPruned();
+        }
+    }
     return db.Exists(make_pair('c', txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
 {
+    {
+        boost::unique_lock<boost::mutex> lock(csWrite);
+        if (fPending && hashPending != uint256(0))
+            return hashPending;
+    }
     uint256 hashBestChain;
     if (!db.Read('B', hashBestChain))
         return uint256(0);
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+bool CCoinsViewDB::WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock)
 {
+    int64_t nStart = GetTimeMicros();
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             BatchWriteCoins(batch, it->first, it->second.coins);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
+    // the best block goes into the same batch, so the database never mixes the coins of two blocks
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    bool ret = db.WriteBatch(batch);
+
+    int64_t nTime = GetTimeMicros() - nStart;
+    histCoinsWrite.Add(nTime);
+    {
+        LOCK(cs_coinsWriteStats);
+        coinsWriteStats.nWrites++;
+        coinsWriteStats.nEntries += changed;
+        coinsWriteStats.nBytes += batch.SizeEstimate();
+        coinsWriteStats.nLastMicros = nTime;
+        coinsWriteStats.nLastEntries = changed;
+        coinsWriteStats.nLastBytes = batch.SizeEstimate();
+    }
+    LogPrint("coindb", "Committed %u transactions (%u bytes) to coin database in %.2fms\n", (unsigned int)changed, (unsigned int)batch.SizeEstimate(), 0.001 * nTime);
+    return ret;
+}
+
+void CCoinsViewDB::WaitForWriter(boost::unique_lock<boost::mutex>& lock) const
+{
+    while (fPending && !fWriteFailed)
+        condWrite.wait(lock);
+}
+
+void CCoinsViewDB::ThreadWriter()
+{
+    RenameThread("fdreserve-coinsdb");
+    boost::unique_lock<boost::mutex> lock(csWrite);
+    while (true) {
+        while (!fPending && !fStopWriter)
+            condWrite.wait(lock);
+        // a pending batch is always committed before the thread exits
+        if (!fPending)
+            return;
+
+        // nothing touches mapPending while fPending is set, so it can be read unlocked
+        lock.unlock();
+        bool fOk = false;
+        try {
+            fOk = WriteCoins(mapPending, hashPending);
+        } catch (const std::exception& e) {
+            LogPrintf("%s : %s\n", __func__, e.what());
+        }
+        lock.lock();
+
+        {
+            LOCK(cs_coinsWriteStats);
+            coinsWriteStats.fInProgress = false;
+        }
+        if (!fOk) {
+            // keep serving the pending entries; the next BatchWrite or Sync reports the failure
+            LogPrintf("ERROR: %s : failed to write to coin database\n", __func__);
+            fWriteFailed = true;
+            condWrite.notify_all();
+            return;
+        }
+        mapPending.clear();
+        fPending = false;
+        condWrite.notify_all();
+    }
+}
+
+bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    if (!threadWriter.joinable()) {
+        bool ret = WriteCoins(mapCoins, hashBlock);
+        mapCoins.clear();
+        return ret;
+    }
+
+    boost::unique_lock<boost::mutex> lock(csWrite);
+    int64_t nStart = GetTimeMicros();
+    WaitForWriter(lock);
+    int64_t nWait = GetTimeMicros() - nStart;
+    if (fWriteFailed)
+        return false;
+
+    size_t count = 0;
+    size_t changed = 0;
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            CCoinsCacheEntry& entry = mapPending[it->first];
+            entry.coins.swap(it->second.coins);
+            entry.flags = CCoinsCacheEntry::DIRTY;
+            changed++;
+        }
+        count++;
+    }
+    mapCoins.clear();
+    hashPending = hashBlock;
+    fPending = true;
+    {
+        LOCK(cs_coinsWriteStats);
+        coinsWriteStats.nWaitMicros += nWait;
+        coinsWriteStats.fInProgress = true;
+    }
+    LogPrint("coindb", "Handing %u changed transactions (out of %u) to the coin database writer, waited %.2fms\n", (unsigned int)changed, (unsigned int)count, 0.001 * nWait);
+    condWrite.notify_all();
+    return true;
+}
+
+bool CCoinsViewDB::Sync()
+{
+    boost::unique_lock<boost::mutex> lock(csWrite);
+    WaitForWriter(lock);
+    return !fWriteFailed;
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
@@ -121,6 +282,13 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
+    {
+        // walk the database only once it holds the best block
+        boost::unique_lock<boost::mutex> lock(csWrite);
+        WaitForWriter(lock);
+        if (fWriteFailed)
+            return false;
+    }
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
     pcursor->SeekToFirst();
 
@@ -207,6 +375,51 @@ bool CBlockTreeDB::ReadInt(const std::string& name, int& nValue)
     return Read(std::make_pair('I', name), nValue);
 }
 
+//! Block index records read from the database in one go before they are decoded
+static const size_t BLOCK_INDEX_LOAD_BATCH = 65536;
+//! Upper bound on the threads decoding block index records
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
+
+struct CBlockIndexRecord {
+    std::string strValue;
+    CDiskBlockIndex diskindex;
+    uint256 hash;
+};
+
+/** Deserialize and hash the records in [nBegin, nEnd); the first failure is reported in strError */
+static void DecodeBlockIndexRecords(std::vector<CBlockIndexRecord>& vRecords, size_t nBegin, size_t nEnd, std::string& strError)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        CBlockIndexRecord& record = vRecords[i];
+        try {
+            CDataStream ssValue(record.strValue.data(), record.strValue.data() + record.strValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> record.diskindex;
+        } catch (std::exception& e) {
+            strError = strprintf("%s : Deserialize or I/O error - %s", __func__, e.what());
+            return;
+        }
+        std::string().swap(record.strValue);
+        record.hash = record.diskindex.GetBlockHash();
+        if (record.diskindex.nHeight <= Params().LAST_POW_BLOCK() && !CheckProofOfWork(record.hash, record.diskindex.nBits)) {
+            strError = strprintf("LoadBlockIndex() : CheckProofOfWork failed: %s", record.diskindex.ToString());
+            return;
+        }
+    }
+}
+
+/** Point *ppindex at the entry for hash, or remember to do so once every entry is in mapBlockIndex */
+static void LinkBlockIndex(CBlockIndex** ppindex, const uint256& hash, std::vector<std::pair<CBlockIndex**, uint256> >& vUnresolved)
+{
+    *ppindex = NULL;
+    if (hash == 0)
+        return;
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
+    if (mi != mapBlockIndex.end())
+        *ppindex = mi->second;
+    else
+        vUnresolved.push_back(std::make_pair(ppindex, hash));
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
@@ -215,61 +428,104 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
     ssKeySet << make_pair('b', uint256(0));
     pcursor->Seek(ssKeySet.str());
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    blockIndexLoadStats.nThreads = nThreads;
+
+    // Records are read from the cursor in batches. Each batch is decoded and
+    // hashed by nThreads threads, then its entries are placed in one arena and
+    // added to mapBlockIndex. Links to blocks that are not loaded yet are
+    // resolved after the last batch.
+    std::vector<CBlockIndexRecord> vRecords;
+    std::vector<std::pair<CBlockIndex**, uint256> > vUnresolved;
+    bool fDone = false;
+    while (!fDone) {
         boost::this_thread::interruption_point();
+
+        int64_t nStart = GetTimeMicros();
+        vRecords.clear();
+        vRecords.reserve(BLOCK_INDEX_LOAD_BATCH);
         try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'b') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
-                pindexNew->nHeight = diskindex.nHeight;
-                pindexNew->nFile = diskindex.nFile;
-                pindexNew->nDataPos = diskindex.nDataPos;
-                pindexNew->nUndoPos = diskindex.nUndoPos;
-                pindexNew->nVersion = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime = diskindex.nTime;
-                pindexNew->nBits = diskindex.nBits;
-                pindexNew->nNonce = diskindex.nNonce;
-                pindexNew->nStatus = diskindex.nStatus;
-                pindexNew->nTx = diskindex.nTx;
-
-                //Proof Of Stake
-                pindexNew->nMint = diskindex.nMint;
-                pindexNew->nMoneySupply = diskindex.nMoneySupply;
-                pindexNew->nFlags = diskindex.nFlags;
-                pindexNew->nStakeModifier = diskindex.nStakeModifier;
-                pindexNew->prevoutStake = diskindex.prevoutStake;
-                pindexNew->nStakeTime = diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-
-                if (pindexNew->nHeight <= Params().LAST_POW_BLOCK()) {
-                    if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
+            while (vRecords.size() < BLOCK_INDEX_LOAD_BATCH) {
+                if (!pcursor->Valid()) {
+                    fDone = true;
+                    break;
                 }
-                // ppcoin: build setStakeSeen
-                if (pindexNew->IsProofOfStake())
-                    setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-
+                leveldb::Slice slKey = pcursor->key();
+                if (slKey.size() == 0 || slKey[0] != 'b') {
+                    fDone = true; // finished loading block index
+                    break;
+                }
+                leveldb::Slice slValue = pcursor->value();
+                vRecords.push_back(CBlockIndexRecord());
+                vRecords.back().strValue.assign(slValue.data(), slValue.size());
                 pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
             }
         } catch (std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
+        int64_t nRead = GetTimeMicros();
+        blockIndexLoadStats.nReadMicros += nRead - nStart;
+        if (vRecords.empty())
+            break;
+
+        size_t nShards = std::min((size_t)nThreads, (vRecords.size() + 1023) / 1024);
+        std::vector<std::string> vErrors(nShards);
+        boost::thread_group threadGroup;
+        for (size_t i = 1; i < nShards; i++)
+            threadGroup.create_thread(boost::bind(&DecodeBlockIndexRecords, boost::ref(vRecords),
+                i * vRecords.size() / nShards, (i + 1) * vRecords.size() / nShards, boost::ref(vErrors[i])));
+        DecodeBlockIndexRecords(vRecords, 0, vRecords.size() / nShards, vErrors[0]);
+        threadGroup.join_all();
+        for (const std::string& strError : vErrors) {
+            if (!strError.empty())
+                return error("%s", strError);
+        }
+        int64_t nDecoded = GetTimeMicros();
+        blockIndexLoadStats.nDecodeMicros += nDecoded - nRead;
+
+        // Construct block index objects
+        CBlockIndex* pindexArena = AllocateBlockIndexArena(vRecords.size());
+        mapBlockIndex.reserve(mapBlockIndex.size() + vRecords.size());
+        for (size_t i = 0; i < vRecords.size(); i++) {
+            const CDiskBlockIndex& diskindex = vRecords[i].diskindex;
+            std::pair<BlockMap::iterator, bool> ret = mapBlockIndex.insert(make_pair(vRecords[i].hash, &pindexArena[i]));
+            CBlockIndex* pindexNew = ret.first->second;
+            pindexNew->phashBlock = &ret.first->first;
+            LinkBlockIndex(&pindexNew->pprev, diskindex.hashPrev, vUnresolved);
+            LinkBlockIndex(&pindexNew->pnext, diskindex.hashNext, vUnresolved);
+            pindexNew->nHeight = diskindex.nHeight;
+            pindexNew->nFile = diskindex.nFile;
+            pindexNew->nDataPos = diskindex.nDataPos;
+            pindexNew->nUndoPos = diskindex.nUndoPos;
+            pindexNew->nVersion = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime = diskindex.nTime;
+            pindexNew->nBits = diskindex.nBits;
+            pindexNew->nNonce = diskindex.nNonce;
+            pindexNew->nStatus = diskindex.nStatus;
+            pindexNew->nTx = diskindex.nTx;
+
+            //Proof Of Stake
+            pindexNew->nMint = diskindex.nMint;
+            pindexNew->nMoneySupply = diskindex.nMoneySupply;
+            pindexNew->nFlags = diskindex.nFlags;
+            pindexNew->nStakeModifier = diskindex.nStakeModifier;
+            pindexNew->prevoutStake = diskindex.prevoutStake;
+            pindexNew->nStakeTime = diskindex.nStakeTime;
+            pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
+
+            // ppcoin: build setStakeSeen
+            if (pindexNew->IsProofOfStake())
+                setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+        }
+        blockIndexLoadStats.nEntries += vRecords.size();
+        blockIndexLoadStats.nInsertMicros += GetTimeMicros() - nDecoded;
     }
 
+    int64_t nStart = GetTimeMicros();
+    for (const PAIRTYPE(CBlockIndex**, uint256) & item : vUnresolved)
+        *item.first = InsertBlockIndex(item.second);
+    blockIndexLoadStats.nLinkMicros += GetTimeMicros() - nStart;
+
     return true;
 }
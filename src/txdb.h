@@ -10,12 +10,17 @@
 
 #include "leveldbwrapper.h"
 #include "main.h"
+#include "stats.h"
 
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 class CCoins;
 class uint256;
 
@@ -26,22 +31,87 @@ static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+struct CCoinsWriteStats {
+    uint64_t nWrites;
+    uint64_t nEntries;
+    uint64_t nBytes;
+    int64_t nLastMicros;
+    uint64_t nLastEntries;
+    uint64_t nLastBytes;
+    //! time block connection spent waiting for the previous write to finish
+    int64_t nWaitMicros;
+    bool fInProgress;
+};
+
+/** Time spent in each phase of loading the block index at startup */
+struct CBlockIndexLoadStats {
+    //! walking the block tree database
+    int64_t nReadMicros;
+    //! deserializing and hashing the records, spread over nThreads threads
+    int64_t nDecodeMicros;
+    //! filling in the entries and adding them to mapBlockIndex
+    int64_t nInsertMicros;
+    //! resolving links to blocks loaded in a later batch
+    int64_t nLinkMicros;
+    //! ordering the entries by height
+    int64_t nSortMicros;
+    //! the height-ordered pass computing chain work, chain tx counts and skip pointers
+    int64_t nChainWorkMicros;
+    //! reading block file info and checking the block files are present
+    int64_t nFileInfoMicros;
+    int64_t nTotalMicros;
+    uint64_t nEntries;
+    int nThreads;
+};
+
+extern CBlockIndexLoadStats blockIndexLoadStats;
+
+/**
+ * CCoinsView backed by the LevelDB coin database (chainstate/)
+ *
+ * Once StartWriter() has been called, BatchWrite only moves the dirty entries
+ * into a pending set and returns; a writer thread serializes them and commits
+ * them together with the best block hash in one LevelDB batch, so the database
+ * always holds the complete state of some block. Reads look at the pending set
+ * before the database. A second BatchWrite waits until the first is on disk.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
 
+    mutable boost::mutex csWrite;
+    mutable boost::condition_variable condWrite;
+    //! entries handed over by the last BatchWrite, readable until they are committed
+    CCoinsMap mapPending;
+    uint256 hashPending;
+    bool fPending;
+    bool fWriteFailed;
+    bool fStopWriter;
+    boost::thread threadWriter;
+
+    bool WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock);
+    void WaitForWriter(boost::unique_lock<boost::mutex>& lock) const;
+    void ThreadWriter();
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
+
+    //! Commit batches from a background thread from now on
+    void StartWriter();
 
     bool GetCoins(const uint256& txid, CCoins& coins) const;
     bool HaveCoins(const uint256& txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+    bool Sync();
 };
 
+void GetCoinsWriteStats(CCoinsWriteStats& stats);
+extern CLatencyHistogram histCoinsWrite;
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDBWrapper
 {
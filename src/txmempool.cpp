@@ -465,7 +465,7 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
     }
 }
 
-void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight)
+void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight, std::list<CTransaction>& removed)
 {
     // Remove transactions spending a coinbase which are now immature
     LOCK(cs);
@@ -484,10 +484,8 @@ void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned in
             }
         }
     }
-    for (const CTransaction& tx : transactionsToRemove) {
-        list<CTransaction> removed;
+    for (const CTransaction& tx : transactionsToRemove)
         remove(tx, removed, true);
-    }
 }
 
 void CTxMemPool::removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed)
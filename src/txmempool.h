@@ -123,7 +123,7 @@ public:
 
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry);
     void remove(const CTransaction& tx, std::list<CTransaction>& removed, bool fRecursive = false);
-    void removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight);
+    void removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight, std::list<CTransaction>& removed);
     void removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed);
     void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts);
     void clear();
@@ -154,6 +154,12 @@ public:
         return (mapTx.count(hash) != 0);
     }
 
+    bool isSpent(const COutPoint& outpoint)
+    {
+        LOCK(cs);
+        return (mapNextTx.count(outpoint) != 0);
+    }
+
     bool lookup(uint256 hash, CTransaction& result) const;
 
     /** Estimate fee rate needed to get into the next nBlocks */
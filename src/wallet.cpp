@@ -730,6 +730,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        UpdateStakeIndex(wtx);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -787,9 +788,28 @@ void CWallet::EraseFromWallet(const uint256& hash)
     if (!fFileBacked)
         return;
     {
-        LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
-            CWalletDB(strWalletFile).EraseTx(hash);
+        LOCK2(cs_main, cs_wallet);
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi == mapWallet.end())
+            return;
+        std::vector<CTxIn> vin = mi->second.vin;
+        std::map<COutPoint, StakeIndexKey>::iterator it = mapStakeIndexKeys.lower_bound(COutPoint(hash, 0));
+        while (it != mapStakeIndexKeys.end() && it->first.hash == hash) {
+            setStakeIndex.erase(make_pair(it->second, it->first));
+            mapStakeIndexKeys.erase(it++);
+            nStakeIndexVersion++;
+        }
+        mapWallet.erase(mi);
+        CWalletDB(strWalletFile).EraseTx(hash);
+
+        // the outputs it spent are no longer spent by it
+        if (fStakeIndexBuilt) {
+            for (const CTxIn& txin : vin) {
+                mi = mapWallet.find(txin.prevout.hash);
+                if (mi != mapWallet.end() && txin.prevout.n < mi->second.vout.size())
+                    IndexStakeOutput(mi->second, txin.prevout.n);
+            }
+        }
     }
     return;
 }
@@ -1592,34 +1612,99 @@ bool less_then_denom(const COutput& out1, const COutput& out2)
     return (!found1 && found2);
 }
 
-bool CWallet::SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, CAmount nTargetAmount) const
+void CWallet::IndexStakeOutput(const CWalletTx& wtx, unsigned int n)
 {
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, NULL, false, STAKABLE_COINS);
+    COutPoint outpoint(wtx.GetHash(), n);
+    std::map<COutPoint, StakeIndexKey>::iterator it = mapStakeIndexKeys.find(outpoint);
+    if (it != mapStakeIndexKeys.end()) {
+        setStakeIndex.erase(make_pair(it->second, outpoint));
+        mapStakeIndexKeys.erase(it);
+        nStakeIndexVersion++;
+    }
+
+    const CBlockIndex* pindex = NULL;
+    if (wtx.GetDepthInMainChain(pindex, false) < 1 || !pindex)
+        return;
+    const CTxOut& txout = wtx.vout[n];
+    isminetype mine = IsMine(txout);
+    if (mine == ISMINE_NO || mine == ISMINE_WATCH_ONLY || txout.nValue <= 0 || IsSpent(outpoint.hash, n))
+        return;
+
+    // same depth AvailableCoins and the stake set ask for
+    int nMaturity = (wtx.IsCoinBase() || wtx.IsCoinStake()) ? Params().COINBASE_MATURITY() + 1 : 10;
+    StakeIndexKey key(pindex->nHeight + nMaturity - 1, txout.nValue);
+    setStakeIndex.insert(make_pair(key, outpoint));
+    mapStakeIndexKeys[outpoint] = key;
+    nStakeIndexVersion++;
+}
+
+void CWallet::BuildStakeIndex()
+{
+    LOCK2(cs_main, cs_wallet);
+    setStakeIndex.clear();
+    mapStakeIndexKeys.clear();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (unsigned int i = 0; i < it->second.vout.size(); i++)
+            IndexStakeOutput(it->second, i);
+    fStakeIndexBuilt = true;
+    LogPrint("staking", "BuildStakeIndex() : %u stake candidates in %u transactions\n", setStakeIndex.size(), mapWallet.size());
+}
+
+void CWallet::UpdateStakeIndex(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fStakeIndexBuilt)
+        return;
+
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        IndexStakeOutput(wtx, i);
+
+    // the outputs it spends, which are spent or released again with it
+    if (wtx.IsCoinBase())
+        return;
+    for (const CTxIn& txin : wtx.vin) {
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
+        if (mi != mapWallet.end() && txin.prevout.n < mi->second.vout.size())
+            IndexStakeOutput(mi->second, txin.prevout.n);
+    }
+}
+
+bool CWallet::SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, CAmount nTargetAmount)
+{
+    LOCK2(cs_main, cs_wallet);
+    if (!fStakeIndexBuilt)
+        BuildStakeIndex();
+
+    int nHeight = chainActive.Height();
     CAmount nAmountSelected = 0;
+    for (const PAIRTYPE(StakeIndexKey, COutPoint) & entry : setStakeIndex) {
+        //check that it is matured, the index is ordered by maturity height
+        if (entry.first.first > nHeight)
+            break;
 
-    for (const COutput& out : vCoins) {
         //make sure not to outrun target amount
-        if (nAmountSelected + out.tx->vout[out.i].nValue > nTargetAmount)
+        CAmount nValue = entry.first.second;
+        if (nAmountSelected + nValue > nTargetAmount)
             continue;
 
-        int64_t nTxTime = out.tx->GetTxTime();
-
         //check for min input size
-        if (ActiveProtocol() >= CONSENSUS_FORK_PROTO && out.tx->vout[out.i].nValue < Params().StakeInputMin())
+        if (ActiveProtocol() >= CONSENSUS_FORK_PROTO && nValue < Params().StakeInputMin())
             continue;
 
-        //check for min age
-        if (GetAdjustedTime() - nTxTime - nHashDrift < nStakeMinAge)
+        const COutPoint& outpoint = entry.second;
+        if (IsLockedCoin(outpoint.hash, outpoint.n))
+            continue;
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+        if (mi == mapWallet.end())
             continue;
 
-        //check that it is matured
-        if (out.nDepth < (out.tx->IsCoinStake() ? Params().COINBASE_MATURITY() : 10))
+        //check for min age
+        if (GetAdjustedTime() - mi->second.GetTxTime() - nHashDrift < nStakeMinAge)
             continue;
 
         //add to our stake set
-        setCoins.insert(make_pair(out.tx, out.i));
-        nAmountSelected += out.tx->vout[out.i].nValue;
+        setCoins.insert(make_pair(&mi->second, outpoint.n));
+        nAmountSelected += nValue;
     }
     return true;
 }
@@ -1632,19 +1717,21 @@ bool CWallet::MintableCoins()
     if (nBalance <= nReserveBalance)
         return false;
 
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, true);
-
-    for (const COutput& out : vCoins) {
-        int64_t nTxTime = out.tx->GetTxTime();
+    LOCK2(cs_main, cs_wallet);
+    if (!fStakeIndexBuilt)
+        BuildStakeIndex();
 
-        if (ActiveProtocol() >= CONSENSUS_FORK_PROTO){
-            if (out.tx->vout[out.i].nValue >= Params().StakeInputMin() && GetAdjustedTime() - nTxTime > nStakeMinAge)
-                return true;
-        } else {
-            if (GetAdjustedTime() - nTxTime > nStakeMinAge)
-                return true;
-        }
+    int nHeight = chainActive.Height();
+    for (const PAIRTYPE(StakeIndexKey, COutPoint) & entry : setStakeIndex) {
+        if (entry.first.first > nHeight)
+            break;
+        if (ActiveProtocol() >= CONSENSUS_FORK_PROTO && entry.first.second < Params().StakeInputMin())
+            continue;
+        if (IsLockedCoin(entry.second.hash, entry.second.n))
+            continue;
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(entry.second.hash);
+        if (mi != mapWallet.end() && GetAdjustedTime() - mi->second.GetTxTime() > nStakeMinAge)
+            return true;
     }
 
     return false;
@@ -2356,13 +2443,22 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     // presstab HyperStake - Initialize as static and don't update the set on every run of CreateCoinStake() in order to lighten resource use
     static std::set<pair<const CWalletTx*, unsigned int> > setStakeCoins;
     static int nLastStakeSetUpdate = 0;
-
-    if (GetTime() - nLastStakeSetUpdate > nStakeSetUpdateTime) {
+    static unsigned int nStakeSetIndexVersion = 0;
+    // kernel constants of setStakeCoins, valid for the tip they were resolved at
+    static std::vector<pair<const CWalletTx*, unsigned int> > vStakeCoins;
+    static std::vector<CStakeKernelInput> vStakeKernels;
+    static uint256 hashStakeKernelsTip = 0;
+
+    // selecting from the stake index is cheap, so also refresh on a new tip or when the index changed
+    if (GetTime() - nLastStakeSetUpdate > nStakeSetUpdateTime || hashStakeKernelsTip != chainActive.Tip()->GetBlockHash() ||
+        nStakeSetIndexVersion != nStakeIndexVersion) {
         setStakeCoins.clear();
+        hashStakeKernelsTip = 0;
         if (!SelectStakeCoins(setStakeCoins, nBalance - nReserveBalance))
             return false;
 
         nLastStakeSetUpdate = GetTime();
+        nStakeSetIndexVersion = nStakeIndexVersion;
     }
 
     if (setStakeCoins.empty())
@@ -2373,80 +2469,80 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     CAmount nCredit = 0;
     CScript scriptPubKeyKernel;
 
-    //prevent staking a time that won't be accepted
+    //prevent staking a time that won't be accepted, the stake minter retries once the clock has passed the tip
     if (GetAdjustedTime() <= chainActive.Tip()->nTime)
-        MilliSleep(10000);
-
-    for(PAIRTYPE(const CWalletTx*, unsigned int) pcoin : setStakeCoins) {
-        //make sure that enough time has elapsed between
-        CBlockIndex* pindex = NULL;
-        BlockMap::iterator it = mapBlockIndex.find(pcoin.first->hashBlock);
-        if (it != mapBlockIndex.end())
-            pindex = it->second;
-        else {
-            if (fDebug)
-                LogPrintf("CreateCoinStake() failed to find block index \n");
-            continue;
-        }
-
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
+        return false;
 
-        uint256 hashProofOfStake = 0;
-        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-        nTxNewTime = GetAdjustedTime();
-        //iterates each utxo inside of CheckStakeKernelHash()
-        if (CheckStakeKernelHash(nBits, block, *pcoin.first, prevoutStake, nTxNewTime, nHashDrift, false, hashProofOfStake, true)) {
-            //Double check that this will pass time requirements
-            if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
-                LogPrintf("CreateCoinStake() : kernel found, but it is too far in the past \n");
-                continue;
+    unsigned int nTimeMin;
+    {
+        LOCK(cs_main);
+        nTimeMin = chainActive.Tip()->GetMedianTimePast();
+        if (hashStakeKernelsTip != chainActive.Tip()->GetBlockHash()) {
+            vStakeCoins.clear();
+            vStakeKernels.clear();
+            for (PAIRTYPE(const CWalletTx*, unsigned int) pcoin : setStakeCoins) {
+                CStakeKernelInput input;
+                COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
+                if (!GetStakeKernelInput(pcoin.first->hashBlock, prevoutStake, pcoin.first->vout[pcoin.second].nValue, input)) {
+                    if (fDebug)
+                        LogPrintf("CreateCoinStake() failed to find block index \n");
+                    continue;
+                }
+                vStakeCoins.push_back(pcoin);
+                vStakeKernels.push_back(input);
             }
+            hashStakeKernelsTip = chainActive.Tip()->GetBlockHash();
+        }
+    }
 
-            // Found a kernel
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : kernel found\n");
+    //searches the whole stake set across the stake search threads
+    CStakeKernelResult kernel;
+    nTxNewTime = GetAdjustedTime();
+    if (SearchStakeKernel(vStakeKernels, nBits, nTxNewTime, nHashDrift, nTimeMin, kernel)) {
+        PAIRTYPE(const CWalletTx*, unsigned int) pcoin = vStakeCoins[kernel.nIndex];
+        nTxNewTime = kernel.nTime;
 
-            vector<valtype> vSolutions;
-            txnouttype whichType;
-            CScript scriptPubKeyOut;
+        // Found a kernel
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : kernel found\n");
 
-            scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
-            if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
-                LogPrintf("CreateCoinStake : failed to parse kernel\n");
-                break;
-            }
+        vector<valtype> vSolutions;
+        txnouttype whichType;
+        CScript scriptPubKeyOut;
+
+        scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
+        if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
+            LogPrintf("CreateCoinStake : failed to parse kernel\n");
+            return false;
+        }
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
+        if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
             if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
-            if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
+                LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
+            return false; // only support pay to public key and pay to address
+        }
+        if (whichType == TX_PUBKEYHASH) // pay to address type
+        {
+            //convert to pay to public key type
+            CKey key;
+            if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
                 if (fDebug && GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
-                break; // only support pay to public key and pay to address
+                    LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+                return false; // unable to find corresponding public key
             }
-            if (whichType == TX_PUBKEYHASH) // pay to address type
-            {
-                //convert to pay to public key type
-                CKey key;
-                if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
-                    if (fDebug && GetBoolArg("-printcoinstake", false))
-                        LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                    break; // unable to find corresponding public key
-                }
-
-                scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
-            } else
-                scriptPubKeyOut = scriptPubKeyKernel;
 
-            txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-            nCredit += pcoin.first->vout[pcoin.second].nValue;
-            vwtxPrev.push_back(pcoin.first);
-            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+            scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
+        } else
+            scriptPubKeyOut = scriptPubKeyKernel;
 
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
+        txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
+        nCredit += pcoin.first->vout[pcoin.second].nValue;
+        vwtxPrev.push_back(pcoin.first);
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
 
-            break;
-        }
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
     }
 
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
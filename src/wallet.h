@@ -159,9 +159,26 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Unspent outputs that can stake once they are deep enough, ordered by the
+     * height they mature at and their value. Kept current by AddToWallet, which
+     * also runs for transactions of connected and disconnected blocks, so that
+     * stake selection does not need to walk mapWallet.
+     */
+    typedef std::pair<int, CAmount> StakeIndexKey;
+    std::set<std::pair<StakeIndexKey, COutPoint> > setStakeIndex;
+    std::map<COutPoint, StakeIndexKey> mapStakeIndexKeys;
+    bool fStakeIndexBuilt;
+    void IndexStakeOutput(const CWalletTx& wtx, unsigned int n);
+
 public:
+    //! Changes whenever the stake index does
+    unsigned int nStakeIndexVersion;
+    void BuildStakeIndex();
+    void UpdateStakeIndex(const CWalletTx& wtx);
+
     bool MintableCoins();
-    bool SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, CAmount nTargetAmount) const;
+    bool SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, CAmount nTargetAmount);
     bool SelectCoinsDark(CAmount nValueMin, CAmount nValueMax, std::vector<CTxIn>& setCoinsRet, CAmount& nValueRet, int nObfuscationRoundsMin, int nObfuscationRoundsMax) const;
     bool SelectCoinsByDenominations(int nDenom, CAmount nValueMin, CAmount nValueMax, std::vector<CTxIn>& vCoinsRet, std::vector<COutput>& vCoinsRet2, CAmount& nValueRet, int nObfuscationRoundsMin, int nObfuscationRoundsMax);
     bool SelectCoinsDarkDenominated(CAmount nTargetValue, std::vector<CTxIn>& setCoinsRet, CAmount& nValueRet) const;
@@ -247,6 +264,8 @@ public:
         nStakeSplitThreshold = 500;
         nHashInterval = 35;
         nStakeSetUpdateTime = 300; // 5 minutes
+        fStakeIndexBuilt = false;
+        nStakeIndexVersion = 0;
 
         //MultiSend
         vMultiSend.clear();